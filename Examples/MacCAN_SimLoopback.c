@@ -0,0 +1,178 @@
+/*  SPDX-License-Identifier: BSD-2-Clause OR GPL-3.0-or-later */
+/*
+ *  MacCAN - macOS User-Space Driver for USB-to-CAN Interfaces
+ *
+ *  Copyright (c) 2012-2023 Uwe Vogt, UV Software, Berlin (info@mac-can.com)
+ *  All rights reserved.
+ *
+ *  This file is part of MacCAN-Core.
+ *
+ *  MacCAN-Core is dual-licensed under the BSD 2-Clause "Simplified" License and
+ *  under the GNU General Public License v3.0 (or any later version).
+ *  You can choose between one of them if you use this file.
+ *
+ *  BSD 2-Clause "Simplified" License:
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ *  MacCAN-Core IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF MacCAN-Core, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  GNU General Public License v3.0 or later:
+ *  MacCAN-Core is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MacCAN-Core is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MacCAN-Core.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*  Loop-back exercise for the simulated USB device (no hardware required):
+ *  plug -> open -> write/read (blocking and asynchronous) -> close -> unplug
+ *
+ *  Build with OPTION_MACCAN_SIMULATION=1 from the MacCAN-Core directory, e.g.:
+ *    cc -DOPTION_MACCAN_SIMULATION=1 -I. Examples/MacCAN_SimLoopback.c MacCAN_*.c \
+ *       -framework IOKit -framework CoreFoundation -o sim_loopback
+ *
+ *  The program returns 0 on success and 1 on the first failed step.
+ */
+#include "MacCAN_IOUsbKit.h"
+#include "MacCAN_IOUsbSim.h"
+#include "MacCAN_Devices.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#if (OPTION_MACCAN_SIMULATION == 0)
+#error "OPTION_MACCAN_SIMULATION must be set to build this example"
+#endif
+
+#define SIM_VENDOR_ID   0x1209U     /* pid.codes test VID */
+#define SIM_PRODUCT_ID  0x0001U     /* pid.codes test PID */
+#define SIM_PACKET_SIZE  CANSIM_DEFAULT_PACKET_SIZE
+#define SIM_PACKETS  16U
+#define SIM_TIMEOUT  100U           /* in [ms] */
+
+const CANDEV_Device_t CANDEV_Devices[] = {
+    {SIM_VENDOR_ID, SIM_PRODUCT_ID, 1U, NULL, NULL},
+    CANDEV_LAST_ENTRY_IN_DEVICE_LIST
+};
+
+typedef struct loopback_tag {
+    atomic_uint received;
+    atomic_uint mismatch;
+} LoopBack_t;
+
+static void FillPacket(UInt8 *buffer, UInt32 size, UInt32 seqNo) {
+    for (UInt32 i = 0U; i < size; i++)
+        buffer[i] = (UInt8)(seqNo + i);
+}
+
+static int ReceiveCallback(CANUSB_Context_t refCon, UInt8 *buffer, UInt32 nbyte) {
+    LoopBack_t *loopBack = (LoopBack_t *)refCon;
+    UInt8 expected[SIM_PACKET_SIZE];
+
+    /* note: packets are looped back in order, the first byte carries the sequence number */
+    unsigned int seqNo = atomic_fetch_add(&loopBack->received, 1U);
+    FillPacket(expected, SIM_PACKET_SIZE, (UInt32)seqNo);
+    if ((nbyte != SIM_PACKET_SIZE) || memcmp(buffer, expected, SIM_PACKET_SIZE))
+        atomic_fetch_add(&loopBack->mismatch, 1U);
+    return 0;
+}
+
+#define CHECK(cond, step)  do { if (!(cond)) { fprintf(stderr, "+++ error: %s\n", step); goto failed; } } while (0)
+
+int main(void) {
+    CANSIM_Param_t param;
+    CANUSB_Index_t index;
+    CANUSB_Handle_t handle = CANUSB_INVALID_HANDLE;
+    CANUSB_AsyncPipe_t asyncPipe = NULL;
+    LoopBack_t loopBack;
+    UInt8 txBuffer[SIM_PACKET_SIZE];
+    UInt8 rxBuffer[SIM_PACKET_SIZE];
+    UInt32 location = 0U;
+    UInt32 size, i;
+    int result = 1;
+
+    atomic_init(&loopBack.received, 0U);
+    atomic_init(&loopBack.mismatch, 0U);
+
+    CHECK(CANUSB_Initialize() == CANUSB_SUCCESS, "CANUSB_Initialize");
+
+    /* (1) plug a simulated device (no transmit handler = loop-back) */
+    bzero(&param, sizeof(CANSIM_Param_t));
+    param.vendorId = SIM_VENDOR_ID;
+    param.productId = SIM_PRODUCT_ID;
+    param.packetSizeIn = SIM_PACKET_SIZE;
+    param.packetSizeOut = SIM_PACKET_SIZE;
+    param.queueSize = CANSIM_DEFAULT_QUEUE_SIZE;
+    param.latency = 100U;
+    CHECK(CANSIM_PlugDevice(&param, &location) == CANUSB_SUCCESS, "CANSIM_PlugDevice");
+
+    /* (2) find and open it like a real device */
+    index = CANUSB_FindDevice(SIM_VENDOR_ID, SIM_PRODUCT_ID, 0U);
+    CHECK(index != CANUSB_INVALID_INDEX, "CANUSB_FindDevice");
+    handle = CANUSB_OpenDevice(index, SIM_VENDOR_ID, SIM_PRODUCT_ID);
+    CHECK(handle != CANUSB_INVALID_HANDLE, "CANUSB_OpenDevice");
+
+    /* (3) blocking write and read */
+    FillPacket(txBuffer, SIM_PACKET_SIZE, 0xA5U);
+    CHECK(CANUSB_WritePipe(handle, CANSIM_PIPE_OUT, txBuffer, SIM_PACKET_SIZE, SIM_TIMEOUT) == CANUSB_SUCCESS, "CANUSB_WritePipe");
+    size = SIM_PACKET_SIZE;
+    CHECK(CANUSB_ReadPipe(handle, CANSIM_PIPE_IN, rxBuffer, &size, SIM_TIMEOUT) == CANUSB_SUCCESS, "CANUSB_ReadPipe");
+    CHECK((size == SIM_PACKET_SIZE) && !memcmp(txBuffer, rxBuffer, SIM_PACKET_SIZE), "loop-back data (blocking)");
+
+    /* (4) asynchronous read of a burst of packets */
+    asyncPipe = CANUSB_CreatePipeAsyncEx(handle, CANSIM_PIPE_IN, SIM_PACKET_SIZE, 4U);
+    CHECK(asyncPipe != NULL, "CANUSB_CreatePipeAsyncEx");
+    CHECK(CANUSB_ReadPipeAsync(asyncPipe, ReceiveCallback, (CANUSB_Context_t)&loopBack) == CANUSB_SUCCESS, "CANUSB_ReadPipeAsync");
+    for (i = 0U; i < SIM_PACKETS; i++) {
+        FillPacket(txBuffer, SIM_PACKET_SIZE, i);
+        CHECK(CANUSB_WritePipe(handle, CANSIM_PIPE_OUT, txBuffer, SIM_PACKET_SIZE, SIM_TIMEOUT) == CANUSB_SUCCESS, "CANUSB_WritePipe (burst)");
+    }
+    for (i = 0U; (i < SIM_TIMEOUT) && (atomic_load(&loopBack.received) < SIM_PACKETS); i++)
+        usleep(1000);
+    CHECK(atomic_load(&loopBack.received) == SIM_PACKETS, "loop-back count (asynchronous)");
+    CHECK(atomic_load(&loopBack.mismatch) == 0U, "loop-back data (asynchronous)");
+    CHECK(CANUSB_DestroyPipeAsync(asyncPipe) == CANUSB_SUCCESS, "CANUSB_DestroyPipeAsync");
+    asyncPipe = NULL;
+
+    /* (5) close and unplug; the device must disappear from the list */
+    CHECK(CANUSB_CloseDevice(handle) == CANUSB_SUCCESS, "CANUSB_CloseDevice");
+    handle = CANUSB_INVALID_HANDLE;
+    CHECK(CANSIM_UnplugDevice(location) == CANUSB_SUCCESS, "CANSIM_UnplugDevice");
+    location = 0U;
+    CHECK(CANUSB_FindDevice(SIM_VENDOR_ID, SIM_PRODUCT_ID, 0U) == CANUSB_INVALID_INDEX, "device still present after unplug");
+
+    fprintf(stdout, "MacCAN simulated loop-back: %u packets ok\n", SIM_PACKETS + 1U);
+    result = 0;
+failed:
+    if (asyncPipe)
+        (void)CANUSB_DestroyPipeAsync(asyncPipe);
+    if (handle != CANUSB_INVALID_HANDLE)
+        (void)CANUSB_CloseDevice(handle);
+    if (location)
+        (void)CANSIM_UnplugDevice(location);
+    (void)CANUSB_Teardown();
+    return result;
+}
@@ -46,15 +46,30 @@
  *  along with MacCAN-Core.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "MacCAN_Devices.h"
+#include "MacCAN_Debug.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #define FINAL_VENDOR_ID  (UInt16)-1
 #define FINAL_PRODUCT_ID  (UInt16)-1
 
+#define DEVICE_HASH_SIZE  256U  /* min. size, power of two (at most half filled) */
+#define DEVICE_HASH(vid,pid,size)  ((((((UInt32)(vid) << 16) | (UInt32)(pid)) * 2654435761U) >> 16) & ((size) - 1U))
+#define DEVICE_NONE  (-1)
+
 extern const CANDEV_Device_t CANDEV_Devices[];
 
 static int nIndex = 0;
+static int nVendor = 0;
+
+static pthread_once_t hashOnce = PTHREAD_ONCE_INIT;
+static short *hashTable = NULL;
+static UInt32 hashSize = 0U;
+
+static void BuildHashTable(void);
+static int IsFirstOfVendor(int index);
 
 const CANDEV_Device_t *CANDEV_GetFirstDevice(void)
 {
@@ -77,10 +92,48 @@ const CANDEV_Device_t *CANDEV_GetNextDevice(void)
     return ptrDevice;
 }
 
+const CANDEV_Device_t *CANDEV_GetFirstVendor(void)
+{
+    const CANDEV_Device_t *ptrDevice = NULL;
+
+    nVendor = 0;
+    if (CANDEV_Devices[nVendor].vendorId != FINAL_VENDOR_ID)
+        ptrDevice = &CANDEV_Devices[nVendor];
+    return ptrDevice;
+}
+
+const CANDEV_Device_t *CANDEV_GetNextVendor(void)
+{
+    const CANDEV_Device_t *ptrDevice = NULL;
+
+    /* skip all entries with a vendor id. already returned */
+    while (CANDEV_Devices[nVendor].vendorId != FINAL_VENDOR_ID) {
+        nVendor += 1;
+        if (IsFirstOfVendor(nVendor))
+            break;
+    }
+    if (CANDEV_Devices[nVendor].vendorId != FINAL_VENDOR_ID)
+        ptrDevice = &CANDEV_Devices[nVendor];
+    return ptrDevice;
+}
+
 const CANDEV_Device_t *CANDEV_GetDeviceById(UInt16 vendorId, UInt16 productId)
 {
     const CANDEV_Device_t *ptrDevice = NULL;
 
+    /* look up the device by its vendor and product id. (constant time) */
+    (void)pthread_once(&hashOnce, BuildHashTable);
+    if (hashTable) {
+        for (UInt32 h = DEVICE_HASH(vendorId, productId, hashSize); hashTable[h] != DEVICE_NONE; h = (h + 1U) & (hashSize - 1U)) {
+            if ((CANDEV_Devices[hashTable[h]].vendorId == vendorId) &&
+                (CANDEV_Devices[hashTable[h]].productId == productId)) {
+                ptrDevice = &CANDEV_Devices[hashTable[h]];
+                break;
+            }
+        }
+        return ptrDevice;
+    }
+    /* note: linear search if the hash table could not be allocated */
     for (int i = 0; CANDEV_Devices[i].vendorId != FINAL_VENDOR_ID; i++) {
         if ((CANDEV_Devices[i].vendorId == vendorId) &&
             (CANDEV_Devices[i].productId == productId)) {
@@ -122,5 +175,50 @@ void CANDEV_DeviceRemoved(const CANDEV_Device_t *device, CANDEV_Index_t index, C
         device->cbkRemoved(index, descriptor);
 }
 
+static void BuildHashTable(void)
+{
+    UInt32 size = DEVICE_HASH_SIZE, h;
+    short *table;
+    int count, i;
+
+    /* sized from the device list (at most half filled) */
+    for (count = 0; CANDEV_Devices[count].vendorId != FINAL_VENDOR_ID; count++)
+        ;
+    if (count > (0x7FFF / 2)) {
+        MACCAN_DEBUG_ERROR("+++ Device list too long for the hash table (%i entries)\n", count);
+        return;
+    }
+    while (size < ((UInt32)count * 2U))
+        size <<= 1;
+    if ((table = (short*)malloc(size * sizeof(short))) == NULL) {
+        MACCAN_DEBUG_ERROR("+++ Unable to allocate the hash table (%u entries)\n", size);
+        return;
+    }
+    /* hash table with linear probing (the first entry wins on duplicates) */
+    for (h = 0U; h < size; h++)
+        table[h] = DEVICE_NONE;
+    for (i = 0; i < count; i++) {
+        for (h = DEVICE_HASH(CANDEV_Devices[i].vendorId, CANDEV_Devices[i].productId, size); table[h] != DEVICE_NONE; h = (h + 1U) & (size - 1U)) {
+            if ((CANDEV_Devices[table[h]].vendorId == CANDEV_Devices[i].vendorId) &&
+                (CANDEV_Devices[table[h]].productId == CANDEV_Devices[i].productId))
+                break;
+        }
+        if (table[h] == DEVICE_NONE)
+            table[h] = (short)i;
+    }
+    hashSize = size;
+    hashTable = table;
+}
+
+static int IsFirstOfVendor(int index)
+{
+    /* note: only called at start-up, the device list is short */
+    for (int i = 0; i < index; i++) {
+        if (CANDEV_Devices[i].vendorId == CANDEV_Devices[index].vendorId)
+            return 0;
+    }
+    return 1;
+}
+
 /* * $Id$ *** (c) UV Software, Berlin ***
  */
@@ -73,6 +73,10 @@ extern const CANDEV_Device_t *CANDEV_GetFirstDevice(void);
 
 extern const CANDEV_Device_t *CANDEV_GetNextDevice(void);
 
+extern const CANDEV_Device_t *CANDEV_GetFirstVendor(void);
+
+extern const CANDEV_Device_t *CANDEV_GetNextVendor(void);
+
 extern const CANDEV_Device_t *CANDEV_GetDeviceById(UInt16 vendorId, UInt16 productId);
 
 extern UInt16 CANDEV_GetVendorId(const CANDEV_Device_t *device);
@@ -69,57 +69,41 @@ CANEPE_Return_t CANEPE_QueryEndpoints(CANEPE_Handle_t handle, CANEPE_Endpoints_t
     /* initialization */
     bzero(endpoints, sizeof(CANEPE_Endpoints_t));
 
-    /* get number of pipes from USB interface */
-    UInt8 numPipes = 0U;
-    retVal = CANUSB_GetInterfaceNumEndpoints(handle, &numPipes);
+    /* get all properties of the USB interface at once (lock-free snapshot) */
+    CANUSB_Properties_t properties;
+    retVal = CANUSB_GetDeviceProperties(handle, &properties);
     if (retVal != CANUSB_SUCCESS) {
-        MACCAN_DEBUG_ERROR("+++ Unable to read number of endpoints from device #%i (%i)\n", handle, retVal);
+        MACCAN_DEBUG_ERROR("+++ Unable to read properties of device #%i (%i)\n", handle, retVal);
         return retVal;
     }
     /* note: IOUsbKit counts pipes not endpoints and also not EP0 */
+    UInt8 numPipes = properties.numEndpoints;
     endpoints->numEndpoints = (numPipes / 2U) + 1U;
 
     /* loop over all pipes of the USB interface */
     for (UInt8 pipeRef = 1U; pipeRef <= numPipes; pipeRef++) {
         if (PIPE2EP(pipeRef) >= CANEPE_MAX_ENDPOINTS)
             break;
-
-        /* get the tranfer type of the pipe: only bulk transfers supported */
-        UInt8 transferType = USBPIPE_TYPE_ANY;
-        retVal = CANUSB_GetInterfaceEndpointTransferType(handle, pipeRef, &transferType);
-        if (retVal != CANUSB_SUCCESS) {
-            MACCAN_DEBUG_ERROR("+++ Unable to read transfer type of pipe #%u from device #%i (%i)\n", pipeRef, handle, retVal);
-            return retVal;
+        if ((pipeRef >= CANUSB_MAX_PIPES) || !(properties.validPipes & ((UInt32)1 << pipeRef))) {
+            MACCAN_DEBUG_ERROR("+++ Unable to read properties of pipe #%u from device #%i\n", pipeRef, handle);
+            return CANUSB_ERROR_RESOURCE;
         }
+        /* get the tranfer type of the pipe: only bulk transfers supported */
+        UInt8 transferType = properties.pipe[pipeRef].transferType;
         if (transferType != USBPIPE_TYPE_BULK) {
             MACCAN_DEBUG_ERROR("+++ Sorry, wrong transfer type of pipe #%u of device #%i (0x%x)\n", pipeRef, handle, transferType);
             return retVal;
         }
         /* get the transfer direction of the pipe: either bulk in or bulk out */
-        UInt8 direction = USBPIPE_DIR_ANY;
-        retVal = CANUSB_GetInterfaceEndpointDirection(handle, pipeRef, &direction);
-        if (retVal != CANUSB_SUCCESS) {
-            MACCAN_DEBUG_ERROR("+++ Unable to read transfer type of pipe #%u from device #%i (%i)\n", pipeRef, handle, retVal);
-            return retVal;
-        }
+        UInt8 direction = properties.pipe[pipeRef].direction;
         if (direction == USBPIPE_DIR_IN) {
-            /* get max packet size of the bulk in pipe of the endpoint */
-            retVal = CANUSB_GetInterfaceEndpointMaxPacketSize(handle, pipeRef, &endpoints->endpoint[PIPE2EP(pipeRef)].pipeIn.packetSize);
-            if (retVal != CANUSB_SUCCESS) {
-                MACCAN_DEBUG_ERROR("+++ Unable to read package size of pipe #%u from device #%i (%i)\n", pipeRef, handle, retVal);
-                return retVal;
-            }
-            /* set the pipe number of the bulk in pipe of the endpoint */
+            /* set max packet size and pipe number of the bulk in pipe of the endpoint */
+            endpoints->endpoint[PIPE2EP(pipeRef)].pipeIn.packetSize = properties.pipe[pipeRef].maxPacketSize;
             endpoints->endpoint[PIPE2EP(pipeRef)].pipeIn.pipeRef = pipeRef;
 
         } else if (direction == USBPIPE_DIR_OUT) {
-            /* get max packet size of the bulk out pipe of the endpoint */
-            retVal = CANUSB_GetInterfaceEndpointMaxPacketSize(handle, pipeRef, &endpoints->endpoint[PIPE2EP(pipeRef)].pipeOut.packetSize);
-            if (retVal != CANUSB_SUCCESS) {
-                MACCAN_DEBUG_ERROR("+++ Unable to read package size of pipe #%u from device #%i (%i)\n", pipeRef, handle, retVal);
-                return retVal;
-            }
-            /* set the pipe number of the bulk out pipe of the endpoint */
+            /* set max packet size and pipe number of the bulk out pipe of the endpoint */
+            endpoints->endpoint[PIPE2EP(pipeRef)].pipeOut.packetSize = properties.pipe[pipeRef].maxPacketSize;
             endpoints->endpoint[PIPE2EP(pipeRef)].pipeOut.pipeRef = pipeRef;
 
         } else {
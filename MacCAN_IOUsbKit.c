@@ -48,8 +48,12 @@
 #include "MacCAN_IOUsbKit.h"
 #include "MacCAN_Devices.h"
 #include "MacCAN_Debug.h"
+#if (OPTION_MACCAN_SIMULATION != 0)
+#include "MacCAN_IOUsbSim.h"
+#endif
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -59,6 +63,7 @@
 
 #include <mach/mach.h>
 #include <mach/clock.h>
+#include <mach/mach_time.h>
 
 #include <IOKit/IOKitLib.h>
 #include <IOKit/IOKitKeys.h>
@@ -84,10 +89,10 @@
 /*#define OPTION_MACCAN_MULTICHANNEL  0  !* set globally: 0 = only one channel on multi-channel devices */
 /*#define OPTION_MACCAN_PIPE_TIMEOUT  0  !* set globally: 0 = do not use xxxPipeTO variant (e.g. macOS < 10.15) */
 /*#define OPTION_MACCAN_PIPE_INFO  !* activate it, if needed */
+/*#define OPTION_MACCAN_SIMULATION  0  !* set globally: 1 = simulated USB devices (for testing w/o hardware) */
+/*#define OPTION_MACCAN_OCCUPANCY_TIMEOUT  500  !* set globally: staleness bound of the occupancy state in [ms] (0 = always probe) */
+/*#define OPTION_MACCAN_WARM_STANDBY  0  !* set globally: grace period of a closed device in [ms] (0 = close at once) */
 
-#if (OPTION_MACCAN_MULTICHANNEL != 0)
-#error multi-channel feature not supported
-#endif
 #ifdef OPTION_MACCAN_PIPE_TIMEOUT
 #if !defined(__MAC_11_0)
 #undef OPTION_MACCAN_PIPE_TIMEOUT      /* xxxPipeTO() not available in macOS < 11 */
@@ -100,45 +105,324 @@
 #define OPTION_MACCAN_CLEAR_BOTH_ENDS  0  /* ClearPipeStallBothEnds() not available in macOS < 11 */
 #endif
 #endif
+#ifndef OPTION_MACCAN_OCCUPANCY_TIMEOUT
+#define OPTION_MACCAN_OCCUPANCY_TIMEOUT  500  /* re-probe a device not opened by us after 500ms */
+#endif
+#ifndef OPTION_MACCAN_WARM_STANDBY
+#define OPTION_MACCAN_WARM_STANDBY  0  /* close the device at once */
+#endif
 #define MAX_STRING_LENGTH  256
 
 #define MIN(x,y)  ((x) <= (y)) ? (x) : (y)
 
-#define IS_INDEX_VALID(idx)  ((0 <= (idx)) && ((idx) < CANUSB_MAX_DEVICES))
-#define IS_HANDLE_VALID(hnd)  IS_INDEX_VALID(hnd)
+#define TIMER_NEVER  (1.0e9)  /* 30 years or so */
+
+#define OPEN_MAX_THREADS  8U  /* for CANUSB_OpenDevices (helper threads, not more than devices) */
+
+#define DRIVER_START_TIMEOUT  5000U  /* in [ms] */
+#define DRIVER_STOP_TIMEOUT  1000U  /* in [ms] */
+#define STANDBY_ABORT_TIMEOUT  500U  /* in [ms] */
+#define ENUMERATE_PASSES  3U  /* probing passes of an enumeration (the last takes the cached state) */
+
+#define USB_MAX_PIPES  CANUSB_MAX_PIPES  /* pipe #0 is the control endpoint */
+#if (OPTION_MACCAN_MULTICHANNEL != 0)
+#define USB_MAX_INTERFACES  4U  /* one CAN channel per interface */
+#define HANDLE_CHANNEL_BITS  2
+#else
+#define USB_MAX_INTERFACES  1U  /* only the first interface is used */
+#define HANDLE_CHANNEL_BITS  0
+#endif
+#define USB_MAX_VENDORS  16  /* one notification per vendor, else one for all USB devices */
+#define USB_ANY_VENDOR  (-1)
+
+#define REGISTRY_HASH_SIZE  64U  /* power of two */
+#define REGISTRY_HASH(key)  ((((UInt32)(key) * 2654435761U) >> 16) & (REGISTRY_HASH_SIZE - 1U))
+#define REGISTRY_ID(vid,pid)  (((UInt32)(vid) << 16) | (UInt32)(pid))
+#define REGISTRY_NONE  (-1)
+
+#if defined(__arm64__)
+#define CACHE_LINE_SIZE  128  /* Apple silicon */
+#else
+#define CACHE_LINE_SIZE  64
+#endif
+#define CACHE_ALIGNED  __attribute__((aligned(CACHE_LINE_SIZE)))
+
+#define WATCHDOG_MIN_PERIOD  10U  /* in [ms] */
+#define WATCHDOG_FIRED_NOTIFY  0x1U
+#define WATCHDOG_FIRED_REARM   0x2U
+#define WATCHDOG_FIRED_RESET   0x4U
 
-#define ENTER_CRITICAL_SECTION(idx)  assert(0 == pthread_mutex_lock(&usbDevice[idx].ptMutex))
-#define LEAVE_CRITICAL_SECTION(idx)  assert(0 == pthread_mutex_unlock(&usbDevice[idx].ptMutex))
+#if (CANUSB_MAX_DEVICES > 256)
+#error Handle format: the device index must fit into 8 bits!
+#endif
+#if (CANUSB_MAX_QUEUE_DEPTH > 32)
+#error Buffer lending: the transfers and the spare buffers must fit into 64 bits!
+#endif
+/* note: a handle is the device index tagged with the channel (bits 8.., multi-channel only) and
+ *       with the generation of the channel (remaining bits up to 30), which is bumped when the
+ *       channel is closed or the device is removed, so a stale handle of a re-plugged or re-opened
+ *       device is rejected (with the first generation handle of channel 0 = index) */
+#define HANDLE_INDEX(hnd)  ((hnd) & 0xFF)
+#define HANDLE_CHANNEL(hnd)  (((UInt32)(hnd) >> 8) & ((1U << HANDLE_CHANNEL_BITS) - 1U))
+#define HANDLE_GENERATION(hnd)  (((UInt32)(hnd) >> (8 + HANDLE_CHANNEL_BITS)) & (0x7FFFFFU >> HANDLE_CHANNEL_BITS))
+#define MAKE_HANDLE(idx,ch,gen)  ((CANUSB_Handle_t)((((UInt32)(gen) & (0x7FFFFFU >> HANDLE_CHANNEL_BITS)) << (8 + HANDLE_CHANNEL_BITS)) | \
+                                                    ((UInt32)(ch) << 8) | (UInt32)(idx)))
+#define USB_INTERFACE(hnd)  usbDevice[HANDLE_INDEX(hnd)].usbInterface[HANDLE_CHANNEL(hnd)]
+
+#define IS_INDEX_IN_RANGE(idx)  ((0 <= (idx)) && ((idx) < CANUSB_MAX_DEVICES))
+#define IS_INDEX_VALID(idx)  ((0 <= (idx)) && ((idx) < GET_NUM_SLOTS()))
+#define IS_HANDLE_VALID(hnd)  ((0 <= (hnd)) && IS_INDEX_VALID(HANDLE_INDEX(hnd)) && \
+                               (HANDLE_GENERATION(hnd) == GET_GENERATION(HANDLE_INDEX(hnd), HANDLE_CHANNEL(hnd))))
+/* note: the device interface is created on the first open (or device request), a device not yet
+ *       opened is only represented by its i/o registry entry */
+#define HAS_DEVICE(idx)  ((usbDevice[idx].ioDevice != NULL) || (usbDevice[idx].ioService != IO_OBJECT_NULL))
+#define IS_HANDLE_CURRENT(hnd)  (usbDevice[HANDLE_INDEX(hnd)].u32Generation[HANDLE_CHANNEL(hnd)] == HANDLE_GENERATION(hnd))
+
+#define PROPERTIES_PRESENT  0x1U
+#define PROPERTIES_OPENED   0x2U
+/* note: the property snapshot is a seqlock; writers hold the device lock exclusively */
+#define BEGIN_PROPERTIES(idx)  (void)__atomic_add_fetch(&usbDevice[idx].u32Sequence, 1U, __ATOMIC_ACQ_REL)
+#define END_PROPERTIES(idx)  (void)__atomic_add_fetch(&usbDevice[idx].u32Sequence, 1U, __ATOMIC_RELEASE)
+
+/* note: the occupancy state is tracked from plug/unplug and own open/close; whether another
+ *       process owns the device is only known by probe-opening it, so that is cached too */
+#define GET_OCCUPANCY(idx)  __atomic_load_n(&usbDevice[idx].occupancy, __ATOMIC_ACQUIRE)
+#define SET_OCCUPANCY(idx,state,time)  do { __atomic_store_n(&usbDevice[idx].u64Occupancy, (time), __ATOMIC_RELAXED); \
+                                            __atomic_store_n(&usbDevice[idx].occupancy, (state), __ATOMIC_RELEASE); } while (0)
+#define IS_OCCUPANCY_FRESH(idx)  ((GetTimestamp() - __atomic_load_n(&usbDevice[idx].u64Occupancy, __ATOMIC_RELAXED)) < \
+                                  ((UInt64)__atomic_load_n(&occupancyTimeout, __ATOMIC_RELAXED) * 1000000ULL))
+
+#define NEXT_REGISTRY()  (void)__atomic_add_fetch(&usbRegistry.generation, 1U, __ATOMIC_RELEASE)
+#define GET_NUM_SLOTS()  __atomic_load_n(&usbRegistry.nSlots, __ATOMIC_ACQUIRE)
+#define GET_GENERATION(idx,ch)  __atomic_load_n(&usbDevice[idx].u32Generation[ch], __ATOMIC_ACQUIRE)
+#define NEXT_GENERATION(idx,ch)  (void)__atomic_add_fetch(&usbDevice[idx].u32Generation[ch], 1U, __ATOMIC_RELEASE)
+/* note: the counter is never reset (it survives a detach), so every submission is balanced by its completion */
+#define GET_INFLIGHT(idx,ch)  __atomic_load_n(&usbDevice[idx].u32InFlight[ch], __ATOMIC_ACQUIRE)
+#define ADD_INFLIGHT(hnd)  (void)__atomic_add_fetch(&usbDevice[HANDLE_INDEX(hnd)].u32InFlight[HANDLE_CHANNEL(hnd)], 1U, __ATOMIC_RELAXED)
+#define SUB_INFLIGHT(hnd)  (void)__atomic_sub_fetch(&usbDevice[HANDLE_INDEX(hnd)].u32InFlight[HANDLE_CHANNEL(hnd)], 1U, __ATOMIC_RELEASE)
+
+#define ENTER_CRITICAL_SECTION(idx)  assert(0 == pthread_rwlock_wrlock(&usbDevice[HANDLE_INDEX(idx)].ptLock))
+#define LEAVE_CRITICAL_SECTION(idx)  assert(0 == pthread_rwlock_unlock(&usbDevice[HANDLE_INDEX(idx)].ptLock))
+
+#define ENTER_SHARED_SECTION(idx)  assert(0 == pthread_rwlock_rdlock(&usbDevice[HANDLE_INDEX(idx)].ptLock))
+#define LEAVE_SHARED_SECTION(idx)  assert(0 == pthread_rwlock_unlock(&usbDevice[HANDLE_INDEX(idx)].ptLock))
+/* note: for the run loop, which must never wait for a thread that may be waiting for its completions */
+#define TRY_SHARED_SECTION(idx)  (0 == pthread_rwlock_tryrdlock(&usbDevice[HANDLE_INDEX(idx)].ptLock))
+
+/* note: the pipes of each channel have their own mutexes, only the control endpoint (#0) is shared */
+#define ENDPOINT_CHANNEL(idx,ref)  (((ref) % USB_MAX_PIPES) ? HANDLE_CHANNEL(idx) : 0U)
+#define ENTER_ENDPOINT_SECTION(idx,ref)  assert(0 == pthread_mutex_lock(&usbDevice[HANDLE_INDEX(idx)].ptEndpoint[ENDPOINT_CHANNEL(idx,ref)][(ref) % USB_MAX_PIPES]))
+#define LEAVE_ENDPOINT_SECTION(idx,ref)  assert(0 == pthread_mutex_unlock(&usbDevice[HANDLE_INDEX(idx)].ptEndpoint[ENDPOINT_CHANNEL(idx,ref)][(ref) % USB_MAX_PIPES]))
+
+#define ENTER_STATS_SECTION(idx)  assert(0 == pthread_mutex_lock(&usbDevice[HANDLE_INDEX(idx)].ptStats[HANDLE_CHANNEL(idx)]))
+#define LEAVE_STATS_SECTION(idx)  assert(0 == pthread_mutex_unlock(&usbDevice[HANDLE_INDEX(idx)].ptStats[HANDLE_CHANNEL(idx)]))
+
+#define ENTER_PIPE_SECTION(pipe)  assert(0 == pthread_mutex_lock(&(pipe)->ptMutex))
+#define LEAVE_PIPE_SECTION(pipe)  assert(0 == pthread_mutex_unlock(&(pipe)->ptMutex))
+
+#define ENTER_RING_SECTION(ring)  assert(0 == pthread_mutex_lock(&(ring)->ptMutex))
+#define LEAVE_RING_SECTION(ring)  assert(0 == pthread_mutex_unlock(&(ring)->ptMutex))
+
+struct usb_transfer_tag;
+struct usb_async_pipe_tag;
+struct usb_device_tag;
 
 static void ReadPipeCallback(void *refCon, IOReturn result, void *arg0);
 static void WritePipeCallback(void *refCon, IOReturn result, void *arg0);
-static int SetupDirectory(SInt32 vendorID, SInt32 productID);
+static void QueuePipeCallback(void *refCon, IOReturn result, void *arg0);
+static void RegisteredPipeCallback(void *refCon, IOReturn result, void *arg0);
+static void IoRingCallback(void *refCon, IOReturn result, void *arg0);
+static IOReturn SubmitRead(struct usb_transfer_tag *transfer);
+static IOReturn SubmitWrite(struct usb_transfer_tag *transfer, UInt32 size);
+static Boolean IsPipeAsyncPending(struct usb_async_pipe_tag *asyncPipe);
+static Boolean CompleteDestroyedPipe(struct usb_async_pipe_tag *asyncPipe);
+static void ReleasePipeAsync(void *info);
+static void FreePipeAsync(struct usb_async_pipe_tag *asyncPipe);
+static UInt32 GetTransferCapacity(struct usb_async_pipe_tag *asyncPipe);
+static int GetBufferNumber(struct usb_async_pipe_tag *asyncPipe, const UInt8 *buffer);
+static IOReturn FlushPipeQueue(struct usb_async_pipe_tag *asyncPipe);
+static UInt64 GetTimestamp(void);
+static CANUSB_Return_t ResultFromIOReturn(IOReturn kr);
+static CANUSB_Return_t StartReadPipe(struct usb_async_pipe_tag *asyncPipe, CANUSB_AsyncPipeCbk_t callback, CANUSB_AsyncPipeCbkEx_t callbackEx, CANUSB_Context_t context);
+static CANUSB_Return_t StartWritePipe(struct usb_async_pipe_tag *asyncPipe, const void *buffer, UInt32 size, UInt16 timeout,
+                                      CANUSB_AsyncPipeCbk_t callback, CANUSB_AsyncPipeCbkEx_t callbackEx, CANUSB_Context_t context);
+static CANUSB_Return_t StartQueuePipe(struct usb_async_pipe_tag *asyncPipe, const void *buffer, UInt32 size,
+                                      CANUSB_AsyncPipeCbk_t callback, CANUSB_AsyncPipeCbkEx_t callbackEx, CANUSB_Context_t context);
+static CANUSB_Return_t StartSubmitPipe(struct usb_async_pipe_tag *asyncPipe, UInt32 slot, UInt32 size,
+                                       CANUSB_AsyncPipeCbk_t callback, CANUSB_AsyncPipeCbkEx_t callbackEx, CANUSB_Context_t context);
+static void DeliverPipeVector(struct usb_async_pipe_tag *asyncPipe, Boolean expired);
+static void UpdateStats(CANUSB_PipeStats_t *stats, IOReturn result, UInt32 length, UInt32 size);
+static void UpdateHistogram(UInt32 *histogram, UInt64 nanoseconds);
+static void CoalescingTimerCallback(CFRunLoopTimerRef timer, void *info);
+static void ScheduleRecovery(struct usb_async_pipe_tag *asyncPipe, IOReturn result, UInt64 timestamp);
+static void RecoveryTimerCallback(CFRunLoopTimerRef timer, void *info);
+static CANUSB_Return_t ResetPipeInterface(struct usb_async_pipe_tag *asyncPipe);
+static void WatchdogTimerCallback(CFRunLoopTimerRef timer, void *info);
+static int InitDeviceLocks(struct usb_device_tag *device);
+static int RegisterDevice(UInt32 location, UInt16 vendorId, UInt16 productId);
+static int UnregisterDevice(UInt32 location);
+static void ReleaseSlot(int index);
+static CANUSB_DeviceState_t ProbeDeviceState(int index);
+static Boolean AbortInterface(int index, UInt32 channel);
+static Boolean ArmStandby(int index);
+static void ReleaseStandby(int index);
+static void StandbyTimerCallback(CFRunLoopTimerRef timer, void *info);
+static void ScheduleStandby(void *info);
+static CANUSB_DeviceState_t GetDeviceState(int index);
+static UInt32 ReadProperties(int index, CANUSB_Properties_t *properties, CANUSB_Handle_t handle);
+static UInt32 OpenedChannels(int index);
+static void ReleaseInterface(int index, UInt32 channel);
+static void FreeDeviceLocks(struct usb_device_tag *device);
+static int SetupDirectory(SInt32 vendorID);
+static void ReleaseDirectory(void);
 static void DeviceAdded(void *refCon, io_iterator_t iterator);
 static void DeviceRemoved(void *refCon, io_iterator_t iterator);
+static int AttachDevice(io_service_t service, IOUSBDeviceInterface **device, const char *name);
+static IOReturn CreateDeviceInterface(int index);
+static Boolean RequireDeviceInterface(int index);
+static Boolean GetRegistryNumber(io_service_t service, CFStringRef key, UInt32 *value);
+static void DetachDevice(UInt32 location);
 static IOReturn ConfigureDevice(IOUSBDeviceInterface **dev);
-static IOReturn FindInterface(IOUSBDeviceInterface **device, int index);
+static IOReturn FindInterface(IOUSBDeviceInterface **device, int index, UInt32 channel);
+static IOReturn SetupInterface(IOUSBInterfaceInterface **interface, int index, UInt32 channel);
 static void* WorkerThread(void* arg);
-
-typedef struct usb_buffer_tag {             /* Double buffer: */
-    UInt8 *data[2];                         /*   pointer to data buffers */
-    UInt8 index;                            /*   index to active data buffer */
+static void* OpenThread(void* arg);
+static void StopRunLoop(void *info);
+static Boolean PerformOnRunLoop(void (*function)(void *info), void *info, Boolean wait);
+static void PerformJobs(void *info);
+static void GetAbsoluteTime(struct timespec *absTime, UInt32 timeout);
+
+typedef struct usb_transfer_tag {           /* Asynchronous transfer: */
+    struct usb_async_pipe_tag *asyncPipe;   /*   pipe of the transfer (back-reference) */
+    UInt8 *data;                            /*   pointer to data buffer */
+    UInt32 index;                           /*   index of the transfer (in the ring) */
+    UInt32 length;                          /*   number of bytes transferred */
+    IOReturn result;                        /*   result of the transfer */
+    UInt64 timestamp;                       /*   time of completion (in [ns]) */
+    Boolean pending;                        /*   transfer is outstanding */
+    Boolean completed;                      /*   transfer is completed, but not delivered */
+} CANUSB_Transfer_t;
+
+typedef struct usb_buffer_tag {             /* Ring of transfers: */
+    CANUSB_Transfer_t *transfer;            /*   transfers (queue depth) */
+    UInt8 *block;                           /*   data buffers (one block) */
+    UInt32 depth;                           /*   number of transfers */
+    UInt32 index;                           /*   index to next transfer to be delivered resp. filled */
     UInt32 size;                            /*   size of each buffer (in byte) */
 } CANUSB_Buffer_t;
 
+typedef struct usb_lending_tag {            /* Buffer lending: */
+    UInt8 **pool;                           /*   stack of free spare buffers */
+    UInt8 *block;                           /*   spare buffers (one block) */
+    UInt32 spares;                          /*   number of spare buffers */
+    UInt32 count;                           /*   number of buffers in the pool */
+    UInt32 lent;                            /*   number of buffers lent to the consumer */
+    UInt32 parked;                          /*   number of transfers waiting for a buffer */
+    UInt32 first;                           /*   index of the first parked transfer */
+    UInt64 onLoan;                          /*   bitmap of the lent buffers (transfers, then spares) */
+} CANUSB_Lending_t;
+
+typedef struct usb_coalescing_tag {         /* Vectored delivery: */
+    CANUSB_AsyncPipeVecCbk_t callback;      /*   vectored callback (NULL = off) */
+    CANUSB_Context_t context;               /*   pointer to user context for callback */
+    UInt32 maxTransfers;                    /*   deliver after N transfers */
+    UInt32 maxDelay;                        /*   or after T micro-seconds (0 = at once) */
+    struct usb_transfer_tag *batch[CANUSB_MAX_QUEUE_DEPTH];  /*   completed transfers (to be delivered) */
+    UInt32 count;                           /*   number of completed transfers */
+    CFRunLoopTimerRef timer;                /*   timer for time-based delivery */
+    Boolean armed;                          /*   timer is armed */
+    Boolean delivering;                     /*   a batch is being delivered */
+} CANUSB_Coalescing_t;
+
+typedef struct usb_recovery_tag {           /* Stall recovery: */
+    CANUSB_RecoveryCbk_t callback;          /*   callback for recovery events (optional) */
+    CANUSB_Context_t context;               /*   pointer to user context for callback */
+    UInt32 initialDelay;                    /*   first backoff (in [ms], 0 = off) */
+    UInt32 maxDelay;                        /*   max. backoff (in [ms]) */
+    UInt32 maxRetries;                      /*   retries before giving up (0 = forever) */
+    UInt32 delay;                           /*   current backoff (in [ms]) */
+    UInt32 retries;                         /*   number of retries so far */
+    UInt64 failedAt;                        /*   time of the error (in [ns]) */
+    IOReturn result;                        /*   result of the failed transfer */
+    CFRunLoopTimerRef timer;                /*   timer for the backoff */
+    Boolean active;                         /*   recovery in progress */
+    Boolean reading;                        /*   re-arm the read transfers on recovery */
+} CANUSB_Recovery_t;
+
+typedef struct usb_watchdog_tag {           /* Inactivity watchdog: */
+    CANUSB_WatchdogCbk_t callback;          /*   callback for watchdog events (optional) */
+    CANUSB_Context_t context;               /*   pointer to user context for callback */
+    UInt32 notifyAfter;                     /*   notify after (in [ms], 0 = off) */
+    UInt32 rearmAfter;                      /*   abort and re-arm after (in [ms], 0 = off) */
+    UInt32 resetAfter;                      /*   reset the device after (in [ms], 0 = off) */
+    UInt64 lastActivity;                    /*   time of the last successful completion (in [ns]) */
+    UInt64 firedAt;                         /*   last activity when the watchdog fired */
+    UInt32 fired;                           /*   levels fired in this dead period */
+    CFRunLoopTimerRef timer;                /*   periodic timer */
+    Boolean rearm;                          /*   re-arm when the aborted transfers are gone */
+} CANUSB_Watchdog_t;
+
+typedef struct usb_registered_tag {         /* Registered caller buffer: */
+    struct usb_async_pipe_tag *asyncPipe;   /*   pipe of the buffer (back-reference) */
+    UInt8 *data;                            /*   pointer to caller's buffer (NULL = slot free) */
+    UInt32 size;                            /*   size of the caller's buffer (in byte) */
+    UInt32 length;                          /*   number of bytes submitted */
+    CANUSB_AsyncPipeCbk_t callback;         /*   callback when the buffer can be reused */
+    CANUSB_AsyncPipeCbkEx_t callbackEx;     /*   callback with host time (instead of the above) */
+    CANUSB_Context_t context;               /*   pointer to user context for callback */
+    Boolean pending;                        /*   buffer is referenced by a transfer */
+    Boolean delivering;                     /*   buffer is handed to the callback */
+} CANUSB_Registered_t;
+
 typedef struct usb_async_pipe_tag {         /* Asynchrounous pipe: */
     UInt8 pipeRef;                          /*   pipe number (endpoint) */
+    UInt8 direction;                        /*   direction of the pipe (USBPIPE_DIR_xyz) */
+    UInt16 maxPacketSize;                   /*   max. packet size of the pipe */
     CANUSB_Handle_t handle;                 /*   device handle */
-    CANUSB_Buffer_t buffer;                 /*   double buffer */
+    IOUSBInterfaceInterface **ioInterface;  /*   interface interface (referenced) */
+    CANUSB_Buffer_t buffer;                 /*   ring of transfers */
+    CANUSB_Lending_t lending;               /*   spare buffers for lending (read pipe) */
+    CANUSB_Coalescing_t coalescing;         /*   vectored delivery (read pipe) */
+    CANUSB_Recovery_t recovery;             /*   stall recovery (optional) */
+    CANUSB_Watchdog_t watchdog;             /*   inactivity watchdog (optional) */
     CANUSB_AsyncPipeCbk_t callback;         /*   callback from notification function */
+    CANUSB_AsyncPipeCbkEx_t callbackEx;     /*   callback with host time (instead of the above) */
     CANUSB_Context_t context;               /*   pointer to user context for callback */
 #if (OPTION_MACCAN_PIPE_TIMEOUT != 0)
     UInt32 noDataTimeout;                   /*   time-out (in [ms]) if no data is transferred */
     UInt32 completionTimeout;               /*   time-out (in [ms]) if the entire request is not completed */
 #endif
     Boolean running;                        /*   flag to indicate the pipe state */
+    Boolean destroyed;                      /*   destroyed by the application (callbacks are dropped) */
+    Boolean released;                       /*   timers released (freed by the last completion) */
+    CANUSB_Registered_t registered[CANUSB_MAX_REGISTERED_BUFFERS];  /*   registered caller buffers */
+    pthread_mutex_t ptMutex;                /*   pthread mutex for the transmit ring */
+    CANUSB_PipeStats_t stats;               /*   I/O statistics of the pipe */
     UInt64 serviced;                        /*   counting callbacks (for debugging) */
 } *CANUSB_AsyncPipe_t;                      /*   note: forward declaration requires C11 */
 
+typedef struct usb_io_slot_tag {            /* I/O ring slot: */
+    struct usb_io_ring_tag *ioRing;         /*   ring of the slot (back-reference) */
+    IOUSBDevRequest devRequest;             /*   device request (control transfer) */
+    UInt64 userData;                        /*   user data of the request */
+    UInt64 submitted;                       /*   time of submission (in [ns]) */
+    UInt32 next;                            /*   next free slot (list) */
+} CANUSB_IoSlot_t;
+
+typedef struct usb_io_ring_tag {            /* I/O ring (submission/completion queue): */
+    CANUSB_Handle_t handle;                 /*   device handle */
+    UInt32 entries;                         /*   number of entries */
+    CANUSB_IoSlot_t *slots;                 /*   slots of the transfers in flight */
+    UInt32 freeSlot;                        /*   first free slot */
+    UInt32 inFlight;                        /*   number of transfers in flight */
+    CANUSB_IoCompletion_t *cq;              /*   completion queue (ring-buffer) */
+    UInt32 head;                            /*   read position of the completion queue */
+    UInt32 tail;                            /*   write position of the completion queue */
+    UInt32 used;                            /*   number of completions in the queue */
+    pthread_mutex_t ptMutex;                /*   pthread mutex for mutual exclusion */
+    pthread_cond_t ptCond;                  /*   pthread condition for blocking reap */
+} *CANUSB_IoRing_t;
+
 typedef struct usb_interface_tag {          /* USB interface: */
     Boolean fOpened;                        /*   interface is opened */
     UInt8 u8Class;                          /*   class of the interface (8-bit) */
@@ -151,106 +435,189 @@ typedef struct usb_interface_tag {          /* USB interface: */
 } USBInterface_t;
 
 typedef struct usb_device_tag {             /* USB device: */
-    Boolean fPresent;                       /*   device is present */
-    io_name_t szName;                       /*   device name */
+    /* hot: touched on each transfer (one cache line w/o multi-channel, up to three with it) */
+    Boolean fPresent CACHE_ALIGNED;         /*   device is present */
+    UInt32 u32Generation[USB_MAX_INTERFACES];  /* generation of the handles (per channel) */
+    UInt32 u32InFlight[USB_MAX_INTERFACES];  /* asynchronous transfers in flight (per channel) */
+    IOUSBDeviceInterface **ioDevice;        /*   device interface (instance) */
+    USBInterface_t usbInterface[USB_MAX_INTERFACES];  /* interface interfaces (one per channel) */
+    /* cold: descriptive data (read by the getters) */
+    UInt32 u32Location CACHE_ALIGNED;       /*   unique location ID (32-bit) */
     UInt16 u16VendorId;                     /*   vendor ID (16-bit) */
     UInt16 u16ProductId;                    /*   product ID (16-bit) */
     UInt16 u16ReleaseNo;                    /*   release no. (16-bit) */
-    UInt8 nCanChannels;                     /*   "number of CAN channels" */
-    UInt32 u32Location;                     /*   unique location ID (32-bit) */
     UInt16 u16Address;                      /*   device address (16-bit?) */
-    IOUSBDeviceInterface **ioDevice;        /*   device interface (instance) */
+    UInt8 nCanChannels;                     /*   "number of CAN channels" */
     CANUSB_Descriptor_t ptrCanDevice;       /*   device descriptor (pointer) */
-    USBInterface_t usbInterface/*[x]*/;     /*   interface interface (only first one supported) */
-    pthread_mutex_t ptMutex;                /*   pthread mutex for mutual exclusion */
-} USBDevice_t;
+    io_name_t szName;                       /*   device name */
+    io_service_t ioService;                 /*   i/o registry entry (for the device interface) */
+    Boolean fStandby;                       /*   closed, but still opened and configured (warm standby) */
+    UInt64 u64Standby;                      /*   end of the grace period (in [ns]) */
+    CFRunLoopTimerRef standbyTimer;         /*   timer to close the device after the grace period */
+    UInt32 u32Sequence;                     /*   sequence number of the snapshot (odd = write in progress) */
+    CANUSB_Properties_t properties[USB_MAX_INTERFACES];  /* property snapshot per channel (written on plug, open and close) */
+    CANUSB_DeviceState_t occupancy;         /*   cached occupancy state of the device */
+    UInt64 u64Occupancy;                    /*   time of the last probe (in [ns], 0 = stale) */
+    /* locks and statistics: each on cache lines of their own */
+    pthread_rwlock_t ptLock CACHE_ALIGNED;  /*   pthread r/w-lock for the device state */
+    pthread_mutex_t ptStats[USB_MAX_INTERFACES] CACHE_ALIGNED;  /* pthread mutex for the I/O statistics (per channel) */
+    CANUSB_PipeStats_t stats[USB_MAX_INTERFACES];  /* I/O statistics of synchronous pipe transfers (per channel) */
+    pthread_mutex_t ptEndpoint[USB_MAX_INTERFACES][USB_MAX_PIPES] CACHE_ALIGNED;  /* pthread mutex for each pipe of each channel (#0 = control endpoint) */
+} CACHE_ALIGNED USBDevice_t;
+
+#if (OPTION_MACCAN_MULTICHANNEL == 0)
+_Static_assert((offsetof(USBDevice_t, usbInterface) + sizeof(((USBDevice_t*)0)->usbInterface)) <= CACHE_LINE_SIZE,
+               "hot data of a USB device exceeds one cache line");
+#else
+_Static_assert((offsetof(USBDevice_t, usbInterface) + sizeof(((USBDevice_t*)0)->usbInterface)) <= (3 * CACHE_LINE_SIZE),
+               "hot data of a multi-channel USB device exceeds three cache lines");
+#endif
 
 typedef struct usb_driver_tag {             /* USB driver: */
     Boolean fRunning;                       /*   flag: driver running */
+    Boolean fTerminated;                    /*   flag: worker thread terminated */
+    Boolean fCancelled;                     /*   flag: start-up given up by the creator */
     pthread_t ptThread;                     /*   pthread of the driver */
     pthread_mutex_t ptMutex;                /*   pthread mutex for mutual exclusion */
+    pthread_cond_t ptCond;                  /*   pthread condition for start-up and teardown */
     CFRunLoopRef refRunLoop;                /*   run loop of the driver */
+    CFRunLoopSourceRef refStopSource;       /*   run loop source to stop the run loop */
+    CFRunLoopSourceRef refPerformSource;    /*   run loop source to perform jobs on the run loop */
+    struct usb_perform_tag *ptrJobs;        /*   jobs to be performed on the run loop (queue) */
     IONotificationPortRef refNotifyPort;    /*   port for notifications */
-    io_iterator_t iterBulkDevicePlugged;    /*   iterator for plugged device(s) */
-    io_iterator_t iterBulkDeviceUnplugged;  /*   iterator for unplugged device(s) */
+    io_iterator_t iterBulkDevicePlugged[USB_MAX_VENDORS];  /* iterators for plugged device(s) */
+    io_iterator_t iterBulkDeviceUnplugged[USB_MAX_VENDORS];  /* iterators for unplugged device(s) */
+    int nNotifications;                     /*   number of notifications (per vendor) */
     int nRevision;                          /*   revision number */
 } USBDriver_t;
 
+typedef struct usb_perform_tag {            /* Job on the run loop: */
+    struct usb_perform_tag *next;           /*   next job in the queue */
+    void (*function)(void *info);           /*   function to be performed */
+    void *info;                             /*   argument of the function */
+    Boolean fWait;                          /*   the caller waits for the job (and frees it) */
+    Boolean fDone;                          /*   the job has been performed */
+} USBPerformJob_t;
+
+typedef struct usb_open_tag {               /* Parallel open: */
+    const CANUSB_Index_t *indexes;          /*   device indexes to be opened */
+    UInt32 count;                           /*   number of devices */
+    UInt16 vendorId;                        /*   vendor ID (or CANUSB_ANY_VENDOR_ID) */
+    UInt16 productId;                       /*   product ID (or CANUSB_ANY_PRODUCT_ID) */
+    CANUSB_Handle_t *handles;               /*   resulting handles */
+    CANUSB_Return_t *results;               /*   resulting error codes (optional) */
+    UInt32 next;                            /*   next device to be opened (atomic) */
+} USBOpenJob_t;
+
+typedef struct usb_registry_tag {           /* Device registry: */
+    int nSlots;                             /*   number of slots in use (high-water mark) */
+    int nFree;                              /*   number of released slots */
+    SInt16 freeSlots[CANUSB_MAX_DEVICES];   /*   stack of released slots */
+    SInt16 byLocation[REGISTRY_HASH_SIZE];  /*   hash buckets by location ID */
+    SInt16 byId[REGISTRY_HASH_SIZE];        /*   hash buckets by vendor/product ID */
+    SInt16 nextLocation[CANUSB_MAX_DEVICES];  /* chain of the location ID buckets */
+    SInt16 nextId[CANUSB_MAX_DEVICES];      /*   chain of the vendor/product ID buckets */
+    UInt32 location[CANUSB_MAX_DEVICES];    /*   location ID of the slot (key) */
+    UInt32 id[CANUSB_MAX_DEVICES];          /*   vendor/product ID of the slot (key) */
+    UInt32 generation;                      /*   bumped on each plug, unplug, open and close */
+    pthread_mutex_t ptMutex;                /*   pthread mutex for mutual exclusion */
+} USBRegistry_t;
+
 static USBDriver_t usbDriver;
 static USBDevice_t usbDevice[CANUSB_MAX_DEVICES];
+static USBRegistry_t usbRegistry;
 static CANUSB_Index_t idxDevice = 0;
 static Boolean fInitialized = false;
+static UInt32 occupancyTimeout = OPTION_MACCAN_OCCUPANCY_TIMEOUT;
+static UInt32 warmStandby = OPTION_MACCAN_WARM_STANDBY;
 
 CANUSB_Return_t CANUSB_Initialize(void) {
     int index, rc = -1;
     pthread_attr_t attr;
-    Boolean running;
-    time_t now;
+    struct timespec absTime;
+    Boolean running, terminated;
+    int res = 0;
 
     /* must not be initialized */
     if (fInitialized)
         return CANUSB_ERROR_YETINIT;
 
-    /* initialize the driver and its devices */
+    /* initialize the driver and its device registry (note: slots are taken into use on demand) */
     bzero(&usbDriver, sizeof(USBDriver_t));
     usbDriver.fRunning = false;
-    for (index = 0; index < CANUSB_MAX_DEVICES; index++) {
-        bzero(&usbDevice[index], sizeof(USBDevice_t));
-        usbDevice[index].fPresent = false;
-        /* create a mutex for each device */
-        if (pthread_mutex_init(&usbDevice[index].ptMutex, NULL) != 0)
-            goto error_initialize;
+    bzero(usbDevice, sizeof(usbDevice));
+    bzero(&usbRegistry, sizeof(USBRegistry_t));
+    for (index = 0; index < (int)REGISTRY_HASH_SIZE; index++) {
+        usbRegistry.byLocation[index] = REGISTRY_NONE;
+        usbRegistry.byId[index] = REGISTRY_NONE;
     }
+    if (pthread_mutex_init(&usbRegistry.ptMutex, NULL) != 0)
+        return CANUSB_ERROR_NOTINIT;
     /* create a mutex and a thread for the driver */
     if (pthread_mutex_init(&usbDriver.ptMutex, NULL) != 0)
         goto error_initialize;
-    if (pthread_attr_init(&attr) != 0)
+    if (pthread_cond_init(&usbDriver.ptCond, NULL) != 0) {
+        (void)pthread_mutex_destroy(&usbDriver.ptMutex);
         goto error_initialize;
+    }
+    if (pthread_attr_init(&attr) != 0)
+        goto error_thread;
     if (pthread_attr_setstacksize(&attr, 64*1024) != 0)
-        goto error_initialize;
+        goto error_thread;
     if (pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED) != 0)
-        goto error_initialize;
+        goto error_thread;
     if (pthread_attr_setschedpolicy(&attr, SCHED_RR) != 0)
-        goto error_initialize;
+        goto error_thread;
     rc = pthread_create(&usbDriver.ptThread, &attr, WorkerThread, NULL);
     assert(pthread_attr_destroy(&attr) == 0);
     if (rc != 0)
-        goto error_initialize;
+        goto error_thread;
 
     /* get SVN/RCS revision number from expanded keyword (to be used as the build number) */
     if (sscanf(SVN_REVISION, "\044Rev: %i\044", &usbDriver.nRevision) != 1) usbDriver.nRevision = 0;
 
-    /* wait for the driver being loaded (by the created thread) or timed out */
+    /* wait for the driver being loaded (signaled by the created thread), failed or timed out */
     MACCAN_DEBUG_INFO("    Loading the MacCAN driver (v%u.%u.%u.%i)\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, usbDriver.nRevision);
     fInitialized = true;
-    now = time(NULL);
-    do {
-        usleep(1000);
-        assert(0 == pthread_mutex_lock(&usbDriver.ptMutex));
-        running = usbDriver.fRunning;
-        assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
-    } while (!running && (time(NULL) < (now + 5/*seconds*/)));
+    GetAbsoluteTime(&absTime, DRIVER_START_TIMEOUT);
+    assert(0 == pthread_mutex_lock(&usbDriver.ptMutex));
+    while (!usbDriver.fRunning && !usbDriver.fTerminated && (res == 0))
+        res = pthread_cond_timedwait(&usbDriver.ptCond, &usbDriver.ptMutex, &absTime);
+    running = usbDriver.fRunning;
+    terminated = usbDriver.fTerminated;
+    assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
     if (!running)
         goto error_runloop;
-    
+
     /* the driver is now loaded (notifications will be received) */
     return CANUSB_SUCCESS;
 
 error_runloop:
-    /* on error: terminate the thread! */
-    CFRunLoopStop(usbDriver.refRunLoop);
+    /* on error: the thread has given up, or it is still starting (then tell it to give up before
+     * it enters the run loop and wait for it, so that the sync objects are not destroyed under it) */
+    if (!terminated) {
+        MACCAN_DEBUG_ERROR("+++ Worker thread not started within %ums\n", DRIVER_START_TIMEOUT);
+        assert(0 == pthread_mutex_lock(&usbDriver.ptMutex));
+        usbDriver.fCancelled = TRUE;
+        assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
+    }
+    (void)pthread_join(usbDriver.ptThread, NULL);
+error_thread:
+    (void)pthread_cond_destroy(&usbDriver.ptCond);
     (void)pthread_mutex_destroy(&usbDriver.ptMutex);
 error_initialize:
     /* on error: tidy-up! */
-    for (index = index - 1; index >= 0; index--)
-        (void)pthread_mutex_destroy(&usbDevice[index].ptMutex);
+    (void)pthread_mutex_destroy(&usbRegistry.ptMutex);
     /* the driver has not been loaded! */
     fInitialized = false;
     return CANUSB_ERROR_NOTINIT;
 }
 
 CANUSB_Return_t CANUSB_Teardown(void) {
-    int index;
+    struct timespec absTime;
+    Boolean terminated;
+    UInt32 channel;
+    int index, res = 0;
 
     /* must be initialized */
     if (!fInitialized)
@@ -258,48 +625,70 @@ CANUSB_Return_t CANUSB_Teardown(void) {
 
     /* "Mr. Gorbachev, tear down this wall!" */
     MACCAN_DEBUG_INFO("    Release the MacCAN driver (v%u.%u.%u.%i)\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, usbDriver.nRevision);
-#if (0)
-    /* note: this does not terminate the worker thread! */
-    assert(pthread_cancel(usbDriver.ptThread) == 0);
-#else
-    // TODO: switch completely over to CFRunLoop interface
-    CFRunLoopStop(usbDriver.refRunLoop);
-#endif
-    usleep(54945);
+    /* stop the run loop (note: a signaled source is not lost, even if the loop is not yet running) */
+    GetAbsoluteTime(&absTime, DRIVER_STOP_TIMEOUT);
+    assert(0 == pthread_mutex_lock(&usbDriver.ptMutex));
+    if (usbDriver.refStopSource) {
+        CFRunLoopSourceSignal(usbDriver.refStopSource);
+        CFRunLoopWakeUp(usbDriver.refRunLoop);
+    }
+    /* wait for the worker thread to leave the run loop, then no callback is in flight anymore */
+    while (!usbDriver.fTerminated && (res == 0))
+        res = pthread_cond_timedwait(&usbDriver.ptCond, &usbDriver.ptMutex, &absTime);
+    terminated = usbDriver.fTerminated;
+    assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
+    /* note: a worker thread still alive uses the devices and the locks, so nothing is released
+     *       (the driver stays initialized and the teardown can be retried) */
+    if (!terminated) {
+        MACCAN_DEBUG_ERROR("+++ Worker thread not terminated within %ums\n", DRIVER_STOP_TIMEOUT);
+        return CANUSB_ERROR_TIMEOUT;
+    }
+    (void)pthread_join(usbDriver.ptThread, NULL);
 
     /* close all USB devices */
-    for (index = 0; index < CANUSB_MAX_DEVICES; index++) {
+    for (index = 0; index < usbRegistry.nSlots; index++) {
         /* release the USB device */
         //MACCAN_DEBUG_FUNC("lock #%i\n", index);
         ENTER_CRITICAL_SECTION(index);
         if (usbDevice[index].fPresent &&
-            (usbDevice[index].ioDevice != NULL)) {
+            HAS_DEVICE(index)) {
             MACCAN_DEBUG_CORE("      - Device #%i: %s", index, usbDevice[index].szName);
-            if (usbDevice[index].usbInterface.fOpened) {
+            /* close a device in warm standby */
+            ReleaseStandby(index);
+            if (OpenedChannels(index)) {
                 /* close the USB interface interface(s) */
-                if (usbDevice[index].usbInterface.ioInterface) {
-                    MACCAN_DEBUG_CODE(0, "close and release I/O interface\n");
-                    (void)(*usbDevice[index].usbInterface.ioInterface)->USBInterfaceClose(usbDevice[index].usbInterface.ioInterface);
-                    (void)(*usbDevice[index].usbInterface.ioInterface)->Release(usbDevice[index].usbInterface.ioInterface);
-                    usbDevice[index].usbInterface.ioInterface = NULL;
+                for (channel = 0U; channel < USB_MAX_INTERFACES; channel++) {
+                    ReleaseInterface(index, channel);
+                    usbDevice[index].usbInterface[channel].fOpened = false;
                 }
                 /* close the USB device interface */
                 MACCAN_DEBUG_CODE(0, "close I/O device\n");
                 (void)(*usbDevice[index].ioDevice)->USBDeviceClose(usbDevice[index].ioDevice);
-                usbDevice[index].usbInterface.fOpened = false;
             }
             /* rest in pease */
             MACCAN_DEBUG_CODE(0, "release I/O device\n");
-            (void)(*usbDevice[index].ioDevice)->Release(usbDevice[index].ioDevice);
+            if (usbDevice[index].ioDevice)
+                (void)(*usbDevice[index].ioDevice)->Release(usbDevice[index].ioDevice);
+            if (usbDevice[index].ioService)
+                (void)IOObjectRelease(usbDevice[index].ioService);
             usbDevice[index].ioDevice = NULL;
+            usbDevice[index].ioService = IO_OBJECT_NULL;
             usbDevice[index].fPresent = false;
             MACCAN_DEBUG_CORE(" (R.I.P.)\n");
         }
+        if (usbDevice[index].standbyTimer) {
+            CFRunLoopTimerInvalidate(usbDevice[index].standbyTimer);
+            CFRelease(usbDevice[index].standbyTimer);
+            usbDevice[index].standbyTimer = NULL;
+        }
         LEAVE_CRITICAL_SECTION(index);
         //MACCAN_DEBUG_FUNC("unlocked\n");
-        (void)pthread_mutex_destroy(&usbDevice[index].ptMutex);
+        FreeDeviceLocks(&usbDevice[index]);
     }
+    (void)pthread_cond_destroy(&usbDriver.ptCond);
     (void)pthread_mutex_destroy(&usbDriver.ptMutex);
+    (void)pthread_mutex_destroy(&usbRegistry.ptMutex);
+    usbRegistry.nSlots = 0;
     fInitialized = false;
     return 0;
 }
@@ -326,14 +715,19 @@ CANUSB_Return_t CANUSB_DeviceRequest(CANUSB_Index_t index, CANUSB_SetupPacket_t
     request.wLenDone = 0;
     (void)size;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", handle);
-    ENTER_CRITICAL_SECTION(index);
+    /* the device interface is needed (note: it is created on demand) */
+    (void)RequireDeviceInterface(index);
+
+    MACCAN_DEBUG_FUNC("lock #%i\n", index);
+    ENTER_SHARED_SECTION(index);
+    ENTER_ENDPOINT_SECTION(index, 0U);
     if (usbDevice[index].fPresent &&
         (usbDevice[index].ioDevice != NULL)) {
         kr = (*usbDevice[index].ioDevice)->DeviceRequest(usbDevice[index].ioDevice, &request);
         if (kIOReturnSuccess != kr) {
             MACCAN_DEBUG_ERROR("+++ Control transfer failed (%08x)\n", kr);
-            LEAVE_CRITICAL_SECTION(index);
+            LEAVE_ENDPOINT_SECTION(index, 0U);
+            LEAVE_SHARED_SECTION(index);
             MACCAN_DEBUG_FUNC("unlocked\n");
             return CANUSB_ERROR_RESOURCE;
         }
@@ -343,12 +737,20 @@ CANUSB_Return_t CANUSB_DeviceRequest(CANUSB_Index_t index, CANUSB_SetupPacket_t
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
+    LEAVE_ENDPOINT_SECTION(index, 0U);
+    LEAVE_SHARED_SECTION(index);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Handle_t CANUSB_OpenDevice(CANUSB_Index_t index, UInt16 vendorId, UInt16 productId) {
+    /* the first (or only) CAN channel of the device */
+    return CANUSB_OpenChannel(index, 0U, vendorId, productId);
+}
+
+CANUSB_Handle_t CANUSB_OpenChannel(CANUSB_Index_t index, UInt8 channel, UInt16 vendorId, UInt16 productId) {
+    IOUSBInterfaceInterface **kept;
+    Boolean first = false;
     IOReturn kr;
 
     /* must be initialized */
@@ -357,13 +759,23 @@ CANUSB_Handle_t CANUSB_OpenDevice(CANUSB_Index_t index, UInt16 vendorId, UInt16
     /* must be a valid index */
     if (!IS_INDEX_VALID(index))
         return CANUSB_INVALID_HANDLE;
+    /* must be a valid channel (one per interface) */
+    if ((UInt32)channel >= USB_MAX_INTERFACES)
+        return CANUSB_INVALID_HANDLE;
 
     /* open the USB device */
     MACCAN_DEBUG_FUNC("lock #%i\n", index);
     ENTER_CRITICAL_SECTION(index);
     if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
-        if (!usbDevice[index].usbInterface.fOpened) {
+        HAS_DEVICE(index)) {
+        /* must be a CAN channel of the device (note: channel 0 even if the number of channels is unknown) */
+        if ((channel != 0U) && (channel >= usbDevice[index].nCanChannels)) {
+            MACCAN_DEBUG_ERROR("+++ Device #%i has no CAN channel #%u (%u channel(s))\n", index, channel, usbDevice[index].nCanChannels);
+            LEAVE_CRITICAL_SECTION(index);
+            MACCAN_DEBUG_FUNC("unlocked\n");
+            return CANUSB_INVALID_HANDLE;
+        }
+        if (!usbDevice[index].usbInterface[channel].fOpened) {
             /* Find matching device by vendor id. and product id. (optional) */
             if ((vendorId != CANUSB_ANY_VENDOR_ID) && (productId != CANUSB_ANY_PRODUCT_ID)) {
                 /* $1 by both vendor id. and product id. */
@@ -388,37 +800,81 @@ CANUSB_Handle_t CANUSB_OpenDevice(CANUSB_Index_t index, UInt16 vendorId, UInt16
                 MACCAN_DEBUG_FUNC("unlocked\n");
                 return CANUSB_INVALID_HANDLE;
             }
-            /* Open the device for exclusive access */
-            kr = (*usbDevice[index].ioDevice)->USBDeviceOpen(usbDevice[index].ioDevice);
-            if (kIOReturnSuccess != kr) {
-                MACCAN_DEBUG_ERROR("+++ Unable to open device #%i: %08x\n", index, kr);
-                LEAVE_CRITICAL_SECTION(index);
-                MACCAN_DEBUG_FUNC("unlocked\n");
-                return CANUSB_INVALID_HANDLE;
+            /* Warm re-open: the interface is still opened (kept within the grace period of the device),
+             * unless it has been closed underneath (then it is released and opened again below) */
+            if (((kept = usbDevice[index].usbInterface[channel].ioInterface) != NULL) &&
+                usbDevice[index].usbInterface[channel].u8NumEndpoints) {
+                kr = (*kept)->GetPipeStatus(kept, 1U);
+                if ((kIOReturnNotOpen == kr) || (kIOReturnNoDevice == kr)) {
+                    MACCAN_DEBUG_ERROR("+++ Kept interface #%u of device #%i is gone: %08x\n", channel, index, kr);
+                    ReleaseInterface(index, channel);
+                }
             }
-            /* Configure the device */
-            kr = ConfigureDevice(usbDevice[index].ioDevice);
-            if (kIOReturnSuccess != kr) {
-                MACCAN_DEBUG_ERROR("+++ Unable to configure device #%i: %08x\n", index, kr);
-                (void)(*usbDevice[index].ioDevice)->USBDeviceClose(usbDevice[index].ioDevice);
-                usbDevice[index].usbInterface.fOpened = false;
+            if (usbDevice[index].usbInterface[channel].ioInterface != NULL) {
+                if (usbDevice[index].fStandby) {
+                    usbDevice[index].fStandby = false;
+                    (void)PerformOnRunLoop(ScheduleStandby, (void*)(intptr_t)index, false);
+                }
+                BEGIN_PROPERTIES(index);
+                bzero(&usbDevice[index].stats[channel], sizeof(CANUSB_PipeStats_t));
+                usbDevice[index].usbInterface[channel].fOpened = true;
+                END_PROPERTIES(index);
+                SET_OCCUPANCY(index, CANUSB_DEVICE_ATTACHED, GetTimestamp());
+                NEXT_REGISTRY();
                 LEAVE_CRITICAL_SECTION(index);
                 MACCAN_DEBUG_FUNC("unlocked\n");
-                return CANUSB_INVALID_HANDLE;
+                return MAKE_HANDLE(index, channel, usbDevice[index].u32Generation[channel]);
+            }
+            /* The first channel opens and configures the device (unless kept opened in warm standby) */
+            if (!OpenedChannels(index) && !usbDevice[index].fStandby) {
+                /* Create the device interface (on the first open) */
+                kr = CreateDeviceInterface(index);
+                if (kIOReturnSuccess != kr) {
+                    MACCAN_DEBUG_ERROR("+++ Unable to create device interface for device #%i: %08x\n", index, kr);
+                    LEAVE_CRITICAL_SECTION(index);
+                    MACCAN_DEBUG_FUNC("unlocked\n");
+                    return CANUSB_INVALID_HANDLE;
+                }
+                /* Open the device for exclusive access */
+                kr = (*usbDevice[index].ioDevice)->USBDeviceOpen(usbDevice[index].ioDevice);
+                if (kIOReturnSuccess != kr) {
+                    MACCAN_DEBUG_ERROR("+++ Unable to open device #%i: %08x\n", index, kr);
+                    if (kIOReturnExclusiveAccess == kr)
+                        SET_OCCUPANCY(index, CANUSB_DEVICE_HIJACKED, GetTimestamp());
+                    LEAVE_CRITICAL_SECTION(index);
+                    MACCAN_DEBUG_FUNC("unlocked\n");
+                    return CANUSB_INVALID_HANDLE;
+                }
+                /* Configure the device */
+                kr = ConfigureDevice(usbDevice[index].ioDevice);
+                if (kIOReturnSuccess != kr) {
+                    MACCAN_DEBUG_ERROR("+++ Unable to configure device #%i: %08x\n", index, kr);
+                    (void)(*usbDevice[index].ioDevice)->USBDeviceClose(usbDevice[index].ioDevice);
+                    LEAVE_CRITICAL_SECTION(index);
+                    MACCAN_DEBUG_FUNC("unlocked\n");
+                    return CANUSB_INVALID_HANDLE;
+                }
+                first = true;
             }
-            /* Get the interfaces */
-            kr = FindInterface(usbDevice[index].ioDevice, index);
+            /* Get the interface of the channel */
+            kr = FindInterface(usbDevice[index].ioDevice, index, (UInt32)channel);
             if (kIOReturnSuccess != kr) {
-                MACCAN_DEBUG_ERROR("+++ Unable to find interfaces on device #%i: %08x\n", index, kr);
-                (void)(*usbDevice[index].ioDevice)->USBDeviceClose(usbDevice[index].ioDevice);
-                usbDevice[index].usbInterface.fOpened = false;
+                MACCAN_DEBUG_ERROR("+++ Unable to find interface #%u on device #%i: %08x\n", channel, index, kr);
+                if (first)  /* note: a device in warm standby stays there */
+                    (void)(*usbDevice[index].ioDevice)->USBDeviceClose(usbDevice[index].ioDevice);
                 LEAVE_CRITICAL_SECTION(index);
                 MACCAN_DEBUG_FUNC("unlocked\n");
                 return CANUSB_INVALID_HANDLE;
             }
-            /* note: fOpened is true */
+            /* note: fOpened is true (and the device is no longer in warm standby) */
+            if (usbDevice[index].fStandby) {
+                usbDevice[index].fStandby = false;
+                (void)PerformOnRunLoop(ScheduleStandby, (void*)(intptr_t)index, false);
+            }
+            SET_OCCUPANCY(index, CANUSB_DEVICE_ATTACHED, GetTimestamp());
+            NEXT_REGISTRY();
         } else {
-            /* all CAN channels on the USB interface are opened */
+            /* the CAN channel on the USB interface is opened */
             LEAVE_CRITICAL_SECTION(index);
             MACCAN_DEBUG_FUNC("unlocked\n");
             return CANUSB_INVALID_HANDLE;
@@ -432,11 +888,62 @@ CANUSB_Handle_t CANUSB_OpenDevice(CANUSB_Index_t index, UInt16 vendorId, UInt16
     LEAVE_CRITICAL_SECTION(index);
     MACCAN_DEBUG_FUNC("unlocked\n");
 
-    /* the index is the handle! */
-    return (CANUSB_Handle_t)index;
+    /* the index tagged with the channel and its generation is the handle! */
+    return MAKE_HANDLE(index, channel, usbDevice[index].u32Generation[channel]);
+}
+
+CANUSB_Return_t CANUSB_OpenDevices(const CANUSB_Index_t *indexes, UInt32 count, UInt16 vendorId, UInt16 productId,
+                                   CANUSB_Handle_t *handles, CANUSB_Return_t *results) {
+    pthread_t threads[OPEN_MAX_THREADS];
+    pthread_attr_t attr;
+    USBOpenJob_t job;
+    UInt32 n = 0U, helpers, i;
+    int ret = CANUSB_SUCCESS;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if ((!indexes || !handles) && count)
+        return CANUSB_ERROR_NULLPTR;
+
+    /* note: each device has its own lock, so the devices can be opened concurrently
+     *       (the calling thread helps, so one device is opened without any thread) */
+    job.indexes = indexes;
+    job.count = count;
+    job.vendorId = vendorId;
+    job.productId = productId;
+    job.handles = handles;
+    job.results = results;
+    job.next = 0U;
+    helpers = (count > 1U) ? (((count - 1U) < OPEN_MAX_THREADS) ? (count - 1U) : OPEN_MAX_THREADS) : 0U;
+    if (helpers && (pthread_attr_init(&attr) == 0)) {
+        (void)pthread_attr_setstacksize(&attr, 64*1024);
+        while (n < helpers) {
+            if (pthread_create(&threads[n], &attr, OpenThread, (void*)&job) != 0)
+                break;  /* note: the remaining devices are opened by the other threads */
+            n++;
+        }
+        assert(pthread_attr_destroy(&attr) == 0);
+    }
+    (void)OpenThread((void*)&job);
+    for (i = 0U; i < n; i++)
+        (void)pthread_join(threads[i], NULL);
+
+    /* note: with per-device results the call itself succeeds (the caller checks each result) */
+    if (results)
+        return CANUSB_SUCCESS;
+    /* all devices opened? */
+    for (i = 0U; i < count; i++) {
+        if (handles[i] == CANUSB_INVALID_HANDLE)
+            ret = CANUSB_ERROR_RESOURCE;
+    }
+    return ret;
 }
 
 CANUSB_Return_t CANUSB_CloseDevice(CANUSB_Handle_t handle) {
+    Boolean last;
+    UInt32 channel;
     IOReturn kr;
     int ret = 0;
 
@@ -450,27 +957,48 @@ CANUSB_Return_t CANUSB_CloseDevice(CANUSB_Handle_t handle) {
     /* close the USB device */
     MACCAN_DEBUG_FUNC("lock #%i\n", handle);
     ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent) {
-        if (usbDevice[handle].usbInterface.fOpened) {
+    if (usbDevice[HANDLE_INDEX(handle)].fPresent && IS_HANDLE_CURRENT(handle)) {
+        /* note: the device is closed with its last opened channel */
+        last = (OpenedChannels(HANDLE_INDEX(handle)) == 1U) ? true : false;
+        if (USB_INTERFACE(handle).fOpened && last && __atomic_load_n(&warmStandby, __ATOMIC_RELAXED) &&
+            AbortInterface(HANDLE_INDEX(handle), HANDLE_CHANNEL(handle)) &&
+            ArmStandby(HANDLE_INDEX(handle))) {
+            /* the USB interface stays opened for a warm re-open within the grace period (but the handle is stale)
+             * note: its transfers have been aborted; if they could not be reaped, the interface is closed for real */
+            BEGIN_PROPERTIES(HANDLE_INDEX(handle));
+            USB_INTERFACE(handle).fOpened = false;
+            USB_INTERFACE(handle).cbkDeviceRemoved = NULL;
+            USB_INTERFACE(handle).refDeviceRemoved = NULL;
+            usbDevice[HANDLE_INDEX(handle)].fStandby = true;
+            NEXT_GENERATION(HANDLE_INDEX(handle), HANDLE_CHANNEL(handle));
+            END_PROPERTIES(HANDLE_INDEX(handle));
+            SET_OCCUPANCY(HANDLE_INDEX(handle), CANUSB_DEVICE_AVAILABLE, GetTimestamp());
+            NEXT_REGISTRY();
+        } else if (USB_INTERFACE(handle).fOpened) {
             /* close the USB interface interface(s) */
-            if (usbDevice[handle].usbInterface.ioInterface) {
+            if (USB_INTERFACE(handle).ioInterface) {
                 MACCAN_DEBUG_CODE(0, "close and release I/O interface\n");
-                kr = (*usbDevice[handle].usbInterface.ioInterface)->USBInterfaceClose(usbDevice[handle].usbInterface.ioInterface);
+                kr = (*USB_INTERFACE(handle).ioInterface)->USBInterfaceClose(USB_INTERFACE(handle).ioInterface);
                 if (kIOReturnSuccess != kr) {
                     MACCAN_DEBUG_ERROR("+++ Unable to close I/O interface of device #%i: %08x\n", handle, kr);
                     // TODO: how to handle this?
                 }
-                kr = (*usbDevice[handle].usbInterface.ioInterface)->Release(usbDevice[handle].usbInterface.ioInterface);
+                kr = (*USB_INTERFACE(handle).ioInterface)->Release(USB_INTERFACE(handle).ioInterface);
                 if (kIOReturnSuccess != kr) {
                     MACCAN_DEBUG_ERROR("+++ Unable to release I/O interface of device #%i: %08x\n", handle, kr);
                     // TODO: how to handle this?
                 }
-                usbDevice[handle].usbInterface.ioInterface = NULL;
+                USB_INTERFACE(handle).ioInterface = NULL;
             }
-            /* Close the task�s connection to the device */
-            if (usbDevice[handle].ioDevice) {
+            /* Close the task�s connection to the device (with its last channel) */
+            if (last && usbDevice[HANDLE_INDEX(handle)].ioDevice) {
+                /* and the interfaces kept from a warm standby */
+                for (channel = 0U; channel < USB_MAX_INTERFACES; channel++) {
+                    if (!usbDevice[HANDLE_INDEX(handle)].usbInterface[channel].fOpened)
+                        ReleaseInterface(HANDLE_INDEX(handle), channel);
+                }
                 MACCAN_DEBUG_CODE(0, "close I/O device\n");
-                kr = (*usbDevice[handle].ioDevice)->USBDeviceClose(usbDevice[handle].ioDevice);
+                kr = (*usbDevice[HANDLE_INDEX(handle)].ioDevice)->USBDeviceClose(usbDevice[HANDLE_INDEX(handle)].ioDevice);
                 if (kIOReturnSuccess != kr) {
                     MACCAN_DEBUG_ERROR("+++ Unable to close I/O device #%i: %08x\n", handle, kr);
                     LEAVE_CRITICAL_SECTION(handle);
@@ -478,8 +1006,16 @@ CANUSB_Return_t CANUSB_CloseDevice(CANUSB_Handle_t handle) {
                     return CANUSB_ERROR_RESOURCE;
                 }
             }
-            /* the USB interface is now closed */
-            usbDevice[handle].usbInterface.fOpened = false;
+            /* the USB interface is now closed (and the handle is stale) */
+            BEGIN_PROPERTIES(HANDLE_INDEX(handle));
+            USB_INTERFACE(handle).fOpened = false;
+            USB_INTERFACE(handle).cbkDeviceRemoved = NULL;
+            USB_INTERFACE(handle).refDeviceRemoved = NULL;
+            NEXT_GENERATION(HANDLE_INDEX(handle), HANDLE_CHANNEL(handle));
+            END_PROPERTIES(HANDLE_INDEX(handle));
+            if (last)
+                SET_OCCUPANCY(HANDLE_INDEX(handle), CANUSB_DEVICE_AVAILABLE, GetTimestamp());
+            NEXT_REGISTRY();
         } else {
             /* the USB interface is not opened */
             ret = CANUSB_ERROR_NOTINIT;
@@ -505,14 +1041,15 @@ CANUSB_Return_t CANUSB_RegisterDetachedCallback(CANUSB_Handle_t handle, CANUSB_D
 
     MACCAN_DEBUG_FUNC("lock #%i\n", handle);
     ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-        usbDevice[handle].usbInterface.cbkDeviceRemoved = callback;
-        usbDevice[handle].usbInterface.refDeviceRemoved = context;
+    if (usbDevice[HANDLE_INDEX(handle)].fPresent &&
+        (USB_INTERFACE(handle).fOpened) &&
+        IS_HANDLE_CURRENT(handle) &&
+        (USB_INTERFACE(handle).ioInterface != NULL)) {
+        USB_INTERFACE(handle).cbkDeviceRemoved = callback;
+        USB_INTERFACE(handle).refDeviceRemoved = context;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (RegisterDetachedCallback)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !usbDevice[HANDLE_INDEX(handle)].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
     LEAVE_CRITICAL_SECTION(handle);
     MACCAN_DEBUG_FUNC("unlocked\n");
@@ -520,6 +1057,8 @@ CANUSB_Return_t CANUSB_RegisterDetachedCallback(CANUSB_Handle_t handle, CANUSB_D
 }
 
 CANUSB_Return_t CANUSB_ReadPipe(CANUSB_Handle_t handle, UInt8 pipeRef, void *buffer, UInt32 *size, UInt16 timeout) {
+    IOUSBInterfaceInterface **interface = NULL;
+    UInt32 requested;
     IOReturn kr;
     int ret = 0;
 #if (OPTION_MACCAN_PIPE_TIMEOUT == 0)
@@ -538,37 +1077,49 @@ CANUSB_Return_t CANUSB_ReadPipe(CANUSB_Handle_t handle, UInt8 pipeRef, void *buf
     if (!buffer || !size)
         return CANUSB_ERROR_NULLPTR;
 
+    /* note: the blocking read holds a reference to the interface, but not the device lock,
+     *       so a close or an unplug is not stalled by a waiting reader (it aborts the read) */
     MACCAN_DEBUG_FUNC("lock #%i (%u)\n", handle, pipeRef);
-    ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-#if (OPTION_MACCAN_PIPE_TIMEOUT == 0)
-        /* note: deactivate define if ReadPipeTO() is not available in IOUSBInterfaceStructXYZ for the device. */
-        kr = (*usbDevice[handle].usbInterface.ioInterface)->ReadPipe(usbDevice[handle].usbInterface.ioInterface,
-                                                                     pipeRef, buffer, size);
-#else
-        if (timeout)
-            kr = (*usbDevice[handle].usbInterface.ioInterface)->ReadPipeTO(usbDevice[handle].usbInterface.ioInterface,
-                                                                           pipeRef, buffer, size,
-                                                                           noDataTimeout, completionTimeout);
-        else
-            kr = (*usbDevice[handle].usbInterface.ioInterface)->ReadPipe(usbDevice[handle].usbInterface.ioInterface,
-                                                                         pipeRef, buffer, size);
-#endif
-        if (kIOReturnSuccess != kr) {
-            MACCAN_DEBUG_ERROR("+++ Unable to read pipe #%d (%08x)\n", pipeRef, kr);
-            LEAVE_CRITICAL_SECTION(handle);
-            MACCAN_DEBUG_FUNC("unlocked\n");
-            return (kIOUSBTransactionTimeout != kr) ? CANUSB_ERROR_RESOURCE : CANUSB_ERROR_TIMEOUT;
-        }
+    ENTER_SHARED_SECTION(handle);
+    if (usbDevice[HANDLE_INDEX(handle)].fPresent &&
+        (USB_INTERFACE(handle).fOpened) &&
+        IS_HANDLE_CURRENT(handle) &&
+        (USB_INTERFACE(handle).ioInterface != NULL)) {
+        interface = USB_INTERFACE(handle).ioInterface;
+        (void)(*interface)->AddRef(interface);
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (ReadPipe)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !usbDevice[HANDLE_INDEX(handle)].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
-    LEAVE_CRITICAL_SECTION(handle);
+    LEAVE_SHARED_SECTION(handle);
     MACCAN_DEBUG_FUNC("unlocked\n");
-    return ret;
+    if (!interface)
+        return ret;
+
+    ENTER_ENDPOINT_SECTION(handle, pipeRef);
+    requested = *size;
+#if (OPTION_MACCAN_PIPE_TIMEOUT == 0)
+    /* note: deactivate define if ReadPipeTO() is not available in IOUSBInterfaceStructXYZ for the device. */
+    kr = (*interface)->ReadPipe(interface, pipeRef, buffer, size);
+#else
+    if (timeout)
+        kr = (*interface)->ReadPipeTO(interface, pipeRef, buffer, size, noDataTimeout, completionTimeout);
+    else
+        kr = (*interface)->ReadPipe(interface, pipeRef, buffer, size);
+#endif
+    ENTER_STATS_SECTION(handle);
+    UpdateStats(&usbDevice[HANDLE_INDEX(handle)].stats[HANDLE_CHANNEL(handle)], kr, *size, requested);
+    LEAVE_STATS_SECTION(handle);
+    LEAVE_ENDPOINT_SECTION(handle, pipeRef);
+    (void)(*interface)->Release(interface);
+    if (kIOReturnSuccess != kr) {
+        MACCAN_DEBUG_ERROR("+++ Unable to read pipe #%d (%08x)\n", pipeRef, kr);
+        return (kIOUSBTransactionTimeout != kr) ? CANUSB_ERROR_RESOURCE : CANUSB_ERROR_TIMEOUT;
+    }
+    /* the channel has been closed or the device removed meanwhile */
+    if (!IS_HANDLE_VALID(handle))
+        return CANUSB_ERROR_HANDLE;
+    return CANUSB_SUCCESS;
 }
 
 CANUSB_Return_t CANUSB_WritePipe(CANUSB_Handle_t handle, UInt8 pipeRef, const void *buffer, UInt32 size, UInt16 timeout) {
@@ -591,42 +1142,51 @@ CANUSB_Return_t CANUSB_WritePipe(CANUSB_Handle_t handle, UInt8 pipeRef, const vo
         return CANUSB_ERROR_NULLPTR;
 
     MACCAN_DEBUG_FUNC("lock #%i (%u)\n", handle, pipeRef);
-    ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-        kr = (*usbDevice[handle].usbInterface.ioInterface)->GetPipeStatus(usbDevice[handle].usbInterface.ioInterface,
+    ENTER_SHARED_SECTION(handle);
+    ENTER_ENDPOINT_SECTION(handle, pipeRef);
+    if (usbDevice[HANDLE_INDEX(handle)].fPresent &&
+        (USB_INTERFACE(handle).fOpened) &&
+        IS_HANDLE_CURRENT(handle) &&
+        (USB_INTERFACE(handle).ioInterface != NULL)) {
+        kr = (*USB_INTERFACE(handle).ioInterface)->GetPipeStatus(USB_INTERFACE(handle).ioInterface,
                                                                           pipeRef);
         if (kIOReturnSuccess != kr) {
             MACCAN_DEBUG_ERROR("+++ Unable to get status of pipe #%d (%08x)\n", pipeRef, kr);
-            LEAVE_CRITICAL_SECTION(handle);
+            LEAVE_ENDPOINT_SECTION(handle, pipeRef);
+            LEAVE_SHARED_SECTION(handle);
             MACCAN_DEBUG_FUNC("unlocked\n");
             return (kIOUSBPipeStalled != kr) ? CANUSB_ERROR_RESOURCE : CANUSB_ERROR_STALLED;
         }
 #if (OPTION_MACCAN_PIPE_TIMEOUT == 0)
         /* note: deactivate define if WritePipeTO() is not available in IOUSBInterfaceStructXYZ for the device. */
-        kr = (*usbDevice[handle].usbInterface.ioInterface)->WritePipe(usbDevice[handle].usbInterface.ioInterface,
+        kr = (*USB_INTERFACE(handle).ioInterface)->WritePipe(USB_INTERFACE(handle).ioInterface,
                                                                       pipeRef, (void*)buffer, size);
 #else
         if (timeout)
-            kr = (*usbDevice[handle].usbInterface.ioInterface)->WritePipeTO(usbDevice[handle].usbInterface.ioInterface,
+            kr = (*USB_INTERFACE(handle).ioInterface)->WritePipeTO(USB_INTERFACE(handle).ioInterface,
                                                                             pipeRef, (void*)buffer, size,
                                                                             noDataTimeout, completionTimeout);
         else
-            kr = (*usbDevice[handle].usbInterface.ioInterface)->WritePipe(usbDevice[handle].usbInterface.ioInterface,
+            kr = (*USB_INTERFACE(handle).ioInterface)->WritePipe(USB_INTERFACE(handle).ioInterface,
                                                                           pipeRef, (void*)buffer, size);
 #endif
+        /* note: WritePipe() transfers all or nothing */
+        ENTER_STATS_SECTION(handle);
+        UpdateStats(&usbDevice[HANDLE_INDEX(handle)].stats[HANDLE_CHANNEL(handle)], kr, size, size);
+        LEAVE_STATS_SECTION(handle);
         if (kIOReturnSuccess != kr) {
             MACCAN_DEBUG_ERROR("+++ Unable to write pipe #%d (%08x)\n", pipeRef, kr);
-            LEAVE_CRITICAL_SECTION(handle);
+            LEAVE_ENDPOINT_SECTION(handle, pipeRef);
+            LEAVE_SHARED_SECTION(handle);
             MACCAN_DEBUG_FUNC("unlocked\n");
             return (kIOUSBTransactionTimeout != kr) ? CANUSB_ERROR_RESOURCE : CANUSB_ERROR_TIMEOUT;
         }
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (WritePipe)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !usbDevice[HANDLE_INDEX(handle)].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
-    LEAVE_CRITICAL_SECTION(handle);
+    LEAVE_ENDPOINT_SECTION(handle, pipeRef);
+    LEAVE_SHARED_SECTION(handle);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
@@ -643,50 +1203,82 @@ CANUSB_Return_t CANUSB_ResetPipe(CANUSB_Handle_t handle, UInt8 pipeRef) {
         return CANUSB_ERROR_HANDLE;
 
     MACCAN_DEBUG_FUNC("lock #%i (%u)\n", handle, pipeRef);
-    ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-        kr = (*usbDevice[handle].usbInterface.ioInterface)->AbortPipe(usbDevice[handle].usbInterface.ioInterface,
+    ENTER_SHARED_SECTION(handle);
+    if (usbDevice[HANDLE_INDEX(handle)].fPresent &&
+        (USB_INTERFACE(handle).fOpened) &&
+        IS_HANDLE_CURRENT(handle) &&
+        (USB_INTERFACE(handle).ioInterface != NULL)) {
+        kr = (*USB_INTERFACE(handle).ioInterface)->AbortPipe(USB_INTERFACE(handle).ioInterface,
                                                                       pipeRef);
         if (kIOReturnSuccess != kr) {
             MACCAN_DEBUG_ERROR("+++ Unable to abort pipe #%d (%08x)\n", pipeRef, kr);
-            LEAVE_CRITICAL_SECTION(handle);
+            LEAVE_SHARED_SECTION(handle);
             MACCAN_DEBUG_FUNC("unlocked\n");
             return CANUSB_ERROR_RESOURCE;
         }
 #if (OPTION_MACCAN_CLEAR_BOTH_ENDS == 0)
-        kr = (*usbDevice[handle].usbInterface.ioInterface)->ClearPipeStall(usbDevice[handle].usbInterface.ioInterface,
+        kr = (*USB_INTERFACE(handle).ioInterface)->ClearPipeStall(USB_INTERFACE(handle).ioInterface,
                                                                            pipeRef);
 #else
-        kr = (*usbDevice[handle].usbInterface.ioInterface)->ClearPipeStallBothEnds(usbDevice[handle].usbInterface.ioInterface,
+        kr = (*USB_INTERFACE(handle).ioInterface)->ClearPipeStallBothEnds(USB_INTERFACE(handle).ioInterface,
                                                                                    pipeRef);
 #endif
         if (kIOReturnSuccess != kr) {
             MACCAN_DEBUG_ERROR("+++ Unable to clear pipe #%d (%08x)\n", pipeRef, kr);
-            LEAVE_CRITICAL_SECTION(handle);
+            LEAVE_SHARED_SECTION(handle);
             MACCAN_DEBUG_FUNC("unlocked\n");
             return CANUSB_ERROR_RESOURCE;
         }
-        kr = (*usbDevice[handle].usbInterface.ioInterface)->GetPipeStatus(usbDevice[handle].usbInterface.ioInterface,
+        kr = (*USB_INTERFACE(handle).ioInterface)->GetPipeStatus(USB_INTERFACE(handle).ioInterface,
                                                                           pipeRef);
         if (kIOReturnSuccess != kr) {
             MACCAN_DEBUG_ERROR("+++ Unable to get status of pipe #%d (%08x)\n", pipeRef, kr);
-            LEAVE_CRITICAL_SECTION(handle);
+            LEAVE_SHARED_SECTION(handle);
             MACCAN_DEBUG_FUNC("unlocked\n");
             return CANUSB_ERROR_RESOURCE;
         }
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (ResetPipe)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !usbDevice[HANDLE_INDEX(handle)].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
-    LEAVE_CRITICAL_SECTION(handle);
+    LEAVE_SHARED_SECTION(handle);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
+CANUSB_Return_t CANUSB_GetDeviceStats(CANUSB_Handle_t handle, CANUSB_PipeStats_t *stats, Boolean reset) {
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(handle))
+        return CANUSB_ERROR_HANDLE;
+    /* check for NULL pointer */
+    if (!stats)
+        return CANUSB_ERROR_NULLPTR;
+
+    /* statistics of the synchronous pipe transfers of the device */
+    MACCAN_DEBUG_FUNC("lock #%i\n", handle);
+    ENTER_STATS_SECTION(handle);
+    memcpy(stats, &usbDevice[HANDLE_INDEX(handle)].stats[HANDLE_CHANNEL(handle)], sizeof(CANUSB_PipeStats_t));
+    if (reset)
+        bzero(&usbDevice[HANDLE_INDEX(handle)].stats[HANDLE_CHANNEL(handle)], sizeof(CANUSB_PipeStats_t));
+    LEAVE_STATS_SECTION(handle);
+    MACCAN_DEBUG_FUNC("unlocked\n");
+    return CANUSB_SUCCESS;
+}
+
 CANUSB_AsyncPipe_t CANUSB_CreatePipeAsync(CANUSB_Handle_t handle, UInt8 pipeRef, size_t bufferSize, Boolean doubleBuffer) {
+    /* note: a double buffer is a queue depth of two transfers */
+    return CANUSB_CreatePipeAsyncEx(handle, pipeRef, bufferSize, doubleBuffer ? 2U : 1U);
+}
+
+CANUSB_AsyncPipe_t CANUSB_CreatePipeAsyncEx(CANUSB_Handle_t handle, UInt8 pipeRef, size_t bufferSize, UInt32 queueDepth) {
     CANUSB_AsyncPipe_t asyncPipe = NULL;
+    UInt8 number, transferType, interval;
+    UInt32 index;
+    IOReturn kr;
 
     /* must be initialized */
     if (!fInitialized)
@@ -694,6 +1286,9 @@ CANUSB_AsyncPipe_t CANUSB_CreatePipeAsync(CANUSB_Handle_t handle, UInt8 pipeRef,
     /* must be a valid handle */
     if (!IS_HANDLE_VALID(handle))
         return NULL;
+    /* check the queue depth */
+    if ((queueDepth < 1U) || (CANUSB_MAX_QUEUE_DEPTH < queueDepth))
+        return NULL;
 
     /* create asynchronous pipe context */
     if ((asyncPipe = (CANUSB_AsyncPipe_t)malloc(sizeof(struct usb_async_pipe_tag))) == NULL) {
@@ -702,40 +1297,57 @@ CANUSB_AsyncPipe_t CANUSB_CreatePipeAsync(CANUSB_Handle_t handle, UInt8 pipeRef,
     }
     bzero(asyncPipe, sizeof(struct usb_async_pipe_tag));
     asyncPipe->handle = CANUSB_INVALID_HANDLE;
-    /* create buffer for USB data transfer */
-    if (doubleBuffer) {
-        MACCAN_DEBUG_CORE("        - Double buffer each of size %u bytes for pipe #%u\n", bufferSize, pipeRef);
-        if ((asyncPipe->buffer.data[0] = malloc(bufferSize)) &&
-            (asyncPipe->buffer.data[1] = malloc(bufferSize))) {
-            asyncPipe->buffer.size = (UInt32)bufferSize;
-            asyncPipe->callback = NULL;
-            asyncPipe->context = NULL;
-            asyncPipe->pipeRef = pipeRef;
-            asyncPipe->handle = handle;
-        } else {
-            MACCAN_DEBUG_ERROR("+++ Unable to create double buffer (2 * %u bytes) for pipe #%u\n", bufferSize, pipeRef);
-            free(asyncPipe);
-            asyncPipe = NULL;
+    /* create the transfers and their buffers for USB data transfer (one block) */
+    MACCAN_DEBUG_CORE("        - %u buffer(s) each of size %u bytes for pipe #%u\n", queueDepth, bufferSize, pipeRef);
+    if ((asyncPipe->buffer.transfer = (CANUSB_Transfer_t*)calloc(queueDepth, sizeof(CANUSB_Transfer_t))) &&
+        (asyncPipe->buffer.block = (UInt8*)malloc(bufferSize * queueDepth))) {
+        for (index = 0U; index < queueDepth; index++) {
+            asyncPipe->buffer.transfer[index].asyncPipe = asyncPipe;
+            asyncPipe->buffer.transfer[index].data = &asyncPipe->buffer.block[bufferSize * index];
+            asyncPipe->buffer.transfer[index].index = index;
         }
+        asyncPipe->buffer.depth = queueDepth;
+        asyncPipe->buffer.index = 0U;
+        asyncPipe->buffer.size = (UInt32)bufferSize;
+        asyncPipe->callback = NULL;
+        asyncPipe->context = NULL;
+        asyncPipe->pipeRef = pipeRef;
+        asyncPipe->handle = handle;
+        assert(0 == pthread_mutex_init(&asyncPipe->ptMutex, NULL));
     } else {
-        MACCAN_DEBUG_CORE("        - Single buffer of size %u bytes for pipe #%u\n", bufferSize, pipeRef);
-        if ((asyncPipe->buffer.data[0] = malloc(bufferSize))) {
-            asyncPipe->buffer.size = (UInt32)bufferSize;
-            asyncPipe->buffer.data[1] = NULL;
-            asyncPipe->callback = NULL;
-            asyncPipe->context = NULL;
-            asyncPipe->pipeRef = pipeRef;
-            asyncPipe->handle = handle;
-        } else {
-            MACCAN_DEBUG_ERROR("+++ Unable to create single buffer (1 * %u bytes) for pipe #%u\n", bufferSize, pipeRef);
-            free(asyncPipe);
-            asyncPipe = NULL;
+        MACCAN_DEBUG_ERROR("+++ Unable to create buffers (%u * %u bytes) for pipe #%u\n", queueDepth, bufferSize, pipeRef);
+        if (asyncPipe->buffer.transfer)
+            free(asyncPipe->buffer.transfer);
+        free(asyncPipe);
+        return NULL;
+    }
+    /* get direction and max. packet size of the pipe (if available) */
+    MACCAN_DEBUG_FUNC("lock #%i (%u)\n", handle, pipeRef);
+    ENTER_SHARED_SECTION(handle);
+    asyncPipe->direction = USBPIPE_DIR_NONE;
+    if (usbDevice[HANDLE_INDEX(handle)].fPresent &&
+        (USB_INTERFACE(handle).fOpened) &&
+        IS_HANDLE_CURRENT(handle) &&
+        (USB_INTERFACE(handle).ioInterface != NULL)) {
+        kr = (*USB_INTERFACE(handle).ioInterface)->GetPipeProperties(USB_INTERFACE(handle).ioInterface,
+                                                                              pipeRef, &asyncPipe->direction, &number,
+                                                                              &transferType, &asyncPipe->maxPacketSize, &interval);
+        if (kIOReturnSuccess != kr) {
+            MACCAN_DEBUG_ERROR("+++ Unable to get properties of pipe #%u (%08x)\n", pipeRef, kr);
+            asyncPipe->direction = USBPIPE_DIR_NONE;
+            asyncPipe->maxPacketSize = 0U;
         }
+        /* note: the callbacks use the interface without lock, it lives as long as the pipe */
+        asyncPipe->ioInterface = USB_INTERFACE(handle).ioInterface;
+        (void)(*asyncPipe->ioInterface)->AddRef(asyncPipe->ioInterface);
     }
+    LEAVE_SHARED_SECTION(handle);
+    MACCAN_DEBUG_FUNC("unlocked\n");
     return asyncPipe;
 }
 
 CANUSB_Return_t CANUSB_DestroyPipeAsync(CANUSB_AsyncPipe_t asyncPipe) {
+    Boolean pending;
 
     /* must be initialized */
     if (!fInitialized)
@@ -743,98 +1355,211 @@ CANUSB_Return_t CANUSB_DestroyPipeAsync(CANUSB_AsyncPipe_t asyncPipe) {
     /* check for NULL pointer */
     if (!asyncPipe)
         return CANUSB_ERROR_NULLPTR;
-    /* must be a valid handle */
-    if (!IS_HANDLE_VALID(asyncPipe->handle))
+    /* must be a valid index (note: the pipe may outlive its handle) */
+    if (!IS_INDEX_VALID(HANDLE_INDEX(asyncPipe->handle)))
+        return CANUSB_ERROR_HANDLE;
+    /* from now on the callbacks of the pipe are dropped and nothing is re-armed */
+    ENTER_PIPE_SECTION(asyncPipe);
+    if (asyncPipe->destroyed) {
+        LEAVE_PIPE_SECTION(asyncPipe);
         return CANUSB_ERROR_HANDLE;
-    /* if running then abort */
-    if (asyncPipe->running)
-        (void)CANUSB_AbortPipeAsync(asyncPipe);
+    }
+    pending = (asyncPipe->running || IsPipeAsyncPending(asyncPipe)) ? true : false;
+    asyncPipe->destroyed = true;
+    asyncPipe->running = false;
+    LEAVE_PIPE_SECTION(asyncPipe);
+    /* if running or transfers in flight then abort (through the pipe's own interface reference, the handle may be stale) */
+    if (pending && asyncPipe->ioInterface)
+        (void)(*asyncPipe->ioInterface)->AbortPipe(asyncPipe->ioInterface, asyncPipe->pipeRef);
 
     MACCAN_DEBUG_CORE("    %8" PRIu64 " notification(s) of pipe #%u serviced\n", asyncPipe->serviced, asyncPipe->pipeRef);
-    /* free buffer(s) and asynchronous pipe context */
-    if (asyncPipe->buffer.data[1])
-        free(asyncPipe->buffer.data[1]);
-    if (asyncPipe->buffer.data[0])
-        free(asyncPipe->buffer.data[0]);
-    free(asyncPipe);
-
+    /* release the timers on the run loop, the pipe is freed there or by its last (aborted) completion
+     * note: the worker thread itself (a callback destroying its pipe) defers it to the next pass of the run loop */
+    if (!PerformOnRunLoop(ReleasePipeAsync, (void*)asyncPipe, pthread_equal(pthread_self(), usbDriver.ptThread) ? false : true)) {
+        MACCAN_DEBUG_ERROR("+++ Unable to release pipe #%u (run loop)\n", asyncPipe->pipeRef);
+        return CANUSB_ERROR_RESOURCE;
+    }
     return CANUSB_SUCCESS;
 }
 
+static void ReleasePipeAsync(void *info) {
+    CANUSB_AsyncPipe_t asyncPipe = (CANUSB_AsyncPipe_t)info;
+    Boolean idle;
+
+    /* note: performed on the run loop, so no callback and no timer of the pipe is running meanwhile */
+    ENTER_PIPE_SECTION(asyncPipe);
+    if (asyncPipe->coalescing.timer) {
+        CFRunLoopTimerInvalidate(asyncPipe->coalescing.timer);
+        CFRelease(asyncPipe->coalescing.timer);
+        asyncPipe->coalescing.timer = NULL;
+    }
+    if (asyncPipe->recovery.timer) {
+        CFRunLoopTimerInvalidate(asyncPipe->recovery.timer);
+        CFRelease(asyncPipe->recovery.timer);
+        asyncPipe->recovery.timer = NULL;
+    }
+    if (asyncPipe->watchdog.timer) {
+        CFRunLoopTimerInvalidate(asyncPipe->watchdog.timer);
+        CFRelease(asyncPipe->watchdog.timer);
+        asyncPipe->watchdog.timer = NULL;
+    }
+    asyncPipe->released = true;
+    idle = !IsPipeAsyncPending(asyncPipe);
+    LEAVE_PIPE_SECTION(asyncPipe);
+    /* free the pipe unless there are aborted transfers to be completed */
+    if (idle)
+        FreePipeAsync(asyncPipe);
+}
+
+static Boolean CompleteDestroyedPipe(CANUSB_AsyncPipe_t asyncPipe) {
+    Boolean idle;
+
+    /* note: called within the pipe's critical section, which is left if the pipe has been destroyed */
+    if (!asyncPipe->destroyed)
+        return false;
+    idle = (asyncPipe->released && !IsPipeAsyncPending(asyncPipe)) ? true : false;
+    LEAVE_PIPE_SECTION(asyncPipe);
+    /* the last completion frees the pipe (once its timers are released) */
+    if (idle)
+        FreePipeAsync(asyncPipe);
+    return true;
+}
+
+static void FreePipeAsync(CANUSB_AsyncPipe_t asyncPipe) {
+    /* free buffers, transfers and asynchronous pipe context */
+    if (asyncPipe->buffer.block)
+        free(asyncPipe->buffer.block);
+    if (asyncPipe->buffer.transfer)
+        free(asyncPipe->buffer.transfer);
+    if (asyncPipe->lending.block)
+        free(asyncPipe->lending.block);
+    if (asyncPipe->lending.pool)
+        free(asyncPipe->lending.pool);
+    if (asyncPipe->ioInterface)
+        (void)(*asyncPipe->ioInterface)->Release(asyncPipe->ioInterface);
+    assert(0 == pthread_mutex_destroy(&asyncPipe->ptMutex));
+    free(asyncPipe);
+}
+
 static void ReadPipeCallback(void *refCon, IOReturn result, void *arg0) {
-    CANUSB_AsyncPipe_t asyncPipe = (CANUSB_AsyncPipe_t)refCon;
+    UInt64 timestamp = GetTimestamp();  /* note: as close to the completion as possible */
+    CANUSB_Transfer_t *transfer = (CANUSB_Transfer_t*)refCon;
+    CANUSB_AsyncPipe_t asyncPipe = (transfer) ? transfer->asyncPipe : NULL;
     UInt64 length = (arg0) ? (UInt64)arg0 : 0U;
-    UInt8 *buffer, index;
+    CANUSB_AsyncPipeCbk_t callback;
+    CANUSB_AsyncPipeCbkEx_t callbackEx;
+    CANUSB_Context_t context;
+    Boolean coalescing;
+    UInt64 start;
     IOReturn kr;
+    int keep, number;
+
+    if (!asyncPipe) {
+        MACCAN_DEBUG_ERROR("+++ Error: read async pipe without context (%08x)\n", result);
+        return;
+    }
+    SUB_INFLIGHT(asyncPipe->handle);
+    /* the transfer has been completed (note: the ring is also re-armed by ReturnPipeBuffer from any thread) */
+    ENTER_PIPE_SECTION(asyncPipe);
+    transfer->pending = false;
+    if (CompleteDestroyedPipe(asyncPipe))
+        return;
+    transfer->completed = true;
+    transfer->result = result;
+    transfer->length = (UInt32)length;
+    transfer->timestamp = timestamp;
+    UpdateStats(&asyncPipe->stats, result, transfer->length, asyncPipe->buffer.size);
+    if (kIOReturnSuccess == result)
+        asyncPipe->watchdog.lastActivity = timestamp;
 
     switch (result)
     {
     case kIOReturnSuccess:
-        if (asyncPipe) {
-            asyncPipe->serviced++;
-            /* sanity check */
-            if (!IS_HANDLE_VALID(asyncPipe->handle)) {
-                asyncPipe->running = false;
-                return;
-            }
-            if (!usbDevice[asyncPipe->handle].usbInterface.ioInterface) {
-                asyncPipe->running = false;
-                return;
-            }
-            if (!asyncPipe->buffer.data[0] || !asyncPipe->buffer.data[1]) {
-                asyncPipe->running = false;
-                return;
-            }
-            if (asyncPipe->buffer.index >= 2) {
-                asyncPipe->running = false;
-                return;
-            }
-            /* double-buffer strategy */
-            index = asyncPipe->buffer.index;
-            buffer = asyncPipe->buffer.data[index];
-            asyncPipe->buffer.index = index ? 0 : 1;
-            /* preparation of the next asynchronous pipe read event (with our pipe context as reference, 6th argument) */
-            kr = (*usbDevice[asyncPipe->handle].usbInterface.ioInterface)->ReadPipeAsync(usbDevice[asyncPipe->handle].usbInterface.ioInterface,
-                                                                                         asyncPipe->pipeRef,
-                                                                                         asyncPipe->buffer.data[asyncPipe->buffer.index],
-                                                                                         asyncPipe->buffer.size,
-                                                                                         ReadPipeCallback,
-                                                                                         (void *)asyncPipe);
-            if (kIOReturnSuccess != kr) {
-                MACCAN_DEBUG_ERROR("+++ Unable to read async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
-                /* error: pipe is boken */
-                asyncPipe->running = false;
-            }
-            /* call the CALLBACK routine with the referenced pipe context */
-            if (asyncPipe->callback && length) {
-                (void)asyncPipe->callback(asyncPipe->context, buffer, (UInt32)length);
-            }
-        } else {
-            MACCAN_DEBUG_ERROR("+++ Error: read async pipe without context (%08x)\n", result);
-        }
         break;
     case kIOReturnAborted:
-        if (asyncPipe) {
-            MACCAN_DEBUG_CORE("!!! Aborted: read async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, result);
-            asyncPipe->running = false;
-        } else {
-            MACCAN_DEBUG_CORE("!!! Aborted: read async pipe without context (%08x)\n", result);
-        }
+        MACCAN_DEBUG_CORE("!!! Aborted: read async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, result);
+        asyncPipe->running = false;
         break;
     default:
-        if (asyncPipe) {
-            MACCAN_DEBUG_ERROR("+++ Error: read async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, result);
-            asyncPipe->running = false;
-        } else {
-            MACCAN_DEBUG_ERROR("+++ Error: read async pipe without context (%08x)\n", result);
-        }
+        MACCAN_DEBUG_ERROR("+++ Error: read async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, result);
+        asyncPipe->running = false;
+        ScheduleRecovery(asyncPipe, result, timestamp);
         break;
     }
+    /* deliver the completed transfers in the order of submission and re-arm them
+     * note: the transfers are re-armed in the same order (ring of transfers), so
+     *       the oldest outstanding transfer is always at the delivery index.
+     */
+    while ((transfer = &asyncPipe->buffer.transfer[asyncPipe->buffer.index])->completed) {
+        transfer->completed = false;
+        asyncPipe->buffer.index = (asyncPipe->buffer.index + 1U) % asyncPipe->buffer.depth;
+        if (kIOReturnSuccess != transfer->result)
+            continue;
+        asyncPipe->serviced++;
+        /* vectored delivery: collect the transfer (it is re-armed after delivery) */
+        if (asyncPipe->coalescing.callback) {
+            asyncPipe->coalescing.batch[asyncPipe->coalescing.count++] = transfer;
+            continue;
+        }
+        keep = 0;
+        callback = asyncPipe->callback;
+        callbackEx = asyncPipe->callbackEx;
+        context = asyncPipe->context;
+        LEAVE_PIPE_SECTION(asyncPipe);
+        /* call the CALLBACK routine with the referenced pipe context (and the host time of completion)
+         * note: outside the pipe's critical section, the transfer is neither pending nor completed meanwhile */
+        start = GetTimestamp();
+        if (callbackEx && transfer->length) {
+            keep = callbackEx(context, transfer->data, transfer->length, transfer->timestamp);
+        } else if (callback && transfer->length) {
+            keep = callback(context, transfer->data, transfer->length);
+        }
+        ENTER_PIPE_SECTION(asyncPipe);
+        UpdateHistogram(asyncPipe->stats.callbackTime, GetTimestamp() - start);
+        /* the consumer keeps the buffer (if lending is enabled): replace it by a spare buffer */
+        if (keep && asyncPipe->lending.pool) {
+            asyncPipe->lending.lent++;
+            if ((number = GetBufferNumber(asyncPipe, transfer->data)) >= 0)
+                asyncPipe->lending.onLoan |= ((UInt64)1 << number);
+            transfer->data = (asyncPipe->lending.count) ? asyncPipe->lending.pool[--asyncPipe->lending.count] : NULL;
+        }
+        /* preparation of the next asynchronous pipe read event on the same transfer (other transfers are still in flight) */
+        if (asyncPipe->running) {
+            if (asyncPipe->lending.parked || !transfer->data) {
+                /* note: no spare buffer available, the transfer (and all after it) is re-armed on return of a buffer */
+                if (!asyncPipe->lending.parked)
+                    asyncPipe->lending.first = transfer->index;
+                asyncPipe->lending.parked++;
+            } else {
+                kr = SubmitRead(transfer);
+                if (kIOReturnSuccess != kr) {
+                    MACCAN_DEBUG_ERROR("+++ Unable to read async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
+                    /* error: pipe is boken */
+                    asyncPipe->running = false;
+                    ScheduleRecovery(asyncPipe, kr, GetTimestamp());
+                }
+            }
+        }
+    }
+    coalescing = (asyncPipe->coalescing.callback) ? true : false;
+    LEAVE_PIPE_SECTION(asyncPipe);
+    /* vectored delivery: deliver the collected transfers (if due) */
+    if (coalescing)
+        DeliverPipeVector(asyncPipe, false);
     return;
 }
 
 CANUSB_Return_t CANUSB_ReadPipeAsync(CANUSB_AsyncPipe_t asyncPipe, CANUSB_AsyncPipeCbk_t callback, CANUSB_Context_t context) {
+    return StartReadPipe(asyncPipe, callback, NULL, context);
+}
+
+CANUSB_Return_t CANUSB_ReadPipeAsyncEx(CANUSB_AsyncPipe_t asyncPipe, CANUSB_AsyncPipeCbkEx_t callback, CANUSB_Context_t context) {
+    return StartReadPipe(asyncPipe, NULL, callback, context);
+}
+
+static CANUSB_Return_t StartReadPipe(CANUSB_AsyncPipe_t asyncPipe, CANUSB_AsyncPipeCbk_t callback, CANUSB_AsyncPipeCbkEx_t callbackEx, CANUSB_Context_t context) {
     IOReturn kr;
+    UInt32 index;
     int ret = 0;
 
     /* must be initialized */
@@ -842,51 +1567,348 @@ CANUSB_Return_t CANUSB_ReadPipeAsync(CANUSB_AsyncPipe_t asyncPipe, CANUSB_AsyncP
         return CANUSB_ERROR_NOTINIT;
     /* check for NULL pointer */
     if (!asyncPipe ||
-        !asyncPipe->buffer.data[0] ||
-        !asyncPipe->buffer.data[1])
+        !asyncPipe->buffer.transfer)
         return CANUSB_ERROR_NULLPTR;
     /* must be a valid handle */
     if (!IS_HANDLE_VALID(asyncPipe->handle))
         return CANUSB_ERROR_HANDLE;
 
     MACCAN_DEBUG_FUNC("lock #%i (%u)\n", asyncPipe->handle, asyncPipe->pipeRef);
-    ENTER_CRITICAL_SECTION(asyncPipe->handle);
-    if (asyncPipe->running) {
+    ENTER_SHARED_SECTION(asyncPipe->handle);
+    ENTER_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+    if (asyncPipe->running || IsPipeAsyncPending(asyncPipe)) {
         MACCAN_DEBUG_ERROR("+++ Async read of pipe #%d already started\n", asyncPipe->pipeRef);
-        LEAVE_CRITICAL_SECTION(asyncPipe->handle);
+        LEAVE_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+        LEAVE_SHARED_SECTION(asyncPipe->handle);
         MACCAN_DEBUG_FUNC("unlocked\n");
         return CANUSB_ERROR_RESOURCE;
     }
-    if (usbDevice[asyncPipe->handle].fPresent &&
-        (usbDevice[asyncPipe->handle].usbInterface.fOpened) &&
-        (usbDevice[asyncPipe->handle].usbInterface.ioInterface != NULL)) {
+    if (usbDevice[HANDLE_INDEX(asyncPipe->handle)].fPresent &&
+        (USB_INTERFACE(asyncPipe->handle).fOpened) &&
+        IS_HANDLE_CURRENT(asyncPipe->handle) &&
+        (USB_INTERFACE(asyncPipe->handle).ioInterface != NULL)) {
         /* register the callback function and the reception data context */
         asyncPipe->callback = callback;
+        asyncPipe->callbackEx = callbackEx;
         asyncPipe->context = context;
-        /* preparation of the first asynchronous pipe read event (with our pipe context as reference, 6th argument) */
-        kr = (*usbDevice[asyncPipe->handle].usbInterface.ioInterface)->ReadPipeAsync(usbDevice[asyncPipe->handle].usbInterface.ioInterface,
-                                                                                     asyncPipe->pipeRef,
-                                                                                     asyncPipe->buffer.data[asyncPipe->buffer.index],
-                                                                                     asyncPipe->buffer.size,
-                                                                                     ReadPipeCallback,
-                                                                                     (void*)asyncPipe);
-        if (kIOReturnSuccess != kr) {
-            MACCAN_DEBUG_ERROR("+++ Unable to start async read pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
-            LEAVE_CRITICAL_SECTION(asyncPipe->handle);
-            MACCAN_DEBUG_FUNC("unlocked\n");
-            return CANUSB_ERROR_RESOURCE;
+        /* transfers whose buffer is still lent need a spare buffer */
+        ENTER_PIPE_SECTION(asyncPipe);
+        asyncPipe->lending.parked = 0U;
+        asyncPipe->coalescing.count = 0U;
+        for (index = 0U; index < asyncPipe->buffer.depth; index++) {
+            if (!asyncPipe->buffer.transfer[index].data) {
+                if (!asyncPipe->lending.count) {
+                    MACCAN_DEBUG_ERROR("+++ No spare buffer for async read pipe #%d (%u lent)\n", asyncPipe->pipeRef, asyncPipe->lending.lent);
+                    LEAVE_PIPE_SECTION(asyncPipe);
+                    LEAVE_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+                    LEAVE_SHARED_SECTION(asyncPipe->handle);
+                    MACCAN_DEBUG_FUNC("unlocked\n");
+                    return CANUSB_ERROR_RESOURCE;
+                }
+                asyncPipe->buffer.transfer[index].data = asyncPipe->lending.pool[--asyncPipe->lending.count];
+            }
         }
-        /* asynchronous pipe read event armed */
+        /* preparation of the first asynchronous pipe read events (all transfers in the order of delivery)
+         * note: still within the pipe's critical section, SubmitRead updates the pipe's statistics */
+        asyncPipe->buffer.index = 0U;
         asyncPipe->running = true;
-    } else {
-        MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (ReadPipeAsync)\n", asyncPipe->handle);
-        ret = !usbDevice[asyncPipe->handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
-    }
-    LEAVE_CRITICAL_SECTION(asyncPipe->handle);
+        for (index = 0U; index < asyncPipe->buffer.depth; index++) {
+            asyncPipe->buffer.transfer[index].completed = false;
+            asyncPipe->buffer.transfer[index].timestamp = 0U;
+            kr = SubmitRead(&asyncPipe->buffer.transfer[index]);
+            if (kIOReturnSuccess != kr) {
+                MACCAN_DEBUG_ERROR("+++ Unable to start async read pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
+                /* note: the transfers already armed are aborted */
+                asyncPipe->running = false;
+                if (index)
+                    (void)(*USB_INTERFACE(asyncPipe->handle).ioInterface)->AbortPipe(USB_INTERFACE(asyncPipe->handle).ioInterface,
+                                                                                             asyncPipe->pipeRef);
+                LEAVE_PIPE_SECTION(asyncPipe);
+                LEAVE_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+                LEAVE_SHARED_SECTION(asyncPipe->handle);
+                MACCAN_DEBUG_FUNC("unlocked\n");
+                return CANUSB_ERROR_RESOURCE;
+            }
+        }
+        /* asynchronous pipe read events armed */
+        asyncPipe->recovery.reading = true;
+        LEAVE_PIPE_SECTION(asyncPipe);
+    } else {
+        MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (ReadPipeAsync)\n", asyncPipe->handle);
+        ret = !usbDevice[HANDLE_INDEX(asyncPipe->handle)].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+    }
+    LEAVE_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+    LEAVE_SHARED_SECTION(asyncPipe->handle);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
+CANUSB_Return_t CANUSB_SetPipeLending(CANUSB_AsyncPipe_t asyncPipe, UInt32 spareBuffers) {
+    UInt32 index;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!asyncPipe ||
+        !asyncPipe->buffer.transfer)
+        return CANUSB_ERROR_NULLPTR;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return CANUSB_ERROR_HANDLE;
+    /* check the number of spare buffers */
+    if (spareBuffers > CANUSB_MAX_QUEUE_DEPTH)
+        return CANUSB_ERROR_ILLPARA;
+
+    ENTER_PIPE_SECTION(asyncPipe);
+    /* note: not while the pipe is running or a buffer is lent to the consumer */
+    if (asyncPipe->running || IsPipeAsyncPending(asyncPipe) || asyncPipe->lending.lent) {
+        LEAVE_PIPE_SECTION(asyncPipe);
+        return CANUSB_ERROR_BUSY;
+    }
+    /* release the previous pool (if any) */
+    if (asyncPipe->lending.block)
+        free(asyncPipe->lending.block);
+    if (asyncPipe->lending.pool)
+        free(asyncPipe->lending.pool);
+    bzero(&asyncPipe->lending, sizeof(CANUSB_Lending_t));
+    /* create the pool of spare buffers (note: a returned buffer can be any of the pipe's buffers) */
+    if (spareBuffers) {
+        if (!(asyncPipe->lending.pool = (UInt8**)calloc(asyncPipe->buffer.depth + spareBuffers, sizeof(UInt8*))) ||
+            !(asyncPipe->lending.block = (UInt8*)malloc((size_t)asyncPipe->buffer.size * spareBuffers))) {
+            MACCAN_DEBUG_ERROR("+++ Unable to create %u spare buffer(s) for pipe #%u\n", spareBuffers, asyncPipe->pipeRef);
+            if (asyncPipe->lending.pool)
+                free(asyncPipe->lending.pool);
+            bzero(&asyncPipe->lending, sizeof(CANUSB_Lending_t));
+            LEAVE_PIPE_SECTION(asyncPipe);
+            return CANUSB_ERROR_RESOURCE;
+        }
+        for (index = 0U; index < spareBuffers; index++)
+            asyncPipe->lending.pool[index] = &asyncPipe->lending.block[(size_t)asyncPipe->buffer.size * index];
+        asyncPipe->lending.spares = spareBuffers;
+        asyncPipe->lending.count = spareBuffers;
+    }
+    LEAVE_PIPE_SECTION(asyncPipe);
+    return CANUSB_SUCCESS;
+}
+
+CANUSB_Return_t CANUSB_ReturnPipeBuffer(CANUSB_AsyncPipe_t asyncPipe, UInt8 *buffer) {
+    CANUSB_Transfer_t *transfer;
+    IOReturn kr;
+    int number;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!asyncPipe || !buffer)
+        return CANUSB_ERROR_NULLPTR;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return CANUSB_ERROR_HANDLE;
+
+    ENTER_PIPE_SECTION(asyncPipe);
+    /* must be a buffer of the pipe that is lent to the consumer (not returned yet, not armed) */
+    number = GetBufferNumber(asyncPipe, buffer);
+    if (!asyncPipe->lending.lent || (number < 0) ||
+        !(asyncPipe->lending.onLoan & ((UInt64)1 << number))) {
+        LEAVE_PIPE_SECTION(asyncPipe);
+        return CANUSB_ERROR_ILLPARA;
+    }
+    asyncPipe->lending.onLoan &= ~((UInt64)1 << number);
+    asyncPipe->lending.pool[asyncPipe->lending.count++] = buffer;
+    asyncPipe->lending.lent--;
+    /* re-arm the parked transfers in the order of delivery */
+    while (asyncPipe->lending.parked && asyncPipe->running) {
+        transfer = &asyncPipe->buffer.transfer[asyncPipe->lending.first];
+        if (!transfer->data) {
+            if (!asyncPipe->lending.count)
+                break;
+            transfer->data = asyncPipe->lending.pool[--asyncPipe->lending.count];
+        }
+        kr = SubmitRead(transfer);
+        if (kIOReturnSuccess != kr) {
+            MACCAN_DEBUG_ERROR("+++ Unable to read async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
+            asyncPipe->running = false;
+            break;
+        }
+        asyncPipe->lending.first = (asyncPipe->lending.first + 1U) % asyncPipe->buffer.depth;
+        asyncPipe->lending.parked--;
+    }
+    LEAVE_PIPE_SECTION(asyncPipe);
+    return CANUSB_SUCCESS;
+}
+
+CANUSB_Return_t CANUSB_SetPipeCoalescing(CANUSB_AsyncPipe_t asyncPipe, UInt32 maxTransfers, UInt32 maxDelay,
+                                         CANUSB_AsyncPipeVecCbk_t callback, CANUSB_Context_t context) {
+    CFRunLoopTimerContext timerContext = { 0, NULL, NULL, NULL, NULL };
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!asyncPipe ||
+        !asyncPipe->buffer.transfer)
+        return CANUSB_ERROR_NULLPTR;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return CANUSB_ERROR_HANDLE;
+    /* check the coalescing parameters (note: at most all transfers of the ring) */
+    if (callback && ((maxTransfers < 1U) || (asyncPipe->buffer.depth < maxTransfers)))
+        return CANUSB_ERROR_ILLPARA;
+
+    ENTER_PIPE_SECTION(asyncPipe);
+    /* note: not while the pipe is running */
+    if (asyncPipe->running || IsPipeAsyncPending(asyncPipe)) {
+        LEAVE_PIPE_SECTION(asyncPipe);
+        return CANUSB_ERROR_BUSY;
+    }
+    /* time-based delivery by a timer on the run loop of the driver */
+    if (callback && maxDelay && !asyncPipe->coalescing.timer) {
+        timerContext.info = (void*)asyncPipe;
+        asyncPipe->coalescing.timer = CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + TIMER_NEVER, TIMER_NEVER,
+                                                           0, 0, CoalescingTimerCallback, &timerContext);
+        if (!asyncPipe->coalescing.timer) {
+            MACCAN_DEBUG_ERROR("+++ Unable to create coalescing timer for pipe #%u\n", asyncPipe->pipeRef);
+            LEAVE_PIPE_SECTION(asyncPipe);
+            return CANUSB_ERROR_RESOURCE;
+        }
+        CFRunLoopAddTimer(usbDriver.refRunLoop, asyncPipe->coalescing.timer, kCFRunLoopDefaultMode);
+    }
+    if ((!callback || !maxDelay) && asyncPipe->coalescing.timer) {
+        CFRunLoopTimerInvalidate(asyncPipe->coalescing.timer);
+        CFRelease(asyncPipe->coalescing.timer);
+        asyncPipe->coalescing.timer = NULL;
+    }
+    asyncPipe->coalescing.callback = callback;
+    asyncPipe->coalescing.context = context;
+    asyncPipe->coalescing.maxTransfers = maxTransfers;
+    asyncPipe->coalescing.maxDelay = maxDelay;
+    asyncPipe->coalescing.count = 0U;
+    asyncPipe->coalescing.armed = false;
+    LEAVE_PIPE_SECTION(asyncPipe);
+    return CANUSB_SUCCESS;
+}
+
+CANUSB_Return_t CANUSB_GetPipeStats(CANUSB_AsyncPipe_t asyncPipe, CANUSB_PipeStats_t *stats, Boolean reset) {
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!asyncPipe || !stats)
+        return CANUSB_ERROR_NULLPTR;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return CANUSB_ERROR_HANDLE;
+
+    /* note: the counters are updated by the completion callbacks, always within the pipe's critical section */
+    ENTER_PIPE_SECTION(asyncPipe);
+    memcpy(stats, &asyncPipe->stats, sizeof(CANUSB_PipeStats_t));
+    if (reset)
+        bzero(&asyncPipe->stats, sizeof(CANUSB_PipeStats_t));
+    LEAVE_PIPE_SECTION(asyncPipe);
+    return CANUSB_SUCCESS;
+}
+
+CANUSB_Return_t CANUSB_SetPipeRecovery(CANUSB_AsyncPipe_t asyncPipe, UInt32 initialDelay, UInt32 maxDelay, UInt32 maxRetries,
+                                       CANUSB_RecoveryCbk_t callback, CANUSB_Context_t context) {
+    CFRunLoopTimerContext timerContext = { 0, NULL, NULL, NULL, NULL };
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!asyncPipe)
+        return CANUSB_ERROR_NULLPTR;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return CANUSB_ERROR_HANDLE;
+    /* check the backoff (note: initial delay 0 = recovery off) */
+    if (initialDelay > maxDelay)
+        return CANUSB_ERROR_ILLPARA;
+
+    ENTER_PIPE_SECTION(asyncPipe);
+    /* recovery by a timer on the run loop of the driver */
+    if (initialDelay && !asyncPipe->recovery.timer) {
+        timerContext.info = (void*)asyncPipe;
+        asyncPipe->recovery.timer = CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + TIMER_NEVER, TIMER_NEVER,
+                                                         0, 0, RecoveryTimerCallback, &timerContext);
+        if (!asyncPipe->recovery.timer) {
+            MACCAN_DEBUG_ERROR("+++ Unable to create recovery timer for pipe #%u\n", asyncPipe->pipeRef);
+            LEAVE_PIPE_SECTION(asyncPipe);
+            return CANUSB_ERROR_RESOURCE;
+        }
+        CFRunLoopAddTimer(usbDriver.refRunLoop, asyncPipe->recovery.timer, kCFRunLoopDefaultMode);
+    }
+    if (!initialDelay && asyncPipe->recovery.timer) {
+        CFRunLoopTimerInvalidate(asyncPipe->recovery.timer);
+        CFRelease(asyncPipe->recovery.timer);
+        asyncPipe->recovery.timer = NULL;
+    }
+    asyncPipe->recovery.callback = callback;
+    asyncPipe->recovery.context = context;
+    asyncPipe->recovery.initialDelay = initialDelay;
+    asyncPipe->recovery.maxDelay = maxDelay;
+    asyncPipe->recovery.maxRetries = maxRetries;
+    asyncPipe->recovery.active = false;
+    LEAVE_PIPE_SECTION(asyncPipe);
+    return CANUSB_SUCCESS;
+}
+
+CANUSB_Return_t CANUSB_SetPipeWatchdog(CANUSB_AsyncPipe_t asyncPipe, UInt32 notifyAfter, UInt32 rearmAfter, UInt32 resetAfter,
+                                       CANUSB_WatchdogCbk_t callback, CANUSB_Context_t context) {
+    CFRunLoopTimerContext timerContext = { 0, NULL, NULL, NULL, NULL };
+    CFTimeInterval interval;
+    UInt32 threshold;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!asyncPipe)
+        return CANUSB_ERROR_NULLPTR;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return CANUSB_ERROR_HANDLE;
+
+    ENTER_PIPE_SECTION(asyncPipe);
+    /* release the previous timer (if any) */
+    if (asyncPipe->watchdog.timer) {
+        CFRunLoopTimerInvalidate(asyncPipe->watchdog.timer);
+        CFRelease(asyncPipe->watchdog.timer);
+        asyncPipe->watchdog.timer = NULL;
+    }
+    /* the watchdog checks four times within the smallest threshold (0 = off) */
+    threshold = notifyAfter;
+    if (rearmAfter && (!threshold || (rearmAfter < threshold)))
+        threshold = rearmAfter;
+    if (resetAfter && (!threshold || (resetAfter < threshold)))
+        threshold = resetAfter;
+    if (threshold) {
+        interval = (CFTimeInterval)((threshold >= (WATCHDOG_MIN_PERIOD * 4U)) ? (threshold / 4U) : WATCHDOG_MIN_PERIOD) / 1000.0;
+        timerContext.info = (void*)asyncPipe;
+        asyncPipe->watchdog.timer = CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + interval, interval,
+                                                         0, 0, WatchdogTimerCallback, &timerContext);
+        if (!asyncPipe->watchdog.timer) {
+            MACCAN_DEBUG_ERROR("+++ Unable to create watchdog timer for pipe #%u\n", asyncPipe->pipeRef);
+            LEAVE_PIPE_SECTION(asyncPipe);
+            return CANUSB_ERROR_RESOURCE;
+        }
+        CFRunLoopAddTimer(usbDriver.refRunLoop, asyncPipe->watchdog.timer, kCFRunLoopDefaultMode);
+    }
+    asyncPipe->watchdog.callback = callback;
+    asyncPipe->watchdog.context = context;
+    asyncPipe->watchdog.notifyAfter = notifyAfter;
+    asyncPipe->watchdog.rearmAfter = rearmAfter;
+    asyncPipe->watchdog.resetAfter = resetAfter;
+    asyncPipe->watchdog.fired = 0U;
+    asyncPipe->watchdog.rearm = false;
+    asyncPipe->watchdog.lastActivity = GetTimestamp();
+    LEAVE_PIPE_SECTION(asyncPipe);
+    return CANUSB_SUCCESS;
+}
+
 CANUSB_Return_t CANUSB_AbortPipeAsync(CANUSB_AsyncPipe_t asyncPipe) {
     IOReturn kr;
     int ret = 0;
@@ -902,80 +1924,61 @@ CANUSB_Return_t CANUSB_AbortPipeAsync(CANUSB_AsyncPipe_t asyncPipe) {
         return CANUSB_ERROR_HANDLE;
 
     MACCAN_DEBUG_FUNC("lock #%i (%u)\n", asyncPipe->handle, asyncPipe->pipeRef);
-    ENTER_CRITICAL_SECTION(asyncPipe->handle);
-    if (usbDevice[asyncPipe->handle].fPresent &&
-        (usbDevice[asyncPipe->handle].usbInterface.fOpened) &&
-        (usbDevice[asyncPipe->handle].usbInterface.ioInterface != NULL)) {
-        kr = (*usbDevice[asyncPipe->handle].usbInterface.ioInterface)->AbortPipe(usbDevice[asyncPipe->handle].usbInterface.ioInterface,
+    ENTER_SHARED_SECTION(asyncPipe->handle);
+    if (usbDevice[HANDLE_INDEX(asyncPipe->handle)].fPresent &&
+        (USB_INTERFACE(asyncPipe->handle).fOpened) &&
+        IS_HANDLE_CURRENT(asyncPipe->handle) &&
+        (USB_INTERFACE(asyncPipe->handle).ioInterface != NULL)) {
+        kr = (*USB_INTERFACE(asyncPipe->handle).ioInterface)->AbortPipe(USB_INTERFACE(asyncPipe->handle).ioInterface,
                                                                                  asyncPipe->pipeRef);
         if (kIOReturnSuccess != kr) {
             MACCAN_DEBUG_ERROR("+++ Unable to abort async pipe #%d (%08x)\n", asyncPipe->pipeRef, kr);
-            LEAVE_CRITICAL_SECTION(asyncPipe->handle);
+            LEAVE_SHARED_SECTION(asyncPipe->handle);
             MACCAN_DEBUG_FUNC("unlocked\n");
             return CANUSB_ERROR_RESOURCE;
         }
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (AbortPipeAsync #%d)\n", asyncPipe->handle, asyncPipe->pipeRef);
-        ret = !usbDevice[asyncPipe->handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !usbDevice[HANDLE_INDEX(asyncPipe->handle)].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
-    LEAVE_CRITICAL_SECTION(asyncPipe->handle);
+    LEAVE_SHARED_SECTION(asyncPipe->handle);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 static void WritePipeCallback(void *refCon, IOReturn result, void *arg0) {
-    CANUSB_AsyncPipe_t asyncPipe = (CANUSB_AsyncPipe_t)refCon;
+    UInt64 timestamp = GetTimestamp();  /* note: as close to the completion as possible */
+    CANUSB_Transfer_t *transfer = (CANUSB_Transfer_t*)refCon;
+    CANUSB_AsyncPipe_t asyncPipe = (transfer) ? transfer->asyncPipe : NULL;
     IOReturn kr;
 
-    (void)arg0;
-
+    if (transfer) {
+        transfer->pending = false;
+        transfer->length = (UInt32)(UInt64)arg0;
+        transfer->timestamp = timestamp;
+        if (asyncPipe) {
+            SUB_INFLIGHT(asyncPipe->handle);
+            ENTER_PIPE_SECTION(asyncPipe);
+            if (CompleteDestroyedPipe(asyncPipe))
+                return;
+            UpdateStats(&asyncPipe->stats, result, transfer->length, asyncPipe->buffer.size);
+            if (kIOReturnSuccess == result)
+                asyncPipe->watchdog.lastActivity = timestamp;
+            LEAVE_PIPE_SECTION(asyncPipe);
+        }
+    }
     switch(result)
     {
     case kIOReturnSuccess:
         if (asyncPipe) {
             asyncPipe->serviced++;
-            /* sanity check */
-            if (!IS_HANDLE_VALID(asyncPipe->handle)) {
-                asyncPipe->running = false;
-                return;
-            }
-            if (!usbDevice[asyncPipe->handle].usbInterface.ioInterface) {
-                asyncPipe->running = false;
-                return;
-            }
-            if (!asyncPipe->buffer.data[0]) {
-                asyncPipe->running = false;
-                return;
-            }
-            /* check if there are more data to be sent */
-            if (asyncPipe->callback &&
-                asyncPipe->callback(asyncPipe->context, asyncPipe->buffer.data[0], asyncPipe->buffer.size)) {
-                /* preparation of the next asynchronous pipe write event (with our pipe context as reference, 8th resp. 6th argument) */
-#if (OPTION_MACCAN_PIPE_TIMEOUT == 0)
-                kr = (*usbDevice[asyncPipe->handle].usbInterface.ioInterface)->WritePipeAsync(usbDevice[asyncPipe->handle].usbInterface.ioInterface,
-                                                                                              asyncPipe->pipeRef,
-                                                                                              asyncPipe->buffer.data[0],
-                                                                                              asyncPipe->buffer.size,
-                                                                                              WritePipeCallback,
-                                                                                              (void*)asyncPipe);
-#else
-                if (asyncPipe->noDataTimeout && asyncPipe->completionTimeout)
-                    kr = (*usbDevice[asyncPipe->handle].usbInterface.ioInterface)->WritePipeAsyncTO(usbDevice[asyncPipe->handle].usbInterface.ioInterface,
-                                                                                                    asyncPipe->pipeRef,
-                                                                                                    asyncPipe->buffer.data[0],
-                                                                                                    asyncPipe->buffer.size,
-                                                                                                    asyncPipe->noDataTimeout,
-                                                                                                    asyncPipe->completionTimeout,
-                                                                                                    WritePipeCallback,
-                                                                                                    (void*)asyncPipe);
-                else
-                    kr = (*usbDevice[asyncPipe->handle].usbInterface.ioInterface)->WritePipeAsync(usbDevice[asyncPipe->handle].usbInterface.ioInterface,
-                                                                                                  asyncPipe->pipeRef,
-                                                                                                  asyncPipe->buffer.data[0],
-                                                                                                  asyncPipe->buffer.size,
-                                                                                                  WritePipeCallback,
-                                                                                                  (void*)asyncPipe);
-#endif
+            /* check if there are more data to be sent (with the host time of completion of the previous ones) */
+            if ((asyncPipe->callbackEx &&
+                 asyncPipe->callbackEx(asyncPipe->context, transfer->data, asyncPipe->buffer.size, transfer->timestamp)) ||
+                (!asyncPipe->callbackEx && asyncPipe->callback &&
+                 asyncPipe->callback(asyncPipe->context, transfer->data, asyncPipe->buffer.size))) {
+                /* preparation of the next asynchronous pipe write event (with the transfer as reference) */
+                kr = SubmitWrite(transfer, asyncPipe->buffer.size);
                 if (kIOReturnSuccess != kr) {
                     MACCAN_DEBUG_ERROR("+++ Unable to write async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
                     /* error: something went wrong */
@@ -1004,6 +2007,9 @@ static void WritePipeCallback(void *refCon, IOReturn result, void *arg0) {
         if (asyncPipe) {
             MACCAN_DEBUG_ERROR("+++ Error: write async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, result);
             asyncPipe->running = false;
+            ENTER_PIPE_SECTION(asyncPipe);
+            ScheduleRecovery(asyncPipe, result, timestamp);
+            LEAVE_PIPE_SECTION(asyncPipe);
         } else {
             MACCAN_DEBUG_ERROR("+++ Error: write async pipe without context (%08x)\n", result);
         }
@@ -1014,6 +2020,16 @@ static void WritePipeCallback(void *refCon, IOReturn result, void *arg0) {
 
 CANUSB_Return_t CANUSB_WritePipeAsync(CANUSB_AsyncPipe_t asyncPipe, const void *buffer, UInt32 size, UInt16 timeout,
                                       CANUSB_AsyncPipeCbk_t callback, CANUSB_Context_t context) {
+    return StartWritePipe(asyncPipe, buffer, size, timeout, callback, NULL, context);
+}
+
+CANUSB_Return_t CANUSB_WritePipeAsyncEx(CANUSB_AsyncPipe_t asyncPipe, const void *buffer, UInt32 size, UInt16 timeout,
+                                        CANUSB_AsyncPipeCbkEx_t callback, CANUSB_Context_t context) {
+    return StartWritePipe(asyncPipe, buffer, size, timeout, NULL, callback, context);
+}
+
+static CANUSB_Return_t StartWritePipe(CANUSB_AsyncPipe_t asyncPipe, const void *buffer, UInt32 size, UInt16 timeout,
+                                      CANUSB_AsyncPipeCbk_t callback, CANUSB_AsyncPipeCbkEx_t callbackEx, CANUSB_Context_t context) {
     IOReturn kr;
     int ret = 0;
 #if (OPTION_MACCAN_PIPE_TIMEOUT == 0)
@@ -1027,173 +2043,680 @@ CANUSB_Return_t CANUSB_WritePipeAsync(CANUSB_AsyncPipe_t asyncPipe, const void *
         return CANUSB_ERROR_NOTINIT;
     /* check for NULL pointer */
     if (!asyncPipe || !buffer ||
-        !asyncPipe->buffer.data[0])
+        !asyncPipe->buffer.transfer)
         return CANUSB_ERROR_NULLPTR;
     /* must be a valid handle */
     if (!IS_HANDLE_VALID(asyncPipe->handle))
         return CANUSB_ERROR_HANDLE;
 
     MACCAN_DEBUG_FUNC("lock #%i (%u)\n", asyncPipe->handle, asyncPipe->pipeRef);
-    ENTER_CRITICAL_SECTION(asyncPipe->handle);
-    if (asyncPipe->running) {
+    ENTER_SHARED_SECTION(asyncPipe->handle);
+    ENTER_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+    if (asyncPipe->running || IsPipeAsyncPending(asyncPipe)) {
         MACCAN_DEBUG_ERROR("+++ Async write of pipe #%d already started\n", asyncPipe->pipeRef);
-        LEAVE_CRITICAL_SECTION(asyncPipe->handle);
+        LEAVE_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+        LEAVE_SHARED_SECTION(asyncPipe->handle);
         MACCAN_DEBUG_FUNC("unlocked\n");
         return CANUSB_ERROR_RESOURCE;
     }
-    if (usbDevice[asyncPipe->handle].fPresent &&
-        (usbDevice[asyncPipe->handle].usbInterface.fOpened) &&
-        (usbDevice[asyncPipe->handle].usbInterface.ioInterface != NULL)) {
-        kr = (*usbDevice[asyncPipe->handle].usbInterface.ioInterface)->GetPipeStatus(usbDevice[asyncPipe->handle].usbInterface.ioInterface,
+    if (usbDevice[HANDLE_INDEX(asyncPipe->handle)].fPresent &&
+        (USB_INTERFACE(asyncPipe->handle).fOpened) &&
+        IS_HANDLE_CURRENT(asyncPipe->handle) &&
+        (USB_INTERFACE(asyncPipe->handle).ioInterface != NULL)) {
+        kr = (*USB_INTERFACE(asyncPipe->handle).ioInterface)->GetPipeStatus(USB_INTERFACE(asyncPipe->handle).ioInterface,
                                                                                      asyncPipe->pipeRef);
         if (kIOReturnSuccess != kr) {
             MACCAN_DEBUG_ERROR("+++ Unable to get status of pipe #%d (%08x)\n", asyncPipe->pipeRef, kr);
-            LEAVE_CRITICAL_SECTION(asyncPipe->handle);
+            LEAVE_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+            LEAVE_SHARED_SECTION(asyncPipe->handle);
             MACCAN_DEBUG_FUNC("unlocked\n");
             return (kIOUSBPipeStalled != kr) ? CANUSB_ERROR_RESOURCE : CANUSB_ERROR_STALLED;
         }
-        /* copy data into the transfer buffer (at index 0) */
-        bzero(asyncPipe->buffer.data[0], (size_t)asyncPipe->buffer.size);
-        memcpy(asyncPipe->buffer.data[0], buffer, (size_t)MIN(size, asyncPipe->buffer.size));
-        asyncPipe->buffer.index = 0;
+        /* frames aggregated by CANUSB_QueuePipeAsync, but not yet sent, would be overwritten */
+        ENTER_PIPE_SECTION(asyncPipe);
+        if (asyncPipe->buffer.transfer[asyncPipe->buffer.index].length) {
+            MACCAN_DEBUG_ERROR("+++ Async write of pipe #%d has queued data\n", asyncPipe->pipeRef);
+            LEAVE_PIPE_SECTION(asyncPipe);
+            LEAVE_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+            LEAVE_SHARED_SECTION(asyncPipe->handle);
+            MACCAN_DEBUG_FUNC("unlocked\n");
+            return CANUSB_ERROR_BUSY;
+        }
+        /* note: from now on the queue is refused (until the write is completed) */
+        asyncPipe->running = true;
+        LEAVE_PIPE_SECTION(asyncPipe);
+        /* copy data into the transfer buffer (of the first transfer) */
+        bzero(asyncPipe->buffer.transfer[0].data, (size_t)asyncPipe->buffer.size);
+        memcpy(asyncPipe->buffer.transfer[0].data, buffer, (size_t)MIN(size, asyncPipe->buffer.size));
+        asyncPipe->buffer.index = 0U;
         /* register the callback function and the transmission data context */
         asyncPipe->callback = callback;
+        asyncPipe->callbackEx = callbackEx;
         asyncPipe->context = context;
-        /* preparation of the asynchronous pipe write event (with our pipe context as reference, 6th or 8th argument) */
-#if (OPTION_MACCAN_PIPE_TIMEOUT == 0)
-        /* note: deactivate define if WritePipeAsyncTO() is not available in IOUSBInterfaceStructXYZ for the device. */
-        kr = (*usbDevice[asyncPipe->handle].usbInterface.ioInterface)->WritePipeAsync(usbDevice[asyncPipe->handle].usbInterface.ioInterface,
-                                                                                      asyncPipe->pipeRef,
-                                                                                      asyncPipe->buffer.data[0],
-                                                                                      asyncPipe->buffer.size,
-                                                                                      WritePipeCallback,
-                                                                                      (void*)asyncPipe);
-#else
+#if (OPTION_MACCAN_PIPE_TIMEOUT != 0)
         /* register also the time-out values */
-        asyncPipe->noDataTimeout = noDataTimeout;
-        asyncPipe->completionTimeout = completionTimeout;
-        /* start the transmission pump (w/ or w/o time-out) */
-        if (timeout)
-            kr = (*usbDevice[asyncPipe->handle].usbInterface.ioInterface)->WritePipeAsyncTO(usbDevice[asyncPipe->handle].usbInterface.ioInterface,
-                                                                                            asyncPipe->pipeRef,
-                                                                                            asyncPipe->buffer.data[0],
-                                                                                            asyncPipe->buffer.size,
-                                                                                            asyncPipe->noDataTimeout,
-                                                                                            asyncPipe->completionTimeout,
-                                                                                            WritePipeCallback,
-                                                                                            (void*)asyncPipe);
-        else
-            kr = (*usbDevice[asyncPipe->handle].usbInterface.ioInterface)->WritePipeAsync(usbDevice[asyncPipe->handle].usbInterface.ioInterface,
-                                                                                          asyncPipe->pipeRef,
-                                                                                          asyncPipe->buffer.data[0],
-                                                                                          asyncPipe->buffer.size,
-                                                                                          WritePipeCallback,
-                                                                                          (void*)asyncPipe);
+        asyncPipe->noDataTimeout = timeout ? noDataTimeout : 0U;
+        asyncPipe->completionTimeout = timeout ? completionTimeout : 0U;
 #endif
+        /* preparation of the asynchronous pipe write event (with the transfer as reference) */
+        kr = SubmitWrite(&asyncPipe->buffer.transfer[0], asyncPipe->buffer.size);
         if (kIOReturnSuccess != kr) {
             MACCAN_DEBUG_ERROR("+++ Unable to start async write pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
-            LEAVE_CRITICAL_SECTION(asyncPipe->handle);
+            asyncPipe->running = false;
+            LEAVE_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+            LEAVE_SHARED_SECTION(asyncPipe->handle);
             MACCAN_DEBUG_FUNC("unlocked\n");
             return (kIOUSBTransactionTimeout != kr) ? CANUSB_ERROR_RESOURCE : CANUSB_ERROR_TIMEOUT;
         }
         /* asynchronous pipe write event armed */
-        asyncPipe->running = true;
+        asyncPipe->recovery.reading = false;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (WritePipeAsync)\n", asyncPipe->handle);
-        ret = !usbDevice[asyncPipe->handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !usbDevice[HANDLE_INDEX(asyncPipe->handle)].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
-    LEAVE_CRITICAL_SECTION(asyncPipe->handle);
+    LEAVE_ENDPOINT_SECTION(asyncPipe->handle, asyncPipe->pipeRef);
+    LEAVE_SHARED_SECTION(asyncPipe->handle);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
-Boolean CANUSB_IsPipeAsyncRunning(CANUSB_AsyncPipe_t asyncPipe) {
-    Boolean running = false;
+static void QueuePipeCallback(void *refCon, IOReturn result, void *arg0) {
+    UInt64 timestamp = GetTimestamp();  /* note: as close to the completion as possible */
+    CANUSB_Transfer_t *transfer = (CANUSB_Transfer_t*)refCon;
+    CANUSB_AsyncPipe_t asyncPipe = (transfer) ? transfer->asyncPipe : NULL;
+    UInt32 length = (UInt32)(UInt64)arg0;
+    IOReturn kr;
+
+    if (!asyncPipe) {
+        MACCAN_DEBUG_ERROR("+++ Error: queue async pipe without context (%08x)\n", result);
+        return;
+    }
+    SUB_INFLIGHT(asyncPipe->handle);
+    switch (result)
+    {
+    case kIOReturnSuccess:
+        break;
+    case kIOReturnAborted:
+        MACCAN_DEBUG_CORE("!!! Aborted: queue async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, result);
+        break;
+    default:
+        MACCAN_DEBUG_ERROR("+++ Error: queue async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, result);
+        break;
+    }
+    ENTER_PIPE_SECTION(asyncPipe);
+    /* the transfer is free again (note: data of a failed transfer are lost) */
+    transfer->pending = false;
+    if (CompleteDestroyedPipe(asyncPipe))
+        return;
+    UpdateStats(&asyncPipe->stats, result, length, transfer->length);
+    if (kIOReturnSuccess == result)
+        asyncPipe->watchdog.lastActivity = timestamp;
+    transfer->length = 0U;
+    asyncPipe->serviced++;
+    /* send the frames aggregated in the meantime (if any) */
+    if (kIOReturnSuccess == result) {
+        kr = FlushPipeQueue(asyncPipe);
+        if (kIOReturnSuccess != kr)
+            MACCAN_DEBUG_ERROR("+++ Unable to write async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
+    } else {
+        ScheduleRecovery(asyncPipe, result, timestamp);
+    }
+    LEAVE_PIPE_SECTION(asyncPipe);
+    /* call the CALLBACK routine with the referenced pipe context (signals free space in the ring) */
+    if (asyncPipe->callbackEx)
+        (void)asyncPipe->callbackEx(asyncPipe->context, NULL, (kIOReturnSuccess == result) ? length : 0U, timestamp);
+    else if (asyncPipe->callback)
+        (void)asyncPipe->callback(asyncPipe->context, NULL, (kIOReturnSuccess == result) ? length : 0U);
+    return;
+}
+
+CANUSB_Return_t CANUSB_QueuePipeAsync(CANUSB_AsyncPipe_t asyncPipe, const void *buffer, UInt32 size,
+                                      CANUSB_AsyncPipeCbk_t callback, CANUSB_Context_t context) {
+    return StartQueuePipe(asyncPipe, buffer, size, callback, NULL, context);
+}
+
+CANUSB_Return_t CANUSB_QueuePipeAsyncEx(CANUSB_AsyncPipe_t asyncPipe, const void *buffer, UInt32 size,
+                                        CANUSB_AsyncPipeCbkEx_t callback, CANUSB_Context_t context) {
+    return StartQueuePipe(asyncPipe, buffer, size, NULL, callback, context);
+}
+
+static CANUSB_Return_t StartQueuePipe(CANUSB_AsyncPipe_t asyncPipe, const void *buffer, UInt32 size,
+                                      CANUSB_AsyncPipeCbk_t callback, CANUSB_AsyncPipeCbkEx_t callbackEx, CANUSB_Context_t context) {
+    CANUSB_Transfer_t *transfer;
+    IOReturn kr;
+    int ret = 0;
 
     /* must be initialized */
     if (!fInitialized)
-        return false;
+        return CANUSB_ERROR_NOTINIT;
     /* check for NULL pointer */
-    if (!asyncPipe)
-        return false;
+    if (!asyncPipe || !buffer ||
+        !asyncPipe->buffer.transfer)
+        return CANUSB_ERROR_NULLPTR;
     /* must be a valid handle */
     if (!IS_HANDLE_VALID(asyncPipe->handle))
-        return false;
+        return CANUSB_ERROR_HANDLE;
+    /* frame must fit into one transfer */
+    if (!size || (size > GetTransferCapacity(asyncPipe)))
+        return CANUSB_ERROR_ILLPARA;
 
-    /* return true if asynchronous operation is running, false otherwise */
     MACCAN_DEBUG_FUNC("lock #%i (%u)\n", asyncPipe->handle, asyncPipe->pipeRef);
-    ENTER_CRITICAL_SECTION(asyncPipe->handle);
-    running = asyncPipe->running;
-    LEAVE_CRITICAL_SECTION(asyncPipe->handle);
+    ENTER_PIPE_SECTION(asyncPipe);
+    if (asyncPipe->running) {
+        MACCAN_DEBUG_ERROR("+++ Async write of pipe #%d already started\n", asyncPipe->pipeRef);
+        LEAVE_PIPE_SECTION(asyncPipe);
+        MACCAN_DEBUG_FUNC("unlocked\n");
+        return CANUSB_ERROR_RESOURCE;
+    }
+    /* note: the device lock is not taken, the pipe holds its own reference to the interface
+     *       and the handle generation is bumped (atomically) when the device is closed */
+    if (IS_HANDLE_VALID(asyncPipe->handle) &&
+        (asyncPipe->ioInterface != NULL)) {
+        /* register the callback function and the transmission data context */
+        asyncPipe->callback = callback;
+        asyncPipe->callbackEx = callbackEx;
+        asyncPipe->context = context;
+        /* the frame does not fit into the transfer being filled: send it */
+        transfer = &asyncPipe->buffer.transfer[asyncPipe->buffer.index];
+        if (!transfer->pending && ((transfer->length + size) > GetTransferCapacity(asyncPipe))) {
+            kr = FlushPipeQueue(asyncPipe);
+            if (kIOReturnSuccess != kr) {
+                MACCAN_DEBUG_ERROR("+++ Unable to write async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
+                LEAVE_PIPE_SECTION(asyncPipe);
+                MACCAN_DEBUG_FUNC("unlocked\n");
+                return (kIOUSBPipeStalled != kr) ? CANUSB_ERROR_RESOURCE : CANUSB_ERROR_STALLED;
+            }
+            transfer = &asyncPipe->buffer.transfer[asyncPipe->buffer.index];
+        }
+        /* all transfers are in flight: the ring is full */
+        if (transfer->pending) {
+            LEAVE_PIPE_SECTION(asyncPipe);
+            MACCAN_DEBUG_FUNC("unlocked\n");
+            return CANUSB_ERROR_FULL;
+        }
+        /* append the frame to the transfer being filled */
+        memcpy(&transfer->data[transfer->length], buffer, (size_t)size);
+        transfer->length += size;
+        /* send it immediately if no transfer is in flight, otherwise aggregate until one is completed */
+        if (!IsPipeAsyncPending(asyncPipe)) {
+            kr = FlushPipeQueue(asyncPipe);
+            if (kIOReturnSuccess != kr) {
+                MACCAN_DEBUG_ERROR("+++ Unable to write async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
+                ret = (kIOUSBPipeStalled != kr) ? CANUSB_ERROR_RESOURCE : CANUSB_ERROR_STALLED;
+            }
+        }
+    } else {
+        MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (QueuePipeAsync)\n", asyncPipe->handle);
+        ret = !IS_HANDLE_VALID(asyncPipe->handle) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+    }
+    LEAVE_PIPE_SECTION(asyncPipe);
     MACCAN_DEBUG_FUNC("unlocked\n");
-    return running;
+    return ret;
 }
 
-CANUSB_Index_t CANUSB_GetFirstDevice(void) {
-    CANUSB_Index_t index = CANUSB_INVALID_INDEX;
-
-    /* must be initialized */
-    if (!fInitialized)
-        return CANUSB_INVALID_INDEX;
+static void RegisteredPipeCallback(void *refCon, IOReturn result, void *arg0) {
+    UInt64 timestamp = GetTimestamp();  /* note: as close to the completion as possible */
+    CANUSB_Registered_t *registered = (CANUSB_Registered_t*)refCon;
+    CANUSB_AsyncPipe_t asyncPipe = (registered) ? registered->asyncPipe : NULL;
+    UInt32 length = (UInt32)(UInt64)arg0;
+    CANUSB_AsyncPipeCbk_t callback;
+    CANUSB_AsyncPipeCbkEx_t callbackEx;
+    CANUSB_Context_t context;
+    UInt8 *data;
+    IOReturn kr;
 
-    /* get the first registered device, if any */
-    // if (idxDevice != 0)  // note: logically equivalent
-        idxDevice = 0;
-    while (idxDevice < CANUSB_MAX_DEVICES) {
-        if (usbDevice[idxDevice].fPresent &&
-            (usbDevice[idxDevice].ioDevice != NULL)) {
-            index = idxDevice;
-            break;
-        }
-        idxDevice++;
+    if (!asyncPipe) {
+        MACCAN_DEBUG_ERROR("+++ Error: submit async pipe without context (%08x)\n", result);
+        return;
     }
-    return index;
+    SUB_INFLIGHT(asyncPipe->handle);
+    if (kIOReturnSuccess != result)
+        MACCAN_DEBUG_ERROR("+++ Error: submit async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, result);
+    ENTER_PIPE_SECTION(asyncPipe);
+    /* the caller's buffer may be reused from now on (but not unregistered until the callback has returned) */
+    registered->pending = false;
+    if (CompleteDestroyedPipe(asyncPipe))
+        return;
+    UpdateStats(&asyncPipe->stats, result, length, registered->length);
+    if (kIOReturnSuccess == result)
+        asyncPipe->watchdog.lastActivity = timestamp;
+    registered->delivering = true;
+    data = registered->data;
+    callback = registered->callback;
+    callbackEx = registered->callbackEx;
+    context = registered->context;
+    asyncPipe->serviced++;
+    /* send the frames aggregated in the meantime (if any) */
+    if (kIOReturnSuccess == result) {
+        kr = FlushPipeQueue(asyncPipe);
+        if (kIOReturnSuccess != kr)
+            MACCAN_DEBUG_ERROR("+++ Unable to write async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
+    } else {
+        ScheduleRecovery(asyncPipe, result, timestamp);
+    }
+    LEAVE_PIPE_SECTION(asyncPipe);
+    /* call the CALLBACK routine with the caller's buffer (number of bytes sent or 0 on error) */
+    if (callbackEx)
+        (void)callbackEx(context, data, (kIOReturnSuccess == result) ? length : 0U, timestamp);
+    else if (callback)
+        (void)callback(context, data, (kIOReturnSuccess == result) ? length : 0U);
+    ENTER_PIPE_SECTION(asyncPipe);
+    registered->delivering = false;
+    LEAVE_PIPE_SECTION(asyncPipe);
+    return;
 }
 
-CANUSB_Index_t CANUSB_GetNextDevice(void) {
-    CANUSB_Index_t index = CANUSB_INVALID_INDEX;
+CANUSB_Return_t CANUSB_RegisterPipeBuffer(CANUSB_AsyncPipe_t asyncPipe, void *buffer, UInt32 size, UInt32 *slot) {
+    UInt32 index;
 
     /* must be initialized */
     if (!fInitialized)
-        return CANUSB_INVALID_INDEX;
-
-    /* get the next registered device, if any */
-    if (idxDevice < CANUSB_MAX_DEVICES)
-        idxDevice += 1;
-    while (idxDevice < CANUSB_MAX_DEVICES) {
-        if (usbDevice[idxDevice].fPresent &&
-            (usbDevice[idxDevice].ioDevice != NULL)) {
-            index = idxDevice;
-            break;
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!asyncPipe || !buffer || !slot)
+        return CANUSB_ERROR_NULLPTR;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return CANUSB_ERROR_HANDLE;
+    /* check buffer size and alignment */
+    if (!size || ((uintptr_t)buffer % CANUSB_BUFFER_ALIGNMENT))
+        return CANUSB_ERROR_ILLPARA;
+
+    ENTER_PIPE_SECTION(asyncPipe);
+    for (index = 0U; index < CANUSB_MAX_REGISTERED_BUFFERS; index++) {
+        if (!asyncPipe->registered[index].data) {
+            asyncPipe->registered[index].asyncPipe = asyncPipe;
+            asyncPipe->registered[index].data = (UInt8*)buffer;
+            asyncPipe->registered[index].size = size;
+            asyncPipe->registered[index].pending = false;
+            asyncPipe->registered[index].delivering = false;
+            asyncPipe->registered[index].callback = NULL;
+            asyncPipe->registered[index].callbackEx = NULL;
+            asyncPipe->registered[index].context = NULL;
+            LEAVE_PIPE_SECTION(asyncPipe);
+            *slot = index;
+            return CANUSB_SUCCESS;
         }
-        idxDevice++;
     }
-    return index;
+    LEAVE_PIPE_SECTION(asyncPipe);
+    return CANUSB_ERROR_RESOURCE;
 }
 
-Boolean CANUSB_IsDevicePresent(CANUSB_Index_t index) {
-    Boolean ret = false;
+CANUSB_Return_t CANUSB_UnregisterPipeBuffer(CANUSB_AsyncPipe_t asyncPipe, UInt32 slot) {
 
     /* must be initialized */
     if (!fInitialized)
-        return false;
-    /* must be a valid index */
-    if (!IS_INDEX_VALID(index))
-        return false;
-
-    MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
-    if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL))
-        ret = true;
-    LEAVE_CRITICAL_SECTION(index);
-    MACCAN_DEBUG_FUNC("unlocked\n");
-    return ret;
-}
-
-Boolean CANUSB_IsDeviceInUse(CANUSB_Index_t index) {
-    Boolean ret = false;
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!asyncPipe)
+        return CANUSB_ERROR_NULLPTR;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return CANUSB_ERROR_HANDLE;
+    /* must be a slot number */
+    if (slot >= CANUSB_MAX_REGISTERED_BUFFERS)
+        return CANUSB_ERROR_ILLPARA;
+
+    ENTER_PIPE_SECTION(asyncPipe);
+    /* must be a registered buffer */
+    if (!asyncPipe->registered[slot].data) {
+        LEAVE_PIPE_SECTION(asyncPipe);
+        return CANUSB_ERROR_ILLPARA;
+    }
+    if (asyncPipe->registered[slot].pending || asyncPipe->registered[slot].delivering) {
+        /* note: the buffer is still referenced by the USB device or by the callback */
+        LEAVE_PIPE_SECTION(asyncPipe);
+        return CANUSB_ERROR_BUSY;
+    }
+    bzero(&asyncPipe->registered[slot], sizeof(CANUSB_Registered_t));
+    LEAVE_PIPE_SECTION(asyncPipe);
+    return CANUSB_SUCCESS;
+}
+
+CANUSB_Return_t CANUSB_SubmitPipeBuffer(CANUSB_AsyncPipe_t asyncPipe, UInt32 slot, UInt32 size,
+                                        CANUSB_AsyncPipeCbk_t callback, CANUSB_Context_t context) {
+    return StartSubmitPipe(asyncPipe, slot, size, callback, NULL, context);
+}
+
+CANUSB_Return_t CANUSB_SubmitPipeBufferEx(CANUSB_AsyncPipe_t asyncPipe, UInt32 slot, UInt32 size,
+                                          CANUSB_AsyncPipeCbkEx_t callback, CANUSB_Context_t context) {
+    return StartSubmitPipe(asyncPipe, slot, size, NULL, callback, context);
+}
+
+static CANUSB_Return_t StartSubmitPipe(CANUSB_AsyncPipe_t asyncPipe, UInt32 slot, UInt32 size,
+                                       CANUSB_AsyncPipeCbk_t callback, CANUSB_AsyncPipeCbkEx_t callbackEx, CANUSB_Context_t context) {
+    CANUSB_Registered_t *registered;
+    IOUSBInterfaceInterface **interface;
     IOReturn kr;
+    int ret = 0;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!asyncPipe)
+        return CANUSB_ERROR_NULLPTR;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return CANUSB_ERROR_HANDLE;
+    /* must be a slot number */
+    if ((slot >= CANUSB_MAX_REGISTERED_BUFFERS) || !size)
+        return CANUSB_ERROR_ILLPARA;
+
+    MACCAN_DEBUG_FUNC("lock #%i (%u)\n", asyncPipe->handle, asyncPipe->pipeRef);
+    ENTER_PIPE_SECTION(asyncPipe);
+    registered = &asyncPipe->registered[slot];
+    /* must be a registered buffer and the data must fit into it */
+    if (!registered->data || (size > registered->size)) {
+        LEAVE_PIPE_SECTION(asyncPipe);
+        MACCAN_DEBUG_FUNC("unlocked\n");
+        return CANUSB_ERROR_ILLPARA;
+    }
+    if (asyncPipe->running || registered->pending) {
+        LEAVE_PIPE_SECTION(asyncPipe);
+        MACCAN_DEBUG_FUNC("unlocked\n");
+        return CANUSB_ERROR_BUSY;
+    }
+    /* note: the device lock is not taken, the pipe holds its own reference to the interface
+     *       and the handle generation is bumped (atomically) when the device is closed */
+    if (IS_HANDLE_VALID(asyncPipe->handle) &&
+        ((interface = asyncPipe->ioInterface) != NULL)) {
+        /* register the callback function and the transmission data context */
+        registered->callback = callback;
+        registered->callbackEx = callbackEx;
+        registered->context = context;
+        registered->length = size;
+        registered->pending = true;
+        ADD_INFLIGHT(asyncPipe->handle);
+        /* asynchronous pipe write event directly from the caller's buffer (with the slot as reference) */
+        kr = (*interface)->WritePipeAsync(interface, asyncPipe->pipeRef, registered->data, size,
+                                          RegisteredPipeCallback, (void*)registered);
+        if (kIOReturnSuccess != kr) {
+            MACCAN_DEBUG_ERROR("+++ Unable to submit async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
+            SUB_INFLIGHT(asyncPipe->handle);
+            registered->pending = false;
+            ret = (kIOUSBPipeStalled != kr) ? CANUSB_ERROR_RESOURCE : CANUSB_ERROR_STALLED;
+        }
+    } else {
+        MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (SubmitPipeBuffer)\n", asyncPipe->handle);
+        ret = !IS_HANDLE_VALID(asyncPipe->handle) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+    }
+    LEAVE_PIPE_SECTION(asyncPipe);
+    MACCAN_DEBUG_FUNC("unlocked\n");
+    return ret;
+}
+
+static void IoRingCallback(void *refCon, IOReturn result, void *arg0) {
+    CANUSB_IoSlot_t *slot = (CANUSB_IoSlot_t*)refCon;
+    CANUSB_IoRing_t ioRing = (slot) ? slot->ioRing : NULL;
+    CANUSB_IoCompletion_t *completion;
+
+    if (!ioRing) {
+        MACCAN_DEBUG_ERROR("+++ Error: I/O ring completion without context (%08x)\n", result);
+        return;
+    }
+    SUB_INFLIGHT(ioRing->handle);
+    ENTER_RING_SECTION(ioRing);
+    /* put the completion into the completion queue (note: there is always room for it) */
+    completion = &ioRing->cq[ioRing->tail];
+    completion->userData = slot->userData;
+    completion->result = ResultFromIOReturn(result);
+    completion->length = (UInt32)(UInt64)arg0;
+    completion->submitted = slot->submitted;
+    completion->completed = GetTimestamp();
+    ioRing->tail = (ioRing->tail + 1U) % ioRing->entries;
+    ioRing->used++;
+    /* release the slot */
+    slot->next = ioRing->freeSlot;
+    ioRing->freeSlot = (UInt32)(slot - ioRing->slots);
+    ioRing->inFlight--;
+    assert(0 == pthread_cond_signal(&ioRing->ptCond));
+    LEAVE_RING_SECTION(ioRing);
+}
+
+CANUSB_IoRing_t CANUSB_CreateIoRing(CANUSB_Handle_t handle, UInt32 entries) {
+    CANUSB_IoRing_t ioRing = NULL;
+    UInt32 index;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return NULL;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(handle))
+        return NULL;
+    /* check the number of entries */
+    if ((entries < 1U) || (CANUSB_MAX_RING_ENTRIES < entries))
+        return NULL;
+
+    /* create the I/O ring with its slots and its completion queue */
+    if ((ioRing = (CANUSB_IoRing_t)calloc(1, sizeof(struct usb_io_ring_tag))) == NULL) {
+        MACCAN_DEBUG_ERROR("+++ Unable to create I/O ring for device #%i\n", handle);
+        return NULL;
+    }
+    if (!(ioRing->slots = (CANUSB_IoSlot_t*)calloc(entries, sizeof(CANUSB_IoSlot_t))) ||
+        !(ioRing->cq = (CANUSB_IoCompletion_t*)calloc(entries, sizeof(CANUSB_IoCompletion_t)))) {
+        MACCAN_DEBUG_ERROR("+++ Unable to create I/O ring with %u entries for device #%i\n", entries, handle);
+        if (ioRing->slots)
+            free(ioRing->slots);
+        free(ioRing);
+        return NULL;
+    }
+    for (index = 0U; index < entries; index++) {
+        ioRing->slots[index].ioRing = ioRing;
+        ioRing->slots[index].next = index + 1U;
+    }
+    ioRing->freeSlot = 0U;
+    ioRing->entries = entries;
+    ioRing->handle = handle;
+    assert(0 == pthread_mutex_init(&ioRing->ptMutex, NULL));
+    assert(0 == pthread_cond_init(&ioRing->ptCond, NULL));
+    return ioRing;
+}
+
+CANUSB_Return_t CANUSB_DestroyIoRing(CANUSB_IoRing_t ioRing) {
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!ioRing)
+        return CANUSB_ERROR_NULLPTR;
+
+    ENTER_RING_SECTION(ioRing);
+    if (ioRing->inFlight) {
+        /* note: abort the pipes first */
+        LEAVE_RING_SECTION(ioRing);
+        return CANUSB_ERROR_BUSY;
+    }
+    LEAVE_RING_SECTION(ioRing);
+    assert(0 == pthread_cond_destroy(&ioRing->ptCond));
+    assert(0 == pthread_mutex_destroy(&ioRing->ptMutex));
+    free(ioRing->cq);
+    free(ioRing->slots);
+    free(ioRing);
+    return CANUSB_SUCCESS;
+}
+
+CANUSB_Return_t CANUSB_SubmitIoRing(CANUSB_IoRing_t ioRing, const CANUSB_IoRequest_t *requests, UInt32 count, UInt32 *submitted) {
+    IOUSBInterfaceInterface **interface;
+    CANUSB_IoSlot_t *slot;
+    IOReturn kr = kIOReturnSuccess;
+    UInt32 n = 0U;
+    int ret = 0;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!ioRing || !requests)
+        return CANUSB_ERROR_NULLPTR;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(ioRing->handle))
+        return CANUSB_ERROR_HANDLE;
+
+    MACCAN_DEBUG_FUNC("lock #%i\n", ioRing->handle);
+    ENTER_SHARED_SECTION(ioRing->handle);
+    if (usbDevice[HANDLE_INDEX(ioRing->handle)].fPresent &&
+        (USB_INTERFACE(ioRing->handle).fOpened) &&
+        IS_HANDLE_CURRENT(ioRing->handle) &&
+        ((interface = USB_INTERFACE(ioRing->handle).ioInterface) != NULL)) {
+        ENTER_RING_SECTION(ioRing);
+        for (n = 0U; n < count; n++) {
+            /* note: a completion must always find room in the completion queue */
+            if ((ioRing->inFlight + ioRing->used) >= ioRing->entries) {
+                ret = CANUSB_ERROR_FULL;
+                break;
+            }
+            slot = &ioRing->slots[ioRing->freeSlot];
+            slot->userData = requests[n].userData;
+            slot->submitted = GetTimestamp();
+            ADD_INFLIGHT(ioRing->handle);
+            /* issue the transfer (with the slot as reference) */
+            switch (requests[n].opcode) {
+            case CANUSB_IO_READ:
+                kr = (*interface)->ReadPipeAsync(interface, requests[n].pipeRef, requests[n].buffer, requests[n].size,
+                                                 IoRingCallback, (void*)slot);
+                break;
+            case CANUSB_IO_WRITE:
+                kr = (*interface)->WritePipeAsync(interface, requests[n].pipeRef, requests[n].buffer, requests[n].size,
+                                                  IoRingCallback, (void*)slot);
+                break;
+            case CANUSB_IO_CONTROL:
+                slot->devRequest.bmRequestType = requests[n].setupPacket.RequestType;
+                slot->devRequest.bRequest = requests[n].setupPacket.Request;
+                slot->devRequest.wValue = requests[n].setupPacket.Value;
+                slot->devRequest.wIndex = requests[n].setupPacket.Index;
+                slot->devRequest.wLength = (UInt16)(MIN(requests[n].setupPacket.Length, requests[n].size));
+                slot->devRequest.pData = requests[n].buffer;
+                slot->devRequest.wLenDone = 0U;
+                kr = (*interface)->ControlRequestAsync(interface, 0U, &slot->devRequest,
+                                                       IoRingCallback, (void*)slot);
+                break;
+            default:
+                kr = kIOReturnBadArgument;
+                break;
+            }
+            if (kIOReturnSuccess != kr) {
+                MACCAN_DEBUG_ERROR("+++ Unable to submit transfer #%u of device #%i (%08x)\n", n, ioRing->handle, kr);
+                SUB_INFLIGHT(ioRing->handle);
+                ret = (kIOReturnBadArgument != kr) ? ResultFromIOReturn(kr) : CANUSB_ERROR_ILLPARA;
+                break;
+            }
+            /* the slot is in flight */
+            ioRing->freeSlot = slot->next;
+            ioRing->inFlight++;
+        }
+        LEAVE_RING_SECTION(ioRing);
+    } else {
+        MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (SubmitIoRing)\n", ioRing->handle);
+        ret = !usbDevice[HANDLE_INDEX(ioRing->handle)].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+    }
+    LEAVE_SHARED_SECTION(ioRing->handle);
+    MACCAN_DEBUG_FUNC("unlocked\n");
+    /* number of submitted transfers (an error is only returned if none was submitted) */
+    if (submitted)
+        *submitted = n;
+    return (n > 0U) ? CANUSB_SUCCESS : ret;
+}
+
+CANUSB_Return_t CANUSB_ReapIoRing(CANUSB_IoRing_t ioRing, CANUSB_IoCompletion_t *completions, UInt32 count, UInt16 timeout, UInt32 *reaped) {
+    struct timespec absTime;
+    UInt32 n = 0U;
+    int res = 0;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!ioRing || !completions || !reaped)
+        return CANUSB_ERROR_NULLPTR;
+
+    GetAbsoluteTime(&absTime, timeout);
+    ENTER_RING_SECTION(ioRing);
+    /* wait for at least one completion (0 = polling, CANUSB_INFINITE = blocking) */
+    while (!ioRing->used && timeout && (res == 0)) {
+        if (timeout == CANUSB_INFINITE)
+            res = pthread_cond_wait(&ioRing->ptCond, &ioRing->ptMutex);
+        else
+            res = pthread_cond_timedwait(&ioRing->ptCond, &ioRing->ptMutex, &absTime);
+    }
+    /* reap the completions (in the order of completion) */
+    while (ioRing->used && (n < count)) {
+        completions[n++] = ioRing->cq[ioRing->head];
+        ioRing->head = (ioRing->head + 1U) % ioRing->entries;
+        ioRing->used--;
+    }
+    LEAVE_RING_SECTION(ioRing);
+    *reaped = n;
+    return (n > 0U) ? CANUSB_SUCCESS : CANUSB_ERROR_EMPTY;
+}
+
+Boolean CANUSB_IsPipeAsyncRunning(CANUSB_AsyncPipe_t asyncPipe) {
+    Boolean running = false;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return false;
+    /* check for NULL pointer */
+    if (!asyncPipe)
+        return false;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return false;
+
+    /* return true if asynchronous operation is running, false otherwise */
+    MACCAN_DEBUG_FUNC("lock #%i (%u)\n", asyncPipe->handle, asyncPipe->pipeRef);
+    ENTER_SHARED_SECTION(asyncPipe->handle);
+    running = asyncPipe->running;
+    LEAVE_SHARED_SECTION(asyncPipe->handle);
+    MACCAN_DEBUG_FUNC("unlocked\n");
+    return running;
+}
+
+CANUSB_Index_t CANUSB_GetFirstDevice(void) {
+    CANUSB_Index_t index = CANUSB_INVALID_INDEX;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_INVALID_INDEX;
+
+    /* get the first registered device, if any */
+    // if (idxDevice != 0)  // note: logically equivalent
+        idxDevice = 0;
+    while (idxDevice < GET_NUM_SLOTS()) {
+        if (usbDevice[idxDevice].fPresent &&
+            HAS_DEVICE(idxDevice)) {
+            index = idxDevice;
+            break;
+        }
+        idxDevice++;
+    }
+    return index;
+}
+
+CANUSB_Index_t CANUSB_GetNextDevice(void) {
+    CANUSB_Index_t index = CANUSB_INVALID_INDEX;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_INVALID_INDEX;
+
+    /* get the next registered device, if any */
+    if (idxDevice < GET_NUM_SLOTS())
+        idxDevice += 1;
+    while (idxDevice < GET_NUM_SLOTS()) {
+        if (usbDevice[idxDevice].fPresent &&
+            HAS_DEVICE(idxDevice)) {
+            index = idxDevice;
+            break;
+        }
+        idxDevice++;
+    }
+    return index;
+}
+
+Boolean CANUSB_IsDevicePresent(CANUSB_Index_t index) {
+    Boolean ret = false;
 
     /* must be initialized */
     if (!fInitialized)
@@ -1203,25 +2726,30 @@ Boolean CANUSB_IsDeviceInUse(CANUSB_Index_t index) {
         return false;
 
     MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
+    ENTER_SHARED_SECTION(index);
     if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
-        if (usbDevice[index].usbInterface.fOpened &&
-            (usbDevice[index].usbInterface.ioInterface != NULL))
-            ret = true;
-        else {
-            /* check if the device is used by another process by trying to open it in exclusive mode*/
-            kr = (*usbDevice[index].ioDevice)->USBDeviceOpen(usbDevice[index].ioDevice);
-            if (kIOReturnSuccess == kr)  /* note: if not then close the device immediately! */
-                (void)(*usbDevice[index].ioDevice)->USBDeviceClose(usbDevice[index].ioDevice);
-            ret = (kIOReturnSuccess != kr) ? true : false;
-        }
-    }
-    LEAVE_CRITICAL_SECTION(index);
+        HAS_DEVICE(index))
+        ret = true;
+    LEAVE_SHARED_SECTION(index);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
+Boolean CANUSB_IsDeviceInUse(CANUSB_Index_t index) {
+    CANUSB_DeviceState_t state;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return false;
+    /* must be a valid index */
+    if (!IS_INDEX_VALID(index))
+        return false;
+
+    /* note: served from the cached occupancy state (re-probed when stale) */
+    state = GetDeviceState(index);
+    return ((state == CANUSB_DEVICE_ATTACHED) || (state == CANUSB_DEVICE_HIJACKED)) ? true : false;
+}
+
 Boolean CANUSB_IsDeviceOpened(CANUSB_Index_t index) {
     Boolean ret = false;
 
@@ -1233,57 +2761,135 @@ Boolean CANUSB_IsDeviceOpened(CANUSB_Index_t index) {
         return false;
 
     MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
+    ENTER_SHARED_SECTION(index);
     if (usbDevice[index].fPresent &&
         (usbDevice[index].ioDevice != NULL) &&
-        (usbDevice[index].usbInterface.fOpened) &&
-        (usbDevice[index].usbInterface.ioInterface != NULL))
+        (OpenedChannels(index) != 0U))
         ret = true;
-    LEAVE_CRITICAL_SECTION(index);
+    LEAVE_SHARED_SECTION(index);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
+CANUSB_Return_t CANUSB_EnumerateDevices(CANUSB_DeviceInfo_t *devices, UInt32 maxDevices, UInt32 *count, UInt32 *generation) {
+    UInt32 n, i, entries, pass, tag;
+    int index;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if ((!devices && maxDevices) || !count)
+        return CANUSB_ERROR_NULLPTR;
+
+    /* note: the generation is bumped after each change of a device state, so the snapshot belongs to
+     *       the generation taken before it if that has not changed until the devices have been probed */
+    for (pass = 1U; ; pass++) {
+        tag = __atomic_load_n(&usbRegistry.generation, __ATOMIC_ACQUIRE);
+        n = 0U;
+        /* note: the slots are copied under the registry mutex, but the devices are probed after releasing it
+         *       (probing opens the device), so a slow device stalls neither the hot-plug handling nor others */
+        assert(0 == pthread_mutex_lock(&usbRegistry.ptMutex));
+        for (index = 0; index < usbRegistry.nSlots; index++) {
+            ENTER_SHARED_SECTION(index);
+            if (usbDevice[index].fPresent &&
+                HAS_DEVICE(index)) {
+                if (n < maxDevices) {
+                    bzero(&devices[n], sizeof(CANUSB_DeviceInfo_t));
+                    devices[n].index = (CANUSB_Index_t)index;
+                    devices[n].vendorId = usbDevice[index].u16VendorId;
+                    devices[n].productId = usbDevice[index].u16ProductId;
+                    devices[n].releaseNo = usbDevice[index].u16ReleaseNo;
+                    devices[n].location = usbDevice[index].u32Location;
+                    devices[n].address = usbDevice[index].u16Address;
+                    devices[n].numChannels = usbDevice[index].nCanChannels;
+                    devices[n].state = GET_OCCUPANCY(index);
+                }
+                n++;
+            }
+            LEAVE_SHARED_SECTION(index);
+        }
+        assert(0 == pthread_mutex_unlock(&usbRegistry.ptMutex));
+        /* the last pass takes the cached occupancy state (as of the snapshot) */
+        if (pass >= ENUMERATE_PASSES)
+            break;
+        /* occupancy state of the copied devices (probed if stale, each under its own lock) */
+        entries = (n < maxDevices) ? n : maxDevices;
+        for (i = 0U; i < entries; i++)
+            devices[i].state = GetDeviceState((int)devices[i].index);
+        /* a device added, removed, opened or closed meanwhile: take the snapshot again */
+        if (__atomic_load_n(&usbRegistry.generation, __ATOMIC_ACQUIRE) == tag)
+            break;
+    }
+    if (generation)
+        *generation = tag;
+    /* number of present devices (can be greater than the array) */
+    *count = n;
+    return CANUSB_SUCCESS;
+}
+
+UInt32 CANUSB_GetDeviceGeneration(void) {
+    /* changes on each plug, unplug, open and close */
+    return __atomic_load_n(&usbRegistry.generation, __ATOMIC_ACQUIRE);
+}
+
+CANUSB_Index_t CANUSB_FindDevice(UInt16 vendorId, UInt16 productId, UInt32 instance) {
+    UInt32 id = REGISTRY_ID(vendorId, productId);
+    CANUSB_Index_t index = CANUSB_INVALID_INDEX;
+    SInt16 slot;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_INVALID_INDEX;
+
+    /* look up the n-th registered device with the given vendor/product ID */
+    assert(0 == pthread_mutex_lock(&usbRegistry.ptMutex));
+    for (slot = usbRegistry.byId[REGISTRY_HASH(id)]; slot != REGISTRY_NONE; slot = usbRegistry.nextId[slot]) {
+        if ((usbRegistry.id[slot] == id) && (instance-- == 0U)) {
+            index = (CANUSB_Index_t)slot;
+            break;
+        }
+    }
+    assert(0 == pthread_mutex_unlock(&usbRegistry.ptMutex));
+    return index;
+}
+
 CANUSB_Return_t CANUSB_GetDeviceState(CANUSB_Index_t index, CANUSB_DeviceState_t *state) {
     int ret = 0;
-    IOReturn kr;
 
     /* must be initialized */
     if (!fInitialized)
         return CANUSB_ERROR_NOTINIT;
     /* must be a valid index */
-    if (!IS_INDEX_VALID(index))
+    if (!IS_INDEX_IN_RANGE(index))
         return CANUSB_ERROR_HANDLE;
     /* check for NULL pointer */
     if (!state)
         return CANUSB_ERROR_NULLPTR;
-
-    MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
-    if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
-        if (usbDevice[index].usbInterface.fOpened &&
-            (usbDevice[index].usbInterface.ioInterface != NULL)) {
-            /* device used by own process */
-            *state = CANUSB_DEVICE_ATTACHED;
-            ret = CANUSB_SUCCESS;
-        } else {
-            /* check if the device is used by another process by trying to open it in exclusive mode */
-            kr = (*usbDevice[index].ioDevice)->USBDeviceOpen(usbDevice[index].ioDevice);
-            if (kIOReturnSuccess == kr)  /* note: if successful then close the device immediately! */
-                (void)(*usbDevice[index].ioDevice)->USBDeviceClose(usbDevice[index].ioDevice);
-            *state = (kIOReturnSuccess != kr) ? CANUSB_DEVICE_HIJACKED : CANUSB_DEVICE_AVAILABLE;
-            ret = CANUSB_SUCCESS;
-        }
-    } else {
+    /* a slot not yet in use has no device */
+    if (!IS_INDEX_VALID(index)) {
         *state = CANUSB_DEVICE_UNAVAILABLE;
-        ret = CANUSB_SUCCESS;
+        return CANUSB_SUCCESS;
     }
-    LEAVE_CRITICAL_SECTION(index);
-    MACCAN_DEBUG_FUNC("unlocked\n");
+
+    /* note: served from the cached occupancy state (re-probed when stale) */
+    *state = GetDeviceState(index);
+    ret = CANUSB_SUCCESS;
     return ret;
 }
 
+CANUSB_Return_t CANUSB_SetWarmStandby(UInt32 milliseconds) {
+    /* grace period of a closed device (0 = close at once) */
+    __atomic_store_n(&warmStandby, milliseconds, __ATOMIC_RELAXED);
+    return CANUSB_SUCCESS;
+}
+
+CANUSB_Return_t CANUSB_SetOccupancyTimeout(UInt32 milliseconds) {
+    /* staleness bound of the cached occupancy state (0 = always probe) */
+    __atomic_store_n(&occupancyTimeout, milliseconds, __ATOMIC_RELAXED);
+    return CANUSB_SUCCESS;
+}
+
 CANUSB_Return_t CANUSB_GetDeviceUsbName(CANUSB_Index_t index, char *buffer, size_t n) {
     int ret = 0;
 
@@ -1300,9 +2906,9 @@ CANUSB_Return_t CANUSB_GetDeviceUsbName(CANUSB_Index_t index, char *buffer, size
     bzero(buffer, n);
 
     MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
+    ENTER_SHARED_SECTION(index);
     if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
+        HAS_DEVICE(index)) {
         if (n > 0U) {
             strncpy(buffer, usbDevice[index].szName, n);
             buffer[(n - 1U)] = '\0';
@@ -1311,7 +2917,7 @@ CANUSB_Return_t CANUSB_GetDeviceUsbName(CANUSB_Index_t index, char *buffer, size
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
+    LEAVE_SHARED_SECTION(index);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
@@ -1337,8 +2943,11 @@ CANUSB_Return_t CANUSB_GetDeviceVendorName(CANUSB_Index_t index, char *buffer, s
     /* empty string for the error case */
     bzero(buffer, n);
 
+    /* the device interface is needed (note: it is created on demand) */
+    (void)RequireDeviceInterface(index);
+
     MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
+    ENTER_SHARED_SECTION(index);
     if (usbDevice[index].fPresent &&
         (usbDevice[index].ioDevice != NULL)) {
         kr = (*usbDevice[index].ioDevice)->USBGetManufacturerStringIndex(usbDevice[index].ioDevice, &si);
@@ -1352,7 +2961,7 @@ CANUSB_Return_t CANUSB_GetDeviceVendorName(CANUSB_Index_t index, char *buffer, s
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
+    LEAVE_SHARED_SECTION(index);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
@@ -1377,8 +2986,11 @@ CANUSB_Return_t CANUSB_GetDeviceProductName(CANUSB_Index_t index, char *buffer,
     /* empty string for the error case */
     bzero(buffer, n);
 
+    /* the device interface is needed (note: it is created on demand) */
+    (void)RequireDeviceInterface(index);
+
     MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
+    ENTER_SHARED_SECTION(index);
     if (usbDevice[index].fPresent &&
         (usbDevice[index].ioDevice != NULL)) {
         kr = (*usbDevice[index].ioDevice)->USBGetProductStringIndex(usbDevice[index].ioDevice, &si);
@@ -1392,7 +3004,7 @@ CANUSB_Return_t CANUSB_GetDeviceProductName(CANUSB_Index_t index, char *buffer,
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
+    LEAVE_SHARED_SECTION(index);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
@@ -1417,8 +3029,11 @@ CANUSB_Return_t CANUSB_GetDeviceSerialNumber(CANUSB_Index_t index, char *buffer,
     /* empty string for the error case */
     bzero(buffer, n);
     
+    /* the device interface is needed (note: it is created on demand) */
+    (void)RequireDeviceInterface(index);
+
     MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
+    ENTER_SHARED_SECTION(index);
     if (usbDevice[index].fPresent &&
         (usbDevice[index].ioDevice != NULL)) {
         kr = (*usbDevice[index].ioDevice)->USBGetSerialNumberStringIndex(usbDevice[index].ioDevice, &si);
@@ -1432,13 +3047,14 @@ CANUSB_Return_t CANUSB_GetDeviceSerialNumber(CANUSB_Index_t index, char *buffer,
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
+    LEAVE_SHARED_SECTION(index);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 #endif
 
 CANUSB_Return_t CANUSB_GetDeviceVendorId(CANUSB_Index_t index, UInt16 *value) {
+    CANUSB_Properties_t properties;
     int ret = 0;
 
     /* must be initialized */
@@ -1451,21 +3067,18 @@ CANUSB_Return_t CANUSB_GetDeviceVendorId(CANUSB_Index_t index, UInt16 *value) {
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
-    if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
-        *value = usbDevice[index].u16VendorId;
+    /* note: lock-free read from the property snapshot */
+    if (ReadProperties(index, &properties, CANUSB_INVALID_HANDLE) & PROPERTIES_PRESENT) {
+        *value = properties.vendorId;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Return_t CANUSB_GetDeviceProductId(CANUSB_Index_t index, UInt16 *value) {
+    CANUSB_Properties_t properties;
     int ret = 0;
 
     /* must be initialized */
@@ -1478,21 +3091,18 @@ CANUSB_Return_t CANUSB_GetDeviceProductId(CANUSB_Index_t index, UInt16 *value) {
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
-    if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
-        *value = usbDevice[index].u16ProductId;
+    /* note: lock-free read from the property snapshot */
+    if (ReadProperties(index, &properties, CANUSB_INVALID_HANDLE) & PROPERTIES_PRESENT) {
+        *value = properties.productId;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Return_t CANUSB_GetDeviceReleaseNo(CANUSB_Index_t index, UInt16 *value) {
+    CANUSB_Properties_t properties;
     int ret = 0;
 
     /* must be initialized */
@@ -1505,21 +3115,18 @@ CANUSB_Return_t CANUSB_GetDeviceReleaseNo(CANUSB_Index_t index, UInt16 *value) {
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
-    if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
-        *value = usbDevice[index].u16ReleaseNo;
+    /* note: lock-free read from the property snapshot */
+    if (ReadProperties(index, &properties, CANUSB_INVALID_HANDLE) & PROPERTIES_PRESENT) {
+        *value = properties.releaseNo;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Return_t CANUSB_GetDeviceLocation(CANUSB_Index_t index, UInt32 *value) {
+    CANUSB_Properties_t properties;
     int ret = 0;
 
     /* must be initialized */
@@ -1532,21 +3139,18 @@ CANUSB_Return_t CANUSB_GetDeviceLocation(CANUSB_Index_t index, UInt32 *value) {
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
-    if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
-        *value = usbDevice[index].u32Location;
+    /* note: lock-free read from the property snapshot */
+    if (ReadProperties(index, &properties, CANUSB_INVALID_HANDLE) & PROPERTIES_PRESENT) {
+        *value = properties.location;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Return_t CANUSB_GetDeviceAddress(CANUSB_Index_t index, UInt16 *value) {
+    CANUSB_Properties_t properties;
     int ret = 0;
 
     /* must be initialized */
@@ -1559,21 +3163,18 @@ CANUSB_Return_t CANUSB_GetDeviceAddress(CANUSB_Index_t index, UInt16 *value) {
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
-    if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
-        *value = usbDevice[index].u16Address;
+    /* note: lock-free read from the property snapshot */
+    if (ReadProperties(index, &properties, CANUSB_INVALID_HANDLE) & PROPERTIES_PRESENT) {
+        *value = properties.address;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Return_t CANUSB_GetDeviceNumCanChannels(CANUSB_Index_t index, UInt8 *value) {
+    CANUSB_Properties_t properties;
     int ret = 0;
 
     /* must be initialized */
@@ -1586,17 +3187,13 @@ CANUSB_Return_t CANUSB_GetDeviceNumCanChannels(CANUSB_Index_t index, UInt8 *valu
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
-    if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
-        *value = (UInt8)usbDevice[index].nCanChannels;
+    /* note: lock-free read from the property snapshot */
+    if (ReadProperties(index, &properties, CANUSB_INVALID_HANDLE) & PROPERTIES_PRESENT) {
+        *value = properties.numChannels;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
@@ -1616,9 +3213,9 @@ CANUSB_Return_t CANUSB_GetDeviceCanDescriptor(CANUSB_Index_t index, CANUSB_Descr
     bzero(descriptor, size);
 
     MACCAN_DEBUG_FUNC("lock #%i\n", index);
-    ENTER_CRITICAL_SECTION(index);
+    ENTER_SHARED_SECTION(index);
     if (usbDevice[index].fPresent &&
-        (usbDevice[index].ioDevice != NULL)) {
+        HAS_DEVICE(index)) {
         if (usbDevice[index].ptrCanDevice) {
             memcpy(descriptor, usbDevice[index].ptrCanDevice, size);
         } else {
@@ -1629,12 +3226,37 @@ CANUSB_Return_t CANUSB_GetDeviceCanDescriptor(CANUSB_Index_t index, CANUSB_Descr
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not available\n", index);
         ret = CANUSB_ERROR_HANDLE;
     }
-    LEAVE_CRITICAL_SECTION(index);
+    LEAVE_SHARED_SECTION(index);
     MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
+CANUSB_Return_t CANUSB_GetDeviceProperties(CANUSB_Handle_t handle, CANUSB_Properties_t *properties) {
+    UInt32 flags;
+    int ret = 0;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(handle))
+        return CANUSB_ERROR_HANDLE;
+    /* check for NULL pointer */
+    if (!properties)
+        return CANUSB_ERROR_NULLPTR;
+
+    /* note: lock-free read of the whole property block */
+    flags = ReadProperties(HANDLE_INDEX(handle), properties, handle);
+    if (!(flags & PROPERTIES_OPENED)) {
+        MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (GetDeviceProperties)\n", handle);
+        ret = !(flags & PROPERTIES_PRESENT) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+    }
+    return ret;
+}
+
 CANUSB_Return_t CANUSB_GetInterfaceClass(CANUSB_Handle_t handle, UInt8 *value) {
+    CANUSB_Properties_t properties;
+    UInt32 flags;
     int ret = 0;
 
     /* must be initialized */
@@ -1647,23 +3269,20 @@ CANUSB_Return_t CANUSB_GetInterfaceClass(CANUSB_Handle_t handle, UInt8 *value) {
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", handle);
-    ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].ioDevice != NULL) &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-        *value = usbDevice[handle].usbInterface.u8Class;
+    /* note: lock-free read from the property snapshot */
+    flags = ReadProperties(HANDLE_INDEX(handle), &properties, handle);
+    if (flags & PROPERTIES_OPENED) {
+        *value = properties.interfaceClass;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (GetInterfaceClass)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !(flags & PROPERTIES_PRESENT) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
-    LEAVE_CRITICAL_SECTION(handle);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Return_t CANUSB_GetInterfaceSubClass(CANUSB_Handle_t handle, UInt8 *value) {
+    CANUSB_Properties_t properties;
+    UInt32 flags;
     int ret = 0;
 
     /* must be initialized */
@@ -1676,23 +3295,20 @@ CANUSB_Return_t CANUSB_GetInterfaceSubClass(CANUSB_Handle_t handle, UInt8 *value
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", handle);
-    ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].ioDevice != NULL) &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-        *value = usbDevice[handle].usbInterface.u8SubClass;
+    /* note: lock-free read from the property snapshot */
+    flags = ReadProperties(HANDLE_INDEX(handle), &properties, handle);
+    if (flags & PROPERTIES_OPENED) {
+        *value = properties.interfaceSubClass;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (GetInterfaceSubClass)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !(flags & PROPERTIES_PRESENT) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
-    LEAVE_CRITICAL_SECTION(handle);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Return_t CANUSB_GetInterfaceProtocol(CANUSB_Handle_t handle, UInt8 *value) {
+    CANUSB_Properties_t properties;
+    UInt32 flags;
     int ret = 0;
 
     /* must be initialized */
@@ -1705,23 +3321,20 @@ CANUSB_Return_t CANUSB_GetInterfaceProtocol(CANUSB_Handle_t handle, UInt8 *value
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", handle);
-    ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].ioDevice != NULL) &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-        *value = usbDevice[handle].usbInterface.u8Protocol;
+    /* note: lock-free read from the property snapshot */
+    flags = ReadProperties(HANDLE_INDEX(handle), &properties, handle);
+    if (flags & PROPERTIES_OPENED) {
+        *value = properties.interfaceProtocol;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (GetInterfaceProtocol)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !(flags & PROPERTIES_PRESENT) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
-    LEAVE_CRITICAL_SECTION(handle);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Return_t CANUSB_GetInterfaceNumEndpoints(CANUSB_Handle_t handle, UInt8 *value) {
+    CANUSB_Properties_t properties;
+    UInt32 flags;
     int ret = 0;
 
     /* must be initialized */
@@ -1734,29 +3347,20 @@ CANUSB_Return_t CANUSB_GetInterfaceNumEndpoints(CANUSB_Handle_t handle, UInt8 *v
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", handle);
-    ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].ioDevice != NULL) &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-        *value = usbDevice[handle].usbInterface.u8NumEndpoints;
+    /* note: lock-free read from the property snapshot */
+    flags = ReadProperties(HANDLE_INDEX(handle), &properties, handle);
+    if (flags & PROPERTIES_OPENED) {
+        *value = properties.numEndpoints;
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (GetInterfaceNumEndpoints)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !(flags & PROPERTIES_PRESENT) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
-    LEAVE_CRITICAL_SECTION(handle);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Return_t CANUSB_GetInterfaceEndpointDirection(CANUSB_Handle_t handle, UInt8 index, UInt8 *value) {
-    IOReturn        kr2;
-    UInt8           direction;
-    UInt8           number;
-    UInt8           transferType;
-    UInt16          maxPacketSize;
-    UInt8           interval;
+    CANUSB_Properties_t properties;
+    UInt32 flags;
     int ret = 0;
 
     /* must be initialized */
@@ -1769,124 +3373,988 @@ CANUSB_Return_t CANUSB_GetInterfaceEndpointDirection(CANUSB_Handle_t handle, UIn
     if (!value)
         return CANUSB_ERROR_NULLPTR;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", handle);
-    ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].ioDevice != NULL) &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-        kr2 = (*usbDevice[handle].usbInterface.ioInterface)->GetPipeProperties(usbDevice[handle].usbInterface.ioInterface,
-                index, &direction, &number, &transferType, &maxPacketSize, &interval);
-        if (kIOReturnSuccess != kr2) {
-            MACCAN_DEBUG_ERROR("+++ Unable to get properties of pipe #%i (%08x)\n", index, kr2);
-            ret = CANUSB_ERROR_RESOURCE;
-        } else {
+    /* note: lock-free read from the property snapshot (pipe properties are read when the device is opened) */
+    flags = ReadProperties(HANDLE_INDEX(handle), &properties, handle);
+    if (flags & PROPERTIES_OPENED) {
+        if ((index < CANUSB_MAX_PIPES) && (properties.validPipes & ((UInt32)1 << index))) {
             /* 0 = out / 1 = in / 2 = none */
-            *value = direction;
+            *value = properties.pipe[index].direction;
+        } else {
+            MACCAN_DEBUG_ERROR("+++ Unable to get properties of pipe #%i\n", index);
+            ret = CANUSB_ERROR_RESOURCE;
         }
     } else {
         MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (GetInterfaceEndpointDirection)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        ret = !(flags & PROPERTIES_PRESENT) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
     }
-    LEAVE_CRITICAL_SECTION(handle);
-    MACCAN_DEBUG_FUNC("unlocked\n");
     return ret;
 }
 
 CANUSB_Return_t CANUSB_GetInterfaceEndpointTransferType(CANUSB_Handle_t handle, UInt8 index, UInt8 *value) {
-    IOReturn        kr2;
-    UInt8           direction;
-    UInt8           number;
-    UInt8           transferType;
-    UInt16          maxPacketSize;
-    UInt8           interval;
+    CANUSB_Properties_t properties;
+    UInt32 flags;
     int ret = 0;
 
-    /* must be initialized */
-    if (!fInitialized)
-        return CANUSB_ERROR_NOTINIT;
-    /* must be a valid handle */
-    if (!IS_HANDLE_VALID(handle))
-        return CANUSB_ERROR_HANDLE;
-    /* check for NULL pointer */
-    if (!value)
-        return CANUSB_ERROR_NULLPTR;
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(handle))
+        return CANUSB_ERROR_HANDLE;
+    /* check for NULL pointer */
+    if (!value)
+        return CANUSB_ERROR_NULLPTR;
+
+    /* note: lock-free read from the property snapshot (pipe properties are read when the device is opened) */
+    flags = ReadProperties(HANDLE_INDEX(handle), &properties, handle);
+    if (flags & PROPERTIES_OPENED) {
+        if ((index < CANUSB_MAX_PIPES) && (properties.validPipes & ((UInt32)1 << index))) {
+            /* 0 = control / 1 = isoc / 2 = bulk / 3 = interrupt */
+            *value = properties.pipe[index].transferType;
+        } else {
+            MACCAN_DEBUG_ERROR("+++ Unable to get properties of pipe #%i\n", index);
+            ret = CANUSB_ERROR_RESOURCE;
+        }
+    } else {
+        MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (GetInterfaceEndpointTransferType)\n", handle);
+        ret = !(flags & PROPERTIES_PRESENT) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+    }
+    return ret;
+}
+
+CANUSB_Return_t CANUSB_GetInterfaceEndpointMaxPacketSize(CANUSB_Handle_t handle, UInt8 index, UInt16 *value) {
+    CANUSB_Properties_t properties;
+    UInt32 flags;
+    int ret = 0;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* must be a valid handle */
+    if (!IS_HANDLE_VALID(handle))
+        return CANUSB_ERROR_HANDLE;
+    /* check for NULL pointer */
+    if (!value)
+        return CANUSB_ERROR_NULLPTR;
+
+    /* note: lock-free read from the property snapshot (pipe properties are read when the device is opened) */
+    flags = ReadProperties(HANDLE_INDEX(handle), &properties, handle);
+    if (flags & PROPERTIES_OPENED) {
+        if ((index < CANUSB_MAX_PIPES) && (properties.validPipes & ((UInt32)1 << index))) {
+            /* as a 16-bit value */
+            *value = properties.pipe[index].maxPacketSize;
+        } else {
+            MACCAN_DEBUG_ERROR("+++ Unable to get properties of pipe #%i\n", index);
+            ret = CANUSB_ERROR_RESOURCE;
+        }
+    } else {
+        MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (GetInterfaceEndpointMaxPacketSize)\n", handle);
+        ret = !(flags & PROPERTIES_PRESENT) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+    }
+    return ret;
+}
+
+UInt32 CANUSB_GetVersion(void) {
+    return ((UInt32)VERSION_MAJOR << 24) |
+           ((UInt32)VERSION_MINOR << 16) |
+           ((UInt32)VERSION_PATCH << 8);
+}
+
+UInt64 CANUSB_GetHostTime(void) {
+    /* monotonic host time in [ns] (same time base as the completion timestamps) */
+    return GetTimestamp();
+}
+
+UInt32 CANUSB_GetRevision(void) {
+    return (UInt32)usbDriver.nRevision;
+}
+
+#if (OPTION_MACCAN_SIMULATION != 0)
+typedef struct usb_simulate_tag {           /* Simulated (un-)plug: */
+    IOUSBDeviceInterface **ioDevice;        /*   device interface (simulation) */
+    const char *name;                       /*   device name */
+    UInt32 location;                        /*   location ID (unplug) */
+    int index;                              /*   resulting device index (plug) */
+} USBSimulate_t;
+
+static void SimulatedDeviceAdded(void *info) {
+    USBSimulate_t *simulate = (USBSimulate_t*)info;
+
+    /* performed on the run loop (as if by a matching notification) */
+    simulate->index = AttachDevice(IO_OBJECT_NULL, simulate->ioDevice, simulate->name);
+}
+
+static void SimulatedDeviceRemoved(void *info) {
+    USBSimulate_t *simulate = (USBSimulate_t*)info;
+
+    /* performed on the run loop (as if by a termination notification) */
+    DetachDevice(simulate->location);
+}
+
+CANUSB_Return_t CANUSB_SimulateDeviceAdded(void *ioDevice, const char *name) {
+    USBSimulate_t simulate;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+    /* check for NULL pointer */
+    if (!ioDevice || !name)
+        return CANUSB_ERROR_NULLPTR;
+
+    /* note: the device interface must be valid until the device is removed */
+    simulate.ioDevice = (IOUSBDeviceInterface **)ioDevice;
+    simulate.name = name;
+    simulate.location = 0U;
+    simulate.index = CANUSB_INVALID_INDEX;
+    if (!PerformOnRunLoop(SimulatedDeviceAdded, (void*)&simulate, true))
+        return CANUSB_ERROR_RESOURCE;
+    if (simulate.index == CANUSB_INVALID_INDEX)
+        return CANUSB_ERROR_RESOURCE;
+    return CANUSB_SUCCESS;
+}
+
+CANUSB_Return_t CANUSB_SimulateDeviceRemoved(UInt32 location) {
+    USBSimulate_t simulate;
+
+    /* must be initialized */
+    if (!fInitialized)
+        return CANUSB_ERROR_NOTINIT;
+
+    /* note: the location ID must not be zero */
+    if (location) {
+        bzero(&simulate, sizeof(USBSimulate_t));
+        simulate.location = location;
+        if (!PerformOnRunLoop(SimulatedDeviceRemoved, (void*)&simulate, true))
+            return CANUSB_ERROR_RESOURCE;
+    }
+    return CANUSB_SUCCESS;
+}
+#endif
+
+static IOReturn SubmitRead(CANUSB_Transfer_t *transfer) {
+    CANUSB_AsyncPipe_t asyncPipe = transfer->asyncPipe;
+    IOUSBInterfaceInterface **interface;
+    IOReturn kr;
+
+    /* sanity check */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return kIOReturnNotOpen;
+    if ((interface = asyncPipe->ioInterface) == NULL)
+        return kIOReturnNotOpen;
+    /* asynchronous pipe read event (with the transfer as reference, 6th argument) */
+    transfer->pending = true;
+    ADD_INFLIGHT(asyncPipe->handle);
+    kr = (*interface)->ReadPipeAsync(interface, asyncPipe->pipeRef, transfer->data, asyncPipe->buffer.size,
+                                     ReadPipeCallback, (void*)transfer);
+    if (kIOReturnSuccess != kr) {
+        SUB_INFLIGHT(asyncPipe->handle);
+        transfer->pending = false;
+        asyncPipe->stats.rearmFailures++;
+    } else if (transfer->timestamp) {
+        /* time from completion to re-arm of the transfer */
+        UpdateHistogram(asyncPipe->stats.rearmGap, GetTimestamp() - transfer->timestamp);
+    }
+    return kr;
+}
+
+static IOReturn SubmitWrite(CANUSB_Transfer_t *transfer, UInt32 size) {
+    CANUSB_AsyncPipe_t asyncPipe = transfer->asyncPipe;
+    IOUSBInterfaceInterface **interface;
+    IOReturn kr;
+
+    /* sanity check */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return kIOReturnNotOpen;
+    if ((interface = asyncPipe->ioInterface) == NULL)
+        return kIOReturnNotOpen;
+    /* asynchronous pipe write event (with the transfer as reference, 6th resp. 8th argument) */
+    transfer->pending = true;
+    ADD_INFLIGHT(asyncPipe->handle);
+#if (OPTION_MACCAN_PIPE_TIMEOUT == 0)
+    /* note: deactivate define if WritePipeAsyncTO() is not available in IOUSBInterfaceStructXYZ for the device. */
+    kr = (*interface)->WritePipeAsync(interface, asyncPipe->pipeRef, transfer->data, size,
+                                      WritePipeCallback, (void*)transfer);
+#else
+    if (asyncPipe->completionTimeout)
+        kr = (*interface)->WritePipeAsyncTO(interface, asyncPipe->pipeRef, transfer->data, size,
+                                            asyncPipe->noDataTimeout, asyncPipe->completionTimeout,
+                                            WritePipeCallback, (void*)transfer);
+    else
+        kr = (*interface)->WritePipeAsync(interface, asyncPipe->pipeRef, transfer->data, size,
+                                          WritePipeCallback, (void*)transfer);
+#endif
+    if (kIOReturnSuccess != kr) {
+        SUB_INFLIGHT(asyncPipe->handle);
+        transfer->pending = false;
+    }
+    return kr;
+}
+
+static Boolean IsPipeAsyncPending(CANUSB_AsyncPipe_t asyncPipe) {
+    UInt32 index;
+
+    /* true if at least one transfer is outstanding */
+    for (index = 0U; index < asyncPipe->buffer.depth; index++) {
+        if (asyncPipe->buffer.transfer[index].pending)
+            return true;
+    }
+    /* or a registered caller buffer is still referenced */
+    for (index = 0U; index < CANUSB_MAX_REGISTERED_BUFFERS; index++) {
+        if (asyncPipe->registered[index].pending)
+            return true;
+    }
+    return false;
+}
+
+static UInt32 GetTransferCapacity(CANUSB_AsyncPipe_t asyncPipe) {
+    UInt32 maxPacketSize = (UInt32)asyncPipe->maxPacketSize;
+
+    /* a multiple of the max. packet size of the endpoint (if known), so only the last packet is short */
+    if (maxPacketSize && (maxPacketSize <= asyncPipe->buffer.size))
+        return (asyncPipe->buffer.size / maxPacketSize) * maxPacketSize;
+    else
+        return asyncPipe->buffer.size;
+}
+
+static int GetBufferNumber(CANUSB_AsyncPipe_t asyncPipe, const UInt8 *buffer) {
+    size_t offset;
+
+    /* number of a buffer of the pipe: the transfer buffers first, then the spare buffers (-1 = none) */
+    if (!buffer || !asyncPipe->buffer.size)
+        return -1;
+    if (asyncPipe->buffer.block && (asyncPipe->buffer.block <= buffer) &&
+        (buffer < &asyncPipe->buffer.block[(size_t)asyncPipe->buffer.size * asyncPipe->buffer.depth])) {
+        offset = (size_t)(buffer - asyncPipe->buffer.block);
+        return (offset % asyncPipe->buffer.size) ? -1 : (int)(offset / asyncPipe->buffer.size);
+    }
+    if (asyncPipe->lending.block && (asyncPipe->lending.block <= buffer) &&
+        (buffer < &asyncPipe->lending.block[(size_t)asyncPipe->buffer.size * asyncPipe->lending.spares])) {
+        offset = (size_t)(buffer - asyncPipe->lending.block);
+        return (offset % asyncPipe->buffer.size) ? -1 : (int)(asyncPipe->buffer.depth + (offset / asyncPipe->buffer.size));
+    }
+    return -1;
+}
+
+static IOReturn FlushPipeQueue(CANUSB_AsyncPipe_t asyncPipe) {
+    CANUSB_Transfer_t *transfer = &asyncPipe->buffer.transfer[asyncPipe->buffer.index];
+    IOUSBInterfaceInterface **interface;
+    IOReturn kr;
+
+    /* note: must be called from within the pipe's critical section */
+    if (transfer->pending || !transfer->length)
+        return kIOReturnSuccess;
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        return kIOReturnNotOpen;
+    if ((interface = asyncPipe->ioInterface) == NULL)
+        return kIOReturnNotOpen;
+    /* send only the bytes actually used (with the transfer as reference) */
+    transfer->pending = true;
+    ADD_INFLIGHT(asyncPipe->handle);
+    kr = (*interface)->WritePipeAsync(interface, asyncPipe->pipeRef, transfer->data, transfer->length,
+                                      QueuePipeCallback, (void*)transfer);
+    if (kIOReturnSuccess != kr) {
+        SUB_INFLIGHT(asyncPipe->handle);
+        transfer->pending = false;
+        return kr;
+    }
+    /* fill the next transfer in the ring */
+    asyncPipe->buffer.index = (asyncPipe->buffer.index + 1U) % asyncPipe->buffer.depth;
+    return kIOReturnSuccess;
+}
+
+static UInt64 GetTimestamp(void) {
+    static mach_timebase_info_data_t timebase = { 0U, 0U };
+
+    /* monotonic time in [ns] (note: mach_absolute_time counts in ticks of the time base) */
+    if (!timebase.denom)
+        (void)mach_timebase_info(&timebase);
+    return (mach_absolute_time() * (UInt64)timebase.numer) / (UInt64)timebase.denom;
+}
+
+static CANUSB_Return_t ResultFromIOReturn(IOReturn kr) {
+    switch (kr) {
+    case kIOReturnSuccess: return CANUSB_SUCCESS;
+    case kIOUSBPipeStalled: return CANUSB_ERROR_STALLED;
+    case kIOUSBTransactionTimeout: return CANUSB_ERROR_TIMEOUT;
+    case kIOReturnOverrun: return CANUSB_ERROR_OVERRUN;
+    case kIOReturnNoDevice: return CANUSB_ERROR_HANDLE;
+    case kIOReturnNotOpen: return CANUSB_ERROR_NOTINIT;
+    default: return CANUSB_ERROR_RESOURCE;
+    }
+}
+
+static void DeliverPipeVector(CANUSB_AsyncPipe_t asyncPipe, Boolean expired) {
+    CANUSB_Transfer_t *batch[CANUSB_MAX_QUEUE_DEPTH];
+    CANUSB_PipeVector_t vector[CANUSB_MAX_QUEUE_DEPTH];
+    UInt32 count, entries, index;
+    UInt64 start;
+    IOReturn kr;
+
+    ENTER_PIPE_SECTION(asyncPipe);
+    /* deliver the batch if N transfers are collected or T micro-seconds are expired
+     * note: only one thread delivers at a time, it picks up what was collected in the meantime
+     */
+    while (!asyncPipe->destroyed && !asyncPipe->coalescing.delivering && asyncPipe->coalescing.count &&
+           (expired || !asyncPipe->coalescing.maxDelay ||
+            (asyncPipe->coalescing.count >= asyncPipe->coalescing.maxTransfers))) {
+        for (index = 0U, entries = 0U; index < asyncPipe->coalescing.count; index++) {
+            batch[index] = asyncPipe->coalescing.batch[index];
+            if (batch[index]->length) {
+                vector[entries].buffer = batch[index]->data;
+                vector[entries].length = batch[index]->length;
+                vector[entries].timestamp = batch[index]->timestamp;
+                entries++;
+            }
+        }
+        count = asyncPipe->coalescing.count;
+        asyncPipe->coalescing.count = 0U;
+        asyncPipe->coalescing.delivering = true;
+        if (asyncPipe->coalescing.armed) {
+            CFRunLoopTimerSetNextFireDate(asyncPipe->coalescing.timer, CFAbsoluteTimeGetCurrent() + TIMER_NEVER);
+            asyncPipe->coalescing.armed = false;
+        }
+        LEAVE_PIPE_SECTION(asyncPipe);
+        /* call the vectored CALLBACK routine (the buffers are valid until it returns) */
+        start = GetTimestamp();
+        if (entries)
+            asyncPipe->coalescing.callback(asyncPipe->coalescing.context, vector, entries);
+        ENTER_PIPE_SECTION(asyncPipe);
+        UpdateHistogram(asyncPipe->stats.callbackTime, GetTimestamp() - start);
+        /* re-arm the delivered transfers in the order of delivery */
+        for (index = 0U; (index < count) && asyncPipe->running; index++) {
+            kr = SubmitRead(batch[index]);
+            if (kIOReturnSuccess != kr) {
+                MACCAN_DEBUG_ERROR("+++ Unable to read async pipe #%d of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
+                asyncPipe->running = false;
+            }
+        }
+        asyncPipe->coalescing.delivering = false;
+        expired = false;
+    }
+    /* wait at most T micro-seconds for more transfers */
+    if (asyncPipe->coalescing.count && !asyncPipe->coalescing.armed && asyncPipe->coalescing.timer) {
+        CFRunLoopTimerSetNextFireDate(asyncPipe->coalescing.timer,
+                                      CFAbsoluteTimeGetCurrent() + ((CFTimeInterval)asyncPipe->coalescing.maxDelay / 1000000.0));
+        asyncPipe->coalescing.armed = true;
+    }
+    LEAVE_PIPE_SECTION(asyncPipe);
+}
+
+static void CoalescingTimerCallback(CFRunLoopTimerRef timer, void *info) {
+    CANUSB_AsyncPipe_t asyncPipe = (CANUSB_AsyncPipe_t)info;
+
+    (void)timer;
+    if (asyncPipe) {
+        ENTER_PIPE_SECTION(asyncPipe);
+        asyncPipe->coalescing.armed = false;
+        LEAVE_PIPE_SECTION(asyncPipe);
+        DeliverPipeVector(asyncPipe, true);
+    }
+}
+
+static void UpdateStats(CANUSB_PipeStats_t *stats, IOReturn result, UInt32 length, UInt32 size) {
+    /* count the completed transfer according to its result */
+    switch (result) {
+    case kIOReturnSuccess:
+        stats->transfers++;
+        stats->bytes += (UInt64)length;
+        if (length < size)
+            stats->shortTransfers++;
+        break;
+    case kIOReturnAborted:
+        stats->aborts++;
+        break;
+    case kIOUSBPipeStalled:
+        stats->stalls++;
+        break;
+    default:
+        stats->errors++;
+        break;
+    }
+}
+
+static void UpdateHistogram(UInt32 *histogram, UInt64 nanoseconds) {
+    UInt64 microseconds = nanoseconds / 1000U;
+    UInt32 bin = 0U;
+
+    /* bin 0 = below 1us, bin n = [2^(n-1), 2^n) us, the last bin takes the rest */
+    while (microseconds && (bin < (CANUSB_HISTOGRAM_BINS - 1U))) {
+        microseconds >>= 1;
+        bin++;
+    }
+    histogram[bin]++;
+}
+
+static void ScheduleRecovery(CANUSB_AsyncPipe_t asyncPipe, IOReturn result, UInt64 timestamp) {
+    /* note: called within the pipe's critical section */
+    if (!asyncPipe->recovery.initialDelay || asyncPipe->recovery.active)
+        return;
+    /* note: aborted by the application or device gone, nothing to recover */
+    if ((kIOReturnAborted == result) || (kIOReturnNoDevice == result))
+        return;
+    MACCAN_DEBUG_CORE("!!! Recovery of pipe #%d of device #%d in %ums (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle,
+                      asyncPipe->recovery.initialDelay, result);
+    asyncPipe->recovery.active = true;
+    asyncPipe->recovery.result = result;
+    asyncPipe->recovery.failedAt = timestamp;
+    asyncPipe->recovery.delay = asyncPipe->recovery.initialDelay;
+    asyncPipe->recovery.retries = 0U;
+    CFRunLoopTimerSetNextFireDate(asyncPipe->recovery.timer,
+                                  CFAbsoluteTimeGetCurrent() + ((CFTimeInterval)asyncPipe->recovery.delay / 1000.0));
+}
+
+static void RecoveryTimerCallback(CFRunLoopTimerRef timer, void *info) {
+    CANUSB_AsyncPipe_t asyncPipe = (CANUSB_AsyncPipe_t)info;
+    CANUSB_RecoveryCbk_t callback;
+    CANUSB_Context_t context;
+    UInt64 downtime = 0U;
+    Boolean reading;
+    int event, ret;
+
+    (void)timer;
+    if (!asyncPipe)
+        return;
+    ENTER_PIPE_SECTION(asyncPipe);
+    if (!asyncPipe->recovery.active || asyncPipe->destroyed) {
+        LEAVE_PIPE_SECTION(asyncPipe);
+        return;
+    }
+    reading = asyncPipe->recovery.reading;
+    /* wait until the outstanding transfers have been aborted */
+    if (IsPipeAsyncPending(asyncPipe)) {
+        CFRunLoopTimerSetNextFireDate(asyncPipe->recovery.timer,
+                                      CFAbsoluteTimeGetCurrent() + ((CFTimeInterval)asyncPipe->recovery.delay / 1000.0));
+        LEAVE_PIPE_SECTION(asyncPipe);
+        if (asyncPipe->ioInterface)
+            (void)(*asyncPipe->ioInterface)->AbortPipe(asyncPipe->ioInterface, asyncPipe->pipeRef);
+        return;
+    }
+    LEAVE_PIPE_SECTION(asyncPipe);
+
+    /* note: the device has been closed or unplugged (stale handle), there is nothing to re-arm */
+    if (!IS_HANDLE_VALID(asyncPipe->handle))
+        ret = CANUSB_ERROR_HANDLE;
+    /* clear the halt of the endpoint and re-arm the pipe */
+    else
+        ret = ResetPipeInterface(asyncPipe);
+    if ((CANUSB_SUCCESS == ret) && reading) {
+        ret = StartReadPipe(asyncPipe, asyncPipe->callback, asyncPipe->callbackEx, asyncPipe->context);
+    } else if (CANUSB_SUCCESS == ret) {
+        ENTER_PIPE_SECTION(asyncPipe);
+        ret = (kIOReturnSuccess == FlushPipeQueue(asyncPipe)) ? CANUSB_SUCCESS : CANUSB_ERROR_RESOURCE;
+        LEAVE_PIPE_SECTION(asyncPipe);
+    }
+    ENTER_PIPE_SECTION(asyncPipe);
+    if (CANUSB_SUCCESS == ret) {
+        /* recovered: report the downtime */
+        downtime = GetTimestamp() - asyncPipe->recovery.failedAt;
+        asyncPipe->recovery.active = false;
+        asyncPipe->stats.recoveries++;
+        event = CANUSB_RECOVERY_SUCCEEDED;
+    } else if ((CANUSB_ERROR_HANDLE == ret) ||
+               (asyncPipe->recovery.maxRetries && (++asyncPipe->recovery.retries >= asyncPipe->recovery.maxRetries))) {
+        /* given up: the application has to take over */
+        asyncPipe->recovery.active = false;
+        event = CANUSB_RECOVERY_FAILED;
+    } else {
+        /* retry with bounded exponential backoff */
+        asyncPipe->recovery.delay = MIN(asyncPipe->recovery.delay * 2U, asyncPipe->recovery.maxDelay);
+        /* note: the timer is gone when the recovery has been turned off meanwhile */
+        if (asyncPipe->recovery.timer)
+            CFRunLoopTimerSetNextFireDate(asyncPipe->recovery.timer,
+                                          CFAbsoluteTimeGetCurrent() + ((CFTimeInterval)asyncPipe->recovery.delay / 1000.0));
+        event = CANUSB_RECOVERY_RETRY;
+    }
+    callback = asyncPipe->recovery.callback;
+    context = asyncPipe->recovery.context;
+    if (!downtime)
+        downtime = GetTimestamp() - asyncPipe->recovery.failedAt;
+    LEAVE_PIPE_SECTION(asyncPipe);
+    MACCAN_DEBUG_CORE("!!! Recovery of pipe #%d of device #%d: event %d after %" PRIu64 "us\n", asyncPipe->pipeRef, asyncPipe->handle,
+                      event, downtime / 1000U);
+    /* report the recovery event to the application */
+    if (callback)
+        callback(context, event, ret, downtime);
+}
+
+static CANUSB_Return_t ResetPipeInterface(CANUSB_AsyncPipe_t asyncPipe) {
+    IOUSBInterfaceInterface **interface;
+    IOReturn kr;
+
+    /* note: through the pipe's own reference to the interface, not through the device table */
+    if ((interface = asyncPipe->ioInterface) == NULL)
+        return CANUSB_ERROR_HANDLE;
+    kr = (*interface)->AbortPipe(interface, asyncPipe->pipeRef);
+    if (kIOReturnSuccess == kr) {
+#if (OPTION_MACCAN_CLEAR_BOTH_ENDS == 0)
+        kr = (*interface)->ClearPipeStall(interface, asyncPipe->pipeRef);
+#else
+        kr = (*interface)->ClearPipeStallBothEnds(interface, asyncPipe->pipeRef);
+#endif
+    }
+    if (kIOReturnSuccess == kr)
+        kr = (*interface)->GetPipeStatus(interface, asyncPipe->pipeRef);
+    if (kIOReturnSuccess != kr) {
+        MACCAN_DEBUG_ERROR("+++ Unable to reset pipe #%u of device #%d (%08x)\n", asyncPipe->pipeRef, asyncPipe->handle, kr);
+        return (kIOReturnNoDevice == kr) ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_RESOURCE;
+    }
+    return CANUSB_SUCCESS;
+}
+
+static void WatchdogTimerCallback(CFRunLoopTimerRef timer, void *info) {
+    CANUSB_AsyncPipe_t asyncPipe = (CANUSB_AsyncPipe_t)info;
+    CANUSB_WatchdogCbk_t callback;
+    CANUSB_Context_t context;
+    IOUSBDeviceInterface **device = NULL;
+    UInt64 now, deadTime;
+    int event = 0;
+    int ret;
+
+    (void)timer;
+    if (!asyncPipe)
+        return;
+    now = GetTimestamp();
+    ENTER_PIPE_SECTION(asyncPipe);
+    if (asyncPipe->destroyed) {
+        LEAVE_PIPE_SECTION(asyncPipe);
+        return;
+    }
+    /* re-arm the pipe when the aborted transfers are gone */
+    if (asyncPipe->watchdog.rearm) {
+        if (IsPipeAsyncPending(asyncPipe)) {
+            LEAVE_PIPE_SECTION(asyncPipe);
+            return;
+        }
+        asyncPipe->watchdog.rearm = false;
+        LEAVE_PIPE_SECTION(asyncPipe);
+        /* note: the device has been closed or unplugged (stale handle), there is nothing to re-arm */
+        if (!IS_HANDLE_VALID(asyncPipe->handle))
+            return;
+        ret = ResetPipeInterface(asyncPipe);
+        if ((CANUSB_SUCCESS == ret) && asyncPipe->recovery.reading)
+            ret = StartReadPipe(asyncPipe, asyncPipe->callback, asyncPipe->callbackEx, asyncPipe->context);
+        if (CANUSB_SUCCESS != ret)
+            MACCAN_DEBUG_ERROR("+++ Watchdog: unable to re-arm pipe #%d of device #%d (%i)\n", asyncPipe->pipeRef, asyncPipe->handle, ret);
+        return;
+    }
+    /* note: a pipe is only dead if it has transfers in flight (or an active callback pump) */
+    if (!asyncPipe->running && !IsPipeAsyncPending(asyncPipe)) {
+        asyncPipe->watchdog.fired = 0U;
+        asyncPipe->watchdog.lastActivity = now;
+        LEAVE_PIPE_SECTION(asyncPipe);
+        return;
+    }
+    /* new completions since the watchdog fired: the pipe is alive again */
+    if (asyncPipe->watchdog.fired && (asyncPipe->watchdog.lastActivity != asyncPipe->watchdog.firedAt))
+        asyncPipe->watchdog.fired = 0U;
+    deadTime = now - asyncPipe->watchdog.lastActivity;
+    /* escalate once per level and per dead period: reset the device, re-arm the pipe, notify the application */
+    if (asyncPipe->watchdog.resetAfter && !(asyncPipe->watchdog.fired & WATCHDOG_FIRED_RESET) &&
+        (deadTime >= ((UInt64)asyncPipe->watchdog.resetAfter * 1000000U))) {
+        asyncPipe->watchdog.fired |= (WATCHDOG_FIRED_RESET | WATCHDOG_FIRED_REARM | WATCHDOG_FIRED_NOTIFY);
+        event = CANUSB_WATCHDOG_RESET;
+    } else if (asyncPipe->watchdog.rearmAfter && !(asyncPipe->watchdog.fired & WATCHDOG_FIRED_REARM) &&
+               (deadTime >= ((UInt64)asyncPipe->watchdog.rearmAfter * 1000000U))) {
+        asyncPipe->watchdog.fired |= (WATCHDOG_FIRED_REARM | WATCHDOG_FIRED_NOTIFY);
+        event = CANUSB_WATCHDOG_REARM;
+    } else if (asyncPipe->watchdog.notifyAfter && !(asyncPipe->watchdog.fired & WATCHDOG_FIRED_NOTIFY) &&
+               (deadTime >= ((UInt64)asyncPipe->watchdog.notifyAfter * 1000000U))) {
+        asyncPipe->watchdog.fired |= WATCHDOG_FIRED_NOTIFY;
+        event = CANUSB_WATCHDOG_EXPIRED;
+    }
+    if (!event) {
+        LEAVE_PIPE_SECTION(asyncPipe);
+        return;
+    }
+    asyncPipe->watchdog.firedAt = asyncPipe->watchdog.lastActivity;
+    asyncPipe->watchdog.rearm = (CANUSB_WATCHDOG_EXPIRED != event) ? true : false;
+    asyncPipe->stats.watchdogs++;
+    callback = asyncPipe->watchdog.callback;
+    context = asyncPipe->watchdog.context;
+    LEAVE_PIPE_SECTION(asyncPipe);
+    MACCAN_DEBUG_CORE("!!! Watchdog: pipe #%d of device #%d dead for %" PRIu64 "ms (event %d)\n", asyncPipe->pipeRef, asyncPipe->handle,
+                      deadTime / 1000000U, event);
+    /* reset the device (the transfers are aborted by the device reset)
+     * note: the run loop does not wait for the device lock, and the reset is issued through
+     *       a reference outside of it; when the device is busy it is only re-armed */
+    if (CANUSB_WATCHDOG_RESET == event) {
+        if (IS_HANDLE_VALID(asyncPipe->handle) && TRY_SHARED_SECTION(asyncPipe->handle)) {
+            if (usbDevice[HANDLE_INDEX(asyncPipe->handle)].fPresent && IS_HANDLE_CURRENT(asyncPipe->handle) &&
+                ((device = usbDevice[HANDLE_INDEX(asyncPipe->handle)].ioDevice) != NULL))
+                (void)(*device)->AddRef(device);
+            LEAVE_SHARED_SECTION(asyncPipe->handle);
+        }
+        if (device) {
+            (void)(*device)->ResetDevice(device);
+            (void)(*device)->Release(device);
+        } else {
+            MACCAN_DEBUG_CORE("!!! Watchdog: device #%d busy or gone, pipe #%d only re-armed\n", asyncPipe->handle, asyncPipe->pipeRef);
+            event = CANUSB_WATCHDOG_REARM;
+        }
+    }
+    /* abort the stuck transfers (they are re-armed on the next tick) */
+    if ((CANUSB_WATCHDOG_EXPIRED != event) && asyncPipe->ioInterface)
+        (void)(*asyncPipe->ioInterface)->AbortPipe(asyncPipe->ioInterface, asyncPipe->pipeRef);
+    /* report the dead time to the application */
+    if (callback)
+        callback(context, event, deadTime);
+}
+
+static int InitDeviceLocks(USBDevice_t *device) {
+    UInt32 channel, pipe;
+
+    /* note: the r/w-lock guards the device state (opened, interface, etc.), whereas
+     *       synchronous transfers of each pipe and of the control endpoint are only
+     *       serialized among themselves (they hold the r/w-lock in shared mode), so
+     *       the channels of a multi-channel device do not contend with each other */
+    if (pthread_rwlock_init(&device->ptLock, NULL) != 0)
+        return -1;
+    for (channel = 0U; channel < USB_MAX_INTERFACES; channel++) {
+        if (pthread_mutex_init(&device->ptStats[channel], NULL) != 0)
+            goto error_stats;
+    }
+    for (pipe = 0U; pipe < (USB_MAX_INTERFACES * USB_MAX_PIPES); pipe++) {
+        if (pthread_mutex_init(&device->ptEndpoint[pipe / USB_MAX_PIPES][pipe % USB_MAX_PIPES], NULL) != 0)
+            goto error_endpoint;
+    }
+    return 0;
+error_endpoint:
+    while (pipe-- > 0U)
+        (void)pthread_mutex_destroy(&device->ptEndpoint[pipe / USB_MAX_PIPES][pipe % USB_MAX_PIPES]);
+error_stats:
+    while (channel-- > 0U)
+        (void)pthread_mutex_destroy(&device->ptStats[channel]);
+    (void)pthread_rwlock_destroy(&device->ptLock);
+    return -1;
+}
+
+static void FreeDeviceLocks(USBDevice_t *device) {
+    UInt32 channel, pipe;
+
+    for (pipe = 0U; pipe < (USB_MAX_INTERFACES * USB_MAX_PIPES); pipe++)
+        (void)pthread_mutex_destroy(&device->ptEndpoint[pipe / USB_MAX_PIPES][pipe % USB_MAX_PIPES]);
+    for (channel = 0U; channel < USB_MAX_INTERFACES; channel++)
+        (void)pthread_mutex_destroy(&device->ptStats[channel]);
+    (void)pthread_rwlock_destroy(&device->ptLock);
+}
+
+static int RegisterDevice(UInt32 location, UInt16 vendorId, UInt16 productId) {
+    UInt32 id = REGISTRY_ID(vendorId, productId);
+    int index = REGISTRY_NONE;
+
+    /* note: called from the run loop (simulated devices included), but the registry is read from any thread,
+     *       so it is guarded by its mutex, and a released slot is only put back by ReleaseSlot after the reset */
+    assert(0 == pthread_mutex_lock(&usbRegistry.ptMutex));
+    if (usbRegistry.nFree > 0) {
+        /* re-use a released slot */
+        index = (int)usbRegistry.freeSlots[--usbRegistry.nFree];
+    } else if (usbRegistry.nSlots < CANUSB_MAX_DEVICES) {
+        /* take a new slot into use (its locks are created on demand) */
+        if (InitDeviceLocks(&usbDevice[usbRegistry.nSlots]) == 0) {
+            index = usbRegistry.nSlots;
+            __atomic_store_n(&usbRegistry.nSlots, index + 1, __ATOMIC_RELEASE);
+        }
+    }
+    if (index != REGISTRY_NONE) {
+        /* insert the slot into the hash buckets */
+        usbRegistry.location[index] = location;
+        usbRegistry.id[index] = id;
+        usbRegistry.nextLocation[index] = usbRegistry.byLocation[REGISTRY_HASH(location)];
+        usbRegistry.byLocation[REGISTRY_HASH(location)] = (SInt16)index;
+        usbRegistry.nextId[index] = usbRegistry.byId[REGISTRY_HASH(id)];
+        usbRegistry.byId[REGISTRY_HASH(id)] = (SInt16)index;
+        /* note: the generation is bumped when the device state has been stored (AttachDevice) */
+    }
+    assert(0 == pthread_mutex_unlock(&usbRegistry.ptMutex));
+    return index;
+}
+
+static int UnregisterDevice(UInt32 location) {
+    SInt16 *link;
+    int index;
+
+    assert(0 == pthread_mutex_lock(&usbRegistry.ptMutex));
+    /* look up the slot by its location ID and remove it from the bucket */
+    for (link = &usbRegistry.byLocation[REGISTRY_HASH(location)]; *link != REGISTRY_NONE; link = &usbRegistry.nextLocation[*link])
+        if (usbRegistry.location[*link] == location)
+            break;
+    if ((index = (int)*link) != REGISTRY_NONE) {
+        *link = usbRegistry.nextLocation[index];
+        /* remove it also from the vendor/product ID bucket */
+        for (link = &usbRegistry.byId[REGISTRY_HASH(usbRegistry.id[index])]; *link != REGISTRY_NONE; link = &usbRegistry.nextId[*link])
+            if (*link == (SInt16)index)
+                break;
+        if (*link != REGISTRY_NONE)
+            *link = usbRegistry.nextId[index];
+        /* note: the slot is re-used not before it has been released (by ReleaseSlot),
+         *       and the generation is bumped when the device has been reset (DetachDevice) */
+    }
+    assert(0 == pthread_mutex_unlock(&usbRegistry.ptMutex));
+    return index;
+}
+
+static void ReleaseSlot(int index) {
+    /* the slot of a removed device can be re-used (note: the device has been reset) */
+    assert(0 == pthread_mutex_lock(&usbRegistry.ptMutex));
+    usbRegistry.freeSlots[usbRegistry.nFree++] = (SInt16)index;
+    assert(0 == pthread_mutex_unlock(&usbRegistry.ptMutex));
+}
+
+static CANUSB_DeviceState_t ProbeDeviceState(int index) {
+    CANUSB_DeviceState_t state;
+    IOReturn kr;
+
+    /* note: must be called from within the device's critical section (exclusive) */
+    if (usbDevice[index].fPresent &&
+        HAS_DEVICE(index)) {
+        if (OpenedChannels(index) != 0U) {
+            /* device used by own process (at least one channel) */
+            return CANUSB_DEVICE_ATTACHED;
+        } else if (usbDevice[index].fStandby) {
+            /* device kept opened by own process for a warm re-open */
+            return CANUSB_DEVICE_AVAILABLE;
+        } else if (IS_OCCUPANCY_FRESH(index)) {
+            /* occupancy state has been probed recently */
+            return GET_OCCUPANCY(index);
+        } else {
+            /* the device interface is needed for probing (note: it is created on demand) */
+            if (CreateDeviceInterface(index) != kIOReturnSuccess)
+                return CANUSB_DEVICE_UNAVAILABLE;
+            /* check if the device is used by another process by trying to open it in exclusive mode */
+            kr = (*usbDevice[index].ioDevice)->USBDeviceOpen(usbDevice[index].ioDevice);
+            if (kIOReturnSuccess == kr)  /* note: if successful then close the device immediately! */
+                (void)(*usbDevice[index].ioDevice)->USBDeviceClose(usbDevice[index].ioDevice);
+            state = (kIOReturnSuccess != kr) ? CANUSB_DEVICE_HIJACKED : CANUSB_DEVICE_AVAILABLE;
+            SET_OCCUPANCY(index, state, GetTimestamp());
+            return state;
+        }
+    }
+    return CANUSB_DEVICE_UNAVAILABLE;
+}
+
+static CANUSB_DeviceState_t GetDeviceState(int index) {
+    CANUSB_DeviceState_t state;
+
+    /* own open/close and plug/unplug are always known, a foreign owner only within the staleness bound */
+    state = GET_OCCUPANCY(index);
+    if ((state == CANUSB_DEVICE_ATTACHED) || (state == CANUSB_DEVICE_UNAVAILABLE) || IS_OCCUPANCY_FRESH(index))
+        return state;
+
+    /* the cached state is stale: probe the device (exclusive) */
+    MACCAN_DEBUG_FUNC("lock #%i\n", index);
+    ENTER_CRITICAL_SECTION(index);
+    state = ProbeDeviceState(index);
+    LEAVE_CRITICAL_SECTION(index);
+    MACCAN_DEBUG_FUNC("unlocked\n");
+    return state;
+}
+
+static UInt32 ReadProperties(int index, CANUSB_Properties_t *properties, CANUSB_Handle_t handle) {
+    UInt32 channel = (handle != CANUSB_INVALID_HANDLE) ? HANDLE_CHANNEL(handle) : 0U;
+    UInt32 sequence;
+    UInt32 flags;
+
+    /* note: a writer holds the device lock exclusively and only on plug, open, close and unplug */
+    do {
+        while ((sequence = __atomic_load_n(&usbDevice[index].u32Sequence, __ATOMIC_ACQUIRE)) & 1U)
+            sched_yield();
+        memcpy(properties, &usbDevice[index].properties[channel], sizeof(CANUSB_Properties_t));
+        flags = (usbDevice[index].fPresent && HAS_DEVICE(index)) ? PROPERTIES_PRESENT : 0U;
+        if (flags && usbDevice[index].usbInterface[channel].fOpened && (usbDevice[index].usbInterface[channel].ioInterface != NULL) &&
+            ((handle == CANUSB_INVALID_HANDLE) || IS_HANDLE_CURRENT(handle)))
+            flags |= PROPERTIES_OPENED;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&usbDevice[index].u32Sequence, __ATOMIC_RELAXED) != sequence);
+    return flags;
+}
+
+static IOReturn CreateDeviceInterface(int index)
+{
+    IOCFPlugInInterface     **plugInInterface = NULL;
+    IOUSBDeviceInterface    **device = NULL;
+    HRESULT                 result;
+    SInt32                  score;
+    kern_return_t           kr;
+
+    /* note: must be called from within the device's critical section (exclusive) */
+    if (usbDevice[index].ioDevice != NULL)
+        return kIOReturnSuccess;
+    if (usbDevice[index].ioService == IO_OBJECT_NULL)
+        return kIOReturnNoDevice;
+    /* Create an intermediate plug-in using the IOCreatePlugInInterfaceForService function */
+    kr = IOCreatePlugInInterfaceForService(usbDevice[index].ioService, kIOUSBDeviceUserClientTypeID, kIOCFPlugInInterfaceID, &plugInInterface, &score);
+    if ((kIOReturnSuccess != kr) || !plugInInterface)
+    {
+        MACCAN_DEBUG_ERROR("+++ IOCreatePlugInInterfaceForService returned 0x%08x.\n", kr);
+        return (kIOReturnSuccess != kr) ? kr : kIOReturnError;
+    }
+    /* Create the device interface using the QueryInterface function */
+    result = (*plugInInterface)->QueryInterface(plugInInterface, CFUUIDGetUUIDBytes(kIOUSBDeviceInterfaceID), (LPVOID *)&device);
+    /* Release the intermediate plug-in object */
+    (*plugInInterface)->Release(plugInInterface);
+    if (result || !device)
+    {
+        MACCAN_DEBUG_ERROR("+++ Couldn't create a device interface (%08x).\n", (int)result);
+        return kIOReturnError;
+    }
+    MACCAN_DEBUG_CORE("    - Device interface created for device #%i\n", index);
+    __atomic_store_n(&usbDevice[index].ioDevice, device, __ATOMIC_RELEASE);
+    return kIOReturnSuccess;
+}
+
+static Boolean RequireDeviceInterface(int index)
+{
+    Boolean ret;
+
+    /* once created the device interface lives until the device is removed */
+    if (__atomic_load_n(&usbDevice[index].ioDevice, __ATOMIC_ACQUIRE) != NULL)
+        return true;
+    MACCAN_DEBUG_FUNC("lock #%i\n", index);
+    ENTER_CRITICAL_SECTION(index);
+    ret = usbDevice[index].fPresent && (CreateDeviceInterface(index) == kIOReturnSuccess);
+    LEAVE_CRITICAL_SECTION(index);
+    MACCAN_DEBUG_FUNC("unlocked\n");
+    return ret;
+}
+
+static Boolean GetRegistryNumber(io_service_t service, CFStringRef key, UInt32 *value)
+{
+    CFTypeRef   numberCF;
+    Boolean     ret;
+
+    /* Get a number property from the i/o registry */
+    numberCF = IORegistryEntryCreateCFProperty(service, key, kCFAllocatorDefault, 0);
+    if (!numberCF)
+        return false;
+    ret = CFNumberGetValue((CFNumberRef)numberCF, kCFNumberSInt32Type, (void *)value);
+    CFRelease(numberCF);
+    return ret;
+}
+
+static Boolean AbortInterface(int index, UInt32 channel) {
+    IOUSBInterfaceInterface **interface = usbDevice[index].usbInterface[channel].ioInterface;
+    UInt64 deadline = GetTimestamp() + ((UInt64)STANDBY_ABORT_TIMEOUT * 1000000ULL);
+    UInt8 pipeRef;
+
+    /* note: must be called from within the device's critical section (exclusive) */
+    if (!interface)
+        return false;
+    /* abort the transfers on every pipe of the interface (pipe #0 is the control endpoint) */
+    for (pipeRef = 1U; pipeRef <= usbDevice[index].usbInterface[channel].u8NumEndpoints; pipeRef++)
+        (void)(*interface)->AbortPipe(interface, pipeRef);
+    /* wait until the aborted transfers have been completed (the callbacks do not take the device lock),
+     * but not on the worker thread: its run loop delivers the completions */
+    if (GET_INFLIGHT(index, channel) && pthread_equal(pthread_self(), usbDriver.ptThread))
+        return false;
+    while (GET_INFLIGHT(index, channel)) {
+        if (GetTimestamp() >= deadline) {
+            MACCAN_DEBUG_ERROR("+++ %u transfer(s) of device #%i not aborted within %ums\n", GET_INFLIGHT(index, channel), index, STANDBY_ABORT_TIMEOUT);
+            return false;
+        }
+        (void)usleep(1000);
+    }
+    return true;
+}
+
+static Boolean ArmStandby(int index) {
+    CFRunLoopTimerContext timerContext = { 0, NULL, NULL, NULL, NULL };
+    UInt32 milliseconds = __atomic_load_n(&warmStandby, __ATOMIC_RELAXED);
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", handle);
-    ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].ioDevice != NULL) &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-        kr2 = (*usbDevice[handle].usbInterface.ioInterface)->GetPipeProperties(usbDevice[handle].usbInterface.ioInterface,
-                index, &direction, &number, &transferType, &maxPacketSize, &interval);
-        if (kIOReturnSuccess != kr2) {
-            MACCAN_DEBUG_ERROR("+++ Unable to get properties of pipe #%i (%08x)\n", index, kr2);
-            ret = CANUSB_ERROR_RESOURCE;
-        } else {
-            /* 0 = Control / 1 = ISOC / 2 = Bulk / 3 = Interrupt */
-            *value = transferType;
+    /* note: must be called from within the device's critical section (exclusive) */
+    if (!milliseconds)
+        return false;
+    if (!usbDevice[index].standbyTimer) {
+        timerContext.info = (void*)(intptr_t)index;
+        usbDevice[index].standbyTimer = CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + TIMER_NEVER, TIMER_NEVER,
+                                                             0, 0, StandbyTimerCallback, &timerContext);
+        if (!usbDevice[index].standbyTimer) {
+            MACCAN_DEBUG_ERROR("+++ Unable to create standby timer for device #%i\n", index);
+            return false;
         }
-    } else {
-        MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (GetInterfaceEndpointTransferType)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+        CFRunLoopAddTimer(usbDriver.refRunLoop, usbDevice[index].standbyTimer, kCFRunLoopDefaultMode);
     }
-    LEAVE_CRITICAL_SECTION(handle);
-    MACCAN_DEBUG_FUNC("unlocked\n");
-    return ret;
+    usbDevice[index].u64Standby = GetTimestamp() + ((UInt64)milliseconds * 1000000ULL);
+    __atomic_store_n(&usbDevice[index].fStandby, true, __ATOMIC_RELEASE);
+    /* note: the timer is armed by the run loop (its owner), not by the caller */
+    if (!PerformOnRunLoop(ScheduleStandby, (void*)(intptr_t)index, false)) {
+        usbDevice[index].fStandby = false;
+        return false;
+    }
+    return true;
 }
 
-CANUSB_Return_t CANUSB_GetInterfaceEndpointMaxPacketSize(CANUSB_Handle_t handle, UInt8 index, UInt16 *value) {
-    IOReturn        kr2;
-    UInt8           direction;
-    UInt8           number;
-    UInt8           transferType;
-    UInt16          maxPacketSize;
-    UInt8           interval;
-    int ret = 0;
+static void ReleaseStandby(int index) {
+    UInt32 channel;
+
+    /* note: must be called from within the device's critical section (exclusive) */
+    if (!usbDevice[index].fStandby)
+        return;
+    usbDevice[index].fStandby = false;
+    if (usbDevice[index].standbyTimer)
+        (void)PerformOnRunLoop(ScheduleStandby, (void*)(intptr_t)index, false);
+    /* close the USB interface(s) and the USB device for real */
+    for (channel = 0U; channel < USB_MAX_INTERFACES; channel++)
+        ReleaseInterface(index, channel);
+    if (usbDevice[index].ioDevice) {
+        MACCAN_DEBUG_CODE(0, "close I/O device (standby)\n");
+        (void)(*usbDevice[index].ioDevice)->USBDeviceClose(usbDevice[index].ioDevice);
+    }
+}
 
-    /* must be initialized */
-    if (!fInitialized)
-        return CANUSB_ERROR_NOTINIT;
-    /* must be a valid handle */
-    if (!IS_HANDLE_VALID(handle))
-        return CANUSB_ERROR_HANDLE;
-    /* check for NULL pointer */
-    if (!value)
-        return CANUSB_ERROR_NULLPTR;
+static void StandbyTimerCallback(CFRunLoopTimerRef timer, void *info) {
+    int index = (int)(intptr_t)info;
+    UInt64 now;
 
-    MACCAN_DEBUG_FUNC("lock #%i\n", handle);
-    ENTER_CRITICAL_SECTION(handle);
-    if (usbDevice[handle].fPresent &&
-        (usbDevice[handle].ioDevice != NULL) &&
-        (usbDevice[handle].usbInterface.fOpened) &&
-        (usbDevice[handle].usbInterface.ioInterface != NULL)) {
-        kr2 = (*usbDevice[handle].usbInterface.ioInterface)->GetPipeProperties(usbDevice[handle].usbInterface.ioInterface,
-                index, &direction, &number, &transferType, &maxPacketSize, &interval);
-        if (kIOReturnSuccess != kr2) {
-            MACCAN_DEBUG_ERROR("+++ Unable to get properties of pipe #%i (%08x)\n", index, kr2);
-            ret = CANUSB_ERROR_RESOURCE;
-        } else {
-            /* as a 16-bit value */
-            *value = maxPacketSize;
-        }
-    } else {
-        MACCAN_DEBUG_ERROR("+++ Sorry, device #%i is not opened or not available (GetInterfaceEndpointMaxPacketSize)\n", handle);
-        ret = !usbDevice[handle].fPresent ? CANUSB_ERROR_HANDLE : CANUSB_ERROR_NOTINIT;
+    /* the grace period is over: close the device (unless re-opened or re-armed meanwhile) */
+    ENTER_CRITICAL_SECTION(index);
+    if (usbDevice[index].fStandby) {
+        now = GetTimestamp();
+        if (now >= usbDevice[index].u64Standby)
+            ReleaseStandby(index);
+        else
+            CFRunLoopTimerSetNextFireDate(timer, CFAbsoluteTimeGetCurrent() + ((CFTimeInterval)(usbDevice[index].u64Standby - now) / 1.0e9));
     }
-    LEAVE_CRITICAL_SECTION(handle);
-    MACCAN_DEBUG_FUNC("unlocked\n");
-    return ret;
+    LEAVE_CRITICAL_SECTION(index);
 }
 
-UInt32 CANUSB_GetVersion(void) {
-    return ((UInt32)VERSION_MAJOR << 24) |
-           ((UInt32)VERSION_MINOR << 16) |
-           ((UInt32)VERSION_PATCH << 8);
+static void ScheduleStandby(void *info) {
+    int index = (int)(intptr_t)info;
+    CFRunLoopTimerRef timer = usbDevice[index].standbyTimer;
+    UInt64 now, until;
+
+    /* note: performed on the run loop without the device lock (the caller may hold it),
+     *       the timer callback checks the standby again within the critical section */
+    if (!timer)
+        return;
+    if (!__atomic_load_n(&usbDevice[index].fStandby, __ATOMIC_ACQUIRE)) {
+        CFRunLoopTimerSetNextFireDate(timer, CFAbsoluteTimeGetCurrent() + TIMER_NEVER);
+        return;
+    }
+    now = GetTimestamp();
+    until = __atomic_load_n(&usbDevice[index].u64Standby, __ATOMIC_RELAXED);
+    CFRunLoopTimerSetNextFireDate(timer, CFAbsoluteTimeGetCurrent() + ((until > now) ? ((CFTimeInterval)(until - now) / 1.0e9) : 0.0));
 }
 
-UInt32 CANUSB_GetRevision(void) {
-    return (UInt32)usbDriver.nRevision;
+static UInt32 OpenedChannels(int index) {
+    UInt32 channel, count = 0U;
+
+    /* note: must be called from within the device's critical section */
+    for (channel = 0U; channel < USB_MAX_INTERFACES; channel++) {
+        if (usbDevice[index].usbInterface[channel].fOpened &&
+            (usbDevice[index].usbInterface[channel].ioInterface != NULL))
+            count++;
+    }
+    return count;
+}
+
+static void ReleaseInterface(int index, UInt32 channel) {
+    /* note: must be called from within the device's critical section (exclusive) */
+    if (usbDevice[index].usbInterface[channel].ioInterface) {
+        MACCAN_DEBUG_CODE(0, "close and release I/O interface #%u\n", channel);
+        (void)(*usbDevice[index].usbInterface[channel].ioInterface)->USBInterfaceClose(usbDevice[index].usbInterface[channel].ioInterface);
+        (void)(*usbDevice[index].usbInterface[channel].ioInterface)->Release(usbDevice[index].usbInterface[channel].ioInterface);
+        usbDevice[index].usbInterface[channel].ioInterface = NULL;
+    }
 }
 
 #if (0)
@@ -1932,14 +4400,20 @@ static Boolean GetStringFromIndex(IOUSBDeviceInterface **dev, UInt8 idx, char *s
  *  See https://developer.apple.com/library/archive/documentation/DeviceDrivers/Conceptual/USBBook
  *  Revision of 2012-01-09
  */
-static int SetupDirectory(SInt32 vendorID, SInt32 productID)
+static int SetupDirectory(SInt32 vendorID)
 {
     mach_port_t             masterPort;
     CFMutableDictionaryRef  matchingDict;
     CFNumberRef             numberRef;
     CFRunLoopSourceRef      runLoopSource;
     kern_return_t           kr;
+    int                     n = usbDriver.nNotifications;
 
+    if (n >= USB_MAX_VENDORS)
+    {
+        MACCAN_DEBUG_ERROR("+++ Too many notifications (max. %i)\n", USB_MAX_VENDORS);
+        return CANUSB_ERROR_RESOURCE;
+    }
     /* Create a master port for communication with the I/O Kit */
 #if defined(__MAC_12_0) && (__MAC_OS_X_VERSION_MIN_REQUIRED >= __MAC_12_0)
     kr = IOMainPort(MACH_PORT_NULL, &masterPort);
@@ -1960,26 +4434,26 @@ static int SetupDirectory(SInt32 vendorID, SInt32 productID)
         mach_port_deallocate(mach_task_self(), masterPort);
         return CANUSB_ERROR_FATAL;
     }
-    /* Add the vendor and product IDs to the matching dictionary */
-    numberRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &vendorID);
-    CFDictionarySetValue(matchingDict,  CFSTR(kUSBVendorID), numberRef);
-    CFRelease(numberRef);
-    numberRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &productID);
-    CFDictionarySetValue(matchingDict, CFSTR(kUSBProductID), numberRef);
-    CFRelease(numberRef);
-    numberRef = NULL;
-
+    /* Add the vendor ID to the matching dictionary (the product IDs are filtered in AttachDevice) */
+    if (vendorID != USB_ANY_VENDOR) {
+        numberRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &vendorID);
+        CFDictionarySetValue(matchingDict,  CFSTR(kUSBVendorID), numberRef);
+        CFRelease(numberRef);
+        numberRef = NULL;
+    }
     usbDriver.refRunLoop = CFRunLoopGetCurrent();
     //To set up asynchronous notifications, create a notification port and
     //add its run loop event source to the program�s run loop
-    usbDriver.refNotifyPort = IONotificationPortCreate(masterPort);
-    runLoopSource = IONotificationPortGetRunLoopSource(usbDriver.refNotifyPort);
-    CFRunLoopAddSource(usbDriver.refRunLoop, runLoopSource,
-                      kCFRunLoopDefaultMode);
-    //Retain additional dictionary references because each call to
+    //(note: one notification port for all notifications)
+    if (!usbDriver.refNotifyPort) {
+        usbDriver.refNotifyPort = IONotificationPortCreate(masterPort);
+        runLoopSource = IONotificationPortGetRunLoopSource(usbDriver.refNotifyPort);
+        CFRunLoopAddSource(usbDriver.refRunLoop, runLoopSource,
+                          kCFRunLoopDefaultMode);
+    }
+    //Retain an additional dictionary reference because each call to
     //IOServiceAddMatchingNotification consumes one reference
     matchingDict = (CFMutableDictionaryRef) CFRetain(matchingDict);
-    matchingDict = (CFMutableDictionaryRef) CFRetain(matchingDict);
 
     //Now set up two notifications: one to be called when a bulk test device
     //is first matched by the I/O Kit and another to be called when the
@@ -1987,40 +4461,49 @@ static int SetupDirectory(SInt32 vendorID, SInt32 productID)
     //Notification of first match
     (void)IOServiceAddMatchingNotification(usbDriver.refNotifyPort,
                   kIOFirstMatchNotification, matchingDict,
-                  DeviceAdded, NULL, &usbDriver.iterBulkDevicePlugged);
+                  DeviceAdded, NULL, &usbDriver.iterBulkDevicePlugged[n]);
     //Iterate over set of matching devices to access already-present devices
     //and to arm the notification
-    DeviceAdded(NULL, usbDriver.iterBulkDevicePlugged);
+    DeviceAdded(NULL, usbDriver.iterBulkDevicePlugged[n]);
     //Notification of termination
     (void)IOServiceAddMatchingNotification(usbDriver.refNotifyPort,
                   kIOTerminatedNotification, matchingDict,
-                  DeviceRemoved, NULL, &usbDriver.iterBulkDeviceUnplugged);
+                  DeviceRemoved, NULL, &usbDriver.iterBulkDeviceUnplugged[n]);
     //Iterate over set of matching devices to release each one and to
     //arm the notification. NOTE: this function is not shown in this document.
-    DeviceRemoved(NULL, usbDriver.iterBulkDeviceUnplugged);
+    DeviceRemoved(NULL, usbDriver.iterBulkDeviceUnplugged[n]);
+    usbDriver.nNotifications = n + 1;
     /* Finished with master port */
     mach_port_deallocate(mach_task_self(), masterPort);
     masterPort = 0;
     return 0;
 }
 
+static void ReleaseDirectory(void)
+{
+    int n;
+
+    /* release the notifications and their notification port (note: from the worker thread) */
+    for (n = 0; n < usbDriver.nNotifications; n++) {
+        if (usbDriver.iterBulkDevicePlugged[n])
+            (void)IOObjectRelease(usbDriver.iterBulkDevicePlugged[n]);
+        if (usbDriver.iterBulkDeviceUnplugged[n])
+            (void)IOObjectRelease(usbDriver.iterBulkDeviceUnplugged[n]);
+        usbDriver.iterBulkDevicePlugged[n] = 0;
+        usbDriver.iterBulkDeviceUnplugged[n] = 0;
+    }
+    usbDriver.nNotifications = 0;
+    if (usbDriver.refNotifyPort) {
+        IONotificationPortDestroy(usbDriver.refNotifyPort);
+        usbDriver.refNotifyPort = NULL;
+    }
+}
+
 static void DeviceAdded(void *refCon, io_iterator_t iterator)
 {
     io_service_t            service;
-    IOCFPlugInInterface     **plugInInterface = NULL;
-    IOUSBDeviceInterface    **device=NULL;
-    HRESULT                 result;
-    SInt32                  score;
-    UInt16                  vendor;
-    UInt16                  product;
-    UInt16                  release;
-    UInt32                  location;
-    USBDeviceAddress        address;
-    UInt8                   speed;
     io_name_t               name;
     kern_return_t           kr;
-    int index, found;
-    const CANDEV_Device_t * canDevice;
 
     while ((service = IOIteratorNext(iterator)))
     {
@@ -2029,74 +4512,102 @@ static void DeviceAdded(void *refCon, io_iterator_t iterator)
         if (KERN_SUCCESS != kr) {
             name[0] = '\0';
         }
-        /* Create an intermediate plug-in using the IOCreatePlugInInterfaceForService function */
-        (void)IOCreatePlugInInterfaceForService(service, kIOUSBDeviceUserClientTypeID, kIOCFPlugInInterfaceID, &plugInInterface, &score);
-        /* Release the device object after getting the intermediate plug-in */
-        kr = IOObjectRelease(service);
-        if ((kIOReturnSuccess != kr) || !plugInInterface)
-        {
-            MACCAN_DEBUG_ERROR("+++ IOCreatePlugInInterfaceForService returned 0x%08x.\n", kr);
-            continue;
-        }
-        /* Create the device interface using the QueryInterface function */
-        result = (*plugInInterface)->QueryInterface(plugInInterface, CFUUIDGetUUIDBytes(kIOUSBDeviceInterfaceID), (LPVOID *)&device);
-        /* Release the intermediate plug-in object */
-        (*plugInInterface)->Release(plugInInterface);
-        if (result || !device)
-        {
-            MACCAN_DEBUG_ERROR("+++ Couldn't create a device interface (%08x).\n", (int)result);
-            continue;
-        }
-        /* Check the vendor, product, and release number values to confirm we�ve got the right device */
+        /* Store the device in the device list (if wanted)
+         * note: the device interface is created when the device is opened, until then
+         *       the device object is kept (and released when the device is removed) */
+        (void)AttachDevice(service, NULL, name);
+    }
+    (void)refCon;  /* to avoid warnings */
+}
+
+static int AttachDevice(io_service_t service, IOUSBDeviceInterface **device, const char *name)
+{
+    UInt16                  vendor = 0U;
+    UInt16                  product = 0U;
+    UInt16                  release = 0U;
+    UInt32                  location = 0U;
+    USBDeviceAddress        address = 0U;
+    UInt32                  value;
+    UInt32                  channel;
+    int index;
+    const CANDEV_Device_t * canDevice;
+
+    /* Check the vendor, product, and release number values to confirm we�ve got the right device */
+    if (device) {
+        /* from the device interface (simulated devices) */
         (void)(*device)->GetDeviceVendor(device, &vendor);
         (void)(*device)->GetDeviceProduct(device, &product);
         (void)(*device)->GetDeviceReleaseNumber(device, &release);
         (void)(*device)->GetLocationID(device, &location);
         (void)(*device)->GetDeviceAddress(device, &address);
-        (void)(*device)->GetDeviceSpeed(device, &speed);
-        if ((canDevice = CANDEV_GetDeviceById(vendor, product)) == NULL) {
-            MACCAN_DEBUG_ERROR("+++ Found unwanted device (vendor = %03x, product = %03x)\n", vendor, product);
+    } else {
+        /* from the i/o registry (no device interface required) */
+        if (GetRegistryNumber(service, CFSTR(kUSBVendorID), &value)) vendor = (UInt16)value;
+        if (GetRegistryNumber(service, CFSTR(kUSBProductID), &value)) product = (UInt16)value;
+        if (GetRegistryNumber(service, CFSTR(kUSBDeviceReleaseNumber), &value)) release = (UInt16)value;
+        if (GetRegistryNumber(service, CFSTR(kUSBDevicePropertyLocationID), &value)) location = value;
+        if (GetRegistryNumber(service, CFSTR(kUSBDevicePropertyAddress), &value)) address = (USBDeviceAddress)value;
+    }
+    if ((canDevice = CANDEV_GetDeviceById(vendor, product)) == NULL) {
+        MACCAN_DEBUG_CORE("    - Ignored unwanted device (vendor = %03x, product = %03x)\n", vendor, product);
+        if (device)
             (void)(*device)->Release(device);
-            continue;
-        }
-        MACCAN_DEBUG_CORE("    - One device added at location %08x\n", location);
-
-        /* look for a free entry in the device list */
-        for (index = 0, found = 0; (index < CANUSB_MAX_DEVICES) && !found; index++) {
-            ENTER_CRITICAL_SECTION(index);
-            if (!usbDevice[index].fPresent) {
-                MACCAN_DEBUG_CORE("      - Device #%i: %s\n", index, name);
-                MACCAN_DEBUG_CORE("        - Properties: vendor = %03x, product = %03x, release = %04x, speed = %d\n",
-                                             vendor, product, release, speed);
-                /* store the properties of the added device */
-                bzero(&usbDevice[index].usbInterface, sizeof(USBInterface_t));
-                usbDevice[index].usbInterface.fOpened = false;
-                strcpy(usbDevice[index].szName, name);
-                usbDevice[index].u16VendorId = vendor;
-                usbDevice[index].u16ProductId = product;
-                usbDevice[index].u16ReleaseNo = release;
-                usbDevice[index].u32Location = location;
-                usbDevice[index].u16Address = address;
-                usbDevice[index].ioDevice = device;
-                usbDevice[index].fPresent = true;
-                found = 1;
-                /* get number of CAN channels from device list */
-                usbDevice[index].nCanChannels = CANDEV_GetNumChannels(canDevice);
-                LEAVE_CRITICAL_SECTION(index);
-                /* call the core callback function when a matching device has been added (if any) */
-                CANDEV_DeviceAdded(canDevice, index, &usbDevice[index].ptrCanDevice);
-            } else {
-                /* entry already used */
-                LEAVE_CRITICAL_SECTION(index);
+        else
+            (void)IOObjectRelease(service);
+        return CANUSB_INVALID_INDEX;
+    }
+    MACCAN_DEBUG_CORE("    - One device added at location %08x\n", location);
+
+    /* get a free entry in the device list (from the registry) */
+    if ((index = RegisterDevice(location, vendor, product)) != REGISTRY_NONE) {
+        ENTER_CRITICAL_SECTION(index);
+        if (!usbDevice[index].fPresent) {
+            MACCAN_DEBUG_CORE("      - Device #%i: %s\n", index, name);
+            MACCAN_DEBUG_CORE("        - Properties: vendor = %03x, product = %03x, release = %04x, address = %d\n",
+                                         vendor, product, release, address);
+            /* store the properties of the added device */
+            BEGIN_PROPERTIES(index);
+            bzero(usbDevice[index].usbInterface, sizeof(usbDevice[index].usbInterface));
+            strcpy(usbDevice[index].szName, name);
+            usbDevice[index].u16VendorId = vendor;
+            usbDevice[index].u16ProductId = product;
+            usbDevice[index].u16ReleaseNo = release;
+            usbDevice[index].u32Location = location;
+            usbDevice[index].u16Address = address;
+            usbDevice[index].ioDevice = device;
+            usbDevice[index].ioService = service;
+            usbDevice[index].fPresent = true;
+            /* get number of CAN channels from device list */
+            usbDevice[index].nCanChannels = CANDEV_GetNumChannels(canDevice);
+            bzero(usbDevice[index].properties, sizeof(usbDevice[index].properties));
+            for (channel = 0U; channel < USB_MAX_INTERFACES; channel++) {
+                usbDevice[index].properties[channel].vendorId = vendor;
+                usbDevice[index].properties[channel].productId = product;
+                usbDevice[index].properties[channel].releaseNo = release;
+                usbDevice[index].properties[channel].location = location;
+                usbDevice[index].properties[channel].address = address;
+                usbDevice[index].properties[channel].numChannels = usbDevice[index].nCanChannels;
             }
+            END_PROPERTIES(index);
+            SET_OCCUPANCY(index, CANUSB_DEVICE_AVAILABLE, 0ULL);
+            NEXT_REGISTRY();  /* note: not before the device state is published */
+            LEAVE_CRITICAL_SECTION(index);
+            /* call the core callback function when a matching device has been added (if any) */
+            CANDEV_DeviceAdded(canDevice, index, &usbDevice[index].ptrCanDevice);
+        } else {
+            /* entry already used (note: a registered slot is always free) */
+            LEAVE_CRITICAL_SECTION(index);
         }
-        if (!found) {
-            /* no free entry available */
-            MACCAN_DEBUG_ERROR("+++ No free entry available for new device (vendor = %03x, product = %03x)\n", vendor, product);
+    } else {
+        /* no free entry available */
+        MACCAN_DEBUG_ERROR("+++ No free entry available for new device (vendor = %03x, product = %03x)\n", vendor, product);
+        if (device)
             (void)(*device)->Release(device);
-        }
+        else
+            (void)IOObjectRelease(service);
+        return CANUSB_INVALID_INDEX;
     }
-    (void)refCon;  /* to avoid warnings */
+    return index;
 }
 
 static void DeviceRemoved(void *refCon, io_iterator_t iterator)
@@ -2105,7 +4616,6 @@ static void DeviceRemoved(void *refCon, io_iterator_t iterator)
     io_service_t    object;
     UInt64          location;
     CFTypeRef       locationCF;
-    int index;
 
     while ((object = IOIteratorNext(iterator)))
     {
@@ -2123,43 +4633,77 @@ static void DeviceRemoved(void *refCon, io_iterator_t iterator)
         }
         MACCAN_DEBUG_CORE("    - One device removed from location %08x\n", location);
 
-        /* remove the device from the device list */
-        for (index = 0; index < CANUSB_MAX_DEVICES; index++) {
-            ENTER_CRITICAL_SECTION(index);
-            if ((UInt32)location == usbDevice[index].u32Location) {
-                MACCAN_DEBUG_CORE("      - Device #%i is %s available (vendor = %03x, product = %03x)\n", index,
-                    usbDevice[index].fPresent? "no longer" : "not", usbDevice[index].u16VendorId, usbDevice[index].u16ProductId);
-                if (usbDevice[index].fPresent &&
-                    (usbDevice[index].ioDevice != NULL)) {
-                    if (usbDevice[index].usbInterface.fOpened &&
-                        (usbDevice[index].usbInterface.ioInterface != NULL) &&
-                        (usbDevice[index].usbInterface.cbkDeviceRemoved != NULL)) {
-                        LEAVE_CRITICAL_SECTION(index);
-                        /* call the driver callback function when the device has been removed */
-                        usbDevice[index].usbInterface.cbkDeviceRemoved(usbDevice[index].usbInterface.refDeviceRemoved);
-                    } else {
-                        /* note: all callbacks must be called outside the critical section! */
-                        LEAVE_CRITICAL_SECTION(index);
+        /* Remove the device from the device list (if any) */
+        DetachDevice((UInt32)location);
+    }
+    (void)refCon;  /* to avoid warnings */
+}
+
+static void DetachDevice(UInt32 location)
+{
+    CANUSB_DetachedCbk_t callback[USB_MAX_INTERFACES];
+    CANUSB_Context_t context[USB_MAX_INTERFACES];
+    UInt32 channel;
+    int index;
+
+    /* remove the device from the device list (O(1) by its location ID) */
+    if ((index = UnregisterDevice(location)) != REGISTRY_NONE) {
+        ENTER_CRITICAL_SECTION(index);
+        if (location == usbDevice[index].u32Location) {
+            MACCAN_DEBUG_CORE("      - Device #%i is %s available (vendor = %03x, product = %03x)\n", index,
+                usbDevice[index].fPresent? "no longer" : "not", usbDevice[index].u16VendorId, usbDevice[index].u16ProductId);
+            if (usbDevice[index].fPresent &&
+                HAS_DEVICE(index)) {
+                for (channel = 0U; channel < USB_MAX_INTERFACES; channel++) {
+                    callback[channel] = NULL;
+                    context[channel] = NULL;
+                    if (usbDevice[index].usbInterface[channel].fOpened &&
+                        (usbDevice[index].usbInterface[channel].ioInterface != NULL)) {
+                        callback[channel] = usbDevice[index].usbInterface[channel].cbkDeviceRemoved;
+                        context[channel] = usbDevice[index].usbInterface[channel].refDeviceRemoved;
                     }
-                    /* call the core callback function when the device has been removed (if any) */
-                    CANDEV_DeviceRemoved(CANDEV_GetDeviceById(usbDevice[index].u16VendorId, usbDevice[index].u16ProductId), index, &usbDevice[index].ptrCanDevice);
-                    ENTER_CRITICAL_SECTION(index);
                 }
-                /* reset the properties of the removed device */
-                bzero(&usbDevice[index].usbInterface, sizeof(USBInterface_t));
-                usbDevice[index].usbInterface.fOpened = false;
-                usbDevice[index].u16VendorId = 0x0U;
-                usbDevice[index].u16ProductId = 0x0U;
-                usbDevice[index].u16ReleaseNo = 0x0U;
-                usbDevice[index].u32Location = 0x0U;
-                usbDevice[index].u16Address = 0x0U;
-                usbDevice[index].ioDevice = NULL;
-                usbDevice[index].fPresent = false;
+                /* note: all callbacks must be called outside the critical section! */
+                LEAVE_CRITICAL_SECTION(index);
+                /* call the driver callback function(s) when the device has been removed (for each opened channel) */
+                for (channel = 0U; channel < USB_MAX_INTERFACES; channel++) {
+                    if (callback[channel] != NULL)
+                        callback[channel](context[channel]);
+                }
+                /* call the core callback function when the device has been removed (if any) */
+                CANDEV_DeviceRemoved(CANDEV_GetDeviceById(usbDevice[index].u16VendorId, usbDevice[index].u16ProductId), index, &usbDevice[index].ptrCanDevice);
+                ENTER_CRITICAL_SECTION(index);
             }
-            LEAVE_CRITICAL_SECTION(index);
+            /* close a device in warm standby */
+            ReleaseStandby(index);
+            /* reset the properties of the removed device (all its handles are stale) */
+            BEGIN_PROPERTIES(index);
+            for (channel = 0U; channel < USB_MAX_INTERFACES; channel++)
+                NEXT_GENERATION(index, channel);
+            bzero(usbDevice[index].usbInterface, sizeof(usbDevice[index].usbInterface));
+            usbDevice[index].u16VendorId = 0x0U;
+            usbDevice[index].u16ProductId = 0x0U;
+            usbDevice[index].u16ReleaseNo = 0x0U;
+            usbDevice[index].u32Location = 0x0U;
+            usbDevice[index].u16Address = 0x0U;
+            if (usbDevice[index].ioService != IO_OBJECT_NULL) {
+                /* release the device interface (if created) and the device object */
+                if (usbDevice[index].ioDevice)
+                    (void)(*usbDevice[index].ioDevice)->Release(usbDevice[index].ioDevice);
+                (void)IOObjectRelease(usbDevice[index].ioService);
+                usbDevice[index].ioService = IO_OBJECT_NULL;
+            }
+            usbDevice[index].ioDevice = NULL;
+            usbDevice[index].fPresent = false;
+            bzero(usbDevice[index].properties, sizeof(usbDevice[index].properties));
+            END_PROPERTIES(index);
+            SET_OCCUPANCY(index, CANUSB_DEVICE_UNAVAILABLE, 0ULL);
         }
+        NEXT_REGISTRY();  /* note: not before the device state is published */
+        LEAVE_CRITICAL_SECTION(index);
+        /* the slot can be re-used */
+        ReleaseSlot(index);
     }
-    (void)refCon;  /* to avoid warnings */
 }
 
 static IOReturn ConfigureDevice(IOUSBDeviceInterface **dev)
@@ -2192,9 +4736,10 @@ static IOReturn ConfigureDevice(IOUSBDeviceInterface **dev)
     return kIOReturnSuccess;
 }
 
-static IOReturn FindInterface(IOUSBDeviceInterface **device, int index)
+static IOReturn FindInterface(IOUSBDeviceInterface **device, int index, UInt32 channel)
 {
     IOReturn                    kr=0;
+    UInt32                      number = 0U;
     IOUSBFindInterfaceRequest   request;
     io_iterator_t               iterator;
     io_service_t                usbInterface;
@@ -2202,20 +4747,17 @@ static IOReturn FindInterface(IOUSBDeviceInterface **device, int index)
     IOUSBInterfaceInterface     **interface = NULL;
     HRESULT                     result;
     SInt32                      score;
-    UInt8                       interfaceClass;
-    UInt8                       interfaceSubClass;
-    UInt8                       interfaceProtocol;
-    UInt8                       interfaceNumEndpoints;
-    CFRunLoopSourceRef          runLoopSource;
-#if (OPTION_MACCAN_PIPE_INFO != 0)
-    int                         pipeRef;
-#endif
 
-    /* Allow to find all the interfaces */
+#if (OPTION_MACCAN_SIMULATION != 0)
+    /* Simulated devices have exactly one interface (and no i/o registry entry) */
+    if (CANSIM_IsSimulatedDevice((void*)device))
+        return (channel == 0U) ? SetupInterface((IOUSBInterfaceInterface **)CANSIM_GetInterface((void*)device), index, channel) : kIOReturnNotFound;
+#endif
+    /* Allow to find all the interfaces (but not their alternate settings, they are not channels of their own) */
     request.bInterfaceClass = kIOUSBFindInterfaceDontCare;
     request.bInterfaceSubClass = kIOUSBFindInterfaceDontCare;
     request.bInterfaceProtocol = kIOUSBFindInterfaceDontCare;
-    request.bAlternateSetting = kIOUSBFindInterfaceDontCare;
+    request.bAlternateSetting = 0U;
     /* Get an iterator for the interfaces on the device */
     kr = (*device)->CreateInterfaceIterator(device, &request, &iterator);
     if (kIOReturnSuccess != kr)
@@ -2223,9 +4765,15 @@ static IOReturn FindInterface(IOUSBDeviceInterface **device, int index)
         MACCAN_DEBUG_ERROR("+++ Unable to create interface iterator (%08x)\n", kr);
         return kr;
     }
-    kr = kIOReturnError;
+    kr = kIOReturnNotFound;
     while ((usbInterface = IOIteratorNext(iterator)))
     {
+        /* One CAN channel per interface: skip the interfaces of the other channels */
+        if (number++ != channel)
+        {
+            (void)IOObjectRelease(usbInterface);
+            continue;
+        }
         /* Create an intermediate plug-in */
         (void)IOCreatePlugInInterfaceForService(usbInterface, kIOUSBInterfaceUserClientTypeID, kIOCFPlugInInterfaceID, &plugInInterface, &score);
         /* Release the usbInterface object after getting the plug-in */
@@ -2244,149 +4792,342 @@ static IOReturn FindInterface(IOUSBDeviceInterface **device, int index)
             MACCAN_DEBUG_ERROR("+++ Couldn't create a device interface for the interface (%08x)\n", (int) result);
             break;
         }
-        /* Get interface class and subclass */
-        (void)(*interface)->GetInterfaceClass(interface, &interfaceClass);
-        (void)(*interface)->GetInterfaceSubClass(interface, &interfaceSubClass);
-        (void)(*interface)->GetInterfaceProtocol(interface, &interfaceProtocol);
-        /* Now open the interface. This will cause the pipes associated with */
-        /* the endpoints in the interface descriptor to be instantiated */
-        kr = (*interface)->USBInterfaceOpen(interface);
-        if (kIOReturnSuccess != kr)
-        {
-            MACCAN_DEBUG_ERROR("+++ Unable to open interface (%08x)\n", kr);
-            (void)(*interface)->Release(interface);
-            break;
-        }
-        /* Get the number of endpoints associated with this interface */
-        kr = (*interface)->GetNumEndpoints(interface, &interfaceNumEndpoints);
-        if (kIOReturnSuccess != kr)
-        {
-            MACCAN_DEBUG_ERROR("+++ Unable to get number of endpoints (%08x)\n", kr);
-            (void)(*interface)->USBInterfaceClose(interface);
-            (void)(*interface)->Release(interface);
-            break;
-        }
+        /* Set up the interface for use by the device */
+        kr = SetupInterface(interface, index, channel);
+        /* The interface of the channel has been found, so exit loop */
+        break;
+    }
+    /* Clean up used resources */
+    (void)IOObjectRelease(iterator);
+    return kr;
+}
+
+static IOReturn SetupInterface(IOUSBInterfaceInterface **interface, int index, UInt32 channel)
+{
+    IOReturn                    kr=0;
+    UInt8                       interfaceClass;
+    UInt8                       interfaceSubClass;
+    UInt8                       interfaceProtocol;
+    UInt8                       interfaceNumEndpoints;
+    CFRunLoopSourceRef          runLoopSource;
+    UInt32                      pipe;
+#if (OPTION_MACCAN_PIPE_INFO != 0)
+    int                         pipeRef;
+#endif
+
+    /* Get interface class and subclass */
+    (void)(*interface)->GetInterfaceClass(interface, &interfaceClass);
+    (void)(*interface)->GetInterfaceSubClass(interface, &interfaceSubClass);
+    (void)(*interface)->GetInterfaceProtocol(interface, &interfaceProtocol);
+    /* Now open the interface. This will cause the pipes associated with */
+    /* the endpoints in the interface descriptor to be instantiated */
+    kr = (*interface)->USBInterfaceOpen(interface);
+    if (kIOReturnSuccess != kr)
+    {
+        MACCAN_DEBUG_ERROR("+++ Unable to open interface (%08x)\n", kr);
+        (void)(*interface)->Release(interface);
+        return kr;
+    }
+    /* Get the number of endpoints associated with this interface */
+    kr = (*interface)->GetNumEndpoints(interface, &interfaceNumEndpoints);
+    if (kIOReturnSuccess != kr)
+    {
+        MACCAN_DEBUG_ERROR("+++ Unable to get number of endpoints (%08x)\n", kr);
+        (void)(*interface)->USBInterfaceClose(interface);
+        (void)(*interface)->Release(interface);
+        return kr;
+    }
 #if (OPTION_MACCAN_PIPE_INFO != 0)
-        MACCAN_DEBUG_CORE("      - Interface class %d, subclass %d, protocol %d\n", interfaceClass, interfaceSubClass, interfaceProtocol);
-        MACCAN_DEBUG_CORE("      - Interface has %d pipe(s):\n", interfaceNumEndpoints + 1);
-        MACCAN_DEBUG_CORE("          - Pipe #0: default control pipe (for device requests)\n");
-        /* Access each pipe in turn, starting with the pipe at index 1 */
-        /* The pipe at index 0 is the default control pipe and should */
-        /* be accessed using (*usbDevice)->DeviceRequest() instead */
-        for (pipeRef = 1; pipeRef <= interfaceNumEndpoints; pipeRef++)
+    MACCAN_DEBUG_CORE("      - Interface class %d, subclass %d, protocol %d\n", interfaceClass, interfaceSubClass, interfaceProtocol);
+    MACCAN_DEBUG_CORE("      - Interface has %d pipe(s):\n", interfaceNumEndpoints + 1);
+    MACCAN_DEBUG_CORE("          - Pipe #0: default control pipe (for device requests)\n");
+    /* Access each pipe in turn, starting with the pipe at index 1 */
+    /* The pipe at index 0 is the default control pipe and should */
+    /* be accessed using (*usbDevice)->DeviceRequest() instead */
+    for (pipeRef = 1; pipeRef <= interfaceNumEndpoints; pipeRef++)
+    {
+        IOReturn        kr2;
+        UInt8           direction;
+        UInt8           number;
+        UInt8           transferType;
+        UInt16          maxPacketSize;
+        UInt8           interval;
+        char            *message;
+
+        kr2 = (*interface)->GetPipeProperties(interface, pipeRef, &direction, &number, &transferType, &maxPacketSize, &interval);
+        if (kIOReturnSuccess != kr2)
+            MACCAN_DEBUG_ERROR("+++ Unable to get properties of pipe #%d (%08x)\n", pipeRef, kr2);
+        else
         {
-            IOReturn        kr2;
-            UInt8           direction;
-            UInt8           number;
-            UInt8           transferType;
-            UInt16          maxPacketSize;
-            UInt8           interval;
-            char            *message;
-
-            kr2 = (*interface)->GetPipeProperties(interface, pipeRef, &direction, &number, &transferType, &maxPacketSize, &interval);
-            if (kIOReturnSuccess != kr2)
-                MACCAN_DEBUG_ERROR("+++ Unable to get properties of pipe #%d (%08x)\n", pipeRef, kr2);
-            else
+            MACCAN_DEBUG_CORE("          - Pipe #%d: ", pipeRef);
+            switch (direction)
             {
-                MACCAN_DEBUG_CORE("          - Pipe #%d: ", pipeRef);
-                switch (direction)
-                {
-                    case kUSBOut:     message = "out"; break;
-                    case kUSBIn:      message = "in"; break;
-                    case kUSBNone:    message = "none"; break;
-                    case kUSBAnyDirn: message = "any"; break;
-                    default:          message = "???"; break;
-                }
-                MACCAN_DEBUG_CORE("direction %s, ", message);
-                switch (transferType)
-                {
-                    case kUSBControl:   message = "control"; break;
-                    case kUSBIsoc:      message = "isoc"; break;
-                    case kUSBBulk:      message = "bulk"; break;
-                    case kUSBInterrupt: message = "interrupt"; break;
-                    case kUSBAnyType:   message = "any"; break;
-                    default:            message = "???"; break;
-                }
-                MACCAN_DEBUG_CORE("transfer type %s, max. packet size %d, interval %ums\n", message, maxPacketSize, interval);
+                case kUSBOut:     message = "out"; break;
+                case kUSBIn:      message = "in"; break;
+                case kUSBNone:    message = "none"; break;
+                case kUSBAnyDirn: message = "any"; break;
+                default:          message = "???"; break;
             }
-        }
-#endif
-        /* For this test, just use first interface, so exit loop */
-        if (IS_INDEX_VALID(index)) {
-            usbDevice[index].usbInterface.ioInterface = interface;
-            usbDevice[index].usbInterface.u8Class = interfaceClass;
-            usbDevice[index].usbInterface.u8SubClass = interfaceSubClass;
-            usbDevice[index].usbInterface.u8Protocol = interfaceProtocol;
-            usbDevice[index].usbInterface.u8NumEndpoints = interfaceNumEndpoints;
-            /* As with service matching notifications, to receive asynchronous */
-            /* I/O completion notifications, you must create an event source and */
-            /* add it to the run loop */
-            kr = (*interface)->CreateInterfaceAsyncEventSource(
-                                    interface, &runLoopSource);
-            if (kr != kIOReturnSuccess)
+            MACCAN_DEBUG_CORE("direction %s, ", message);
+            switch (transferType)
             {
-                MACCAN_DEBUG_ERROR("+++ Unable to create asynchronous event source for device #%i (%08x)\n", index, kr);
-                (void)(*interface)->USBInterfaceClose(interface);
-                (void)(*interface)->Release(interface);
-                break;
+                case kUSBControl:   message = "control"; break;
+                case kUSBIsoc:      message = "isoc"; break;
+                case kUSBBulk:      message = "bulk"; break;
+                case kUSBInterrupt: message = "interrupt"; break;
+                case kUSBAnyType:   message = "any"; break;
+                default:            message = "???"; break;
             }
-            CFRunLoopAddSource(usbDriver.refRunLoop, runLoopSource,
-                                    kCFRunLoopDefaultMode);
-            MACCAN_DEBUG_CORE("      + Device #%i: asynchronous event source added to run loop\n", index);
-            /* the USB interface can now be used */
-            usbDevice[index].usbInterface.fOpened = true;
-            kr = kIOReturnSuccess;
+            MACCAN_DEBUG_CORE("transfer type %s, max. packet size %d, interval %ums\n", message, maxPacketSize, interval);
         }
-        else
+    }
+#endif
+    /* Store the interface in the device list */
+    if (IS_INDEX_VALID(index) && (channel < USB_MAX_INTERFACES)) {
+        BEGIN_PROPERTIES(index);
+        usbDevice[index].usbInterface[channel].ioInterface = interface;
+        usbDevice[index].usbInterface[channel].u8Class = interfaceClass;
+        usbDevice[index].usbInterface[channel].u8SubClass = interfaceSubClass;
+        usbDevice[index].usbInterface[channel].u8Protocol = interfaceProtocol;
+        usbDevice[index].usbInterface[channel].u8NumEndpoints = interfaceNumEndpoints;
+        usbDevice[index].properties[channel].interfaceClass = interfaceClass;
+        usbDevice[index].properties[channel].interfaceSubClass = interfaceSubClass;
+        usbDevice[index].properties[channel].interfaceProtocol = interfaceProtocol;
+        usbDevice[index].properties[channel].numEndpoints = interfaceNumEndpoints;
+        /* the pipe properties do not change while the interface is opened */
+        usbDevice[index].properties[channel].validPipes = 0U;
+        for (pipe = 0U; (pipe <= (UInt32)interfaceNumEndpoints) && (pipe < CANUSB_MAX_PIPES); pipe++) {
+            if ((*interface)->GetPipeProperties(interface, (UInt8)pipe, &usbDevice[index].properties[channel].pipe[pipe].direction,
+                                                &usbDevice[index].properties[channel].pipe[pipe].number,
+                                                &usbDevice[index].properties[channel].pipe[pipe].transferType,
+                                                &usbDevice[index].properties[channel].pipe[pipe].maxPacketSize,
+                                                &usbDevice[index].properties[channel].pipe[pipe].interval) == kIOReturnSuccess)
+                usbDevice[index].properties[channel].validPipes |= ((UInt32)1 << pipe);
+        }
+        /* As with service matching notifications, to receive asynchronous */
+        /* I/O completion notifications, you must create an event source and */
+        /* add it to the run loop */
+        kr = (*interface)->CreateInterfaceAsyncEventSource(
+                                interface, &runLoopSource);
+        if (kr != kIOReturnSuccess)
         {
+            MACCAN_DEBUG_ERROR("+++ Unable to create asynchronous event source for device #%i (%08x)\n", index, kr);
             (void)(*interface)->USBInterfaceClose(interface);
             (void)(*interface)->Release(interface);
-            kr = kIOReturnError;
+            END_PROPERTIES(index);
+            return kr;
         }
-        break;
+        /* note: all simulated devices share the event source of the simulation */
+        if (runLoopSource)
+            CFRunLoopAddSource(usbDriver.refRunLoop, runLoopSource,
+                                    kCFRunLoopDefaultMode);
+        MACCAN_DEBUG_CORE("      + Device #%i: asynchronous event source added to run loop\n", index);
+        /* the USB interface can now be used */
+        bzero(&usbDevice[index].stats[channel], sizeof(CANUSB_PipeStats_t));
+        usbDevice[index].usbInterface[channel].fOpened = true;
+        END_PROPERTIES(index);
+        kr = kIOReturnSuccess;
+    }
+    else
+    {
+        (void)(*interface)->USBInterfaceClose(interface);
+        (void)(*interface)->Release(interface);
+        kr = kIOReturnError;
     }
-    /* Clean up used resources */
-    (void)IOObjectRelease(iterator);
     return kr;
 }
 
 static void* WorkerThread(void* arg)
 {
-    const CANDEV_Device_t *ptrDevice = CANDEV_GetFirstDevice();
-
-    /* set up the IOUSBKit to manage and access CAN to USB devices */
-    while (ptrDevice) {
-        if (SetupDirectory((SInt32)ptrDevice->vendorId,
-                           (SInt32)ptrDevice->productId) != 0)
+    const CANDEV_Device_t *ptrDevice;
+    CFRunLoopSourceContext context;
+    int numVendors = 0;
+
+    /* set up the IOUSBKit to manage and access CAN to USB devices:
+     * one notification per vendor (the products are filtered when a device is added),
+     * or one for all USB devices if there are too many vendors in the device list */
+    for (ptrDevice = CANDEV_GetFirstVendor(); ptrDevice; ptrDevice = CANDEV_GetNextVendor())
+        numVendors++;
+    if (numVendors <= USB_MAX_VENDORS) {
+        for (ptrDevice = CANDEV_GetFirstVendor(); ptrDevice; ptrDevice = CANDEV_GetNextVendor()) {
+            if (SetupDirectory((SInt32)ptrDevice->vendorId) != 0)
+                goto exit_worker_thread;
+        }
+    } else {
+        if (SetupDirectory(USB_ANY_VENDOR) != 0)
             goto exit_worker_thread;
-        ptrDevice = CANDEV_GetNextDevice();
     }
-    /* indicate to the creator that the thread is running */
+    /* create a run loop source to stop the run loop from another thread */
+    bzero(&context, sizeof(CFRunLoopSourceContext));
+    context.perform = StopRunLoop;
+    usbDriver.refStopSource = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context);
+    if (!usbDriver.refStopSource)
+        goto exit_worker_thread;
+    CFRunLoopAddSource(usbDriver.refRunLoop, usbDriver.refStopSource, kCFRunLoopDefaultMode);
+    /* create a run loop source to perform jobs from other threads on the run loop */
+    bzero(&context, sizeof(CFRunLoopSourceContext));
+    context.perform = PerformJobs;
+    usbDriver.refPerformSource = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context);
+    if (!usbDriver.refPerformSource)
+        goto exit_worker_thread;
+    CFRunLoopAddSource(usbDriver.refRunLoop, usbDriver.refPerformSource, kCFRunLoopDefaultMode);
+
+    /* indicate to the creator that the thread is running (unless it has given up on us) */
     assert(0 == pthread_mutex_lock(&usbDriver.ptMutex));
+    if (usbDriver.fCancelled) {
+        assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
+        goto exit_worker_thread;
+    }
     usbDriver.fRunning = TRUE;
+    assert(0 == pthread_cond_broadcast(&usbDriver.ptCond));
     assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
 
     /* start the run loop so notifications will be received */
     MACCAN_DEBUG_CORE("    - Run loop started so notifications will be received\n");
     CFRunLoopRun();
 
-#if (0)
-    /* fatal error: execution should never come here! */
-    MACCAN_DEBUG_ERROR("+++ Oops, something went terribly wrong!\a\n");
-#else
     /* indicate to the creator that the thread is terminated */
     MACCAN_DEBUG_CORE("    - So long, and thanks for all the fish!\n");
-#endif
+    (void)arg;  /* to avoid compiler warnings */
+exit_worker_thread:
     assert(0 == pthread_mutex_lock(&usbDriver.ptMutex));
+    if (usbDriver.refStopSource) {
+        CFRunLoopRemoveSource(usbDriver.refRunLoop, usbDriver.refStopSource, kCFRunLoopDefaultMode);
+        CFRelease(usbDriver.refStopSource);
+        usbDriver.refStopSource = NULL;
+    }
+    if (usbDriver.refPerformSource) {
+        CFRunLoopRemoveSource(usbDriver.refRunLoop, usbDriver.refPerformSource, kCFRunLoopDefaultMode);
+        CFRelease(usbDriver.refPerformSource);
+        usbDriver.refPerformSource = NULL;
+    }
+    ReleaseDirectory();
     usbDriver.fRunning = FALSE;
+    usbDriver.fTerminated = TRUE;
+    assert(0 == pthread_cond_broadcast(&usbDriver.ptCond));
     assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
-
-    (void)arg;  /* to avoid compiler warnings */
-exit_worker_thread:
+    /* perform the jobs posted in the meantime (no caller must wait forever) */
+    PerformJobs(NULL);
     /* terminate the thread */
     pthread_exit(NULL);
     return NULL;
 }
 
+static void* OpenThread(void* arg)
+{
+    USBOpenJob_t *job = (USBOpenJob_t*)arg;
+    CANUSB_Index_t index;
+    UInt32 i;
+
+    /* take the next device from the list until all are opened */
+    while ((i = __atomic_fetch_add(&job->next, 1U, __ATOMIC_RELAXED)) < job->count) {
+        index = job->indexes[i];
+        job->handles[i] = CANUSB_OpenDevice(index, job->vendorId, job->productId);
+        if (!job->results)
+            continue;
+        if (job->handles[i] != CANUSB_INVALID_HANDLE)
+            job->results[i] = CANUSB_SUCCESS;
+        else if (!IS_INDEX_VALID(index))
+            job->results[i] = CANUSB_ERROR_HANDLE;
+        else switch (GetDeviceState(index)) {
+            case CANUSB_DEVICE_ATTACHED: job->results[i] = CANUSB_ERROR_BUSY; break;
+            case CANUSB_DEVICE_HIJACKED: job->results[i] = CANUSB_ERROR_BUSY; break;
+            case CANUSB_DEVICE_AVAILABLE: job->results[i] = CANUSB_ERROR_RESOURCE; break;
+            default: job->results[i] = CANUSB_ERROR_HANDLE; break;
+        }
+    }
+    return NULL;
+}
+
+static void StopRunLoop(void *info)
+{
+    /* performed by the run loop of the worker thread when signaled */
+    CFRunLoopStop(CFRunLoopGetCurrent());
+    (void)info;
+}
+
+static Boolean PerformOnRunLoop(void (*function)(void *info), void *info, Boolean wait)
+{
+    USBPerformJob_t *job;
+
+    /* on the worker thread: perform the job at once (or defer it to the next pass of the run loop) */
+    if (wait && pthread_equal(pthread_self(), usbDriver.ptThread)) {
+        function(info);
+        return true;
+    }
+    if ((job = (USBPerformJob_t*)malloc(sizeof(USBPerformJob_t))) == NULL)
+        return false;
+    job->next = NULL;
+    job->function = function;
+    job->info = info;
+    job->fWait = wait;
+    job->fDone = false;
+    assert(0 == pthread_mutex_lock(&usbDriver.ptMutex));
+    /* no run loop (not yet started or already stopped): nobody else is performing jobs */
+    if (!usbDriver.fRunning || !usbDriver.refPerformSource) {
+        assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
+        free(job);
+        function(info);
+        return true;
+    }
+    /* post the job to the run loop (note: the jobs are performed in the order they are posted) */
+    if (usbDriver.ptrJobs) {
+        USBPerformJob_t *last = usbDriver.ptrJobs;
+        while (last->next)
+            last = last->next;
+        last->next = job;
+    } else {
+        usbDriver.ptrJobs = job;
+    }
+    CFRunLoopSourceSignal(usbDriver.refPerformSource);
+    CFRunLoopWakeUp(usbDriver.refRunLoop);
+    /* wait until the job has been performed (if requested) */
+    if (wait) {
+        while (!job->fDone)
+            assert(0 == pthread_cond_wait(&usbDriver.ptCond, &usbDriver.ptMutex));
+    }
+    assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
+    if (wait)
+        free(job);
+    return true;
+}
+
+static void PerformJobs(void *info)
+{
+    USBPerformJob_t *job, *next;
+
+    /* performed by the run loop of the worker thread when signaled (and once more when it is left) */
+    assert(0 == pthread_mutex_lock(&usbDriver.ptMutex));
+    job = usbDriver.ptrJobs;
+    usbDriver.ptrJobs = NULL;
+    assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
+    for (; job; job = next) {
+        next = job->next;
+        job->function(job->info);
+        if (job->fWait) {
+            /* note: the waiting caller frees the job */
+            assert(0 == pthread_mutex_lock(&usbDriver.ptMutex));
+            job->fDone = true;
+            assert(0 == pthread_cond_broadcast(&usbDriver.ptCond));
+            assert(0 == pthread_mutex_unlock(&usbDriver.ptMutex));
+        } else {
+            free(job);
+        }
+    }
+    (void)info;
+}
+
+static void GetAbsoluteTime(struct timespec *absTime, UInt32 timeout)
+{
+    /* absolute time for pthread_cond_timedwait (timeout in [ms]) */
+    clock_gettime(CLOCK_REALTIME, absTime);
+    absTime->tv_sec += (time_t)(timeout / 1000U);
+    absTime->tv_nsec += (long)(timeout % 1000U) * (long)1000000;
+    if (absTime->tv_nsec >= (long)1000000000) {
+        absTime->tv_nsec -= (long)1000000000;
+        absTime->tv_sec += (time_t)1;
+    }
+}
+
 /* * $Id$ *** (c) UV Software, Berlin ***
  */
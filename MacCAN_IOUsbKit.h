@@ -56,6 +56,19 @@
 #define CANUSB_INVALID_INDEX  (-1)
 #define CANUSB_INVALID_HANDLE  (-1)
 
+#ifndef CANUSB_MAX_QUEUE_DEPTH
+#define CANUSB_MAX_QUEUE_DEPTH  32U
+#endif
+#ifndef CANUSB_MAX_REGISTERED_BUFFERS
+#define CANUSB_MAX_REGISTERED_BUFFERS  16U
+#endif
+#define CANUSB_BUFFER_ALIGNMENT  8U
+#ifndef CANUSB_MAX_RING_ENTRIES
+#define CANUSB_MAX_RING_ENTRIES  1024U
+#endif
+
+#define CANUSB_MAX_PIPES  32U  /* incl. the default control pipe #0 */
+
 #define CANUSB_ANY_VENDOR_ID  0xFFFFU
 #define CANUSB_ANY_PRODUCT_ID  0xFFFFU
 
@@ -103,14 +116,111 @@ typedef enum usb_device_state_tag {
     CANUSB_DEVICE_ATTACHED = (CANUSB_BOARD_OCCUPIED + 1),
 } CANUSB_DeviceState_t;
 
+typedef struct usb_device_info_tag {    /* snapshot of a present device: */
+    CANUSB_Index_t index;               /*   device index (for CANUSB_OpenDevice) */
+    UInt16 vendorId;                    /*   vendor ID */
+    UInt16 productId;                   /*   product ID */
+    UInt16 releaseNo;                   /*   release no. */
+    UInt16 address;                     /*   device address */
+    UInt32 location;                    /*   unique location ID */
+    UInt8 numChannels;                  /*   number of CAN channels */
+    CANUSB_DeviceState_t state;         /*   device state */
+} CANUSB_DeviceInfo_t;
+
+typedef struct usb_properties_tag {     /* device and interface properties: */
+    UInt16 vendorId;                    /*   vendor ID */
+    UInt16 productId;                   /*   product ID */
+    UInt16 releaseNo;                   /*   release no. */
+    UInt16 address;                     /*   device address */
+    UInt32 location;                    /*   unique location ID */
+    UInt8 numChannels;                  /*   number of CAN channels */
+    UInt8 interfaceClass;               /*   class of the interface */
+    UInt8 interfaceSubClass;            /*   subclass of the interface */
+    UInt8 interfaceProtocol;            /*   protocol of the interface */
+    UInt8 numEndpoints;                 /*   number of endpoints (w/o pipe #0) */
+    UInt32 validPipes;                  /*   bit n set = properties of pipe #n are valid */
+    struct {                            /*   pipe properties: */
+        UInt8 direction;                /*     USBPIPE_DIR_xyz */
+        UInt8 number;                   /*     endpoint number */
+        UInt8 transferType;             /*     USBPIPE_TYPE_xyz */
+        UInt8 interval;                 /*     polling interval */
+        UInt16 maxPacketSize;           /*     max. packet size */
+    } pipe[CANUSB_MAX_PIPES];           /*   array of pipes (index = pipe number) */
+} CANUSB_Properties_t;
+
 typedef void *CANUSB_Descriptor_t;
 typedef void *CANUSB_Context_t;
 
 typedef void (*CANUSB_DetachedCbk_t)(CANUSB_Context_t refCon);
 typedef int (*CANUSB_AsyncPipeCbk_t)(CANUSB_Context_t refCon, UInt8 *buffer, UInt32 nbyte);
+typedef int (*CANUSB_AsyncPipeCbkEx_t)(CANUSB_Context_t refCon, UInt8 *buffer, UInt32 nbyte, UInt64 timestamp);
+
+typedef struct usb_pipe_vector_tag {
+    UInt8 *buffer;                      /* data of the transfer */
+    UInt32 length;                      /* number of bytes received */
+    UInt64 timestamp;                   /* time of completion (in [ns]) */
+} CANUSB_PipeVector_t;
+
+typedef void (*CANUSB_AsyncPipeVecCbk_t)(CANUSB_Context_t refCon, const CANUSB_PipeVector_t *vector, UInt32 count);
 
 typedef struct usb_async_pipe_tag *CANUSB_AsyncPipe_t;
 
+/* Stall recovery (events) */
+#define CANUSB_RECOVERY_RETRY      1    /* recovery failed, retried after backoff */
+#define CANUSB_RECOVERY_SUCCEEDED  2    /* pipe recovered (downtime reported) */
+#define CANUSB_RECOVERY_FAILED     3    /* given up after max. retries */
+
+typedef void (*CANUSB_RecoveryCbk_t)(CANUSB_Context_t refCon, int event, CANUSB_Return_t result, UInt64 downtime);
+
+/* Inactivity watchdog (events; note: an idle read pipe sees no completions, so the thresholds
+ * must be well above the longest regular silence of the device, e.g. its status interval) */
+#define CANUSB_WATCHDOG_EXPIRED    1    /* no completion within the notify threshold */
+#define CANUSB_WATCHDOG_REARM      2    /* transfers aborted and the pipe re-armed */
+#define CANUSB_WATCHDOG_RESET      3    /* device reset and the pipe re-armed */
+
+typedef void (*CANUSB_WatchdogCbk_t)(CANUSB_Context_t refCon, int event, UInt64 deadTime);
+
+/* I/O statistics (of an asynchronous pipe or of the synchronous transfers of a device) */
+#define CANUSB_HISTOGRAM_BINS  16U      /* bin 0 = below 1us, bin n = [2^(n-1), 2^n) us */
+
+typedef struct usb_pipe_stats_tag {
+    UInt64 transfers;                   /* number of completed transfers */
+    UInt64 bytes;                       /* number of bytes transferred */
+    UInt64 shortTransfers;              /* transfers shorter than requested */
+    UInt64 stalls;                      /* transfers ended by a stalled pipe */
+    UInt64 aborts;                      /* transfers aborted */
+    UInt64 errors;                      /* other errors (e.g. time-out) */
+    UInt64 rearmFailures;               /* read transfers that could not be (re-)armed */
+    UInt64 recoveries;                  /* successful recoveries (see CANUSB_SetPipeRecovery) */
+    UInt64 watchdogs;                   /* watchdog events (see CANUSB_SetPipeWatchdog) */
+    UInt32 rearmGap[CANUSB_HISTOGRAM_BINS];      /* time from completion to re-arm (async read) */
+    UInt32 callbackTime[CANUSB_HISTOGRAM_BINS];  /* duration of the callback (async read) */
+} CANUSB_PipeStats_t;
+
+/* I/O ring (submission/completion queue) */
+#define CANUSB_IO_READ     1U
+#define CANUSB_IO_WRITE    2U
+#define CANUSB_IO_CONTROL  3U
+
+typedef struct usb_io_request_tag {
+    UInt8 opcode;                       /* CANUSB_IO_READ, _WRITE or _CONTROL */
+    UInt8 pipeRef;                      /* pipe number (not for control transfers) */
+    CANUSB_SetupPacket_t setupPacket;   /* setup packet (only for control transfers) */
+    void *buffer;                       /* data buffer (valid until completed) */
+    UInt32 size;                        /* size of the data buffer */
+    UInt64 userData;                    /* passed to the completion */
+} CANUSB_IoRequest_t;
+
+typedef struct usb_io_completion_tag {
+    UInt64 userData;                    /* from the request */
+    CANUSB_Return_t result;             /* result of the transfer */
+    UInt32 length;                      /* number of bytes transferred */
+    UInt64 submitted;                   /* time of submission (in [ns]) */
+    UInt64 completed;                   /* time of completion (in [ns]) */
+} CANUSB_IoCompletion_t;
+
+typedef struct usb_io_ring_tag *CANUSB_IoRing_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -123,6 +233,11 @@ extern CANUSB_Return_t CANUSB_DeviceRequest(CANUSB_Index_t index, CANUSB_SetupPa
 
 extern CANUSB_Handle_t CANUSB_OpenDevice(CANUSB_Index_t index, UInt16 vendorId, UInt16 productId);
 
+extern CANUSB_Handle_t CANUSB_OpenChannel(CANUSB_Index_t index, UInt8 channel, UInt16 vendorId, UInt16 productId);
+
+extern CANUSB_Return_t CANUSB_OpenDevices(const CANUSB_Index_t *indexes, UInt32 count, UInt16 vendorId, UInt16 productId,
+                                          CANUSB_Handle_t *handles, CANUSB_Return_t *results);
+
 extern CANUSB_Return_t CANUSB_CloseDevice(CANUSB_Handle_t handle);
 
 extern CANUSB_Return_t CANUSB_RegisterDetachedCallback(CANUSB_Handle_t handle, CANUSB_DetachedCbk_t callback, CANUSB_Context_t context);
@@ -133,24 +248,83 @@ extern CANUSB_Return_t CANUSB_WritePipe(CANUSB_Handle_t handle, UInt8 pipeRef, c
 
 extern CANUSB_Return_t CANUSB_ResetPipe(CANUSB_Handle_t handle, UInt8 pipeRef);
 
+extern CANUSB_Return_t CANUSB_GetDeviceStats(CANUSB_Handle_t handle, CANUSB_PipeStats_t *stats, Boolean reset);
+
 extern CANUSB_AsyncPipe_t CANUSB_CreatePipeAsync(CANUSB_Handle_t handle, UInt8 pipeRef, size_t bufferSize, Boolean doubleBuffer);
 
+extern CANUSB_AsyncPipe_t CANUSB_CreatePipeAsyncEx(CANUSB_Handle_t handle, UInt8 pipeRef, size_t bufferSize, UInt32 queueDepth);
+
 extern CANUSB_Return_t CANUSB_DestroyPipeAsync(CANUSB_AsyncPipe_t asyncPipe);
 
 extern CANUSB_Return_t CANUSB_AbortPipeAsync(CANUSB_AsyncPipe_t asyncPipe);
 
+extern CANUSB_Return_t CANUSB_SetPipeLending(CANUSB_AsyncPipe_t asyncPipe, UInt32 spareBuffers);
+
+extern CANUSB_Return_t CANUSB_ReturnPipeBuffer(CANUSB_AsyncPipe_t asyncPipe, UInt8 *buffer);
+
+extern CANUSB_Return_t CANUSB_SetPipeCoalescing(CANUSB_AsyncPipe_t asyncPipe, UInt32 maxTransfers, UInt32 maxDelay,
+                                                                           CANUSB_AsyncPipeVecCbk_t callback, CANUSB_Context_t context);
+
 extern CANUSB_Return_t CANUSB_ReadPipeAsync(CANUSB_AsyncPipe_t asyncPipe, CANUSB_AsyncPipeCbk_t callback, CANUSB_Context_t context);
 
+extern CANUSB_Return_t CANUSB_ReadPipeAsyncEx(CANUSB_AsyncPipe_t asyncPipe, CANUSB_AsyncPipeCbkEx_t callback, CANUSB_Context_t context);
+
 extern CANUSB_Return_t CANUSB_WritePipeAsync(CANUSB_AsyncPipe_t asyncPipe, const void *buffer, UInt32 size, UInt16 timeout,
                                                                            CANUSB_AsyncPipeCbk_t callback, CANUSB_Context_t context);
+
+extern CANUSB_Return_t CANUSB_WritePipeAsyncEx(CANUSB_AsyncPipe_t asyncPipe, const void *buffer, UInt32 size, UInt16 timeout,
+                                                                           CANUSB_AsyncPipeCbkEx_t callback, CANUSB_Context_t context);
+
+extern CANUSB_Return_t CANUSB_QueuePipeAsync(CANUSB_AsyncPipe_t asyncPipe, const void *buffer, UInt32 size,
+                                                                           CANUSB_AsyncPipeCbk_t callback, CANUSB_Context_t context);
+
+extern CANUSB_Return_t CANUSB_QueuePipeAsyncEx(CANUSB_AsyncPipe_t asyncPipe, const void *buffer, UInt32 size,
+                                                                           CANUSB_AsyncPipeCbkEx_t callback, CANUSB_Context_t context);
+
+extern CANUSB_Return_t CANUSB_RegisterPipeBuffer(CANUSB_AsyncPipe_t asyncPipe, void *buffer, UInt32 size, UInt32 *slot);
+
+extern CANUSB_Return_t CANUSB_UnregisterPipeBuffer(CANUSB_AsyncPipe_t asyncPipe, UInt32 slot);
+
+extern CANUSB_Return_t CANUSB_SubmitPipeBuffer(CANUSB_AsyncPipe_t asyncPipe, UInt32 slot, UInt32 size,
+                                                                           CANUSB_AsyncPipeCbk_t callback, CANUSB_Context_t context);
+
+extern CANUSB_Return_t CANUSB_SubmitPipeBufferEx(CANUSB_AsyncPipe_t asyncPipe, UInt32 slot, UInt32 size,
+                                                                           CANUSB_AsyncPipeCbkEx_t callback, CANUSB_Context_t context);
+
 extern Boolean CANUSB_IsPipeAsyncRunning(CANUSB_AsyncPipe_t asyncPipe);
 
+extern CANUSB_Return_t CANUSB_SetPipeRecovery(CANUSB_AsyncPipe_t asyncPipe, UInt32 initialDelay, UInt32 maxDelay, UInt32 maxRetries,
+                                                                           CANUSB_RecoveryCbk_t callback, CANUSB_Context_t context);
+
+extern CANUSB_Return_t CANUSB_SetPipeWatchdog(CANUSB_AsyncPipe_t asyncPipe, UInt32 notifyAfter, UInt32 rearmAfter, UInt32 resetAfter,
+                                                                           CANUSB_WatchdogCbk_t callback, CANUSB_Context_t context);
+
+extern CANUSB_Return_t CANUSB_GetPipeStats(CANUSB_AsyncPipe_t asyncPipe, CANUSB_PipeStats_t *stats, Boolean reset);
+
+extern CANUSB_IoRing_t CANUSB_CreateIoRing(CANUSB_Handle_t handle, UInt32 entries);
+
+extern CANUSB_Return_t CANUSB_DestroyIoRing(CANUSB_IoRing_t ioRing);
+
+extern CANUSB_Return_t CANUSB_SubmitIoRing(CANUSB_IoRing_t ioRing, const CANUSB_IoRequest_t *requests, UInt32 count, UInt32 *submitted);
+
+extern CANUSB_Return_t CANUSB_ReapIoRing(CANUSB_IoRing_t ioRing, CANUSB_IoCompletion_t *completions, UInt32 count, UInt16 timeout, UInt32 *reaped);
+
 extern CANUSB_Index_t CANUSB_GetFirstDevice(void);
 
 extern CANUSB_Index_t CANUSB_GetNextDevice(void);
 
+extern CANUSB_Return_t CANUSB_EnumerateDevices(CANUSB_DeviceInfo_t *devices, UInt32 maxDevices, UInt32 *count, UInt32 *generation);
+
+extern UInt32 CANUSB_GetDeviceGeneration(void);
+
+extern CANUSB_Index_t CANUSB_FindDevice(UInt16 vendorId, UInt16 productId, UInt32 instance);
+
 extern CANUSB_Return_t CANUSB_GetDeviceState(CANUSB_Index_t index, CANUSB_DeviceState_t *state);
 
+extern CANUSB_Return_t CANUSB_SetOccupancyTimeout(UInt32 milliseconds);
+
+extern CANUSB_Return_t CANUSB_SetWarmStandby(UInt32 milliseconds);
+
 extern CANUSB_Return_t CANUSB_GetDeviceUsbName(CANUSB_Index_t index, char *buffer, size_t n);
 
 extern CANUSB_Return_t CANUSB_GetDeviceVendorId(CANUSB_Index_t index, UInt16 *value);
@@ -167,6 +341,8 @@ extern CANUSB_Return_t CANUSB_GetDeviceNumCanChannels(CANUSB_Index_t index, UInt
 
 extern CANUSB_Return_t CANUSB_GetDeviceCanDescriptor(CANUSB_Index_t index, CANUSB_Descriptor_t descriptor, size_t size);
 
+extern CANUSB_Return_t CANUSB_GetDeviceProperties(CANUSB_Handle_t handle, CANUSB_Properties_t *properties);
+
 extern CANUSB_Return_t CANUSB_GetInterfaceClass(CANUSB_Handle_t handle, UInt8 *value);
 
 extern CANUSB_Return_t CANUSB_GetInterfaceSubClass(CANUSB_Handle_t handle, UInt8 *value);
@@ -185,6 +361,14 @@ extern UInt32 CANUSB_GetVersion(void);
 
 extern UInt32 CANUSB_GetRevision(void);
 
+extern UInt64 CANUSB_GetHostTime(void);
+
+#if (OPTION_MACCAN_SIMULATION != 0)
+/* === Simulation (see MacCAN_IOUsbSim.h) === */
+extern CANUSB_Return_t CANUSB_SimulateDeviceAdded(void *ioDevice, const char *name);
+extern CANUSB_Return_t CANUSB_SimulateDeviceRemoved(UInt32 location);
+#endif
+
 /* === Deprecated === */
 extern Boolean CANUSB_IsDevicePresent(CANUSB_Index_t index);
 extern Boolean CANUSB_IsDeviceInUse(CANUSB_Index_t index);
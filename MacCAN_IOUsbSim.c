@@ -0,0 +1,1136 @@
+/*  SPDX-License-Identifier: BSD-2-Clause OR GPL-3.0-or-later */
+/*
+ *  MacCAN - macOS User-Space Driver for USB-to-CAN Interfaces
+ *
+ *  Copyright (c) 2012-2023 Uwe Vogt, UV Software, Berlin (info@mac-can.com)
+ *  All rights reserved.
+ *
+ *  This file is part of MacCAN-Core.
+ *
+ *  MacCAN-Core is dual-licensed under the BSD 2-Clause "Simplified" License and
+ *  under the GNU General Public License v3.0 (or any later version).
+ *  You can choose between one of them if you use this file.
+ *
+ *  BSD 2-Clause "Simplified" License:
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ *  MacCAN-Core IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF MacCAN-Core, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  GNU General Public License v3.0 or later:
+ *  MacCAN-Core is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MacCAN-Core is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MacCAN-Core.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "MacCAN_IOUsbSim.h"
+#include "MacCAN_Devices.h"
+#include "MacCAN_Debug.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <IOKit/IOKitLib.h>
+#include <IOKit/IOReturn.h>
+#include <IOKit/IOTypes.h>
+#include <IOKit/usb/IOUSBLib.h>
+#include <IOKit/usb/USB.h>
+
+#include <CoreFoundation/CFRunLoop.h>
+
+/*#define OPTION_MACCAN_SIMULATION  0  !* set globally: 1 = simulated USB devices (for testing w/o hardware) */
+
+#if (OPTION_MACCAN_SIMULATION != 0)
+
+#define BITS_PER_BYTE  10U  /* bit-times on the CAN bus per byte of USB payload (approx.) */
+#define NUM_PIPES  3U       /* default control pipe, bulk in pipe and bulk out pipe */
+
+#define MAX_STRING_LENGTH  256
+#define MIN(x,y)  (((x) <= (y)) ? (x) : (y))
+
+#define IS_PIPE_VALID(ref)  ((ref == CANSIM_PIPE_IN) || (ref == CANSIM_PIPE_OUT))
+
+#define ENTER_CRITICAL_SECTION()  assert(0 == pthread_mutex_lock(&simDriver.ptMutex))
+#define LEAVE_CRITICAL_SECTION()  assert(0 == pthread_mutex_unlock(&simDriver.ptMutex))
+
+#define SIGNAL_CONDITION()  assert(0 == pthread_cond_broadcast(&simDriver.ptCond))
+#define WAIT_CONDITION()  assert(0 == pthread_cond_wait(&simDriver.ptCond, &simDriver.ptMutex))
+
+#define QUEUE_PUSH(queue,elem)  do{ (elem)->next = NULL; \
+                                    if ((queue).tail) (queue).tail->next = (elem); else (queue).head = (elem); \
+                                    (queue).tail = (elem); } while(0)
+#define QUEUE_POP(queue,elem)  do{ (elem) = (queue).head; \
+                                   if (elem) { (queue).head = (elem)->next; if (!(queue).head) (queue).tail = NULL; } } while(0)
+
+typedef struct sim_request_tag {            /* Simulated transfer: */
+    struct sim_request_tag *next;           /*   next request in the queue */
+    UInt8 pipeRef;                          /*   pipe number (endpoint) */
+    UInt8 *buffer;                          /*   data buffer of the caller */
+    UInt32 size;                            /*   size of the data buffer */
+    UInt32 length;                          /*   number of bytes transferred */
+    UInt64 dueTime;                         /*   time of completion (in [us]) */
+    UInt64 deadline;                        /*   time-out (in [us], 0 = none) */
+    IOAsyncCallback1 callback;              /*   completion callback (NULL = synchronous) */
+    void *refCon;                           /*   reference for the callback */
+    IOReturn result;                        /*   result of the transfer */
+    Boolean done;                           /*   synchronous request completed */
+} SimRequest_t;
+
+typedef struct sim_packet_tag {             /* Looped-back packet: */
+    struct sim_packet_tag *next;            /*   next packet in the queue */
+    UInt64 dueTime;                         /*   available at bulk in pipe (in [us]) */
+    UInt32 length;                          /*   number of bytes */
+    UInt8 data[];                           /*   the data itself */
+} SimPacket_t;
+
+typedef struct sim_request_queue_tag {      /* Request queue: */
+    SimRequest_t *head;                     /*   first request */
+    SimRequest_t *tail;                     /*   last request */
+} SimRequestQueue_t;
+
+typedef struct sim_interface_tag {          /* Simulated USB interface: */
+    IOUSBInterfaceInterface *vtbl;          /*   COM interface (must be the first member) */
+    struct sim_device_tag *device;          /*   device of the interface */
+    Boolean fOpened;                        /*   interface is opened */
+    Boolean fStalled[NUM_PIPES];            /*   pipe is halted */
+} SimInterface_t;
+
+typedef struct sim_device_tag {             /* Simulated USB device: */
+    IOUSBDeviceInterface *vtbl;             /*   COM interface (must be the first member) */
+    SimInterface_t usbInterface;            /*   interface (only one) */
+    Boolean fPresent;                       /*   device is plugged in */
+    Boolean fOpened;                        /*   device is opened (exclusive access) */
+    UInt32 u32Location;                     /*   unique location ID (32-bit) */
+    UInt16 u16Address;                      /*   device address (16-bit) */
+    CANSIM_Param_t param;                   /*   device parameters */
+    CANSIM_TransmitCbk_t transmit;          /*   transmit handler (NULL = loop-back) */
+    CANUSB_Context_t refTransmit;           /*   pointer to user context for handler */
+    Boolean fBlocked;                       /*   transmit handler is busy */
+    UInt64 wireFree;                        /*   time when the wire is free (in [us]) */
+    SimRequestQueue_t reads;                /*   pending transfers on bulk in pipe */
+    SimRequestQueue_t writes;               /*   pending transfers on bulk out pipe */
+    struct {                                /*   looped-back packets: */
+        SimPacket_t *head;                  /*     first packet */
+        SimPacket_t *tail;                  /*     last packet */
+        UInt32 count;                       /*     number of packets */
+    } packets;
+    UInt64 dropped;                         /*   packets dropped (queue full) */
+} SimDevice_t;
+
+typedef struct sim_driver_tag {             /* Simulation driver: */
+    Boolean fRunning;                       /*   flag: thread running */
+    pthread_t ptThread;                     /*   pthread of the simulation */
+    pthread_mutex_t ptMutex;                /*   pthread mutex for mutual exclusion */
+    pthread_cond_t ptCond;                  /*   pthread condition for signaling */
+    SimRequestQueue_t done;                 /*   completed asynchronous transfers */
+    CFRunLoopSourceRef refSource;           /*   event source for the completions */
+    CFRunLoopRef refRunLoop;                /*   run loop the event source is added to */
+} SimDriver_t;
+
+static ULONG SimAddRef(void *self);
+static ULONG SimRelease(void *self);
+static IOReturn SimDeviceOpen(void *self);
+static IOReturn SimDeviceClose(void *self);
+static IOReturn SimGetDeviceVendor(void *self, UInt16 *value);
+static IOReturn SimGetDeviceProduct(void *self, UInt16 *value);
+static IOReturn SimGetDeviceReleaseNumber(void *self, UInt16 *value);
+static IOReturn SimGetDeviceAddress(void *self, USBDeviceAddress *value);
+static IOReturn SimGetDeviceSpeed(void *self, UInt8 *value);
+static IOReturn SimGetLocationID(void *self, UInt32 *value);
+static IOReturn SimGetNumberOfConfigurations(void *self, UInt8 *value);
+static IOReturn SimGetConfigurationDescriptorPtr(void *self, UInt8 index, IOUSBConfigurationDescriptorPtr *desc);
+static IOReturn SimSetConfiguration(void *self, UInt8 value);
+static IOReturn SimResetDevice(void *self);
+static IOReturn SimDeviceRequest(void *self, IOUSBDevRequest *request);
+static IOReturn SimCreateInterfaceIterator(void *self, IOUSBFindInterfaceRequest *request, io_iterator_t *iterator);
+
+static IOReturn SimCreateInterfaceAsyncEventSource(void *self, CFRunLoopSourceRef *source);
+static IOReturn SimInterfaceOpen(void *self);
+static IOReturn SimInterfaceClose(void *self);
+static IOReturn SimGetInterfaceClass(void *self, UInt8 *value);
+static IOReturn SimGetInterfaceSubClass(void *self, UInt8 *value);
+static IOReturn SimGetInterfaceProtocol(void *self, UInt8 *value);
+static IOReturn SimGetNumEndpoints(void *self, UInt8 *value);
+static IOReturn SimGetPipeProperties(void *self, UInt8 pipeRef, UInt8 *direction, UInt8 *number, UInt8 *transferType, UInt16 *maxPacketSize, UInt8 *interval);
+static IOReturn SimGetPipeStatus(void *self, UInt8 pipeRef);
+static IOReturn SimAbortPipe(void *self, UInt8 pipeRef);
+static IOReturn SimClearPipeStall(void *self, UInt8 pipeRef);
+static IOReturn SimReadPipe(void *self, UInt8 pipeRef, void *buf, UInt32 *size);
+static IOReturn SimWritePipe(void *self, UInt8 pipeRef, void *buf, UInt32 size);
+static IOReturn SimReadPipeTO(void *self, UInt8 pipeRef, void *buf, UInt32 *size, UInt32 noDataTimeout, UInt32 completionTimeout);
+static IOReturn SimWritePipeTO(void *self, UInt8 pipeRef, void *buf, UInt32 size, UInt32 noDataTimeout, UInt32 completionTimeout);
+static IOReturn SimReadPipeAsync(void *self, UInt8 pipeRef, void *buf, UInt32 size, IOAsyncCallback1 callback, void *refCon);
+static IOReturn SimWritePipeAsync(void *self, UInt8 pipeRef, void *buf, UInt32 size, IOAsyncCallback1 callback, void *refCon);
+static IOReturn SimReadPipeAsyncTO(void *self, UInt8 pipeRef, void *buf, UInt32 size, UInt32 noDataTimeout, UInt32 completionTimeout, IOAsyncCallback1 callback, void *refCon);
+static IOReturn SimWritePipeAsyncTO(void *self, UInt8 pipeRef, void *buf, UInt32 size, UInt32 noDataTimeout, UInt32 completionTimeout, IOAsyncCallback1 callback, void *refCon);
+static IOReturn SimControlRequest(void *self, UInt8 pipeRef, IOUSBDevRequest *request);
+static IOReturn SimControlRequestAsync(void *self, UInt8 pipeRef, IOUSBDevRequest *request, IOAsyncCallback1 callback, void *refCon);
+
+static IOReturn SubmitRequest(SimInterface_t *usbInterface, UInt8 pipeRef, void *buffer, UInt32 size, UInt32 timeout,
+                              IOAsyncCallback1 callback, void *refCon, UInt32 *transferred);
+static void CompleteRequest(SimRequest_t *request, IOReturn result, UInt32 length);
+static void CancelRequests(SimRequestQueue_t *queue, UInt8 pipeRef, IOReturn result, UInt64 expired);
+static UInt64 ServiceDevice(SimDevice_t *device, UInt64 now);
+static void FlushPackets(SimDevice_t *device);
+static int QueuePacket(SimDevice_t *device, const UInt8 *data, UInt32 length, UInt64 now);
+static SimDevice_t *FindDevice(UInt32 location);
+static void* SimulationThread(void *arg);
+static void ScheduleEventSource(void *info, CFRunLoopRef runLoop, CFRunLoopMode mode);
+static void CancelEventSource(void *info, CFRunLoopRef runLoop, CFRunLoopMode mode);
+static void DeliverCompletions(void *info);
+static UInt64 GetTime(void);
+
+static IOUSBDeviceInterface simDeviceInterface = {
+    .AddRef = SimAddRef,
+    .Release = SimRelease,
+    .USBDeviceOpen = SimDeviceOpen,
+    .USBDeviceClose = SimDeviceClose,
+    .GetDeviceVendor = SimGetDeviceVendor,
+    .GetDeviceProduct = SimGetDeviceProduct,
+    .GetDeviceReleaseNumber = SimGetDeviceReleaseNumber,
+    .GetDeviceAddress = SimGetDeviceAddress,
+    .GetDeviceSpeed = SimGetDeviceSpeed,
+    .GetLocationID = SimGetLocationID,
+    .GetNumberOfConfigurations = SimGetNumberOfConfigurations,
+    .GetConfigurationDescriptorPtr = SimGetConfigurationDescriptorPtr,
+    .SetConfiguration = SimSetConfiguration,
+    .ResetDevice = SimResetDevice,
+    .DeviceRequest = SimDeviceRequest,
+    .CreateInterfaceIterator = SimCreateInterfaceIterator
+};
+
+static IOUSBInterfaceInterface simInterfaceInterface = {
+    .AddRef = SimAddRef,
+    .Release = SimRelease,
+    .CreateInterfaceAsyncEventSource = SimCreateInterfaceAsyncEventSource,
+    .USBInterfaceOpen = SimInterfaceOpen,
+    .USBInterfaceClose = SimInterfaceClose,
+    .GetInterfaceClass = SimGetInterfaceClass,
+    .GetInterfaceSubClass = SimGetInterfaceSubClass,
+    .GetInterfaceProtocol = SimGetInterfaceProtocol,
+    .GetNumEndpoints = SimGetNumEndpoints,
+    .GetPipeProperties = SimGetPipeProperties,
+    .GetPipeStatus = SimGetPipeStatus,
+    .AbortPipe = SimAbortPipe,
+    .ClearPipeStall = SimClearPipeStall,
+#if defined(__MAC_11_0)
+    .ClearPipeStallBothEnds = SimClearPipeStall,
+#endif
+    .ReadPipe = SimReadPipe,
+    .WritePipe = SimWritePipe,
+    .ReadPipeTO = SimReadPipeTO,
+    .WritePipeTO = SimWritePipeTO,
+    .ReadPipeAsync = SimReadPipeAsync,
+    .WritePipeAsync = SimWritePipeAsync,
+    .ReadPipeAsyncTO = SimReadPipeAsyncTO,
+    .WritePipeAsyncTO = SimWritePipeAsyncTO,
+    .ControlRequest = SimControlRequest,
+    .ControlRequestAsync = SimControlRequestAsync
+};
+
+static IOUSBConfigurationDescriptor simConfiguration = {
+    .bLength = (UInt8)sizeof(IOUSBConfigurationDescriptor),
+    .bDescriptorType = 0x02U,
+    .bNumInterfaces = 1U,
+    .bConfigurationValue = 1U
+};
+
+static SimDriver_t simDriver = {
+    .fRunning = false,
+    .ptMutex = PTHREAD_MUTEX_INITIALIZER,
+    .ptCond = PTHREAD_COND_INITIALIZER
+};
+static SimDevice_t simDevice[CANSIM_MAX_DEVICES];
+
+CANSIM_Return_t CANSIM_PlugDevice(const CANSIM_Param_t *param, UInt32 *location) {
+    const CANDEV_Device_t *canDevice;
+    char name[MAX_STRING_LENGTH];
+    int index, rc;
+
+    /* check for NULL pointer */
+    if (!param)
+        return CANUSB_ERROR_NULLPTR;
+    /* the device must be known by the driver */
+    if ((canDevice = CANDEV_GetDeviceById(param->vendorId, param->productId)) == NULL) {
+        MACCAN_DEBUG_ERROR("+++ Unable to simulate unknown device (vendor = %03x, product = %03x)\n", param->vendorId, param->productId);
+        return CANUSB_ERROR_ILLPARA;
+    }
+    /* look for a free entry in the simulation */
+    ENTER_CRITICAL_SECTION();
+    for (index = 0; index < CANSIM_MAX_DEVICES; index++) {
+        if (!simDevice[index].fPresent)
+            break;
+    }
+    if (index >= CANSIM_MAX_DEVICES) {
+        MACCAN_DEBUG_ERROR("+++ No free entry available for simulated device (vendor = %03x, product = %03x)\n", param->vendorId, param->productId);
+        LEAVE_CRITICAL_SECTION();
+        return CANUSB_ERROR_RESOURCE;
+    }
+    /* set up the device and its interface */
+    bzero(&simDevice[index], sizeof(SimDevice_t));
+    simDevice[index].vtbl = &simDeviceInterface;
+    simDevice[index].usbInterface.vtbl = &simInterfaceInterface;
+    simDevice[index].usbInterface.device = &simDevice[index];
+    simDevice[index].param = *param;
+    if (!simDevice[index].param.packetSizeIn)
+        simDevice[index].param.packetSizeIn = CANSIM_DEFAULT_PACKET_SIZE;
+    if (!simDevice[index].param.packetSizeOut)
+        simDevice[index].param.packetSizeOut = CANSIM_DEFAULT_PACKET_SIZE;
+    if (!simDevice[index].param.queueSize)
+        simDevice[index].param.queueSize = CANSIM_DEFAULT_QUEUE_SIZE;
+    simDevice[index].u32Location = CANSIM_LOCATION_ID | ((UInt32)(index + 1) << 8);
+    simDevice[index].u16Address = (UInt16)(index + 1);
+    simDevice[index].fPresent = true;
+    /* start the simulation (if not already running) */
+    if (!simDriver.fRunning) {
+        simDriver.fRunning = true;
+        if (pthread_create(&simDriver.ptThread, NULL, SimulationThread, NULL) != 0) {
+            MACCAN_DEBUG_ERROR("+++ Unable to start the simulation thread\n");
+            simDriver.fRunning = false;
+            simDevice[index].fPresent = false;
+            LEAVE_CRITICAL_SECTION();
+            return CANUSB_ERROR_RESOURCE;
+        }
+    }
+    LEAVE_CRITICAL_SECTION();
+
+    /* plug the device into the IOUsbKit (as if by a matching notification) */
+    snprintf(name, MAX_STRING_LENGTH, "Simulated CAN-USB (%04x:%04x)", param->vendorId, param->productId);
+    MACCAN_DEBUG_CORE("    - One simulated device plugged in at location %08x\n", simDevice[index].u32Location);
+    if ((rc = CANUSB_SimulateDeviceAdded((void*)&simDevice[index], name)) != CANUSB_SUCCESS) {
+        MACCAN_DEBUG_ERROR("+++ Unable to plug in simulated device (%i)\n", rc);
+        (void)CANSIM_UnplugDevice(simDevice[index].u32Location);
+        return rc;
+    }
+    if (location)
+        *location = simDevice[index].u32Location;
+    return CANUSB_SUCCESS;
+}
+
+CANSIM_Return_t CANSIM_UnplugDevice(UInt32 location) {
+    Boolean running = false;
+    pthread_t thread;
+    int index;
+
+    ENTER_CRITICAL_SECTION();
+    for (index = 0; index < CANSIM_MAX_DEVICES; index++) {
+        if (simDevice[index].fPresent && (simDevice[index].u32Location == location))
+            break;
+    }
+    if (index >= CANSIM_MAX_DEVICES) {
+        LEAVE_CRITICAL_SECTION();
+        return CANUSB_ERROR_HANDLE;
+    }
+    /* pending transfers are terminated and looped-back packets are gone */
+    simDevice[index].fPresent = false;
+    simDevice[index].fOpened = false;
+    CancelRequests(&simDevice[index].reads, 0U, kIOReturnNoDevice, 0U);
+    CancelRequests(&simDevice[index].writes, 0U, kIOReturnNoDevice, 0U);
+    FlushPackets(&simDevice[index]);
+    MACCAN_DEBUG_CORE("    - One simulated device unplugged from location %08x (%" PRIu64 " packet(s) dropped)\n",
+                      location, simDevice[index].dropped);
+    /* stop the simulation when the last device is gone */
+    for (index = 0; index < CANSIM_MAX_DEVICES; index++) {
+        if (simDevice[index].fPresent)
+            running = true;
+    }
+    thread = simDriver.ptThread;
+    if (!running)
+        simDriver.fRunning = false;
+    SIGNAL_CONDITION();
+    LEAVE_CRITICAL_SECTION();
+
+    /* unplug the device from the IOUsbKit (as if by a termination notification) */
+    (void)CANUSB_SimulateDeviceRemoved(location);
+
+    /* note: pending completions are delivered on the run loop (even when the simulation has terminated) */
+    if (!running) {
+        if (pthread_equal(thread, pthread_self()))
+            (void)pthread_detach(thread);
+        else
+            (void)pthread_join(thread, NULL);
+    }
+    return CANUSB_SUCCESS;
+}
+
+CANSIM_Return_t CANSIM_SetTiming(UInt32 location, UInt32 latency, UInt32 bitrate) {
+    SimDevice_t *device;
+    int ret = CANUSB_ERROR_HANDLE;
+
+    ENTER_CRITICAL_SECTION();
+    if ((device = FindDevice(location)) != NULL) {
+        device->param.latency = latency;
+        device->param.bitrate = bitrate;
+        ret = CANUSB_SUCCESS;
+    }
+    LEAVE_CRITICAL_SECTION();
+    return ret;
+}
+
+CANSIM_Return_t CANSIM_SetTransmitHandler(UInt32 location, CANSIM_TransmitCbk_t callback, CANUSB_Context_t context) {
+    SimDevice_t *device;
+    int ret = CANUSB_ERROR_HANDLE;
+
+    /* note: the handler is never called after this function returns */
+    ENTER_CRITICAL_SECTION();
+    if ((device = FindDevice(location)) != NULL) {
+        device->transmit = callback;
+        device->refTransmit = context;
+        device->fBlocked = false;
+        SIGNAL_CONDITION();
+        ret = CANUSB_SUCCESS;
+    }
+    LEAVE_CRITICAL_SECTION();
+    return ret;
+}
+
+CANSIM_Return_t CANSIM_ResumeTransmit(UInt32 location) {
+    SimDevice_t *device;
+    int ret = CANUSB_ERROR_HANDLE;
+
+    ENTER_CRITICAL_SECTION();
+    if ((device = FindDevice(location)) != NULL) {
+        device->fBlocked = false;
+        SIGNAL_CONDITION();
+        ret = CANUSB_SUCCESS;
+    }
+    LEAVE_CRITICAL_SECTION();
+    return ret;
+}
+
+CANSIM_Return_t CANSIM_ReceivePacket(UInt32 location, const void *buffer, UInt32 length) {
+    SimDevice_t *device;
+    int ret = CANUSB_ERROR_HANDLE;
+
+    /* check for NULL pointer */
+    if (!buffer && length)
+        return CANUSB_ERROR_NULLPTR;
+
+    /* note: the packet is available at the bulk in pipe after the latency */
+    ENTER_CRITICAL_SECTION();
+    if ((device = FindDevice(location)) != NULL) {
+        ret = QueuePacket(device, (const UInt8*)buffer, length, GetTime());
+        SIGNAL_CONDITION();
+    }
+    LEAVE_CRITICAL_SECTION();
+    return ret;
+}
+
+Boolean CANSIM_IsSimulatedDevice(void *ioDevice) {
+    /* a simulated device is an entry of the simulation */
+    return (((SimDevice_t*)ioDevice >= &simDevice[0]) &&
+            ((SimDevice_t*)ioDevice < &simDevice[CANSIM_MAX_DEVICES])) ? true : false;
+}
+
+void *CANSIM_GetInterface(void *ioDevice) {
+    /* the one and only interface of the simulated device */
+    if (CANSIM_IsSimulatedDevice(ioDevice))
+        return (void*)&((SimDevice_t*)ioDevice)->usbInterface;
+    else
+        return NULL;
+}
+
+/*  ---  IOUSBDeviceInterface  ---
+ */
+static ULONG SimAddRef(void *self) {
+    (void)self;
+    return 1U;  /* note: static objects */
+}
+
+static ULONG SimRelease(void *self) {
+    (void)self;
+    return 1U;  /* note: static objects */
+}
+
+static IOReturn SimDeviceOpen(void *self) {
+    SimDevice_t *device = (SimDevice_t*)self;
+    IOReturn kr = kIOReturnSuccess;
+
+    ENTER_CRITICAL_SECTION();
+    if (!device->fPresent)
+        kr = kIOReturnNoDevice;
+    else if (device->fOpened)
+        kr = kIOReturnExclusiveAccess;
+    else
+        device->fOpened = true;
+    LEAVE_CRITICAL_SECTION();
+    return kr;
+}
+
+static IOReturn SimDeviceClose(void *self) {
+    SimDevice_t *device = (SimDevice_t*)self;
+    IOReturn kr = kIOReturnSuccess;
+
+    ENTER_CRITICAL_SECTION();
+    if (!device->fPresent)
+        kr = kIOReturnNoDevice;
+    else if (!device->fOpened)
+        kr = kIOReturnNotOpen;
+    else
+        device->fOpened = false;
+    LEAVE_CRITICAL_SECTION();
+    return kr;
+}
+
+static IOReturn SimGetDeviceVendor(void *self, UInt16 *value) {
+    *value = ((SimDevice_t*)self)->param.vendorId;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetDeviceProduct(void *self, UInt16 *value) {
+    *value = ((SimDevice_t*)self)->param.productId;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetDeviceReleaseNumber(void *self, UInt16 *value) {
+    *value = ((SimDevice_t*)self)->param.releaseNo;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetDeviceAddress(void *self, USBDeviceAddress *value) {
+    *value = (USBDeviceAddress)((SimDevice_t*)self)->u16Address;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetDeviceSpeed(void *self, UInt8 *value) {
+    (void)self;
+    *value = 1U;  /* note: full speed */
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetLocationID(void *self, UInt32 *value) {
+    *value = ((SimDevice_t*)self)->u32Location;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetNumberOfConfigurations(void *self, UInt8 *value) {
+    (void)self;
+    *value = 1U;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetConfigurationDescriptorPtr(void *self, UInt8 index, IOUSBConfigurationDescriptorPtr *desc) {
+    (void)self;
+    if (index != 0U)
+        return kIOReturnBadArgument;
+    *desc = &simConfiguration;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimSetConfiguration(void *self, UInt8 value) {
+    SimDevice_t *device = (SimDevice_t*)self;
+
+    if (!device->fPresent)
+        return kIOReturnNoDevice;
+    if (!device->fOpened)
+        return kIOReturnNotOpen;
+    if (value != simConfiguration.bConfigurationValue)
+        return kIOReturnBadArgument;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimResetDevice(void *self) {
+    SimDevice_t *device = (SimDevice_t*)self;
+
+    if (!device->fPresent)
+        return kIOReturnNoDevice;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimDeviceRequest(void *self, IOUSBDevRequest *request) {
+    SimDevice_t *device = (SimDevice_t*)self;
+    CANUSB_SetupPacket_t setupPacket;
+    UInt32 transferred = 0U;
+
+    if (!device->fPresent)
+        return kIOReturnNoDevice;
+    if (!request)
+        return kIOReturnBadArgument;
+    /* note: the device requests are vendor-specific */
+    if (device->param.callback) {
+        setupPacket.RequestType = request->bmRequestType;
+        setupPacket.Request = request->bRequest;
+        setupPacket.Value = request->wValue;
+        setupPacket.Index = request->wIndex;
+        setupPacket.Length = request->wLength;
+        if (device->param.callback(device->param.context, &setupPacket, request->pData, &transferred) != 0)
+            return kIOUSBPipeStalled;
+    }
+    request->wLenDone = MIN(transferred, (UInt32)request->wLength);
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimCreateInterfaceIterator(void *self, IOUSBFindInterfaceRequest *request, io_iterator_t *iterator) {
+    (void)self;
+    (void)request;
+    (void)iterator;
+    return kIOReturnUnsupported;  /* note: use CANSIM_GetInterface() */
+}
+
+/*  ---  IOUSBInterfaceInterface  ---
+ */
+static IOReturn SimCreateInterfaceAsyncEventSource(void *self, CFRunLoopSourceRef *source) {
+    CFRunLoopSourceContext context;
+    IOReturn kr = kIOReturnSuccess;
+
+    (void)self;
+    /* note: completions are delivered on the run loop the source is added to (as with IOKit),
+     *       one source for all simulated interfaces (it lives as long as the process) */
+    ENTER_CRITICAL_SECTION();
+    if (!simDriver.refSource) {
+        bzero(&context, sizeof(CFRunLoopSourceContext));
+        context.schedule = ScheduleEventSource;
+        context.cancel = CancelEventSource;
+        context.perform = DeliverCompletions;
+        if ((simDriver.refSource = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context)) == NULL)
+            kr = kIOReturnNoResources;
+    }
+    *source = simDriver.refSource;
+    LEAVE_CRITICAL_SECTION();
+    return kr;
+}
+
+static IOReturn SimInterfaceOpen(void *self) {
+    SimInterface_t *usbInterface = (SimInterface_t*)self;
+    IOReturn kr = kIOReturnSuccess;
+
+    ENTER_CRITICAL_SECTION();
+    if (!usbInterface->device->fPresent)
+        kr = kIOReturnNoDevice;
+    else if (usbInterface->fOpened)
+        kr = kIOReturnExclusiveAccess;
+    else {
+        bzero(usbInterface->fStalled, sizeof(usbInterface->fStalled));
+        usbInterface->fOpened = true;
+    }
+    LEAVE_CRITICAL_SECTION();
+    return kr;
+}
+
+static IOReturn SimInterfaceClose(void *self) {
+    SimInterface_t *usbInterface = (SimInterface_t*)self;
+
+    ENTER_CRITICAL_SECTION();
+    /* note: closing the interface aborts all pending transfers */
+    CancelRequests(&usbInterface->device->reads, 0U, kIOReturnAborted, 0U);
+    CancelRequests(&usbInterface->device->writes, 0U, kIOReturnAborted, 0U);
+    FlushPackets(usbInterface->device);
+    usbInterface->fOpened = false;
+    SIGNAL_CONDITION();
+    LEAVE_CRITICAL_SECTION();
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetInterfaceClass(void *self, UInt8 *value) {
+    (void)self;
+    *value = 0xFFU;  /* note: vendor-specific */
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetInterfaceSubClass(void *self, UInt8 *value) {
+    (void)self;
+    *value = 0x00U;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetInterfaceProtocol(void *self, UInt8 *value) {
+    (void)self;
+    *value = 0x00U;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetNumEndpoints(void *self, UInt8 *value) {
+    (void)self;
+    *value = (UInt8)(NUM_PIPES - 1U);  /* note: w/o EP0 */
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetPipeProperties(void *self, UInt8 pipeRef, UInt8 *direction, UInt8 *number, UInt8 *transferType, UInt16 *maxPacketSize, UInt8 *interval) {
+    SimInterface_t *usbInterface = (SimInterface_t*)self;
+
+    switch (pipeRef) {
+    case CANSIM_PIPE_IN:
+        *direction = kUSBIn;
+        *maxPacketSize = usbInterface->device->param.packetSizeIn;
+        break;
+    case CANSIM_PIPE_OUT:
+        *direction = kUSBOut;
+        *maxPacketSize = usbInterface->device->param.packetSizeOut;
+        break;
+    default:
+        return kIOReturnBadArgument;
+    }
+    *number = pipeRef;
+    *transferType = kUSBBulk;
+    *interval = 0U;
+    return kIOReturnSuccess;
+}
+
+static IOReturn SimGetPipeStatus(void *self, UInt8 pipeRef) {
+    SimInterface_t *usbInterface = (SimInterface_t*)self;
+    IOReturn kr = kIOReturnSuccess;
+
+    if (!IS_PIPE_VALID(pipeRef))
+        return kIOReturnBadArgument;
+    ENTER_CRITICAL_SECTION();
+    if (!usbInterface->device->fPresent)
+        kr = kIOReturnNoDevice;
+    else if (!usbInterface->fOpened)
+        kr = kIOReturnNotOpen;
+    else if (usbInterface->fStalled[pipeRef])
+        kr = kIOUSBPipeStalled;
+    LEAVE_CRITICAL_SECTION();
+    return kr;
+}
+
+static IOReturn SimAbortPipe(void *self, UInt8 pipeRef) {
+    SimInterface_t *usbInterface = (SimInterface_t*)self;
+    IOReturn kr = kIOReturnSuccess;
+
+    if (!IS_PIPE_VALID(pipeRef))
+        return kIOReturnBadArgument;
+    ENTER_CRITICAL_SECTION();
+    if (!usbInterface->device->fPresent)
+        kr = kIOReturnNoDevice;
+    else if (!usbInterface->fOpened)
+        kr = kIOReturnNotOpen;
+    else {
+        /* note: aborted transfers are completed by the simulation thread */
+        CancelRequests((pipeRef == CANSIM_PIPE_IN) ? &usbInterface->device->reads : &usbInterface->device->writes,
+                       pipeRef, kIOReturnAborted, 0U);
+        SIGNAL_CONDITION();
+    }
+    LEAVE_CRITICAL_SECTION();
+    return kr;
+}
+
+static IOReturn SimClearPipeStall(void *self, UInt8 pipeRef) {
+    SimInterface_t *usbInterface = (SimInterface_t*)self;
+    IOReturn kr = kIOReturnSuccess;
+
+    if (!IS_PIPE_VALID(pipeRef))
+        return kIOReturnBadArgument;
+    ENTER_CRITICAL_SECTION();
+    if (!usbInterface->device->fPresent)
+        kr = kIOReturnNoDevice;
+    else if (!usbInterface->fOpened)
+        kr = kIOReturnNotOpen;
+    else {
+        CancelRequests((pipeRef == CANSIM_PIPE_IN) ? &usbInterface->device->reads : &usbInterface->device->writes,
+                       pipeRef, kIOReturnAborted, 0U);
+        usbInterface->fStalled[pipeRef] = false;
+        SIGNAL_CONDITION();
+    }
+    LEAVE_CRITICAL_SECTION();
+    return kr;
+}
+
+static IOReturn SimReadPipe(void *self, UInt8 pipeRef, void *buf, UInt32 *size) {
+    if (!size)
+        return kIOReturnBadArgument;
+    return SubmitRequest((SimInterface_t*)self, pipeRef, buf, *size, 0U, NULL, NULL, size);
+}
+
+static IOReturn SimWritePipe(void *self, UInt8 pipeRef, void *buf, UInt32 size) {
+    return SubmitRequest((SimInterface_t*)self, pipeRef, buf, size, 0U, NULL, NULL, NULL);
+}
+
+static IOReturn SimReadPipeTO(void *self, UInt8 pipeRef, void *buf, UInt32 *size, UInt32 noDataTimeout, UInt32 completionTimeout) {
+    (void)noDataTimeout;
+    if (!size)
+        return kIOReturnBadArgument;
+    return SubmitRequest((SimInterface_t*)self, pipeRef, buf, *size, completionTimeout, NULL, NULL, size);
+}
+
+static IOReturn SimWritePipeTO(void *self, UInt8 pipeRef, void *buf, UInt32 size, UInt32 noDataTimeout, UInt32 completionTimeout) {
+    (void)noDataTimeout;
+    return SubmitRequest((SimInterface_t*)self, pipeRef, buf, size, completionTimeout, NULL, NULL, NULL);
+}
+
+static IOReturn SimReadPipeAsync(void *self, UInt8 pipeRef, void *buf, UInt32 size, IOAsyncCallback1 callback, void *refCon) {
+    if (!callback)
+        return kIOReturnBadArgument;
+    return SubmitRequest((SimInterface_t*)self, pipeRef, buf, size, 0U, callback, refCon, NULL);
+}
+
+static IOReturn SimWritePipeAsync(void *self, UInt8 pipeRef, void *buf, UInt32 size, IOAsyncCallback1 callback, void *refCon) {
+    if (!callback)
+        return kIOReturnBadArgument;
+    return SubmitRequest((SimInterface_t*)self, pipeRef, buf, size, 0U, callback, refCon, NULL);
+}
+
+static IOReturn SimReadPipeAsyncTO(void *self, UInt8 pipeRef, void *buf, UInt32 size, UInt32 noDataTimeout, UInt32 completionTimeout, IOAsyncCallback1 callback, void *refCon) {
+    (void)noDataTimeout;
+    if (!callback)
+        return kIOReturnBadArgument;
+    return SubmitRequest((SimInterface_t*)self, pipeRef, buf, size, completionTimeout, callback, refCon, NULL);
+}
+
+static IOReturn SimWritePipeAsyncTO(void *self, UInt8 pipeRef, void *buf, UInt32 size, UInt32 noDataTimeout, UInt32 completionTimeout, IOAsyncCallback1 callback, void *refCon) {
+    (void)noDataTimeout;
+    if (!callback)
+        return kIOReturnBadArgument;
+    return SubmitRequest((SimInterface_t*)self, pipeRef, buf, size, completionTimeout, callback, refCon, NULL);
+}
+
+static IOReturn SimControlRequest(void *self, UInt8 pipeRef, IOUSBDevRequest *request) {
+    SimInterface_t *usbInterface = (SimInterface_t*)self;
+
+    if (pipeRef != 0U)
+        return kIOReturnBadArgument;
+    if (!usbInterface->fOpened)
+        return kIOReturnNotOpen;
+    return SimDeviceRequest((void*)usbInterface->device, request);
+}
+
+static IOReturn SimControlRequestAsync(void *self, UInt8 pipeRef, IOUSBDevRequest *request, IOAsyncCallback1 callback, void *refCon) {
+    SimInterface_t *usbInterface = (SimInterface_t*)self;
+    SimRequest_t *completion;
+    IOReturn kr;
+
+    if ((pipeRef != 0U) || !request || !callback)
+        return kIOReturnBadArgument;
+    if (!usbInterface->fOpened)
+        return kIOReturnNotOpen;
+    if ((completion = (SimRequest_t*)malloc(sizeof(SimRequest_t))) == NULL)
+        return kIOReturnNoMemory;
+    bzero(completion, sizeof(SimRequest_t));
+    completion->callback = callback;
+    completion->refCon = refCon;
+    /* note: the vendor request is handled at once, its completion is delivered by the simulation thread */
+    kr = SimDeviceRequest((void*)usbInterface->device, request);
+    ENTER_CRITICAL_SECTION();
+    CompleteRequest(completion, kr, (kIOReturnSuccess == kr) ? request->wLenDone : 0U);
+    SIGNAL_CONDITION();
+    LEAVE_CRITICAL_SECTION();
+    return kIOReturnSuccess;
+}
+
+/*  ---  Simulation  ---
+ *
+ *  bulk out :  a transfer occupies the wire for (length * BITS_PER_BYTE / bitrate) seconds,
+ *              it is completed when the last bit is sent and then looped back or handed
+ *              over to the transmit handler (e.g. a simulated CAN bus, see MacCAN_SimBus.c)
+ *  bulk in  :  a looped-back or received packet is available after (latency) micro-seconds,
+ *              it completes the oldest pending transfer (one packet per transfer)
+ *
+ *  Completion callbacks are called on the run loop the event source of the simulation is added to
+ *  (i.e. the run loop of the IOUsbKit), so a simulated device has the same threading model as IOKit.
+ */
+static IOReturn SubmitRequest(SimInterface_t *usbInterface, UInt8 pipeRef, void *buffer, UInt32 size, UInt32 timeout,
+                              IOAsyncCallback1 callback, void *refCon, UInt32 *transferred) {
+    SimDevice_t *device = usbInterface->device;
+    SimRequest_t local, *request = &local;
+    UInt64 now, duration;
+    IOReturn kr;
+
+    if (!IS_PIPE_VALID(pipeRef) || (!buffer && size))
+        return kIOReturnBadArgument;
+    /* asynchronous requests live until completion */
+    if (callback && ((request = (SimRequest_t*)malloc(sizeof(SimRequest_t))) == NULL))
+        return kIOReturnNoMemory;
+    bzero(request, sizeof(SimRequest_t));
+    request->pipeRef = pipeRef;
+    request->buffer = (UInt8*)buffer;
+    request->size = size;
+    request->callback = callback;
+    request->refCon = refCon;
+
+    ENTER_CRITICAL_SECTION();
+    if (!device->fPresent)
+        kr = kIOReturnNoDevice;
+    else if (!usbInterface->fOpened)
+        kr = kIOReturnNotOpen;
+    else if (usbInterface->fStalled[pipeRef])
+        kr = kIOUSBPipeStalled;
+    else {
+        now = GetTime();
+        request->deadline = timeout ? (now + ((UInt64)timeout * 1000U)) : 0U;
+        if (pipeRef == CANSIM_PIPE_OUT) {
+            /* the wire is occupied until the transfer is sent */
+            duration = device->param.bitrate ? (((UInt64)size * BITS_PER_BYTE * 1000000U) / device->param.bitrate) : 0U;
+            device->wireFree = ((device->wireFree > now) ? device->wireFree : now) + duration;
+            request->dueTime = device->wireFree;
+            QUEUE_PUSH(device->writes, request);
+        } else {
+            QUEUE_PUSH(device->reads, request);
+        }
+        SIGNAL_CONDITION();
+        kr = kIOReturnSuccess;
+    }
+    if ((kIOReturnSuccess == kr) && !callback) {
+        /* synchronous request: wait for completion */
+        while (!request->done)
+            WAIT_CONDITION();
+        kr = request->result;
+        if (transferred)
+            *transferred = request->length;
+    }
+    LEAVE_CRITICAL_SECTION();
+
+    if ((kIOReturnSuccess != kr) && callback)
+        free(request);
+    return kr;
+}
+
+static void CompleteRequest(SimRequest_t *request, IOReturn result, UInt32 length) {
+    /* note: called within the critical section */
+    request->result = result;
+    request->length = length;
+    if (request->callback) {
+        /* the callback is called on the run loop */
+        QUEUE_PUSH(simDriver.done, request);
+        if (simDriver.refSource && simDriver.refRunLoop) {
+            CFRunLoopSourceSignal(simDriver.refSource);
+            CFRunLoopWakeUp(simDriver.refRunLoop);
+        }
+    } else {
+        request->done = true;
+        SIGNAL_CONDITION();
+    }
+}
+
+static void CancelRequests(SimRequestQueue_t *queue, UInt8 pipeRef, IOReturn result, UInt64 expired) {
+    SimRequest_t *request, *remaining = NULL, *last = NULL;
+
+    /* note: called within the critical section */
+    while ((request = queue->head)) {
+        queue->head = request->next;
+        if (((pipeRef == 0U) || (request->pipeRef == pipeRef)) &&
+            ((expired == 0U) || (request->deadline && (request->deadline <= expired)))) {
+            CompleteRequest(request, result, 0U);
+        } else {
+            request->next = NULL;
+            if (last)
+                last->next = request;
+            else
+                remaining = request;
+            last = request;
+        }
+    }
+    queue->head = remaining;
+    queue->tail = last;
+}
+
+static UInt64 ServiceDevice(SimDevice_t *device, UInt64 now) {
+    SimRequest_t *request;
+    SimPacket_t *packet;
+    UInt64 wakeup = 0U;
+    UInt32 length;
+    int rc;
+
+    /* note: called within the critical section */
+    if (!device->fPresent)
+        return 0U;
+    /* bulk out: the transfer has been sent, hand it over or loop it back */
+    while (device->writes.head && !device->fBlocked && (device->writes.head->dueTime <= now)) {
+        if (device->transmit) {
+            rc = device->transmit(device->refTransmit, device->writes.head->buffer, device->writes.head->size);
+            if (rc == CANUSB_ERROR_BUSY) {
+                /* retry when resumed */
+                device->fBlocked = true;
+                break;
+            }
+            QUEUE_POP(device->writes, request);
+            if (rc != CANUSB_SUCCESS) {
+                /* the endpoint is halted */
+                device->usbInterface.fStalled[CANSIM_PIPE_OUT] = true;
+                CompleteRequest(request, kIOUSBPipeStalled, 0U);
+                CancelRequests(&device->writes, 0U, kIOUSBPipeStalled, 0U);
+                break;
+            }
+        } else {
+            QUEUE_POP(device->writes, request);
+            (void)QueuePacket(device, request->buffer, request->size, now);
+        }
+        CompleteRequest(request, kIOReturnSuccess, request->size);
+    }
+    /* bulk in: a looped-back or received packet is available */
+    while (device->reads.head && device->packets.head && (device->packets.head->dueTime <= now)) {
+        QUEUE_POP(device->reads, request);
+        QUEUE_POP(device->packets, packet);
+        device->packets.count--;
+        length = MIN(packet->length, request->size);
+        memcpy(request->buffer, packet->data, length);
+        CompleteRequest(request, (packet->length <= request->size) ? kIOReturnSuccess : kIOReturnOverrun, length);
+        free(packet);
+    }
+    /* time-out: the transfer has not been completed in time */
+    CancelRequests(&device->reads, 0U, kIOUSBTransactionTimeout, now);
+    CancelRequests(&device->writes, 0U, kIOUSBTransactionTimeout, now);
+
+    /* next event of the device (if any) */
+    if (device->writes.head && !device->fBlocked)
+        wakeup = device->writes.head->dueTime;
+    if (device->reads.head && device->packets.head)
+        if (!wakeup || (device->packets.head->dueTime < wakeup))
+            wakeup = device->packets.head->dueTime;
+    for (request = device->reads.head; request; request = request->next)
+        if (request->deadline && (!wakeup || (request->deadline < wakeup)))
+            wakeup = request->deadline;
+    for (request = device->writes.head; request; request = request->next)
+        if (request->deadline && (!wakeup || (request->deadline < wakeup)))
+            wakeup = request->deadline;
+    return wakeup;
+}
+
+static void FlushPackets(SimDevice_t *device) {
+    SimPacket_t *packet;
+
+    /* note: called within the critical section */
+    while (device->packets.head) {
+        QUEUE_POP(device->packets, packet);
+        free(packet);
+    }
+    device->packets.count = 0U;
+}
+
+static int QueuePacket(SimDevice_t *device, const UInt8 *data, UInt32 length, UInt64 now) {
+    SimPacket_t *packet;
+
+    /* note: called within the critical section */
+    if (device->packets.count >= device->param.queueSize) {
+        device->dropped++;
+        return CANUSB_ERROR_FULL;
+    }
+    if ((packet = (SimPacket_t*)malloc(sizeof(SimPacket_t) + length)) == NULL) {
+        device->dropped++;
+        return CANUSB_ERROR_RESOURCE;
+    }
+    if (length)
+        memcpy(packet->data, data, length);
+    packet->length = length;
+    packet->dueTime = now + device->param.latency;
+    QUEUE_PUSH(device->packets, packet);
+    device->packets.count++;
+    return CANUSB_SUCCESS;
+}
+
+static SimDevice_t *FindDevice(UInt32 location) {
+    int index;
+
+    /* note: called within the critical section */
+    for (index = 0; index < CANSIM_MAX_DEVICES; index++) {
+        if (simDevice[index].fPresent && (simDevice[index].u32Location == location))
+            return &simDevice[index];
+    }
+    return NULL;
+}
+
+static void* SimulationThread(void *arg) {
+    UInt64 now, wakeup, next;
+    struct timespec absTime;
+    int index;
+
+    ENTER_CRITICAL_SECTION();
+    while (simDriver.fRunning) {
+        /* service all simulated devices (note: the completions are handed over to the run loop) */
+        now = GetTime();
+        for (index = 0, wakeup = 0U; index < CANSIM_MAX_DEVICES; index++) {
+            next = ServiceDevice(&simDevice[index], now);
+            if (next && (!wakeup || (next < wakeup)))
+                wakeup = next;
+        }
+        /* wait for the next event or for a new request */
+        if (wakeup) {
+            clock_gettime(CLOCK_REALTIME, &absTime);
+            wakeup -= now;
+            absTime.tv_sec += (time_t)(wakeup / 1000000U);
+            absTime.tv_nsec += (long)(wakeup % 1000000U) * (long)1000;
+            if (absTime.tv_nsec >= (long)1000000000) {
+                absTime.tv_nsec -= (long)1000000000;
+                absTime.tv_sec += (time_t)1;
+            }
+            (void)pthread_cond_timedwait(&simDriver.ptCond, &simDriver.ptMutex, &absTime);
+        } else {
+            WAIT_CONDITION();
+        }
+    }
+    LEAVE_CRITICAL_SECTION();
+    (void)arg;  /* to avoid compiler warnings */
+    return NULL;
+}
+
+static void ScheduleEventSource(void *info, CFRunLoopRef runLoop, CFRunLoopMode mode) {
+    /* the event source has been added to a run loop: deliver the completions there */
+    ENTER_CRITICAL_SECTION();
+    simDriver.refRunLoop = runLoop;
+    LEAVE_CRITICAL_SECTION();
+    (void)info;
+    (void)mode;
+}
+
+static void CancelEventSource(void *info, CFRunLoopRef runLoop, CFRunLoopMode mode) {
+    SimRequest_t *request;
+
+    /* the event source has been removed from its run loop (e.g. the run loop is gone):
+     * as with IOKit, completions not yet delivered are lost */
+    ENTER_CRITICAL_SECTION();
+    if (simDriver.refRunLoop == runLoop) {
+        simDriver.refRunLoop = NULL;
+        while (simDriver.done.head) {
+            QUEUE_POP(simDriver.done, request);
+            free(request);
+        }
+    }
+    LEAVE_CRITICAL_SECTION();
+    (void)info;
+    (void)mode;
+}
+
+static void DeliverCompletions(void *info) {
+    SimRequest_t *request, *list;
+
+    /* performed by the run loop when signaled: call the completion callbacks outside the critical section */
+    ENTER_CRITICAL_SECTION();
+    list = simDriver.done.head;
+    simDriver.done.head = simDriver.done.tail = NULL;
+    LEAVE_CRITICAL_SECTION();
+    while ((request = list)) {
+        list = request->next;
+        request->callback(request->refCon, request->result, (void*)(uintptr_t)request->length);
+        free(request);
+    }
+    (void)info;
+}
+
+static UInt64 GetTime(void) {
+    struct timespec now;
+
+    /* monotonic time in [us] */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((UInt64)now.tv_sec * 1000000U) + ((UInt64)now.tv_nsec / 1000U);
+}
+#endif /* OPTION_MACCAN_SIMULATION */
+
+/* * $Id$ *** (c) UV Software, Berlin ***
+ */
@@ -0,0 +1,114 @@
+/*  SPDX-License-Identifier: BSD-2-Clause OR GPL-3.0-or-later */
+/*
+ *  MacCAN - macOS User-Space Driver for USB-to-CAN Interfaces
+ *
+ *  Copyright (c) 2012-2023 Uwe Vogt, UV Software, Berlin (info@mac-can.com)
+ *  All rights reserved.
+ *
+ *  This file is part of MacCAN-Core.
+ *
+ *  MacCAN-Core is dual-licensed under the BSD 2-Clause "Simplified" License and
+ *  under the GNU General Public License v3.0 (or any later version).
+ *  You can choose between one of them if you use this file.
+ *
+ *  BSD 2-Clause "Simplified" License:
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ *  MacCAN-Core IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF MacCAN-Core, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  GNU General Public License v3.0 or later:
+ *  MacCAN-Core is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MacCAN-Core is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MacCAN-Core.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MACCAN_IOUSBSIM_H_INCLUDED
+#define MACCAN_IOUSBSIM_H_INCLUDED
+
+#include "MacCAN_IOUsbKit.h"
+
+#ifndef CANSIM_MAX_DEVICES
+#define CANSIM_MAX_DEVICES  8
+#endif
+#define CANSIM_LOCATION_ID  0xFA000000U
+
+/* pipes of a simulated interface */
+#define CANSIM_PIPE_IN   1U
+#define CANSIM_PIPE_OUT  2U
+
+#define CANSIM_DEFAULT_PACKET_SIZE  64U
+#define CANSIM_DEFAULT_QUEUE_SIZE  256U
+
+typedef int CANSIM_Return_t;
+
+typedef int (*CANSIM_ControlCbk_t)(CANUSB_Context_t refCon, const CANUSB_SetupPacket_t *setupPacket, void *buffer, UInt32 *transferred);
+
+/* note: called by the simulation thread within its critical section (no CANSIM_ calls allowed),
+ *       return CANUSB_SUCCESS when accepted, CANUSB_ERROR_BUSY to retry after CANSIM_ResumeTransmit,
+ *       or any other error to stall the bulk out pipe
+ */
+typedef int (*CANSIM_TransmitCbk_t)(CANUSB_Context_t refCon, const UInt8 *buffer, UInt32 length);
+
+typedef struct sim_device_param_tag {   /* Simulated USB device: */
+    UInt16 vendorId;                    /*   vendor ID (must be in CANDEV_Devices) */
+    UInt16 productId;                   /*   product ID (must be in CANDEV_Devices) */
+    UInt16 releaseNo;                   /*   release no. (bcdDevice) */
+    UInt16 packetSizeIn;                /*   max. packet size of bulk in pipe */
+    UInt16 packetSizeOut;               /*   max. packet size of bulk out pipe */
+    UInt32 queueSize;                   /*   number of packets buffered by the device */
+    UInt32 latency;                     /*   loop-back latency (in [us]) */
+    UInt32 bitrate;                     /*   bit-rate for pacing (in [bit/s], 0 = none) */
+    CANSIM_ControlCbk_t callback;       /*   handler for device requests (optional) */
+    CANUSB_Context_t context;           /*   pointer to user context for callback */
+} CANSIM_Param_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern CANSIM_Return_t CANSIM_PlugDevice(const CANSIM_Param_t *param, UInt32 *location);
+
+extern CANSIM_Return_t CANSIM_UnplugDevice(UInt32 location);
+
+extern CANSIM_Return_t CANSIM_SetTiming(UInt32 location, UInt32 latency, UInt32 bitrate);
+
+extern CANSIM_Return_t CANSIM_SetTransmitHandler(UInt32 location, CANSIM_TransmitCbk_t callback, CANUSB_Context_t context);
+
+extern CANSIM_Return_t CANSIM_ResumeTransmit(UInt32 location);
+
+extern CANSIM_Return_t CANSIM_ReceivePacket(UInt32 location, const void *buffer, UInt32 length);
+
+extern Boolean CANSIM_IsSimulatedDevice(void *ioDevice);
+
+extern void *CANSIM_GetInterface(void *ioDevice);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* MACCAN_IOUSBSIM_H_INCLUDED */
+
+/* * $Id$ *** (c) UV Software, Berlin ***
+ */
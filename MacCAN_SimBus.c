@@ -0,0 +1,920 @@
+/*  SPDX-License-Identifier: BSD-2-Clause OR GPL-3.0-or-later */
+/*
+ *  MacCAN - macOS User-Space Driver for USB-to-CAN Interfaces
+ *
+ *  Copyright (c) 2012-2023 Uwe Vogt, UV Software, Berlin (info@mac-can.com)
+ *  All rights reserved.
+ *
+ *  This file is part of MacCAN-Core.
+ *
+ *  MacCAN-Core is dual-licensed under the BSD 2-Clause "Simplified" License and
+ *  under the GNU General Public License v3.0 (or any later version).
+ *  You can choose between one of them if you use this file.
+ *
+ *  BSD 2-Clause "Simplified" License:
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ *  MacCAN-Core IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF MacCAN-Core, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  GNU General Public License v3.0 or later:
+ *  MacCAN-Core is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MacCAN-Core is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MacCAN-Core.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "MacCAN_SimBus.h"
+#include "MacCAN_Debug.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <time.h>
+
+#if (OPTION_MACCAN_SIMULATION != 0)
+
+#define MAX_FRAME_BITS  640U    /* SOF .. CRC (w/o stuff bits) of the longest frame */
+#define ERROR_FRAME_BITS  17U   /* error flag (6), error delimiter (8) and intermission (3) */
+#define SUSPEND_BITS  8U        /* suspend transmission of an error passive transmitter */
+#define RECOVERY_BITS  1408U    /* bus-off recovery: 128 occurrences of 11 recessive bits */
+
+#define OUTCOME_SUCCESS  0      /* frame transmitted and acknowledged */
+#define OUTCOME_ACK_ERROR  1    /* frame not acknowledged */
+#define OUTCOME_BIT_ERROR  2    /* frame destroyed by a bit error */
+
+#define NO_NODE  (-1)
+
+#define MIN(x,y)  (((x) <= (y)) ? (x) : (y))
+
+#define IS_BUS_VALID(idx)  ((0 <= (idx)) && ((idx) < CANBUS_MAX_BUSES) && simBus[idx].fCreated)
+#define IS_NODE_VALID(bus,idx)  ((0 <= (idx)) && ((idx) < CANBUS_MAX_NODES) && simBus[bus].node[idx].fAttached)
+
+#define ENTER_CRITICAL_SECTION(bus)  assert(0 == pthread_mutex_lock(&(bus)->ptMutex))
+#define LEAVE_CRITICAL_SECTION(bus)  assert(0 == pthread_mutex_unlock(&(bus)->ptMutex))
+
+#define SIGNAL_CONDITION(bus)  assert(0 == pthread_cond_broadcast(&(bus)->ptCond))
+#define WAIT_CONDITION(bus)  assert(0 == pthread_cond_wait(&(bus)->ptCond, &(bus)->ptMutex))
+
+typedef struct frame_geometry_tag {     /* Bit positions of a frame: */
+    UInt32 brsPos;                      /*   up to and incl. BRS bit (0 = no bit-rate switching) */
+    UInt32 crcDelPos;                   /*   up to and incl. CRC delimiter */
+    UInt32 ackPos;                      /*   up to and incl. ACK slot */
+    UInt32 total;                       /*   all bits incl. stuff bits and intermission */
+} FrameGeometry_t;
+
+typedef struct sim_queue_entry_tag {    /* Transmit queue entry: */
+    CANBUS_Frame_t frame;               /*   the frame to be transmitted */
+    UInt64 queuedAt;                    /*   time when queued (in [ns]) */
+} SimQueueEntry_t;
+
+typedef struct sim_node_tag {           /* Node on the bus: */
+    Boolean fAttached;                  /*   node is attached to the bus */
+    struct sim_bus_tag *bus;            /*   the bus of the node */
+    CANBUS_NodeParam_t param;           /*   node parameters */
+    struct {                            /*   transmit queue: */
+        SimQueueEntry_t *entries;       /*     ring buffer */
+        UInt32 size;                    /*     number of entries */
+        UInt32 head;                    /*     oldest entry */
+        UInt32 used;                    /*     used entries */
+    } txQueue;
+    Boolean fBlocked;                   /*   device waits for free entries */
+    UInt8 state;                        /*   fault confinement state */
+    UInt16 tec;                         /*   transmit error counter */
+    UInt8 rec;                          /*   receive error counter */
+    UInt64 recoveryTime;                /*   end of bus-off recovery (in [ns]) */
+    CANBUS_NodeStatus_t counters;       /*   statistics */
+} SimNode_t;
+
+typedef struct sim_delivery_tag {       /* Frame to be delivered: */
+    SimNode_t *node;                    /*   receiving node */
+    UInt32 location;                    /*   location ID of its device */
+    CANBUS_EncodeCbk_t encode;          /*   encoder of the node */
+    CANUSB_Context_t context;           /*   pointer to user context for the encoder */
+    CANBUS_Frame_t frame;               /*   the received frame */
+    Boolean fDropped;                   /*   not delivered to the device */
+} SimDelivery_t;
+
+typedef struct sim_bus_tag {            /* Simulated CAN bus: */
+    Boolean fCreated;                   /*   bus is created */
+    Boolean fRunning;                   /*   flag: thread running */
+    CANBUS_Param_t param;               /*   bus parameters */
+    SimNode_t node[CANBUS_MAX_NODES];   /*   nodes on the bus */
+    struct {                            /*   frame on the bus: */
+        Boolean fBusy;                  /*     bus is busy */
+        int node;                       /*     transmitting node (or NO_NODE) */
+        int outcome;                    /*     success or error */
+        UInt64 startTime;               /*     start of frame (in [ns]) */
+        UInt64 endTime;                 /*     end of frame or error frame (in [ns]) */
+    } current;
+    UInt64 idleTime;                    /*   bus idle since (in [ns]) */
+    UInt64 createTime;                  /*   time of creation (in [ns]) */
+    UInt32 random;                      /*   state of the error generator */
+    SimDelivery_t delivery[CANBUS_MAX_NODES];  /* deliveries of the current frame */
+    int nDeliveries;                    /*   number of deliveries */
+    UInt32 resumeLocation;              /*   device to be resumed (0 = none) */
+    Boolean fDelivering;                /*   deliveries in progress */
+    CANBUS_BusStatus_t counters;        /*   statistics */
+    pthread_t ptThread;                 /*   pthread of the bus */
+    pthread_mutex_t ptMutex;            /*   pthread mutex for mutual exclusion */
+    pthread_cond_t ptCond;              /*   pthread condition for signaling */
+} SimBus_t;
+
+static int TransmitCallback(CANUSB_Context_t refCon, const UInt8 *buffer, UInt32 length);
+static Boolean StartFrame(SimBus_t *bus, UInt64 now);
+static void CompleteFrame(SimBus_t *bus);
+static void DeliverFrames(SimBus_t *bus);
+static UInt64 RecoverNodes(SimBus_t *bus, UInt64 now);
+static void UpdateState(SimBus_t *bus, SimNode_t *node, UInt64 now);
+static void GetGeometry(const CANBUS_Frame_t *frame, FrameGeometry_t *geometry);
+static UInt64 BitsToTime(const SimBus_t *bus, const FrameGeometry_t *geometry, UInt32 bits);
+static UInt32 ArbitrationField(const CANBUS_Frame_t *frame);
+static UInt32 CollisionPosition(const CANBUS_Frame_t *frame, const CANBUS_Frame_t *other);
+static UInt32 PutBits(UInt8 *bits, UInt32 n, UInt32 value, UInt32 count);
+static UInt32 StuffBits(const UInt8 *bits, UInt32 n, UInt32 mark, UInt32 *marked, Boolean trailing);
+static UInt16 CalcCrc15(const UInt8 *bits, UInt32 n);
+static UInt32 Random(SimBus_t *bus);
+static void WaitUntil(SimBus_t *bus, UInt64 wakeup);
+static void* BusThread(void *arg);
+static UInt64 GetTime(void);
+
+static const UInt8 dlc2len[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64 };
+
+static SimBus_t simBus[CANBUS_MAX_BUSES];
+static pthread_mutex_t busMutex = PTHREAD_MUTEX_INITIALIZER;
+
+CANBUS_Handle_t CANBUS_CreateBus(const CANBUS_Param_t *param) {
+    SimBus_t *bus = NULL;
+    int index;
+
+    /* check for NULL pointer */
+    if (!param)
+        return CANBUS_INVALID_HANDLE;
+    /* a bit-rate is required */
+    if (!param->nominalBitrate)
+        return CANBUS_INVALID_HANDLE;
+
+    /* look for a free entry */
+    assert(0 == pthread_mutex_lock(&busMutex));
+    for (index = 0; index < CANBUS_MAX_BUSES; index++) {
+        if (!simBus[index].fCreated) {
+            bus = &simBus[index];
+            break;
+        }
+    }
+    if (!bus) {
+        MACCAN_DEBUG_ERROR("+++ No free entry available for simulated bus\n");
+        assert(0 == pthread_mutex_unlock(&busMutex));
+        return CANBUS_INVALID_HANDLE;
+    }
+    bzero(bus, sizeof(SimBus_t));
+    bus->param = *param;
+    bus->current.node = NO_NODE;
+    bus->random = param->seed ? param->seed : 0x2545F491U;
+    bus->createTime = bus->idleTime = GetTime();
+    if ((pthread_mutex_init(&bus->ptMutex, NULL) != 0) ||
+        (pthread_cond_init(&bus->ptCond, NULL) != 0)) {
+        MACCAN_DEBUG_ERROR("+++ Unable to create mutex or condition for simulated bus\n");
+        assert(0 == pthread_mutex_unlock(&busMutex));
+        return CANBUS_INVALID_HANDLE;
+    }
+    bus->fRunning = true;
+    if (pthread_create(&bus->ptThread, NULL, BusThread, (void*)bus) != 0) {
+        MACCAN_DEBUG_ERROR("+++ Unable to start thread for simulated bus\n");
+        (void)pthread_cond_destroy(&bus->ptCond);
+        (void)pthread_mutex_destroy(&bus->ptMutex);
+        bus->fRunning = false;
+        assert(0 == pthread_mutex_unlock(&busMutex));
+        return CANBUS_INVALID_HANDLE;
+    }
+    bus->fCreated = true;
+    assert(0 == pthread_mutex_unlock(&busMutex));
+    MACCAN_DEBUG_CORE("    - Simulated bus #%i created (%u kbit/s, %u kbit/s)\n", index,
+                      param->nominalBitrate / 1000U, param->dataBitrate / 1000U);
+    return (CANBUS_Handle_t)index;
+}
+
+CANBUS_Return_t CANBUS_DestroyBus(CANBUS_Handle_t handle) {
+    SimBus_t *bus;
+    int index;
+
+    /* must be a valid handle */
+    if (!IS_BUS_VALID(handle))
+        return CANUSB_ERROR_HANDLE;
+    bus = &simBus[handle];
+
+    /* detach all nodes (outside the critical section) */
+    for (index = 0; index < CANBUS_MAX_NODES; index++) {
+        if (bus->node[index].fAttached)
+            (void)CANBUS_DetachNode(handle, index);
+    }
+    /* stop the thread */
+    ENTER_CRITICAL_SECTION(bus);
+    bus->fRunning = false;
+    SIGNAL_CONDITION(bus);
+    LEAVE_CRITICAL_SECTION(bus);
+    (void)pthread_join(bus->ptThread, NULL);
+
+    assert(0 == pthread_mutex_lock(&busMutex));
+    (void)pthread_cond_destroy(&bus->ptCond);
+    (void)pthread_mutex_destroy(&bus->ptMutex);
+    bus->fCreated = false;
+    assert(0 == pthread_mutex_unlock(&busMutex));
+    MACCAN_DEBUG_CORE("    - Simulated bus #%i destroyed (%" PRIu64 " frame(s), %" PRIu64 " error frame(s))\n", handle,
+                      bus->counters.frames, bus->counters.errorFrames);
+    return CANUSB_SUCCESS;
+}
+
+CANBUS_Node_t CANBUS_AttachNode(CANBUS_Handle_t handle, const CANBUS_NodeParam_t *param) {
+    SimBus_t *bus;
+    SimNode_t *node = NULL;
+    SimQueueEntry_t *entries;
+    UInt32 size;
+    int index;
+
+    /* must be a valid handle */
+    if (!IS_BUS_VALID(handle))
+        return CANBUS_INVALID_HANDLE;
+    bus = &simBus[handle];
+    /* check for NULL pointer */
+    if (!param || !param->decode || !param->encode)
+        return CANBUS_INVALID_HANDLE;
+
+    /* allocate the transmit queue */
+    size = param->queueSize ? param->queueSize : CANBUS_DEFAULT_QUEUE_SIZE;
+    if ((entries = (SimQueueEntry_t*)calloc(size, sizeof(SimQueueEntry_t))) == NULL)
+        return CANBUS_INVALID_HANDLE;
+    ENTER_CRITICAL_SECTION(bus);
+    for (index = 0; index < CANBUS_MAX_NODES; index++) {
+        if (bus->node[index].fAttached && (bus->node[index].param.location == param->location)) {
+            MACCAN_DEBUG_ERROR("+++ Device at location %08x already attached to bus #%i\n", param->location, handle);
+            LEAVE_CRITICAL_SECTION(bus);
+            free(entries);
+            return CANBUS_INVALID_HANDLE;
+        }
+    }
+    for (index = 0; index < CANBUS_MAX_NODES; index++) {
+        if (!bus->node[index].fAttached) {
+            node = &bus->node[index];
+            break;
+        }
+    }
+    if (!node) {
+        MACCAN_DEBUG_ERROR("+++ No free entry available on bus #%i\n", handle);
+        LEAVE_CRITICAL_SECTION(bus);
+        free(entries);
+        return CANBUS_INVALID_HANDLE;
+    }
+    bzero(node, sizeof(SimNode_t));
+    node->bus = bus;
+    node->param = *param;
+    node->txQueue.entries = entries;
+    node->txQueue.size = size;
+    node->state = CANBUS_ERROR_ACTIVE;
+    node->fAttached = true;
+    LEAVE_CRITICAL_SECTION(bus);
+
+    /* bulk out transfers of the device go onto the bus from now on */
+    if (CANSIM_SetTransmitHandler(param->location, TransmitCallback, (CANUSB_Context_t)node) != CANUSB_SUCCESS) {
+        MACCAN_DEBUG_ERROR("+++ No simulated device at location %08x\n", param->location);
+        (void)CANBUS_DetachNode(handle, index);
+        return CANBUS_INVALID_HANDLE;
+    }
+    MACCAN_DEBUG_CORE("      - Device at location %08x attached to bus #%i as node #%i\n", param->location, handle, index);
+    return (CANBUS_Node_t)index;
+}
+
+CANBUS_Return_t CANBUS_DetachNode(CANBUS_Handle_t handle, CANBUS_Node_t index) {
+    SimBus_t *bus;
+    SimNode_t *node;
+
+    /* must be a valid handle */
+    if (!IS_BUS_VALID(handle) || !IS_NODE_VALID(handle, index))
+        return CANUSB_ERROR_HANDLE;
+    bus = &simBus[handle];
+    node = &bus->node[index];
+
+    /* note: the transmit handler is never called after this */
+    (void)CANSIM_SetTransmitHandler(node->param.location, NULL, NULL);
+
+    ENTER_CRITICAL_SECTION(bus);
+    /* note: the encoder of the node may be in use */
+    while (bus->fDelivering)
+        WAIT_CONDITION(bus);
+    /* a frame of the node on the bus is not completed */
+    if (bus->current.fBusy && (bus->current.node == index))
+        bus->current.node = NO_NODE;
+    free(node->txQueue.entries);
+    node->txQueue.entries = NULL;
+    node->fAttached = false;
+    LEAVE_CRITICAL_SECTION(bus);
+    return CANUSB_SUCCESS;
+}
+
+CANBUS_Return_t CANBUS_ResetNode(CANBUS_Handle_t handle, CANBUS_Node_t index) {
+    SimBus_t *bus;
+    SimNode_t *node;
+
+    /* must be a valid handle */
+    if (!IS_BUS_VALID(handle) || !IS_NODE_VALID(handle, index))
+        return CANUSB_ERROR_HANDLE;
+    bus = &simBus[handle];
+    node = &bus->node[index];
+
+    /* reset the fault confinement (e.g. bus-off w/o auto-recovery) */
+    ENTER_CRITICAL_SECTION(bus);
+    node->tec = 0U;
+    node->rec = 0U;
+    node->state = CANBUS_ERROR_ACTIVE;
+    SIGNAL_CONDITION(bus);
+    LEAVE_CRITICAL_SECTION(bus);
+    return CANUSB_SUCCESS;
+}
+
+CANBUS_Return_t CANBUS_GetNodeStatus(CANBUS_Handle_t handle, CANBUS_Node_t index, CANBUS_NodeStatus_t *status) {
+    SimBus_t *bus;
+    SimNode_t *node;
+
+    /* must be a valid handle */
+    if (!IS_BUS_VALID(handle) || !IS_NODE_VALID(handle, index))
+        return CANUSB_ERROR_HANDLE;
+    /* check for NULL pointer */
+    if (!status)
+        return CANUSB_ERROR_NULLPTR;
+    bus = &simBus[handle];
+    node = &bus->node[index];
+
+    ENTER_CRITICAL_SECTION(bus);
+    *status = node->counters;
+    status->state = node->state;
+    status->txErrorCounter = node->tec;
+    status->rxErrorCounter = node->rec;
+    status->queued = node->txQueue.used;
+    LEAVE_CRITICAL_SECTION(bus);
+    return CANUSB_SUCCESS;
+}
+
+CANBUS_Return_t CANBUS_GetBusStatus(CANBUS_Handle_t handle, CANBUS_BusStatus_t *status) {
+    SimBus_t *bus;
+
+    /* must be a valid handle */
+    if (!IS_BUS_VALID(handle))
+        return CANUSB_ERROR_HANDLE;
+    /* check for NULL pointer */
+    if (!status)
+        return CANUSB_ERROR_NULLPTR;
+    bus = &simBus[handle];
+
+    ENTER_CRITICAL_SECTION(bus);
+    *status = bus->counters;
+    status->elapsedTime = GetTime() - bus->createTime;
+    LEAVE_CRITICAL_SECTION(bus);
+    return CANUSB_SUCCESS;
+}
+
+UInt32 CANBUS_GetFrameBits(const CANBUS_Frame_t *frame, UInt32 *dataBits) {
+    FrameGeometry_t geometry;
+
+    /* check for NULL pointer */
+    if (!frame)
+        return 0U;
+    GetGeometry(frame, &geometry);
+    /* note: the BRS bit and the CRC delimiter are split between the two phases */
+    if (dataBits)
+        *dataBits = geometry.brsPos ? (geometry.crcDelPos - geometry.brsPos - 1U) : 0U;
+    return geometry.total;
+}
+
+/*  ---  Transmit handler (simulation thread of the devices)  ---
+ */
+static int TransmitCallback(CANUSB_Context_t refCon, const UInt8 *buffer, UInt32 length) {
+    SimNode_t *node = (SimNode_t*)refCon;
+    SimBus_t *bus = node->bus;
+    CANBUS_Frame_t frames[CANBUS_MAX_FRAMES];
+    UInt32 count = CANBUS_MAX_FRAMES;
+    UInt32 i, tail;
+    UInt64 now;
+    int ret = CANUSB_SUCCESS;
+
+    /* USB payload into CAN frames (vendor-specific) */
+    if (node->param.decode(node->param.context, buffer, length, frames, &count) != 0)
+        return CANUSB_ERROR_ILLPARA;
+    if (count > CANBUS_MAX_FRAMES)
+        return CANUSB_ERROR_ILLPARA;
+
+    ENTER_CRITICAL_SECTION(bus);
+    if (!node->fAttached || node->param.listenOnly) {
+        /* note: frames of a passive node are discarded */
+    } else if (count > node->txQueue.size) {
+        MACCAN_DEBUG_ERROR("+++ Transfer of %u frame(s) exceeds the queue of node #%i\n", count, (int)(node - bus->node));
+        ret = CANUSB_ERROR_OVERRUN;
+    } else if (count > (node->txQueue.size - node->txQueue.used)) {
+        /* the device holds the transfer until there is room */
+        node->fBlocked = true;
+        ret = CANUSB_ERROR_BUSY;
+    } else {
+        now = GetTime();
+        for (i = 0; i < count; i++) {
+            tail = (node->txQueue.head + node->txQueue.used) % node->txQueue.size;
+            node->txQueue.entries[tail].frame = frames[i];
+            node->txQueue.entries[tail].queuedAt = now;
+            node->txQueue.used++;
+        }
+        SIGNAL_CONDITION(bus);
+    }
+    LEAVE_CRITICAL_SECTION(bus);
+    return ret;
+}
+
+/*  ---  Bus engine  ---
+ *
+ *  The bus is either idle or busy with one frame (or an error frame). A frame starts when the
+ *  bus becomes idle or when the first frame is queued; all nodes with a frame queued by then
+ *  take part in the arbitration, the node with the lowest arbitration field wins (the same
+ *  field with a different control or data field collides, i.e. a bit error). The duration of the frame is calculated bit-exactly (incl. dynamic and fixed
+ *  stuff bits and the CAN FD bit-rate switch); the outcome is determined at its start:
+ *  - no other node acknowledges the frame (ACK error), or
+ *  - the frame is destroyed by an injected bit error (error rate), or
+ *  - the frame is transmitted successfully and delivered to all receivers.
+ *  Fault confinement follows ISO 11898-1 (simplified: one error per error frame).
+ */
+static Boolean StartFrame(SimBus_t *bus, UInt64 now) {
+    SimNode_t *node;
+    SimQueueEntry_t *entry;
+    FrameGeometry_t geometry;
+    UInt32 field, lowest = 0U;
+    UInt64 queuedAt = 0U, startTime, duration;
+    int index, winner = NO_NODE;
+    Boolean acknowledged = false;
+    UInt32 errorPos, collision = 0U;
+
+    /* start of the frame: the oldest queued frame, but not before the bus becomes idle
+     * note: back-to-back frames start when the bus becomes idle (not when the thread wakes up) */
+    for (index = 0; index < CANBUS_MAX_NODES; index++) {
+        node = &bus->node[index];
+        if (!node->fAttached || node->param.listenOnly || (node->state == CANBUS_BUS_OFF) || !node->txQueue.used)
+            continue;
+        entry = &node->txQueue.entries[node->txQueue.head];
+        if (!queuedAt || (entry->queuedAt < queuedAt))
+            queuedAt = entry->queuedAt;
+    }
+    if (!queuedAt)
+        return false;
+    startTime = (queuedAt > bus->idleTime) ? queuedAt : bus->idleTime;
+    if (startTime > now)
+        startTime = now;
+    /* arbitration (note: a frame queued after the start of the frame waits for the next one) */
+    for (index = 0; index < CANBUS_MAX_NODES; index++) {
+        node = &bus->node[index];
+        if (!node->fAttached || node->param.listenOnly || (node->state == CANBUS_BUS_OFF) || !node->txQueue.used)
+            continue;
+        entry = &node->txQueue.entries[node->txQueue.head];
+        if (entry->queuedAt > startTime)
+            continue;
+        field = ArbitrationField(&entry->frame);
+        if ((winner == NO_NODE) || (field < lowest)) {
+            winner = index;
+            lowest = field;
+            collision = 0U;
+        } else if ((field == lowest) && !collision) {
+            collision = CollisionPosition(&bus->node[winner].txQueue.entries[bus->node[winner].txQueue.head].frame, &entry->frame);
+        }
+    }
+    if (winner == NO_NODE)
+        return false;
+    for (index = 0; index < CANBUS_MAX_NODES; index++) {
+        node = &bus->node[index];
+        if ((index != winner) && node->fAttached && !node->param.listenOnly &&
+            (node->state != CANBUS_BUS_OFF) && node->txQueue.used &&
+            (node->txQueue.entries[node->txQueue.head].queuedAt <= startTime) &&
+            (ArbitrationField(&node->txQueue.entries[node->txQueue.head].frame) != lowest))
+            node->counters.arbitrationLost++;
+        if ((index != winner) && node->fAttached && !node->param.listenOnly && (node->state != CANBUS_BUS_OFF))
+            acknowledged = true;
+    }
+    node = &bus->node[winner];
+    entry = &node->txQueue.entries[node->txQueue.head];
+    GetGeometry(&entry->frame, &geometry);
+
+    /* outcome of the frame */
+    if (collision) {
+        /* note: both frames are destroyed by the error frame, the winner is the one counting it */
+        errorPos = MIN(collision, geometry.crcDelPos);
+        bus->current.outcome = OUTCOME_BIT_ERROR;
+    } else if (bus->param.errorRate && ((Random(bus) % 1000000U) < bus->param.errorRate)) {
+        errorPos = 1U + (Random(bus) % geometry.crcDelPos);
+        bus->current.outcome = OUTCOME_BIT_ERROR;
+    } else if (!acknowledged) {
+        errorPos = geometry.ackPos;
+        bus->current.outcome = OUTCOME_ACK_ERROR;
+    } else {
+        errorPos = 0U;
+        bus->current.outcome = OUTCOME_SUCCESS;
+    }
+    if (errorPos) {
+        duration = BitsToTime(bus, &geometry, errorPos);
+        duration += ((UInt64)ERROR_FRAME_BITS * 1000000000U) / bus->param.nominalBitrate;
+        if (node->state == CANBUS_ERROR_PASSIVE)
+            duration += ((UInt64)SUSPEND_BITS * 1000000000U) / bus->param.nominalBitrate;
+    } else {
+        duration = BitsToTime(bus, &geometry, geometry.total);
+    }
+    bus->current.startTime = startTime;
+    bus->current.endTime = bus->current.startTime + duration;
+    bus->current.node = winner;
+    bus->current.fBusy = true;
+    return true;
+}
+
+static void CompleteFrame(SimBus_t *bus) {
+    SimNode_t *node, *receiver;
+    SimDelivery_t *delivery;
+    CANBUS_Frame_t frame;
+    UInt64 now = bus->current.endTime;
+    int index;
+
+    bus->nDeliveries = 0;
+    bus->resumeLocation = 0U;
+    bus->counters.busyTime += bus->current.endTime - bus->current.startTime;
+    bus->idleTime = bus->current.endTime;
+    bus->current.fBusy = false;
+    if (bus->current.node == NO_NODE)
+        return;  /* note: the transmitter has been detached */
+    node = &bus->node[bus->current.node];
+
+    switch (bus->current.outcome) {
+    case OUTCOME_SUCCESS:
+        frame = node->txQueue.entries[node->txQueue.head].frame;
+        node->txQueue.head = (node->txQueue.head + 1U) % node->txQueue.size;
+        node->txQueue.used--;
+        frame.timeStamp = bus->current.endTime / 1000U;
+        if (frame.flags & CANBUS_FRAME_FDF)
+            frame.flags = (node->state != CANBUS_ERROR_ACTIVE) ? (frame.flags | CANBUS_FRAME_ESI) : (frame.flags & ~CANBUS_FRAME_ESI);
+        if (node->tec)
+            node->tec--;
+        node->counters.txFrames++;
+        bus->counters.frames++;
+        for (index = 0; index < CANBUS_MAX_NODES; index++) {
+            receiver = &bus->node[index];
+            if (!receiver->fAttached || (receiver->state == CANBUS_BUS_OFF))
+                continue;
+            if (receiver == node) {
+                if (!node->param.echo)
+                    continue;
+            } else {
+                receiver->rec = (receiver->rec > 127U) ? 127U : (receiver->rec ? (receiver->rec - 1U) : 0U);
+                receiver->counters.rxFrames++;
+                UpdateState(bus, receiver, now);
+            }
+            delivery = &bus->delivery[bus->nDeliveries++];
+            delivery->node = receiver;
+            delivery->location = receiver->param.location;
+            delivery->encode = receiver->param.encode;
+            delivery->context = receiver->param.context;
+            delivery->frame = frame;
+            if (receiver == node)
+                delivery->frame.flags |= CANBUS_FRAME_ECHO;
+            delivery->fDropped = false;
+        }
+        /* the device waits for free entries in the transmit queue */
+        if (node->fBlocked) {
+            node->fBlocked = false;
+            bus->resumeLocation = node->param.location;
+        }
+        break;
+    case OUTCOME_ACK_ERROR:
+        /* note: an error passive transmitter does not count missing ACKs (exception 1) */
+        if (node->state != CANBUS_ERROR_PASSIVE)
+            node->tec += 8U;
+        node->counters.errorFrames++;
+        bus->counters.errorFrames++;
+        break;
+    case OUTCOME_BIT_ERROR:
+    default:
+        node->tec += 8U;
+        node->counters.errorFrames++;
+        bus->counters.errorFrames++;
+        for (index = 0; index < CANBUS_MAX_NODES; index++) {
+            receiver = &bus->node[index];
+            if ((receiver == node) || !receiver->fAttached || (receiver->state == CANBUS_BUS_OFF))
+                continue;
+            if (receiver->rec < 255U)
+                receiver->rec++;
+            receiver->counters.errorFrames++;
+            UpdateState(bus, receiver, now);
+        }
+        break;
+    }
+    UpdateState(bus, node, now);
+}
+
+static void DeliverFrames(SimBus_t *bus) {
+    UInt8 buffer[CANBUS_MAX_PACKET_SIZE];
+    UInt32 length;
+    int index;
+
+    /* note: called outside the critical section */
+    for (index = 0; index < bus->nDeliveries; index++) {
+        length = CANBUS_MAX_PACKET_SIZE;
+        if ((bus->delivery[index].encode(bus->delivery[index].context, &bus->delivery[index].frame, buffer, &length) != 0) ||
+            (CANSIM_ReceivePacket(bus->delivery[index].location, buffer, MIN(length, CANBUS_MAX_PACKET_SIZE)) != CANUSB_SUCCESS))
+            bus->delivery[index].fDropped = true;
+    }
+    if (bus->resumeLocation)
+        (void)CANSIM_ResumeTransmit(bus->resumeLocation);
+}
+
+static UInt64 RecoverNodes(SimBus_t *bus, UInt64 now) {
+    SimNode_t *node;
+    UInt64 wakeup = 0U;
+    int index;
+
+    for (index = 0; index < CANBUS_MAX_NODES; index++) {
+        node = &bus->node[index];
+        if (!node->fAttached || (node->state != CANBUS_BUS_OFF) || !bus->param.autoRecovery)
+            continue;
+        if (node->recoveryTime <= now) {
+            MACCAN_DEBUG_CORE("      - Node #%i recovered from bus-off\n", index);
+            node->tec = 0U;
+            node->rec = 0U;
+            node->state = CANBUS_ERROR_ACTIVE;
+        } else if (!wakeup || (node->recoveryTime < wakeup)) {
+            wakeup = node->recoveryTime;
+        }
+    }
+    return wakeup;
+}
+
+static void UpdateState(SimBus_t *bus, SimNode_t *node, UInt64 now) {
+    if (node->state == CANBUS_BUS_OFF)
+        return;
+    if (node->tec > 255U) {
+        node->tec = 256U;
+        node->state = CANBUS_BUS_OFF;
+        node->recoveryTime = now + ((UInt64)RECOVERY_BITS * 1000000000U) / bus->param.nominalBitrate;
+        MACCAN_DEBUG_CORE("      - Node #%i is bus-off\n", (int)(node - bus->node));
+    } else if ((node->tec > 127U) || (node->rec > 127U)) {
+        node->state = CANBUS_ERROR_PASSIVE;
+    } else {
+        node->state = CANBUS_ERROR_ACTIVE;
+    }
+}
+
+/*  ---  Bit stream  ---
+ */
+static void GetGeometry(const CANBUS_Frame_t *frame, FrameGeometry_t *geometry) {
+    UInt8 bits[MAX_FRAME_BITS];
+    UInt32 n = 0U, mark = 0U, marked = 0U, length, crcBits, i;
+    Boolean fdf = (frame->flags & CANBUS_FRAME_FDF) ? true : false;
+    Boolean rtr = (!fdf && (frame->flags & CANBUS_FRAME_RTR)) ? true : false;
+
+    length = fdf ? dlc2len[frame->dlc & 0xFU] : (rtr ? 0U : MIN((UInt32)frame->dlc, 8U));
+
+    /* SOF, arbitration field and control field */
+    n = PutBits(bits, n, 0U, 1U);
+    if (frame->flags & CANBUS_FRAME_XTD) {
+        n = PutBits(bits, n, frame->canId >> 18, 11U);
+        n = PutBits(bits, n, 3U, 2U);                       /* SRR, IDE */
+        n = PutBits(bits, n, frame->canId, 18U);
+        n = PutBits(bits, n, rtr ? 1U : 0U, 1U);            /* RTR or RRS */
+        n = PutBits(bits, n, fdf ? 1U : 0U, 1U);            /* r1 or FDF */
+        n = PutBits(bits, n, 0U, 1U);                       /* r0 or res */
+    } else {
+        n = PutBits(bits, n, frame->canId, 11U);
+        n = PutBits(bits, n, rtr ? 1U : 0U, 1U);            /* RTR or RRS */
+        n = PutBits(bits, n, 0U, 1U);                       /* IDE */
+        n = PutBits(bits, n, fdf ? 1U : 0U, 1U);            /* r0 or FDF */
+        if (fdf)
+            n = PutBits(bits, n, 0U, 1U);                   /* res */
+    }
+    if (fdf) {
+        n = PutBits(bits, n, (frame->flags & CANBUS_FRAME_BRS) ? 1U : 0U, 1U);
+        mark = n;
+        n = PutBits(bits, n, (frame->flags & CANBUS_FRAME_ESI) ? 1U : 0U, 1U);
+    }
+    n = PutBits(bits, n, frame->dlc, 4U);
+    /* data field */
+    for (i = 0U; i < length; i++)
+        n = PutBits(bits, n, frame->data[i], 8U);
+
+    if (!fdf) {
+        /* CRC-15 with dynamic stuff bits */
+        n = PutBits(bits, n, CalcCrc15(bits, n), 15U);
+        geometry->crcDelPos = StuffBits(bits, n, 0U, NULL, true) + 1U;
+        geometry->brsPos = 0U;
+    } else {
+        /* stuff count and CRC-17/21 with fixed stuff bits (one before and after every 4th bit) */
+        crcBits = (length > 16U) ? 21U : 17U;
+        geometry->crcDelPos = StuffBits(bits, n, mark, &marked, false) + 4U + crcBits + 1U + ((4U + crcBits) / 4U) + 1U;
+        geometry->brsPos = (frame->flags & CANBUS_FRAME_BRS) ? marked : 0U;
+    }
+    /* CRC delimiter, ACK slot, ACK delimiter, EOF and intermission */
+    geometry->ackPos = geometry->crcDelPos + 1U;
+    geometry->total = geometry->crcDelPos + 12U;
+}
+
+static UInt64 BitsToTime(const SimBus_t *bus, const FrameGeometry_t *geometry, UInt32 bits) {
+    UInt64 halfNominal, halfData = 0U;
+
+    /* note: the BRS bit and the CRC delimiter are half nominal and half data bits (sample point at 50%) */
+    if (!geometry->brsPos || !bus->param.dataBitrate || (bits < geometry->brsPos)) {
+        halfNominal = 2U * (UInt64)bits;
+    } else {
+        halfNominal = 2U * (UInt64)(geometry->brsPos - 1U) + 1U;
+        halfData = 1U;
+        if (bits < geometry->crcDelPos) {
+            halfData += 2U * (UInt64)(bits - geometry->brsPos);
+        } else {
+            halfData += 2U * (UInt64)(geometry->crcDelPos - geometry->brsPos - 1U) + 1U;
+            halfNominal += 1U + 2U * (UInt64)(bits - geometry->crcDelPos);
+        }
+    }
+    return ((halfNominal * 1000000000U) / (2U * (UInt64)bus->param.nominalBitrate)) +
+           (halfData ? ((halfData * 1000000000U) / (2U * (UInt64)bus->param.dataBitrate)) : 0U);
+}
+
+static UInt32 ArbitrationField(const CANBUS_Frame_t *frame) {
+    /* base ID, RTR/SRR/RRS, IDE, extended ID, RTR/RRS (lowest value wins) */
+    if (frame->flags & CANBUS_FRAME_XTD)
+        return ((frame->canId >> 18) & 0x7FFU) << 21 | (1U << 20) | (1U << 19) |
+               ((frame->canId & 0x3FFFFU) << 1) | (((frame->flags & (CANBUS_FRAME_RTR | CANBUS_FRAME_FDF)) == CANBUS_FRAME_RTR) ? 1U : 0U);
+    else
+        return ((frame->canId & 0x7FFU) << 21) |
+               ((((frame->flags & (CANBUS_FRAME_RTR | CANBUS_FRAME_FDF)) == CANBUS_FRAME_RTR) ? 1U : 0U) << 20);
+}
+
+static UInt32 CollisionPosition(const CANBUS_Frame_t *frame, const CANBUS_Frame_t *other) {
+    UInt32 pos = (frame->flags & CANBUS_FRAME_XTD) ? 33U : 13U;  /* SOF and arbitration field */
+    UInt32 length, i;
+    UInt8 diff;
+
+    /* bit position of the first difference after the arbitration field (0 = same frame on the wire)
+     * note: without stuff bits, the control field is taken as six bits */
+    if (((frame->flags ^ other->flags) & (CANBUS_FRAME_FDF | CANBUS_FRAME_BRS)) || (frame->dlc != other->dlc))
+        return pos + 1U;
+    if (frame->flags & CANBUS_FRAME_FDF)
+        length = dlc2len[frame->dlc & 0xFU];
+    else
+        length = (frame->flags & CANBUS_FRAME_RTR) ? 0U : MIN((UInt32)frame->dlc, 8U);
+    for (i = 0U; i < length; i++) {
+        if ((diff = frame->data[i] ^ other->data[i]) != 0U) {
+            pos += 6U + (8U * i) + 1U;
+            while (!(diff & 0x80U)) {
+                diff <<= 1;
+                pos++;
+            }
+            return pos;
+        }
+    }
+    return 0U;
+}
+
+static UInt32 PutBits(UInt8 *bits, UInt32 n, UInt32 value, UInt32 count) {
+    /* most significant bit first */
+    while (count--)
+        bits[n++] = (UInt8)((value >> count) & 1U);
+    return n;
+}
+
+static UInt32 StuffBits(const UInt8 *bits, UInt32 n, UInt32 mark, UInt32 *marked, Boolean trailing) {
+    UInt32 i, out = 0U, run = 0U;
+    UInt8 last = 2U;
+
+    /* a complementary bit after five consecutive bits of equal value */
+    for (i = 0U; i < n; i++) {
+        if (run == 5U) {
+            last = !last;
+            run = 1U;
+            out++;
+        }
+        if (bits[i] == last) {
+            run++;
+        } else {
+            last = bits[i];
+            run = 1U;
+        }
+        out++;
+        if (marked && ((i + 1U) == mark))
+            *marked = out;
+    }
+    if (trailing && (run == 5U))
+        out++;
+    return out;
+}
+
+static UInt16 CalcCrc15(const UInt8 *bits, UInt32 n) {
+    UInt16 crc = 0U;
+    UInt32 i;
+
+    /* x^15 + x^14 + x^10 + x^8 + x^7 + x^4 + x^3 + 1 */
+    for (i = 0U; i < n; i++) {
+        if ((bits[i] ^ (crc >> 14)) & 1U)
+            crc = ((crc << 1) ^ 0x4599U) & 0x7FFFU;
+        else
+            crc = (crc << 1) & 0x7FFFU;
+    }
+    return crc;
+}
+
+static UInt32 Random(SimBus_t *bus) {
+    /* xorshift32 (reproducible with the same seed) */
+    bus->random ^= bus->random << 13;
+    bus->random ^= bus->random >> 17;
+    bus->random ^= bus->random << 5;
+    return bus->random;
+}
+
+static void WaitUntil(SimBus_t *bus, UInt64 wakeup) {
+    struct timespec absTime;
+    UInt64 now = GetTime();
+
+    /* note: called within the critical section */
+    if (!wakeup) {
+        WAIT_CONDITION(bus);
+    } else if (wakeup > now) {
+        clock_gettime(CLOCK_REALTIME, &absTime);
+        wakeup -= now;
+        absTime.tv_sec += (time_t)(wakeup / 1000000000U);
+        absTime.tv_nsec += (long)(wakeup % 1000000000U);
+        if (absTime.tv_nsec >= (long)1000000000) {
+            absTime.tv_nsec -= (long)1000000000;
+            absTime.tv_sec += (time_t)1;
+        }
+        (void)pthread_cond_timedwait(&bus->ptCond, &bus->ptMutex, &absTime);
+    }
+}
+
+static void* BusThread(void *arg) {
+    SimBus_t *bus = (SimBus_t*)arg;
+    UInt64 now, wakeup;
+    int index;
+
+    ENTER_CRITICAL_SECTION(bus);
+    while (bus->fRunning) {
+        now = GetTime();
+        if (bus->current.fBusy) {
+            /* the bus is busy until the end of the frame */
+            if (now < bus->current.endTime) {
+                WaitUntil(bus, bus->current.endTime);
+                continue;
+            }
+            CompleteFrame(bus);
+            /* deliver the frame outside the critical section */
+            if (bus->nDeliveries || bus->resumeLocation) {
+                bus->fDelivering = true;
+                LEAVE_CRITICAL_SECTION(bus);
+                DeliverFrames(bus);
+                ENTER_CRITICAL_SECTION(bus);
+                for (index = 0; index < bus->nDeliveries; index++) {
+                    if (bus->delivery[index].fDropped)
+                        bus->delivery[index].node->counters.dropped++;
+                }
+                bus->fDelivering = false;
+                SIGNAL_CONDITION(bus);
+            }
+            continue;
+        }
+        /* the bus is idle: recover from bus-off, then arbitrate */
+        wakeup = RecoverNodes(bus, now);
+        if (!StartFrame(bus, now))
+            WaitUntil(bus, wakeup);
+    }
+    LEAVE_CRITICAL_SECTION(bus);
+    return NULL;
+}
+
+static UInt64 GetTime(void) {
+    struct timespec now;
+
+    /* monotonic time in [ns] */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((UInt64)now.tv_sec * 1000000000U) + (UInt64)now.tv_nsec;
+}
+#endif /* OPTION_MACCAN_SIMULATION */
+
+/* * $Id$ *** (c) UV Software, Berlin ***
+ */
@@ -0,0 +1,158 @@
+/*  SPDX-License-Identifier: BSD-2-Clause OR GPL-3.0-or-later */
+/*
+ *  MacCAN - macOS User-Space Driver for USB-to-CAN Interfaces
+ *
+ *  Copyright (c) 2012-2023 Uwe Vogt, UV Software, Berlin (info@mac-can.com)
+ *  All rights reserved.
+ *
+ *  This file is part of MacCAN-Core.
+ *
+ *  MacCAN-Core is dual-licensed under the BSD 2-Clause "Simplified" License and
+ *  under the GNU General Public License v3.0 (or any later version).
+ *  You can choose between one of them if you use this file.
+ *
+ *  BSD 2-Clause "Simplified" License:
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ *  MacCAN-Core IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF MacCAN-Core, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  GNU General Public License v3.0 or later:
+ *  MacCAN-Core is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MacCAN-Core is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MacCAN-Core.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MACCAN_SIMBUS_H_INCLUDED
+#define MACCAN_SIMBUS_H_INCLUDED
+
+#include "MacCAN_IOUsbSim.h"
+
+#ifndef CANBUS_MAX_BUSES
+#define CANBUS_MAX_BUSES  4
+#endif
+#ifndef CANBUS_MAX_NODES
+#define CANBUS_MAX_NODES  8
+#endif
+#define CANBUS_INVALID_HANDLE  (-1)
+
+#define CANBUS_MAX_FRAMES  64U  /* max. number of frames per USB transfer */
+#define CANBUS_MAX_PACKET_SIZE  512U  /* max. size of an encoded frame */
+#define CANBUS_DEFAULT_QUEUE_SIZE  32U
+
+/* frame format */
+#define CANBUS_FRAME_XTD   0x01U  /* extended frame format (29-bit identifier) */
+#define CANBUS_FRAME_RTR   0x02U  /* remote frame (classical CAN only) */
+#define CANBUS_FRAME_FDF   0x04U  /* CAN FD frame format */
+#define CANBUS_FRAME_BRS   0x08U  /* bit-rate switching (CAN FD only) */
+#define CANBUS_FRAME_ESI   0x10U  /* error state indicator (CAN FD only) */
+#define CANBUS_FRAME_ECHO  0x80U  /* frame transmitted by the node itself */
+
+/* fault confinement */
+#define CANBUS_ERROR_ACTIVE   0U
+#define CANBUS_ERROR_PASSIVE  1U
+#define CANBUS_BUS_OFF        2U
+
+typedef int CANBUS_Return_t;
+typedef int CANBUS_Handle_t;
+typedef int CANBUS_Node_t;
+
+typedef struct sim_bus_frame_tag {      /* CAN frame: */
+    UInt32 canId;                       /*   identifier (11-bit or 29-bit) */
+    UInt8 flags;                        /*   frame format (CANBUS_FRAME_xyz) */
+    UInt8 dlc;                          /*   data length code (0 .. 15) */
+    UInt8 data[64];                     /*   payload (up to 64 bytes) */
+    UInt64 timeStamp;                   /*   end of frame (in [us], monotonic) */
+} CANBUS_Frame_t;
+
+/* note: USB payload from the driver (bulk out) into frames; count: in = capacity, out = frames */
+typedef int (*CANBUS_DecodeCbk_t)(CANUSB_Context_t refCon, const UInt8 *buffer, UInt32 length, CANBUS_Frame_t *frames, UInt32 *count);
+/* note: frame from the bus into USB payload for the driver (bulk in); length: in = size, out = bytes */
+typedef int (*CANBUS_EncodeCbk_t)(CANUSB_Context_t refCon, const CANBUS_Frame_t *frame, UInt8 *buffer, UInt32 *length);
+
+typedef struct sim_bus_param_tag {      /* Simulated CAN bus: */
+    UInt32 nominalBitrate;              /*   arbitration phase bit-rate (in [bit/s]) */
+    UInt32 dataBitrate;                 /*   data phase bit-rate (in [bit/s], 0 = no bit-rate switching) */
+    UInt32 errorRate;                   /*   frames destroyed by a bit error (per million, 0 = none) */
+    UInt32 seed;                        /*   seed for error injection (0 = default) */
+    Boolean autoRecovery;               /*   bus-off recovery after 128 x 11 recessive bits */
+} CANBUS_Param_t;
+
+typedef struct sim_node_param_tag {     /* Node on the bus: */
+    UInt32 location;                    /*   location ID of the simulated device */
+    UInt32 queueSize;                   /*   transmit queue of the node (in [frames], 0 = default) */
+    Boolean echo;                       /*   echo transmitted frames to the driver */
+    Boolean listenOnly;                 /*   neither acknowledge nor transmit */
+    CANBUS_DecodeCbk_t decode;          /*   decoder for bulk out transfers */
+    CANBUS_EncodeCbk_t encode;          /*   encoder for bulk in transfers */
+    CANUSB_Context_t context;           /*   pointer to user context for the codec */
+} CANBUS_NodeParam_t;
+
+typedef struct sim_node_status_tag {    /* Status of a node: */
+    UInt8 state;                        /*   error active, error passive or bus off */
+    UInt16 txErrorCounter;              /*   transmit error counter */
+    UInt8 rxErrorCounter;               /*   receive error counter */
+    UInt32 queued;                      /*   frames in the transmit queue */
+    UInt64 txFrames;                    /*   frames transmitted */
+    UInt64 rxFrames;                    /*   frames received */
+    UInt64 arbitrationLost;             /*   arbitrations lost */
+    UInt64 errorFrames;                 /*   error frames (transmitter or receiver) */
+    UInt64 dropped;                     /*   frames not delivered to the device */
+} CANBUS_NodeStatus_t;
+
+typedef struct sim_bus_status_tag {     /* Status of the bus: */
+    UInt64 frames;                      /*   frames transmitted */
+    UInt64 errorFrames;                 /*   error frames */
+    UInt64 busyTime;                    /*   time the bus was busy (in [ns]) */
+    UInt64 elapsedTime;                 /*   time since creation (in [ns]) */
+} CANBUS_BusStatus_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern CANBUS_Handle_t CANBUS_CreateBus(const CANBUS_Param_t *param);
+
+extern CANBUS_Return_t CANBUS_DestroyBus(CANBUS_Handle_t bus);
+
+extern CANBUS_Node_t CANBUS_AttachNode(CANBUS_Handle_t bus, const CANBUS_NodeParam_t *param);
+
+extern CANBUS_Return_t CANBUS_DetachNode(CANBUS_Handle_t bus, CANBUS_Node_t node);
+
+extern CANBUS_Return_t CANBUS_ResetNode(CANBUS_Handle_t bus, CANBUS_Node_t node);
+
+extern CANBUS_Return_t CANBUS_GetNodeStatus(CANBUS_Handle_t bus, CANBUS_Node_t node, CANBUS_NodeStatus_t *status);
+
+extern CANBUS_Return_t CANBUS_GetBusStatus(CANBUS_Handle_t bus, CANBUS_BusStatus_t *status);
+
+extern UInt32 CANBUS_GetFrameBits(const CANBUS_Frame_t *frame, UInt32 *dataBits);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* MACCAN_SIMBUS_H_INCLUDED */
+
+/* * $Id$ *** (c) UV Software, Berlin ***
+ */